@@ -47,9 +47,34 @@
 
 namespace amath {
 
-//  Helper function to load vertex and fragment shader files
+//  Helper function to load vertex and fragment shader files.  The
+//    optional prelude (e.g. #defines) is inserted after the #version line of
+//    both, and the optional NULL-terminated attribute names are bound to
+//    locations 0, 1, ...  Linked programs are cached on disk as program
+//    binaries; returns 0 if the program can't be built.
 GLuint InitShader( const char* vertexShaderFile,
-		   const char* fragmentShaderFile );
+		   const char* fragmentShaderFile,
+		   const char* prelude = NULL,
+		   const char* const* attributes = NULL );
+
+//  The same with tessellation control and evaluation shaders between the
+//    vertex and fragment stages; either file may be NULL.  The optional
+//    NULL-terminated feedback outputs are captured, interleaved in that
+//    order, by transform feedback.
+GLuint InitShader( const char* vertexShaderFile,
+		   const char* tessControlShaderFile,
+		   const char* tessEvaluationShaderFile,
+		   const char* fragmentShaderFile,
+		   const char* prelude,
+		   const char* const* attributes,
+		   const char* const* feedback = NULL );
+
+//  A program of just a compute shader, built and cached the same way
+GLuint InitComputeShader( const char* computeShaderFile,
+			  const char* prelude = NULL );
+
+//  Turn the program binary cache of InitShader on or off (default on)
+void EnableShaderCache( bool enable );
 
 //  Defined constant for when numbers are too small to be used in the
 //    denominator of a division operation.  This is only used if the
@@ -0,0 +1,149 @@
+#include "arena.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<size_t> heap_allocations(0);
+
+size_t heap_allocation_count() {
+    return heap_allocations.load();
+}
+
+void count_heap_allocation() {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+}
+
+// route the global heap through the allocation counter
+void *operator new(size_t bytes) {
+    count_heap_allocation();
+    void *p = std::malloc(bytes ? bytes : 1);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+    std::free(p);
+}
+
+LinearArena::LinearArena(MemTag tag, size_t block_size)
+        : _tag(tag), _block_size(block_size), _blocks(), _current(0), _offset(0), _capacity(0) {
+}
+
+LinearArena::~LinearArena() {
+    free_blocks();
+}
+
+void LinearArena::add_block(size_t min_size) {
+    Block block;
+    block.size = min_size > _block_size ? min_size : _block_size;
+    block.data = static_cast<char *>(std::malloc(block.size));
+    if (!block.data) {
+        throw std::bad_alloc();
+    }
+    count_heap_allocation();
+    mem_track_alloc(_tag, block.size);
+    _capacity += block.size;
+    _blocks.push_back(block);
+}
+
+void LinearArena::free_blocks() {
+    for (auto &block : _blocks) {
+        std::free(block.data);
+        mem_track_free(_tag, block.size);
+    }
+    _blocks.clear();
+    _capacity = 0;
+}
+
+void *LinearArena::allocate(size_t bytes, size_t align) {
+    while (true) {
+        if (_current < _blocks.size()) {
+            Block &block = _blocks[_current];
+            uintptr_t base = (uintptr_t) block.data;
+            size_t start = ((base + _offset + align - 1) & ~(uintptr_t) (align - 1)) - base;
+            if (start + bytes <= block.size) {
+                _offset = start + bytes;
+                return block.data + start;
+            }
+            if (_current + 1 < _blocks.size()) {
+                ++_current;
+                _offset = 0;
+                continue;
+            }
+        }
+        // leave room to align the first allocation in the new block
+        add_block(bytes + align);
+        _current = _blocks.size() - 1;
+        _offset = 0;
+    }
+}
+
+void LinearArena::rewind(const Mark &m) {
+    _current = m.block;
+    _offset = m.offset;
+}
+
+void LinearArena::reset() {
+    if (_blocks.size() > 1) {
+        size_t total = _capacity;
+        free_blocks();
+        add_block(total);
+    }
+    _current = 0;
+    _offset = 0;
+}
+
+SizeClassPool::SizeClassPool(MemTag tag)
+        : _tag(tag), _free(8 * sizeof(size_t)) {
+    for (auto &list : _free) {
+        list.reserve(4);
+    }
+}
+
+SizeClassPool::~SizeClassPool() {
+    for (size_t c = 0; c < _free.size(); ++c) {
+        for (void *p : _free[c]) {
+            std::free(p);
+            mem_track_free(_tag, (size_t) 1 << c);
+        }
+    }
+}
+
+int SizeClassPool::size_class(size_t bytes) {
+    int c = 4;
+    while (((size_t) 1 << c) < bytes) {
+        ++c;
+    }
+    return c;
+}
+
+void *SizeClassPool::acquire(size_t bytes) {
+    int c = size_class(bytes);
+    if (!_free[c].empty()) {
+        void *p = _free[c].back();
+        _free[c].pop_back();
+        return p;
+    }
+
+    void *p = std::malloc((size_t) 1 << c);
+    if (!p) {
+        throw std::bad_alloc();
+    }
+    count_heap_allocation();
+    mem_track_alloc(_tag, (size_t) 1 << c);
+    return p;
+}
+
+void SizeClassPool::release(void *ptr, size_t bytes) {
+    if (ptr) {
+        _free[size_class(bytes)].push_back(ptr);
+    }
+}
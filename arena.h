@@ -0,0 +1,102 @@
+#ifndef GLRENDER_ARENA_H
+#define GLRENDER_ARENA_H
+
+#include <cstddef>
+#include <vector>
+
+#include "memstats.h"
+
+// Linear (bump) allocator for temporaries whose lifetime ends together: the
+// scratch space of one tessellation pass, the normal accumulation of a load.
+// Nothing is freed individually; reset() makes the whole arena available
+// again while keeping its memory, so a warmed up arena serves a repeated
+// workload without touching the heap.
+class LinearArena {
+public:
+    explicit LinearArena(MemTag tag, size_t block_size = 1 << 20);
+
+    ~LinearArena();
+
+    LinearArena(const LinearArena &) = delete;
+
+    LinearArena &operator=(const LinearArena &) = delete;
+
+    void *allocate(size_t bytes, size_t align = 16);
+
+    // uninitialized storage for n objects of a trivially destructible type
+    template<typename T>
+    T *alloc_array(size_t n) {
+        return static_cast<T *>(allocate(n * sizeof(T), alignof(T) < 16 ? 16 : alignof(T)));
+    }
+
+    // position to rewind to, for scratch space nested inside a longer pass
+    struct Mark {
+        size_t block;
+        size_t offset;
+    };
+
+    inline Mark mark() const {
+        Mark m = {_current, _offset};
+        return m;
+    }
+
+    void rewind(const Mark &m);
+
+    // releases everything allocated so far. If the last pass needed more than
+    // one block, the blocks are merged into one big enough for all of it.
+    void reset();
+
+    inline size_t capacity() const {
+        return _capacity;
+    }
+
+private:
+    struct Block {
+        char *data;
+        size_t size;
+    };
+
+    void add_block(size_t min_size);
+
+    void free_blocks();
+
+    MemTag _tag;
+    size_t _block_size;
+    std::vector<Block> _blocks;
+    size_t _current;        // block being bumped
+    size_t _offset;         // first free byte in that block
+    size_t _capacity;
+};
+
+// Free lists of power-of-two sized buffers, for the staging arrays that get
+// reallocated with a different size every time the resolution changes.
+// Released buffers are kept and handed out again to any request of the same
+// size class.
+class SizeClassPool {
+public:
+    explicit SizeClassPool(MemTag tag);
+
+    ~SizeClassPool();
+
+    SizeClassPool(const SizeClassPool &) = delete;
+
+    SizeClassPool &operator=(const SizeClassPool &) = delete;
+
+    void *acquire(size_t bytes);
+
+    void release(void *ptr, size_t bytes);
+
+private:
+    static int size_class(size_t bytes);
+
+    MemTag _tag;
+    std::vector<std::vector<void *> > _free;
+};
+
+// allocations the program made from the general purpose heap so far: every
+// operator new plus the blocks of the arenas and pools above
+size_t heap_allocation_count();
+
+void count_heap_allocation();
+
+#endif //GLRENDER_ARENA_H
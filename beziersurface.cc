@@ -4,57 +4,92 @@
 
 #include "beziersurface.h"
 
-void parse_bezier_surface(const std::string &file_path, std::vector<BezierSurface> &surfaces) {
-    std::ifstream file(file_path.c_str());
-
-    if (!file.good()) {
-        std::cerr << "Fail to read bezier surface file " << file_path << std::endl;
-        return;
+#include <algorithm>
+
+BezierSurface::BezierSurface(const float *points, int u_deg, int v_deg)
+        : _points(), _u_deg(u_deg), _v_deg(v_deg) {
+    int count = point_count();
+    _points.resize(2 * count);
+    for (int i = 0; i < count; ++i) {
+        _points[i] = point(points[3 * i], points[3 * i + 1], points[3 * i + 2], 1);
+    }
+    for (int i = 0; i <= v_deg; ++i) {
+        for (int j = 0; j <= u_deg; ++j) {
+            _points[count + j * (v_deg + 1) + i] = _points[i * (u_deg + 1) + j];
+        }
     }
 
-    surfaces.clear();
+    compute_bounds();
+}
 
-    int num_surface;
-    file >> num_surface;
+// 64 bit FNV-1a over the degrees and the rows of control points
+unsigned long long BezierSurface::content_hash() const {
+    unsigned long long hash = 14695981039346656037ULL;
+    int header[2] = {_u_deg, _v_deg};
+    const unsigned char *bytes[2] = {reinterpret_cast<const unsigned char *>(header),
+                                     reinterpret_cast<const unsigned char *>(_points.data())};
+    size_t sizes[2] = {sizeof(header), sizeof(point) * point_count()};
+    for (int part = 0; part < 2; ++part) {
+        for (size_t i = 0; i < sizes[part]; ++i) {
+            hash ^= bytes[part][i];
+            hash *= 1099511628211ULL;
+        }
+    }
+    return hash;
+}
 
-    while (num_surface--) {
-        int u_deg, v_deg;
-        file >> u_deg >> v_deg;
+// The partial derivatives of the patch are non-negative combinations of the
+// differences of neighbouring control points along a row and along a column,
+// so the normal, their cross product, is a non-negative combination of the
+// cross products of every row difference with every column difference. A cone
+// around all of those holds every normal of the patch.
+void BezierSurface::compute_bounds() {
+    for (int i = 0; i < point_count(); ++i) {
+        const point &p = _points[i];
+        _bounds.extend(vec3(p.x, p.y, p.z));
+    }
 
-        float x, y, z;
-        std::vector<float> control_points;
-        for (int i = 0; i <= v_deg; ++i) {
-            for (int j = 0; j <= u_deg; ++j) {
-                file >> x >> y >> z;
-                control_points.push_back(x);
-                control_points.push_back(y);
-                control_points.push_back(z);
+    std::vector<vec3> generators;
+    for (int i = 0; i <= _v_deg; ++i) {
+        for (int j = 0; j < _u_deg; ++j) {
+            vec4 du = row(i)[j + 1] - row(i)[j];
+            for (int k = 0; k < _v_deg; ++k) {
+                for (int l = 0; l <= _u_deg; ++l) {
+                    vec4 dv = column(l)[k + 1] - column(l)[k];
+                    vec3 n = cross(du, dv);
+                    if (length(n) > 1e-12f) {
+                        generators.push_back(normalize(n));
+                    }
+                }
             }
         }
-        surfaces.push_back(BezierSurface(control_points, u_deg, v_deg));
     }
 
-    file.close();
-}
+    _cone_angle = -1;
+    vec3 sum(0.0, 0.0, 0.0);
+    for (auto &n : generators) {
+        sum += n;
+    }
+    if (generators.empty() || length(sum) < 1e-6f) {
+        return;
+    }
 
-BezierSurface::BezierSurface(const std::vector<float> &points, int u_deg, int v_deg)
-        : _control_points(), _u_deg(u_deg), _v_deg(v_deg) {
-    int index;
-    for (int i = 0; i <= v_deg; ++i) {
-        std::vector<point> row;
-        for (int j = 0; j <= u_deg; ++j) {
-            index = i * ((u_deg + 1) * 3) + j * 3;
-            row.push_back(point(points[index], points[index + 1], points[index + 2], 1));
-        }
-        _control_points.push_back(row);
+    _cone_axis = normalize(sum);
+    float min_cos = 1;
+    for (auto &n : generators) {
+        min_cos = std::min(min_cos, dot(_cone_axis, n));
+    }
+    if (min_cos > 0) {
+        _cone_angle = acosf(std::min(min_cos, 1.0f));
     }
 }
 
-void BezierSurface::eval_bezier(const std::vector<point> &controlpoints, int degree, const float t, point &pnt,
-                             vec4 &tangent) {
-    std::vector<point> temp;
-    for (auto &elem : controlpoints) {
-        temp.push_back(elem);
+void BezierSurface::eval_bezier(const point *controlpoints, int degree, const float t, point &pnt,
+                             vec4 &tangent, LinearArena &scratch) {
+    LinearArena::Mark mark = scratch.mark();
+    point *temp = scratch.alloc_array<point>(degree + 1);
+    for (int i = 0; i <= degree; ++i) {
+        temp[i] = controlpoints[i];
     }
 
     int start_index = 0;
@@ -81,36 +116,31 @@ void BezierSurface::eval_bezier(const std::vector<point> &controlpoints, int deg
     tangent.z = prev.z - temp[degree - 1].z;
     tangent.w = 0;
 
+    scratch.rewind(mark);
 }
 
-void BezierSurface::eval_sample(float u_samp, float v_samp, point &pnt, vec4 &norm) {
-    std::vector<point> controlpoints;
+void BezierSurface::eval_sample(float u_samp, float v_samp, point &pnt, vec4 &norm, LinearArena &scratch) {
+    LinearArena::Mark mark = scratch.mark();
+    point *controlpoints = scratch.alloc_array<point>(std::max(_u_deg, _v_deg) + 1);
 
     // sweep out control points b0, b1, ..., bm to collect control points
     vec4 tangent;
     for (int i = 0; i <= _v_deg; ++i) {
-        point temp;
-        eval_bezier(_control_points[i], _u_deg, u_samp, temp, tangent);
-        controlpoints.push_back(temp);
+        eval_bezier(row(i), _u_deg, u_samp, controlpoints[i], tangent, scratch);
     }
 
     point u_v;
     vec4 v_tan;
-    eval_bezier(controlpoints, _v_deg, 1 - v_samp, u_v, v_tan);
-
-    controlpoints.clear();
+    eval_bezier(controlpoints, _v_deg, 1 - v_samp, u_v, v_tan, scratch);
 
 
     for (int i = 0; i <= _u_deg; ++i) {
-        point temp;
-        get_column(i);
-        eval_bezier(get_column(i), _v_deg, 1 - v_samp, temp, tangent);
-        controlpoints.push_back(temp);
+        eval_bezier(column(i), _v_deg, 1 - v_samp, controlpoints[i], tangent, scratch);
     }
 
     point redundant;
     vec4 u_tan;
-    eval_bezier(controlpoints, _u_deg, u_samp, redundant, u_tan);
+    eval_bezier(controlpoints, _u_deg, u_samp, redundant, u_tan, scratch);
 
     pnt.x = u_v.x;
     pnt.y = u_v.y;
@@ -122,12 +152,11 @@ void BezierSurface::eval_sample(float u_samp, float v_samp, point &pnt, vec4 &no
     norm.y = ret.y;
     norm.z = ret.z;
     norm.w = 0;
-}
 
-void BezierSurface::eval_surface(int samples, std::vector<vec4> &points, std::vector<vec4> &norms) {
-    points.clear();
-    norms.clear();
+    scratch.rewind(mark);
+}
 
+void BezierSurface::eval_surface(int samples, point *points, vec4 *norms, LinearArena &scratch) {
     int u_sample_num = samples * _u_deg + 1;
     int v_sample_num = samples * _v_deg + 1;
 
@@ -140,17 +169,59 @@ void BezierSurface::eval_surface(int samples, std::vector<vec4> &points, std::ve
         v_sample = i * v_sample_step;
         for (int j = 0; j < u_sample_num; ++j) {
             u_sample = j * u_sample_step;
-            vec4 temp_p;
-            vec4 temp_n;
-            eval_sample(u_sample, v_sample, temp_p, temp_n);
-            points.push_back(temp_p);
-            norms.push_back(temp_n);
+            eval_sample(u_sample, v_sample, *points++, *norms++, scratch);
         }
     }
 }
 
+void BezierSurface::eval_triangles(int samples, point *vertices, vec4 *norms, LinearArena &scratch) {
+    LinearArena::Mark mark = scratch.mark();
+    point *points_vec = scratch.alloc_array<point>(sample_count(samples));
+    vec4 *norm_vec = scratch.alloc_array<vec4>(sample_count(samples));
+    eval_surface(samples, points_vec, norm_vec, scratch);
+
+    int u_sample_num = samples * _u_deg + 1;
+    int v_sample_num = samples * _v_deg + 1;
+
+    int vn_index = 0;
 
+    for (int i = 0; i < v_sample_num - 1; ++i) {
+        for (int j = 0; j < u_sample_num - 1; ++j) {
+            vec4 tri1_v1 = points_vec[i * u_sample_num + j];
+            vec4 tri1_v2 = points_vec[(i + 1) * u_sample_num + j + 1];
+            vec4 tri1_v3 = points_vec[(i + 1) * u_sample_num + j];
 
+            vec4 tri2_v1 = tri1_v2;
+            vec4 tri2_v2 = tri1_v1;
+            vec4 tri2_v3 = points_vec[i * u_sample_num + j + 1];
 
+            vec4 tri1_n1 = norm_vec[i * u_sample_num + j];
+            vec4 tri1_n2 = norm_vec[(i + 1) * u_sample_num + j + 1];
+            vec4 tri1_n3 = norm_vec[(i + 1) * u_sample_num + j];
 
+            vec4 tri2_n1 = tri1_n2;
+            vec4 tri2_n2 = tri1_n1;
+            vec4 tri2_n3 = norm_vec[i * u_sample_num + j + 1];
 
+            vertices[vn_index] = tri1_v1;
+            vertices[vn_index + 1] = tri1_v2;
+            vertices[vn_index + 2] = tri1_v3;
+
+            vertices[vn_index + 3] = tri2_v1;
+            vertices[vn_index + 4] = tri2_v2;
+            vertices[vn_index + 5] = tri2_v3;
+
+            norms[vn_index] = tri1_n1;
+            norms[vn_index + 1] = tri1_n2;
+            norms[vn_index + 2] = tri1_n3;
+
+            norms[vn_index + 3] = tri2_n1;
+            norms[vn_index + 4] = tri2_n2;
+            norms[vn_index + 5] = tri2_n3;
+
+            vn_index += 6;
+        }
+    }
+
+    scratch.rewind(mark);
+}
@@ -5,23 +5,51 @@
 #ifndef GLRENDER_BEZIERSURFACE_H
 #define GLRENDER_BEZIERSURFACE_H
 
+#include <algorithm>
 #include <string>
 #include <vector>
-#include <fstream>
 
 #include "amath.h"
+#include "memstats.h"
+#include "arena.h"
+#include "frustum.h"
 
 class BezierSurface {
 public:
     typedef amath::vec4 point;
 
-    BezierSurface(const std::vector<float> &points, int u_deg, int v_deg);
+    BezierSurface(const float *points, int u_deg, int v_deg);
 
-    void eval_bezier(const std::vector<point> &controlpoints, int degree, const float t, point &pnt, vec4 &tangent);
+    // patches are only moved around, never copied, since each owns its
+    // control points and a file holds many thousands of patches
+    BezierSurface(const BezierSurface &) = delete;
 
-    void eval_sample(float u_samp, float v_samp, point &pnt, vec4 &norm);
+    BezierSurface &operator=(const BezierSurface &) = delete;
 
-    void eval_surface(int samples, std::vector<vec4> &points, std::vector<vec4> &norms);
+    BezierSurface(BezierSurface &&) = default;
+
+    BezierSurface &operator=(BezierSurface &&) = default;
+
+    // the evaluators take their temporaries from `scratch` and give them back
+    // before returning
+    void eval_bezier(const point *controlpoints, int degree, const float t, point &pnt, vec4 &tangent,
+                     LinearArena &scratch);
+
+    void eval_sample(float u_samp, float v_samp, point &pnt, vec4 &norm, LinearArena &scratch);
+
+    // writes sample_count(samples) points and normals
+    void eval_surface(int samples, point *points, vec4 *norms, LinearArena &scratch);
+
+    inline int sample_count(int samples) const {
+        return (samples * _u_deg + 1) * (samples * _v_deg + 1);
+    }
+
+    // stitches the samples into a triangle list, two triangles per grid cell
+    void eval_triangles(int samples, point *vertices, vec4 *norms, LinearArena &scratch);
+
+    inline int triangle_vertex_count(int samples) const {
+        return 2 * (samples * _u_deg) * (samples * _v_deg) * 3;
+    }
 
     inline int u_deg() const {
         return _u_deg;
@@ -31,20 +59,59 @@ public:
         return _v_deg;
     }
 
+    // copies the (u_deg + 1) * (v_deg + 1) control points, row by row, as they
+    // were read
+    void copy_control_points(point *points) const {
+        std::copy(_points.begin(), _points.begin() + point_count(), points);
+    }
+
+    // a hash of the degrees and control points, for telling whether a patch
+    // changed between two reads of its file
+    unsigned long long content_hash() const;
+
+    // the patch lies in the convex hull of its control points, and so in
+    // their bounding box
+    inline const Bounds &bounds() const {
+        return _bounds;
+    }
+
+    // a cone around `axis`, with half angle `angle` in radians, holding the
+    // normal at every point of the patch (in the orientation of eval_sample);
+    // false if the normals turn too much for a cone under 90 degrees
+    inline bool normal_cone(vec3 &axis, float &angle) const {
+        axis = _cone_axis;
+        angle = _cone_angle;
+        return _cone_angle >= 0;
+    }
+
 private:
-    std::vector<point> get_column(int i) const{
-        std::vector<point> column;
-        for (auto &row : _control_points) {
-            column.push_back(row[i]);
-        }
-        return std::move(column);
+    inline int point_count() const {
+        return (_u_deg + 1) * (_v_deg + 1);
+    }
+
+    // the u_deg + 1 control points of row i, and the v_deg + 1 of column j,
+    // next to each other either way
+    inline const point *row(int i) const {
+        return &_points[i * (_u_deg + 1)];
     }
 
-    std::vector<std::vector<point> > _control_points;
+    inline const point *column(int j) const {
+        return &_points[point_count() + j * (_v_deg + 1)];
+    }
+
+    void compute_bounds();
+
+    // all control points in one allocation (16 byte aligned, as operator new
+    // is): the rows one after the other, then the same points again as
+    // columns, so that the sweeps of eval_sample in both directions read
+    // straight through memory
+    tracked_vector<point, MEM_PARSER> _points;
     int _u_deg;
     int _v_deg;
-};
 
-void parse_bezier_surface(const std::string &file_path, std::vector<BezierSurface> &surfaces);
+    Bounds _bounds;
+    vec3 _cone_axis;
+    float _cone_angle;  // negative if there is no cone
+};
 
 #endif //GLRENDER_BEZIERSURFACE_H
@@ -0,0 +1,610 @@
+#include "bricks.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "memstats.h"
+#include "meshnormals.h"
+#include "shadervariants.h"
+
+static const char BRICK_MAGIC[8] = {'G', 'L', 'R', 'B', 'R', 'K', '0', '1'};
+
+// few enough that a brick's vertices always fit uint16 indices
+static const size_t BRICK_TRIANGLES = 1 << 14;
+
+// bricks start on a page boundary
+static const size_t PAGE_SIZE = 4096;
+
+// read ahead at most this share of the slots' worth of bricks, so that the
+// staging memory held for them stays a fraction of the budget
+static const size_t PREFETCH_SHARE = 4;
+
+// what a brick's vertices look like in the file and on the GPU
+struct BrickVertex {
+    float position[3];
+    int16_t normal[2];
+};
+
+struct BrickEntry {
+    float min[3];
+    float max[3];
+    uint64_t offset;
+    uint32_t vertex_count;
+    uint32_t index_count;
+};
+
+static const size_t HEADER_BYTES = sizeof(BRICK_MAGIC) + 4 * sizeof(uint32_t);
+
+static inline size_t brick_bytes(size_t vertex_count, size_t index_count) {
+    return sizeof(BrickVertex) * vertex_count + sizeof(uint16_t) * index_count;
+}
+
+// the octahedron encoding that vshader.glsl decodes: n / |n|_1, with the
+// lower half folded over the diagonals
+static void pack_normal(const vec4 &n, int16_t *out) {
+    float l1 = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    float x = l1 > 0 ? n.x / l1 : 0.0f;
+    float y = l1 > 0 ? n.y / l1 : 0.0f;
+    if (n.z < 0) {
+        float fx = (1.0f - fabsf(y)) * (x >= 0 ? 1.0f : -1.0f);
+        float fy = (1.0f - fabsf(x)) * (y >= 0 ? 1.0f : -1.0f);
+        x = fx;
+        y = fy;
+    }
+    out[0] = (int16_t) lrintf(std::max(-1.0f, std::min(1.0f, x)) * 32767.0f);
+    out[1] = (int16_t) lrintf(std::max(-1.0f, std::min(1.0f, y)) * 32767.0f);
+}
+
+// splits order[begin, end) at the median of the triangle centers until the
+// pieces fit a brick, appending them in order
+static void split_bricks(std::vector<uint32_t> &order, const std::vector<vec3> &centers, size_t begin, size_t end,
+                         std::vector<std::pair<size_t, size_t> > &ranges) {
+    if (end - begin <= BRICK_TRIANGLES) {
+        ranges.push_back(std::make_pair(begin, end));
+        return;
+    }
+    Bounds bounds;
+    for (size_t i = begin; i < end; ++i) {
+        bounds.extend(centers[order[i]]);
+    }
+    vec3 extent = bounds.extent();
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : extent.y >= extent.z ? 1 : 2;
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(order.begin() + begin, order.begin() + middle, order.begin() + end,
+                     [&](uint32_t a, uint32_t b) { return centers[a][axis] < centers[b][axis]; });
+    split_bricks(order, centers, begin, middle, ranges);
+    split_bricks(order, centers, middle, end, ranges);
+}
+
+bool is_brick_file(const std::string &path) {
+    char magic[sizeof(BRICK_MAGIC)];
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    bool match = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, BRICK_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+bool write_brick_file(const std::string &path, const float *verts, size_t vertex_count, const int *tris,
+                      size_t index_count, BrickFileStats &stats) {
+    auto start_time = std::chrono::steady_clock::now();
+    size_t triangle_count = index_count / 3;
+    stats.bricks = 0;
+    stats.bytes = 0;
+
+    // the smooth normals as the loader makes them; pack_normal scales them
+    std::vector<vec4> normals(vertex_count, vec4(0.0, 0.0, 0.0, 0.0));
+    add_face_normals(verts, tris, index_count, normals.data());
+    std::vector<vec3> centers(triangle_count);
+    for (size_t t = 0; t < triangle_count; ++t) {
+        const int *tri = tris + 3 * t;
+        vec3 v[3];
+        for (int k = 0; k < 3; ++k) {
+            v[k] = vec3(verts[3 * tri[k]], verts[3 * tri[k] + 1], verts[3 * tri[k] + 2]);
+        }
+        centers[t] = (v[0] + v[1] + v[2]) / 3.0;
+    }
+
+    std::vector<uint32_t> order(triangle_count);
+    for (size_t t = 0; t < triangle_count; ++t) {
+        order[t] = (uint32_t) t;
+    }
+    std::vector<std::pair<size_t, size_t> > ranges;
+    if (triangle_count) {
+        split_bricks(order, centers, 0, triangle_count, ranges);
+    }
+    centers.clear();
+    centers.shrink_to_fit();
+
+    // write to the side and rename, so a reader never sees half a file
+    std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Fail to write brick file " << path << std::endl;
+        return false;
+    }
+
+    // the table is filled in as the bricks are written, and written last
+    std::vector<BrickEntry> table(ranges.size());
+    size_t data_start = HEADER_BYTES + sizeof(BrickEntry) * table.size();
+    size_t offset = (data_start + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+    bool ok = fseek(fp, (long) offset, SEEK_SET) == 0;
+
+    uint32_t max_vertices = 0, max_indices = 0;
+    std::vector<int> local(vertex_count, -1);
+    std::vector<int> brick_vertices;
+    std::vector<BrickVertex> vertex_data;
+    std::vector<uint16_t> index_data;
+    std::vector<char> padding(PAGE_SIZE, 0);
+    for (size_t b = 0; b < ranges.size() && ok; ++b) {
+        brick_vertices.clear();
+        index_data.clear();
+        for (size_t i = ranges[b].first; i < ranges[b].second; ++i) {
+            const int *tri = tris + 3 * order[i];
+            for (int k = 0; k < 3; ++k) {
+                if (local[tri[k]] < 0) {
+                    local[tri[k]] = (int) brick_vertices.size();
+                    brick_vertices.push_back(tri[k]);
+                }
+                index_data.push_back((uint16_t) local[tri[k]]);
+            }
+        }
+
+        Bounds bounds;
+        vertex_data.resize(brick_vertices.size());
+        for (size_t i = 0; i < brick_vertices.size(); ++i) {
+            int v = brick_vertices[i];
+            local[v] = -1;
+            for (int k = 0; k < 3; ++k) {
+                vertex_data[i].position[k] = verts[3 * v + k];
+            }
+            bounds.extend(vec3(verts[3 * v], verts[3 * v + 1], verts[3 * v + 2]));
+            pack_normal(normals[v], vertex_data[i].normal);
+        }
+
+        BrickEntry &entry = table[b];
+        for (int k = 0; k < 3; ++k) {
+            entry.min[k] = bounds.min[k];
+            entry.max[k] = bounds.max[k];
+        }
+        entry.offset = offset;
+        entry.vertex_count = (uint32_t) vertex_data.size();
+        entry.index_count = (uint32_t) index_data.size();
+        max_vertices = std::max(max_vertices, entry.vertex_count);
+        max_indices = std::max(max_indices, entry.index_count);
+
+        size_t bytes = brick_bytes(vertex_data.size(), index_data.size());
+        size_t pad = (PAGE_SIZE - bytes % PAGE_SIZE) % PAGE_SIZE;
+        ok = fwrite(vertex_data.data(), sizeof(BrickVertex), vertex_data.size(), fp) == vertex_data.size() &&
+             fwrite(index_data.data(), sizeof(uint16_t), index_data.size(), fp) == index_data.size() &&
+             (b + 1 == ranges.size() || fwrite(padding.data(), 1, pad, fp) == pad);
+        offset += bytes + pad;
+    }
+
+    uint32_t header[4] = {(uint32_t) table.size(), max_vertices, max_indices, 0};
+    ok = ok && fseek(fp, 0, SEEK_SET) == 0 &&
+         fwrite(BRICK_MAGIC, sizeof(BRICK_MAGIC), 1, fp) == 1 &&
+         fwrite(header, sizeof(header), 1, fp) == 1 &&
+         fwrite(table.data(), sizeof(BrickEntry), table.size(), fp) == table.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        std::cerr << "Fail to write brick file " << path << std::endl;
+        return false;
+    }
+
+    stats.bricks = table.size();
+    stats.bytes = table.empty() ? data_start : table.back().offset +
+                                               brick_bytes(table.back().vertex_count, table.back().index_count);
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    return true;
+}
+
+BrickStreamer::BrickStreamer()
+        : _fd(-1), _max_vertices(0), _max_indices(0), _vao(0), _slot_bytes(0), _frame(0), _pending(false),
+          _stopping(false) {
+    _buffers[0] = _buffers[1] = 0;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+BrickStreamer::~BrickStreamer() {
+    // the context is usually gone by now, and the driver cleans up with it;
+    // the read ahead thread has to stop before the file goes
+    std::unique_lock<std::mutex> lock(_prefetch_mutex);
+    _stopping = true;
+    _prefetch_wake.notify_all();
+    lock.unlock();
+    if (_prefetcher.joinable()) {
+        _prefetcher.join();
+    }
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+}
+
+// reads `bytes` at `offset`, false if the file ends first or can't be read
+static bool read_at(int fd, size_t offset, char *out, size_t bytes) {
+    while (bytes) {
+        ssize_t got = pread(fd, out, bytes, (off_t) offset);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        }
+        if (got <= 0) {
+            return false;
+        }
+        out += got;
+        offset += (size_t) got;
+        bytes -= (size_t) got;
+    }
+    return true;
+}
+
+// reads and checks the header and the table of an open brick file
+static bool read_table(int fd, const std::string &path, std::vector<BrickEntry> &table, size_t &max_vertices,
+                       size_t &max_indices) {
+    struct stat info;
+    char header[HEADER_BYTES];
+    if (fstat(fd, &info) != 0 || !read_at(fd, 0, header, HEADER_BYTES) ||
+        memcmp(header, BRICK_MAGIC, sizeof(BRICK_MAGIC)) != 0) {
+        std::cerr << "Brick file " << path << " is cut short or not a brick file" << std::endl;
+        return false;
+    }
+    size_t size = (size_t) info.st_size;
+    uint32_t counts[3];
+    memcpy(counts, header + sizeof(BRICK_MAGIC), sizeof(counts));
+    size_t count = counts[0];
+    max_vertices = counts[1];
+    max_indices = counts[2];
+
+    // the table is sized against the file before anything is allocated for it
+    bool ok = size >= HEADER_BYTES + sizeof(BrickEntry) * count && max_vertices <= 65536;
+    if (ok) {
+        table.resize(count);
+        ok = read_at(fd, HEADER_BYTES, reinterpret_cast<char *>(table.data()), sizeof(BrickEntry) * count);
+    }
+    for (size_t b = 0; b < count && ok; ++b) {
+        const BrickEntry &entry = table[b];
+        // written so that no offset, however large, wraps the sum
+        ok = entry.offset % PAGE_SIZE == 0 && entry.vertex_count <= max_vertices &&
+             entry.index_count <= max_indices && entry.offset <= size &&
+             brick_bytes(entry.vertex_count, entry.index_count) <= size - entry.offset;
+    }
+    if (!ok) {
+        std::cerr << "Brick file " << path << " is broken" << std::endl;
+    }
+    return ok;
+}
+
+bool BrickStreamer::open(const std::string &path, size_t budget) {
+    // the new file is checked before anything of the open one goes, so that
+    // a broken file leaves it as it was
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Fail to read brick file " << path << std::endl;
+        return false;
+    }
+    std::vector<BrickEntry> table;
+    size_t max_vertices = 0;
+    size_t max_indices = 0;
+    if (!read_table(fd, path, table, max_vertices, max_indices)) {
+        ::close(fd);
+        return false;
+    }
+    size_t count = table.size();
+
+    close();
+    _fd = fd;
+    _max_vertices = max_vertices;
+    _max_indices = max_indices;
+    for (size_t b = 0; b < count; ++b) {
+        const BrickEntry &entry = table[b];
+        Brick brick;
+        brick.bounds.extend(vec3(entry.min[0], entry.min[1], entry.min[2]));
+        brick.bounds.extend(vec3(entry.max[0], entry.max[1], entry.max[2]));
+        brick.offset = entry.offset;
+        brick.vertex_count = entry.vertex_count;
+        brick.index_count = entry.index_count;
+        brick.slot = -1;
+        brick.wanted_frame = 0;
+        brick.broken = false;
+        _bricks.push_back(brick);
+        _bounds.extend(brick.bounds);
+    }
+
+    _slot_bytes = brick_bytes(_max_vertices, _max_indices);
+    size_t slots = std::max<size_t>(1, std::min(count, budget / std::max<size_t>(_slot_bytes, 1)));
+    _slot_brick.assign(slots, -1);
+    _distance.resize(count);
+    _staged.resize(count);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+    glGenBuffers(2, _buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(BrickVertex) * _max_vertices * slots, NULL, GL_DYNAMIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 3, GL_FLOAT, GL_FALSE, sizeof(BrickVertex),
+                          BUFFER_OFFSET(offsetof(BrickVertex, position)));
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_NORMAL, 2, GL_SHORT, GL_TRUE, sizeof(BrickVertex),
+                          BUFFER_OFFSET(offsetof(BrickVertex, normal)));
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[1]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * _max_indices * slots, NULL, GL_DYNAMIC_DRAW);
+    glBindVertexArray((GLuint) previous);
+    mem_track_alloc(MEM_GPU_BUFFERS, bytes());
+
+    _stopping = false;
+    _prefetcher = std::thread(&BrickStreamer::prefetch_loop, this);
+    return true;
+}
+
+void BrickStreamer::close() {
+    {
+        std::unique_lock<std::mutex> lock(_prefetch_mutex);
+        _stopping = true;
+        _prefetch_queue.clear();
+        _prefetch_wake.notify_all();
+    }
+    if (_prefetcher.joinable()) {
+        _prefetcher.join();
+    }
+    if (_vao) {
+        glDeleteBuffers(2, _buffers);
+        glDeleteVertexArrays(1, &_vao);
+        mem_track_free(MEM_GPU_BUFFERS, bytes());
+    }
+    _vao = 0;
+    _buffers[0] = _buffers[1] = 0;
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+    _bricks.clear();
+    _bounds = Bounds();
+    _slot_brick.clear();
+    _slot_bytes = 0;
+    _staged.clear();
+    tracked_vector<char, MEM_UPLOAD_STAGING>().swap(_read);
+    _frame = 0;
+    _pending = false;
+    memset(&_stats, 0, sizeof(_stats));
+}
+
+// true if every index of a brick picks one of its own vertices; the draw
+// adds the slot's base vertex, so one past them reads another brick's
+static bool indices_in_range(const char *data, size_t vertex_count, size_t index_count) {
+    const uint16_t *indices = reinterpret_cast<const uint16_t *>(data + sizeof(BrickVertex) * vertex_count);
+    for (size_t i = 0; i < index_count; ++i) {
+        if (indices[i] >= vertex_count) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const char *BrickStreamer::read(size_t brick) {
+    Brick &b = _bricks[brick];
+    size_t bytes = brick_bytes(b.vertex_count, b.index_count);
+    bool prefetched = false;
+    {
+        std::unique_lock<std::mutex> lock(_prefetch_mutex);
+        if (!_staged[brick].empty()) {
+            _read.swap(_staged[brick]);
+            tracked_vector<char, MEM_UPLOAD_STAGING>().swap(_staged[brick]);
+            prefetched = true;
+        }
+    }
+    if (!prefetched) {
+        _read.resize(bytes);
+        if (!read_at(_fd, b.offset, _read.data(), bytes)) {
+            // the file was cut short since it was opened
+            std::cerr << "Fail to read brick " << brick << ", left out" << std::endl;
+            b.broken = true;
+            return NULL;
+        }
+    }
+    if (!indices_in_range(_read.data(), b.vertex_count, b.index_count)) {
+        std::cerr << "Brick " << brick << " has indices out of range, left out" << std::endl;
+        b.broken = true;
+        return NULL;
+    }
+    if (prefetched) {
+        ++_stats.prefetched_loads;
+    }
+    return _read.data();
+}
+
+void BrickStreamer::upload(size_t brick, size_t slot, const char *data) {
+    Brick &b = _bricks[brick];
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(BrickVertex) * _max_vertices * slot, sizeof(BrickVertex) * b.vertex_count,
+                    data);
+    // the element array binding is part of the VAO
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+    glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, sizeof(uint16_t) * _max_indices * slot, sizeof(uint16_t) * b.index_count,
+                    data + sizeof(BrickVertex) * b.vertex_count);
+    glBindVertexArray((GLuint) previous);
+
+    b.slot = (long) slot;
+    _slot_brick[slot] = (long) brick;
+    ++_stats.loads;
+}
+
+// the distance from `eye` to the nearest point of `bounds`, 0 inside
+static float distance_to(const vec3 &eye, const Bounds &bounds) {
+    vec3 d;
+    for (int k = 0; k < 3; ++k) {
+        d[k] = std::max(std::max(bounds.min[k] - eye[k], eye[k] - bounds.max[k]), 0.0f);
+    }
+    return length(d);
+}
+
+void BrickStreamer::update(const ViewFrustum &frustum, const vec3 &eye, const ViewFrustum &ahead,
+                           const vec3 &ahead_eye, size_t upload_budget) {
+    ++_frame;
+    _stats.uploaded = 0;
+    _visible.clear();
+    for (size_t b = 0; b < _bricks.size(); ++b) {
+        if (!_bricks[b].broken && frustum.classify(_bricks[b].bounds) != ViewFrustum::OUTSIDE) {
+            _distance[b] = distance_to(eye, _bricks[b].bounds);
+            _visible.push_back(b);
+        }
+    }
+    std::sort(_visible.begin(), _visible.end(), [this](size_t a, size_t b) { return _distance[a] < _distance[b]; });
+    _stats.visible = _visible.size();
+
+    // the nearest bricks, as many as there are slots, make the cut; slots of
+    // those that didn't are taken in the order they were last wanted
+    size_t wanted = std::min(_visible.size(), _slot_brick.size());
+    for (size_t i = 0; i < wanted; ++i) {
+        _bricks[_visible[i]].wanted_frame = _frame;
+    }
+    size_t uploaded_bytes = 0;
+    size_t waiting = wanted;
+    for (size_t i = 0; i < wanted; ++i) {
+        Brick &brick = _bricks[_visible[i]];
+        if (brick.slot >= 0) {
+            continue;
+        }
+        if (uploaded_bytes >= upload_budget) {
+            waiting = i;
+            break;
+        }
+        const char *data = read(_visible[i]);
+        if (!data) {
+            continue;
+        }
+        // a free slot, or else the one least recently wanted, which can't
+        // be this frame's: fewer bricks make the cut than there are slots
+        size_t slot = 0;
+        for (size_t s = 0; s < _slot_brick.size(); ++s) {
+            if (_slot_brick[s] < 0) {
+                slot = s;
+                break;
+            }
+            if (_bricks[_slot_brick[s]].wanted_frame < _bricks[_slot_brick[slot]].wanted_frame) {
+                slot = s;
+            }
+        }
+        if (_slot_brick[slot] >= 0) {
+            _bricks[_slot_brick[slot]].slot = -1;
+            ++_stats.evictions;
+        }
+        upload(_visible[i], slot, data);
+        uploaded_bytes += brick_bytes(brick.vertex_count, brick.index_count);
+        ++_stats.uploaded;
+    }
+    _pending = waiting < wanted;
+
+    // read ahead what didn't fit this frame's uploads, then what the camera
+    // will see further along, nearest first
+    std::vector<size_t> prefetch;
+    size_t prefetch_limit = std::max<size_t>(1, _slot_brick.size() / PREFETCH_SHARE);
+    for (size_t i = waiting; i < wanted && prefetch.size() < prefetch_limit; ++i) {
+        if (_bricks[_visible[i]].slot < 0) {
+            prefetch.push_back(_visible[i]);
+        }
+    }
+    std::vector<std::pair<float, size_t> > coming;
+    for (size_t b = 0; b < _bricks.size(); ++b) {
+        if (_bricks[b].slot < 0 && !_bricks[b].broken && _bricks[b].wanted_frame != _frame &&
+            ahead.classify(_bricks[b].bounds) != ViewFrustum::OUTSIDE) {
+            coming.push_back(std::make_pair(distance_to(ahead_eye, _bricks[b].bounds), b));
+        }
+    }
+    std::sort(coming.begin(), coming.end());
+    for (size_t i = 0; i < coming.size() && prefetch.size() < prefetch_limit; ++i) {
+        prefetch.push_back(coming[i].second);
+    }
+    {
+        // the newest guess replaces what wasn't read yet, and lets go of what
+        // was read for an older one
+        std::unique_lock<std::mutex> lock(_prefetch_mutex);
+        std::vector<unsigned char> keep(_bricks.size(), 0);
+        _prefetch_queue.clear();
+        for (size_t b : prefetch) {
+            keep[b] = 1;
+            if (_staged[b].empty()) {
+                _prefetch_queue.push_back(b);
+            }
+        }
+        for (size_t b = 0; b < _staged.size(); ++b) {
+            if (!keep[b] && !_staged[b].empty()) {
+                tracked_vector<char, MEM_UPLOAD_STAGING>().swap(_staged[b]);
+            }
+        }
+        _prefetch_wake.notify_one();
+    }
+
+    _draw_counts.clear();
+    _draw_offsets.clear();
+    _draw_base_vertices.clear();
+    _stats.drawn = 0;
+    _stats.triangles = 0;
+    for (size_t b : _visible) {
+        const Brick &brick = _bricks[b];
+        if (brick.slot < 0) {
+            continue;
+        }
+        _draw_counts.push_back((GLsizei) brick.index_count);
+        _draw_offsets.push_back(BUFFER_OFFSET(sizeof(uint16_t) * _max_indices * brick.slot));
+        _draw_base_vertices.push_back((GLint) (_max_vertices * brick.slot));
+        ++_stats.drawn;
+        _stats.triangles += brick.index_count / 3;
+    }
+}
+
+size_t BrickStreamer::draw() {
+    if (_draw_counts.empty()) {
+        return 0;
+    }
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+    glMultiDrawElementsBaseVertex(GL_TRIANGLES, _draw_counts.data(), GL_UNSIGNED_SHORT,
+                                  const_cast<const GLvoid *const *>(_draw_offsets.data()),
+                                  (GLsizei) _draw_counts.size(), _draw_base_vertices.data());
+    glBindVertexArray((GLuint) previous);
+    return _stats.triangles;
+}
+
+// reads queued bricks into staging memory of their own, so that the upload
+// finds them there
+void BrickStreamer::prefetch_loop() {
+    std::unique_lock<std::mutex> lock(_prefetch_mutex);
+    while (true) {
+        _prefetch_wake.wait(lock, [this] { return _stopping || !_prefetch_queue.empty(); });
+        if (_stopping) {
+            return;
+        }
+        size_t b = _prefetch_queue.front();
+        _prefetch_queue.pop_front();
+        size_t offset = _bricks[b].offset;
+        size_t bytes = brick_bytes(_bricks[b].vertex_count, _bricks[b].index_count);
+        lock.unlock();
+
+        // a brick that can't be read is left for the upload to find out
+        tracked_vector<char, MEM_UPLOAD_STAGING> data(bytes);
+        bool ok = read_at(_fd, offset, data.data(), bytes);
+
+        lock.lock();
+        if (ok) {
+            _staged[b].swap(data);
+        }
+    }
+}
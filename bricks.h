@@ -0,0 +1,184 @@
+#ifndef GLRENDER_BRICKS_H
+#define GLRENDER_BRICKS_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amath.h"
+#include "frustum.h"
+#include "memstats.h"
+
+// Meshes too big for memory, drawn out of core from a brick file: the mesh
+// cut into spatial bricks of up to BRICK_TRIANGLES triangles, each with its
+// own indexed vertices and precomputed smooth normals, laid out ready to go
+// into a vertex buffer. Bricks start on a page of their own, so that each one
+// can be read ahead or dropped from memory by itself.
+//
+//   char     magic[8]                  "GLRBRK01"
+//   uint32   brick count
+//   uint32   most vertices in a brick
+//   uint32   most indices in a brick
+//   uint32   unused
+//   float    min[3], max[3]            per brick, with
+//   uint64   offset in the file
+//   uint32   vertex count, index count
+//   ...      the bricks: per vertex x, y, z as floats and its normal as two
+//            octahedron encoded snorm shorts, then uint16 indices
+//
+// Bricks are cut by splitting the triangles at the median of their centers
+// along the longest side of their bounds, over and over, so they are about
+// the same size and compact in space.
+
+// what write_brick_file did
+struct BrickFileStats {
+    size_t bricks;
+    size_t bytes;           // of the file
+    double ms;
+};
+
+// true if the file is a brick file, by its magic
+bool is_brick_file(const std::string &path);
+
+// cuts the mesh into bricks and writes them; false if the file can't be
+// written. The cutting is in memory: on top of the mesh it takes a normal
+// and a slot per vertex, and a center and an order per triangle.
+bool write_brick_file(const std::string &path, const float *verts, size_t vertex_count, const int *tris,
+                      size_t index_count, BrickFileStats &stats);
+
+// Streams the bricks of a brick file through a fixed set of GPU slots, as
+// many as the memory budget holds. Every frame the bricks in view are ranked
+// nearest first, and those that make the cut and aren't on the GPU yet are
+// copied into the slots of bricks that didn't, the least recently wanted
+// first. Bricks are read with pread() into staging memory and let go of once
+// they are on the GPU, so the process holds little of the file, and a file
+// cut short or rewritten in place while open makes for bricks left out
+// rather than a fault on a mapping.
+//
+// A thread reads ahead the bricks that a frustum further along the camera's
+// path will see, so that by the time they are wanted they are in memory.
+class BrickStreamer {
+public:
+    struct Stats {
+        size_t visible;             // bricks in view
+        size_t drawn;               // of those, on the GPU
+        size_t triangles;           // drawn
+        size_t uploaded;            // bricks copied to the GPU this frame
+        size_t loads;               // bricks copied to the GPU since open()
+        size_t prefetched_loads;    // of those, read ahead before they were wanted
+        size_t evictions;
+    };
+
+    BrickStreamer();
+
+    ~BrickStreamer();
+
+    BrickStreamer(const BrickStreamer &) = delete;
+
+    BrickStreamer &operator=(const BrickStreamer &) = delete;
+
+    // opens the file and sets up as many slots as fit in `budget` bytes of
+    // GPU memory, at least one, in place of the file open before. False if
+    // the file can't be read or is malformed, and then the file before stays
+    // open.
+    bool open(const std::string &path, size_t budget);
+
+    void close();
+
+    // picks the bricks to keep for `frustum` seen from `eye`, copies up to
+    // `upload_budget` bytes of those missing to the GPU and queues what
+    // `ahead`, seen from `ahead_eye`, wants to be read ahead
+    void update(const ViewFrustum &frustum, const vec3 &eye, const ViewFrustum &ahead, const vec3 &ahead_eye,
+                size_t upload_budget);
+
+    // draws the bricks in view that are on the GPU, leaving the vertex array
+    // binding as it was; returns the number of triangles drawn. The normals
+    // are packed, so the program has to be a SHADER_PACKED_NORMALS variant.
+    size_t draw();
+
+    // true while bricks in view are still waiting for a slot or the upload
+    // budget of a later frame
+    inline bool pending() const {
+        return _pending;
+    }
+
+    inline bool empty() const {
+        return _bricks.empty();
+    }
+
+    inline size_t brick_count() const {
+        return _bricks.size();
+    }
+
+    inline size_t slot_count() const {
+        return _slot_brick.size();
+    }
+
+    // of the slots on the GPU
+    inline size_t bytes() const {
+        return _slot_bytes * _slot_brick.size();
+    }
+
+    inline const Bounds &bounds() const {
+        return _bounds;
+    }
+
+    inline const Stats &stats() const {
+        return _stats;
+    }
+
+private:
+    struct Brick {
+        Bounds bounds;
+        size_t offset;
+        size_t vertex_count;
+        size_t index_count;
+        long slot;                  // -1 if not on the GPU
+        size_t wanted_frame;        // last frame it made the cut
+        bool broken;                // can't be read or indices out of range, never drawn
+    };
+
+    // the brick's data, as read ahead or else read now, or NULL if it can't
+    // be read or an index is past its vertices, and then the brick is marked
+    // broken
+    const char *read(size_t brick);
+
+    // copies a brick's data into a slot
+    void upload(size_t brick, size_t slot, const char *data);
+
+    void prefetch_loop();
+
+    int _fd;
+    std::vector<Brick> _bricks;
+    Bounds _bounds;
+    size_t _max_vertices;
+    size_t _max_indices;
+
+    GLuint _vao;
+    GLuint _buffers[2];             // vertices, indices
+    size_t _slot_bytes;
+    std::vector<long> _slot_brick;  // per slot, -1 if free
+
+    size_t _frame;
+    bool _pending;
+    Stats _stats;
+    std::vector<size_t> _visible;
+    std::vector<float> _distance;
+    std::vector<GLsizei> _draw_counts;
+    std::vector<const GLvoid *> _draw_offsets;
+    std::vector<GLint> _draw_base_vertices;
+    tracked_vector<char, MEM_UPLOAD_STAGING> _read;     // the brick being uploaded
+
+    std::thread _prefetcher;
+    std::mutex _prefetch_mutex;
+    std::condition_variable _prefetch_wake;
+    std::deque<size_t> _prefetch_queue;
+    std::vector<tracked_vector<char, MEM_UPLOAD_STAGING> > _staged;    // per brick, read ahead or empty
+    bool _stopping;
+};
+
+#endif //GLRENDER_BRICKS_H
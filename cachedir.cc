@@ -0,0 +1,55 @@
+#include "cachedir.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/stat.h>
+
+std::string cache_dir() {
+    const char *dir;
+    std::string path;
+    if ((dir = getenv("XDG_CACHE_HOME"))) {
+        path = dir;
+    } else if ((dir = getenv("HOME"))) {
+        path = std::string(dir) + "/.cache";
+        mkdir(path.c_str(), 0755);
+    } else {
+        return "";
+    }
+    path += "/glrender";
+    mkdir(path.c_str(), 0755);
+    return path;
+}
+
+// 64 bit FNV-1a
+static unsigned long long hash_bytes(unsigned long long hash, const void *data, size_t size) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    for (size_t i = 0; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+std::string model_cache_file(const std::string &model_path, const char *extension, unsigned long long &key) {
+    struct stat info;
+    char *real_path = realpath(model_path.c_str(), NULL);
+    if (!real_path || stat(real_path, &info) != 0) {
+        free(real_path);
+        return "";
+    }
+
+    key = hash_bytes(14695981039346656037ULL, real_path, strlen(real_path));
+    free(real_path);
+    long long size = info.st_size, mtime = info.st_mtime;
+    key = hash_bytes(key, &size, sizeof(size));
+    key = hash_bytes(key, &mtime, sizeof(mtime));
+
+    std::string dir = cache_dir();
+    if (dir.empty()) {
+        return "";
+    }
+    char name[32];
+    snprintf(name, sizeof(name), "/%016llx.", key);
+    return dir + name + extension;
+}
@@ -0,0 +1,17 @@
+#ifndef GLRENDER_CACHEDIR_H
+#define GLRENDER_CACHEDIR_H
+
+#include <string>
+
+// $XDG_CACHE_HOME/glrender, else ~/.cache/glrender, created if needed; empty
+// if there is no home to put it in
+std::string cache_dir();
+
+// a file in cache_dir() for data derived from the model at `model_path`
+// (like its levels of detail), named after the model's path, size and
+// modification time so that an edited model gets a fresh entry. `key` gets
+// the same identity as a number, to store in the file and check on reading.
+// Empty if the model can't be found or there is no cache directory.
+std::string model_cache_file(const std::string &model_path, const char *extension, unsigned long long &key);
+
+#endif //GLRENDER_CACHEDIR_H
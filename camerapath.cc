@@ -0,0 +1,90 @@
+#include "camerapath.h"
+
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+
+static const char *CAMERA_PATH_HEADER = "glrender-camera-path";
+static const int CAMERA_PATH_VERSION = 1;
+
+bool CameraPath::save(const std::string &file_path) const {
+    std::ofstream out(file_path.c_str());
+
+    if (!out.good()) {
+        std::cerr << "Fail to write camera path " << file_path << std::endl;
+        return false;
+    }
+
+    out << CAMERA_PATH_HEADER << ' ' << CAMERA_PATH_VERSION << '\n';
+    out << _samples.size() << '\n';
+    // enough digits for the floats to survive the round trip exactly
+    out << std::setprecision(9);
+    for (auto &s : _samples) {
+        out << s.thetax << ' ' << s.thetay << ' ' << s.radius << ' ' << s.sampling_resolution << '\n';
+    }
+
+    out.close();
+    return true;
+}
+
+bool CameraPath::load(const std::string &file_path) {
+    std::ifstream in(file_path.c_str());
+
+    if (!in.good()) {
+        std::cerr << "Fail to read camera path " << file_path << std::endl;
+        return false;
+    }
+
+    std::string header;
+    int version = 0;
+    size_t count = 0;
+    in >> header >> version >> count;
+    if (header != CAMERA_PATH_HEADER || version != CAMERA_PATH_VERSION) {
+        std::cerr << file_path << " is not a camera path file" << std::endl;
+        return false;
+    }
+
+    _samples.clear();
+    for (size_t i = 0; i < count; ++i) {
+        CameraSample s;
+        if (!(in >> s.thetax >> s.thetay >> s.radius >> s.sampling_resolution)) {
+            std::cerr << "Camera path " << file_path << " is truncated at sample " << i << std::endl;
+            return false;
+        }
+        _samples.push_back(s);
+    }
+
+    in.close();
+    return !_samples.empty();
+}
+
+CameraSample CameraPath::at(long frame, long frame_count) const {
+    if (_samples.size() == 1 || frame_count <= 1) {
+        return _samples.front();
+    }
+
+    // position of this frame along the recording
+    double t = (double) frame * (_samples.size() - 1) / (frame_count - 1);
+    size_t i = (size_t) t;
+    if (i >= _samples.size() - 1) {
+        return _samples.back();
+    }
+    float f = (float) (t - i);
+
+    const CameraSample &a = _samples[i];
+    const CameraSample &b = _samples[i + 1];
+
+    // thetay wraps around at 360, so go the short way around
+    float dy = b.thetay - a.thetay;
+    if (dy > 180.0f) dy -= 360.0f;
+    if (dy < -180.0f) dy += 360.0f;
+
+    CameraSample s;
+    s.thetax = a.thetax + (b.thetax - a.thetax) * f;
+    s.thetay = a.thetay + dy * f;
+    if (s.thetay > 360.0f) s.thetay -= 360.0f;
+    if (s.thetay < 0.0f) s.thetay += 360.0f;
+    s.radius = a.radius + (b.radius - a.radius) * f;
+    s.sampling_resolution = a.sampling_resolution;
+    return s;
+}
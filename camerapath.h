@@ -0,0 +1,41 @@
+#ifndef GLRENDER_CAMERAPATH_H
+#define GLRENDER_CAMERAPATH_H
+
+#include <string>
+#include <vector>
+
+// Everything that decides what a frame renders: the orbit camera and the
+// Bezier sampling resolution.
+struct CameraSample {
+    float thetax;
+    float thetay;
+    float radius;
+    int sampling_resolution;
+};
+
+// A camera trajectory, one sample per displayed frame, that can be written to
+// a file while the user drives the viewer and replayed from it later.
+class CameraPath {
+public:
+    inline void record(const CameraSample &sample) {
+        _samples.push_back(sample);
+    }
+
+    inline size_t size() const {
+        return _samples.size();
+    }
+
+    bool save(const std::string &file_path) const;
+
+    bool load(const std::string &file_path);
+
+    // the sample shown at `frame` when the whole path is replayed over
+    // `frame_count` frames. Angles and radius are interpolated, the sampling
+    // resolution is held until the next recorded change.
+    CameraSample at(long frame, long frame_count) const;
+
+private:
+    std::vector<CameraSample> _samples;
+};
+
+#endif //GLRENDER_CAMERAPATH_H
@@ -0,0 +1,162 @@
+#include "computetessellator.h"
+
+#include <algorithm>
+
+#include "memstats.h"
+
+ComputeTessellator::ComputeTessellator()
+        : _program(0), _patch_count_location(-1), _sample_count_location(-1), _points_bytes(0),
+          _batch_capacity(0), _batch_samples(0), _vertices(0), _queued_vertices(0) {
+    _buffers[0] = _buffers[1] = 0;
+}
+
+ComputeTessellator::~ComputeTessellator() {
+    // the context is usually gone by now, and the driver cleans up with it
+}
+
+bool ComputeTessellator::supported() {
+#ifdef __APPLE__
+    return false;
+#else
+    return GLEW_VERSION_4_3 || (GLEW_ARB_compute_shader && GLEW_ARB_shader_storage_buffer_object);
+#endif
+}
+
+bool ComputeTessellator::upload(const std::vector<BezierSurface> &surfaces, const char *shader_file) {
+    release();
+    if (surfaces.empty()) {
+        return false;
+    }
+
+    for (auto &surf : surfaces) {
+        if (surf.u_deg() > MAX_DEGREE || surf.v_deg() > MAX_DEGREE) {
+            std::cerr << "Bezier patch of degree " << surf.u_deg() << " by " << surf.v_deg()
+                      << " is too high for the compute tessellator" << std::endl;
+            return false;
+        }
+    }
+
+    GLint previous_program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+    std::string prelude = "#define MAX_DEGREE " + std::to_string(MAX_DEGREE) + "\n";
+    _program = InitComputeShader(shader_file, prelude.c_str());
+    glUseProgram((GLuint) previous_program);
+    if (!_program) {
+        return false;
+    }
+    _patch_count_location = glGetUniformLocation(_program, "patch_count");
+    _sample_count_location = glGetUniformLocation(_program, "sample_count");
+
+    size_t total = 0;
+    for (auto &surf : surfaces) {
+        total += (surf.u_deg() + 1) * (surf.v_deg() + 1);
+    }
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> points(total);
+
+    _first_point.resize(surfaces.size());
+    _u_deg.resize(surfaces.size());
+    _v_deg.resize(surfaces.size());
+    GLint next = 0;
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+        _first_point[i] = next;
+        _u_deg[i] = surfaces[i].u_deg();
+        _v_deg[i] = surfaces[i].v_deg();
+        surfaces[i].copy_control_points(&points[next]);
+        next += (_u_deg[i] + 1) * (_v_deg[i] + 1);
+    }
+
+    _points_bytes = sizeof(vec4) * total;
+    glGenBuffers(2, _buffers);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[0]);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, _points_bytes, points.data(), GL_STATIC_DRAW);
+    mem_track_alloc(MEM_GPU_BUFFERS, _points_bytes);
+    return true;
+}
+
+size_t ComputeTessellator::update(size_t patch, const BezierSurface &surface) {
+    size_t count = (surface.u_deg() + 1) * (surface.v_deg() + 1);
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> points(count);
+    surface.copy_control_points(points.data());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _buffers[0]);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(vec4) * _first_point[patch], sizeof(vec4) * count, points.data());
+    return sizeof(vec4) * count;
+}
+
+void ComputeTessellator::release() {
+    if (_buffers[0]) {
+        glDeleteBuffers(2, _buffers);
+        mem_track_free(MEM_GPU_BUFFERS, _points_bytes + sizeof(BatchPatch) * _batch_capacity);
+    }
+    if (_program) {
+        glDeleteProgram(_program);
+    }
+    _program = 0;
+    _buffers[0] = _buffers[1] = 0;
+    _points_bytes = 0;
+    _batch_capacity = 0;
+    _first_point.clear();
+    _u_deg.clear();
+    _v_deg.clear();
+    _batch.clear();
+    _batch_samples = 0;
+    _queued_vertices = 0;
+}
+
+void ComputeTessellator::add(size_t patch, int samples, GLint first_vertex) {
+    BatchPatch entry;
+    entry.first_point = _first_point[patch];
+    entry.u_deg = _u_deg[patch];
+    entry.v_deg = _v_deg[patch];
+    entry.samples = samples;
+    entry.first_sample = _batch_samples;
+    entry.first_vertex = first_vertex;
+    entry.unused[0] = entry.unused[1] = 0;
+    _batch.push_back(entry);
+
+    _batch_samples += (samples * entry.u_deg + 1) * (samples * entry.v_deg + 1);
+    _queued_vertices += 2 * (samples * entry.u_deg) * (samples * entry.v_deg) * 3;
+}
+
+size_t ComputeTessellator::dispatch(GLuint position_buffer, GLuint normal_buffer) {
+    _vertices = _queued_vertices;
+    if (_batch.empty()) {
+        return 0;
+    }
+
+    // the table only grows, so that a batch of the size before is uploaded
+    // without reallocating
+    size_t bytes = sizeof(BatchPatch) * _batch.size();
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, _buffers[1]);
+    if (_batch.size() > _batch_capacity) {
+        size_t capacity = std::max(_batch.size(), 2 * _batch_capacity);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(BatchPatch) * capacity, NULL, GL_DYNAMIC_DRAW);
+        mem_track_alloc(MEM_GPU_BUFFERS, sizeof(BatchPatch) * (capacity - _batch_capacity));
+        _batch_capacity = capacity;
+    }
+    glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, bytes, _batch.data());
+
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 0, _buffers[0]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, _buffers[1]);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, position_buffer);
+    glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, normal_buffer);
+
+    GLint previous_program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &previous_program);
+    glUseProgram(_program);
+    glUniform1i(_patch_count_location, (GLint) _batch.size());
+    glUniform1i(_sample_count_location, _batch_samples);
+    // past the smallest limit on work groups in x, the rest go in rows of y
+    GLuint groups = (_batch_samples + LOCAL_SIZE - 1) / LOCAL_SIZE;
+    GLuint columns = groups < MAX_GROUPS_X ? groups : MAX_GROUPS_X;
+    glDispatchCompute(columns, (groups + columns - 1) / columns, 1);
+    glUseProgram((GLuint) previous_program);
+
+    // draws from the buffers have to see what the shader wrote, and so does
+    // the copy into a bigger buffer when they grow
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+
+    _batch.clear();
+    _batch_samples = 0;
+    _queued_vertices = 0;
+    return bytes;
+}
@@ -0,0 +1,95 @@
+#ifndef GLRENDER_COMPUTETESSELLATOR_H
+#define GLRENDER_COMPUTETESSELLATOR_H
+
+#include <string>
+#include <vector>
+
+#include "amath.h"
+#include "beziersurface.h"
+
+// Tessellates Bezier patches on the GPU with the compute shader in
+// tessellate.glsl, into the same triangle lists eval_triangles makes, written
+// straight into the vertex buffers the triangle paths draw from.
+//
+// The control points of every patch are uploaded once. A batch of patches
+// is then queued with add(), each with its resolution and the first vertex
+// of its triangles, and dispatch() tessellates the whole batch in a single
+// dispatch; the only upload is a small table describing the batch.
+class ComputeTessellator {
+public:
+    // highest patch degree the shader takes
+    static const int MAX_DEGREE = 15;
+
+    ComputeTessellator();
+
+    ~ComputeTessellator();
+
+    ComputeTessellator(const ComputeTessellator &) = delete;
+
+    ComputeTessellator &operator=(const ComputeTessellator &) = delete;
+
+    // whether the context has compute shaders and storage buffers; needs a
+    // current context
+    static bool supported();
+
+    // builds the program from `shader_file` and puts the control points of
+    // the surfaces into a storage buffer; false, with nothing uploaded, if
+    // the shader doesn't build or a patch's degree is over MAX_DEGREE
+    bool upload(const std::vector<BezierSurface> &surfaces, const char *shader_file);
+
+    // replaces the control points of a patch with those of `surface`, which
+    // has the same degrees; returns the bytes uploaded
+    size_t update(size_t patch, const BezierSurface &surface);
+
+    void release();
+
+    inline bool empty() const {
+        return _first_point.empty();
+    }
+
+    // queues a patch for the next dispatch, at `samples` segments per degree,
+    // its triangle_vertex_count(samples) vertices from `first_vertex` on
+    void add(size_t patch, int samples, GLint first_vertex);
+
+    // tessellates the queued patches into the two buffers, which take a vec4
+    // position and a vec4 normal per vertex, and empties the queue. The
+    // vertices can be drawn from right after. Returns the bytes uploaded.
+    size_t dispatch(GLuint position_buffer, GLuint normal_buffer);
+
+    // vertices written by the last dispatch
+    inline size_t vertices() const {
+        return _vertices;
+    }
+
+private:
+    // one patch of a batch, as the shader reads it (std430)
+    struct BatchPatch {
+        GLint first_point;
+        GLint u_deg;
+        GLint v_deg;
+        GLint samples;
+        GLint first_sample;
+        GLint first_vertex;
+        GLint unused[2];
+    };
+
+    static const GLuint LOCAL_SIZE = 64;
+    static const GLuint MAX_GROUPS_X = 65535;
+
+    GLuint _program;
+    GLint _patch_count_location;
+    GLint _sample_count_location;
+    GLuint _buffers[2];         // control points, batch table
+    size_t _points_bytes;
+    size_t _batch_capacity;     // in patches
+
+    std::vector<GLint> _first_point;    // per surface
+    std::vector<int> _u_deg;
+    std::vector<int> _v_deg;
+    std::vector<BatchPatch> _batch;
+    GLint _batch_samples;
+    size_t _vertices;
+    size_t _queued_vertices;
+};
+
+#endif //GLRENDER_COMPUTETESSELLATOR_H
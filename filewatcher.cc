@@ -0,0 +1,60 @@
+#include "filewatcher.h"
+
+#include <cstring>
+#include <iostream>
+
+#include <sys/inotify.h>
+#include <unistd.h>
+
+FileWatcher::FileWatcher()
+        : _fd(-1) {
+}
+
+FileWatcher::~FileWatcher() {
+    close();
+}
+
+bool FileWatcher::watch(const std::string &path) {
+    close();
+
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "." : slash == 0 ? "/" : path.substr(0, slash);
+    _name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+    _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (_fd < 0 || inotify_add_watch(_fd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        std::cerr << "Fail to watch " << path << " for changes" << std::endl;
+        close();
+        return false;
+    }
+    return true;
+}
+
+void FileWatcher::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+    }
+    _fd = -1;
+}
+
+bool FileWatcher::changed() {
+    if (_fd < 0) {
+        return false;
+    }
+
+    // the events of the other files in the directory are read and dropped
+    // along the way
+    bool changed = false;
+    alignas(struct inotify_event) char buffer[4096];
+    ssize_t length;
+    while ((length = read(_fd, buffer, sizeof(buffer))) > 0) {
+        for (ssize_t offset = 0; offset < length;) {
+            const struct inotify_event *event = reinterpret_cast<const struct inotify_event *>(buffer + offset);
+            if (event->len && strcmp(event->name, _name.c_str()) == 0) {
+                changed = true;
+            }
+            offset += sizeof(struct inotify_event) + event->len;
+        }
+    }
+    return changed;
+}
@@ -0,0 +1,40 @@
+#ifndef GLRENDER_FILEWATCHER_H
+#define GLRENDER_FILEWATCHER_H
+
+#include <string>
+
+// Watches a file for being written or replaced, through inotify. The watch is
+// on the file's directory rather than the file itself: exporters often write
+// a new file and rename it over the old one, and a watch on the old file
+// would go with it. A change counts once the writer has closed the file or
+// the new one has been moved into place, so a file is never seen half
+// written by a writer that does either.
+class FileWatcher {
+public:
+    FileWatcher();
+
+    ~FileWatcher();
+
+    FileWatcher(const FileWatcher &) = delete;
+
+    FileWatcher &operator=(const FileWatcher &) = delete;
+
+    // false if inotify isn't there or the directory can't be watched
+    bool watch(const std::string &path);
+
+    void close();
+
+    inline bool watching() const {
+        return _fd >= 0;
+    }
+
+    // true if the file was written or replaced since the last call, however
+    // many times. Never blocks.
+    bool changed();
+
+private:
+    int _fd;
+    std::string _name;      // of the file in its directory
+};
+
+#endif //GLRENDER_FILEWATCHER_H
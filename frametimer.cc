@@ -0,0 +1,198 @@
+#include "frametimer.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+
+FrameTimer::FrameTimer(size_t window)
+        : _window(window), _records(), _frame_bytes(0), _total_bytes(0), _triangles(0),
+          _gpu_timing(false), _slot(0), _dropped_queries(0) {
+    _queries[0] = _queries[1] = 0;
+    _query_frame[0] = _query_frame[1] = -1;
+}
+
+void FrameTimer::init_gl() {
+#ifndef __APPLE__
+    _gpu_timing = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+#else
+    _gpu_timing = true;
+#endif
+    if (_gpu_timing) {
+        glGenQueries(2, _queries);
+    } else {
+        std::cerr << "GL_TIME_ELAPSED queries unavailable, GPU timing disabled" << std::endl;
+    }
+}
+
+void FrameTimer::begin_frame() {
+    _frame_start = std::chrono::steady_clock::now();
+    _frame_bytes = 0;
+
+    if (_gpu_timing) {
+        // the query in this slot was issued two frames ago; if the GPU still
+        // hasn't got to it we drop the sample rather than wait
+        if (_query_frame[_slot] >= 0) {
+            collect_gpu_result(_slot, false);
+            if (_query_frame[_slot] >= 0) {
+                _query_frame[_slot] = -1;
+                ++_dropped_queries;
+            }
+        }
+        glBeginQuery(GL_TIME_ELAPSED, _queries[_slot]);
+    }
+}
+
+void FrameTimer::end_frame() {
+    Record rec;
+    rec.frame = (long) _records.size();
+    rec.cpu_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _frame_start).count();
+    rec.gpu_ms = -1.0;
+    rec.triangles = _triangles;
+    rec.bytes_uploaded = _frame_bytes;
+    _records.push_back(rec);
+
+    if (_gpu_timing) {
+        glEndQuery(GL_TIME_ELAPSED);
+        _query_frame[_slot] = rec.frame;
+        _slot = 1 - _slot;
+
+        // the other slot belongs to the previous frame, pick it up if it is ready
+        if (_query_frame[_slot] >= 0) {
+            collect_gpu_result(_slot, false);
+        }
+    }
+}
+
+void FrameTimer::finish() {
+    if (!_gpu_timing) {
+        return;
+    }
+    for (int i = 0; i < 2; ++i) {
+        if (_query_frame[i] >= 0) {
+            collect_gpu_result(i, true);
+        }
+    }
+}
+
+void FrameTimer::collect_gpu_result(int slot, bool wait) {
+    GLuint available = 0;
+    if (!wait) {
+        glGetQueryObjectuiv(_queries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available) {
+            return;
+        }
+    }
+
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(_queries[slot], GL_QUERY_RESULT, &elapsed);
+    _records[_query_frame[slot]].gpu_ms = elapsed / 1.0e6;
+    _query_frame[slot] = -1;
+}
+
+double FrameTimer::percentile(bool gpu, double p) const {
+    std::vector<double> samples;
+    size_t first = _records.size() > _window ? _records.size() - _window : 0;
+    for (size_t i = first; i < _records.size(); ++i) {
+        double ms = gpu ? _records[i].gpu_ms : _records[i].cpu_ms;
+        if (ms >= 0.0) {
+            samples.push_back(ms);
+        }
+    }
+    if (samples.empty()) {
+        return -1.0;
+    }
+
+    size_t k = (size_t) (p / 100.0 * (samples.size() - 1) + 0.5);
+    std::nth_element(samples.begin(), samples.begin() + k, samples.end());
+    return samples[k];
+}
+
+double FrameTimer::cpu_percentile(double p) const {
+    return percentile(false, p);
+}
+
+double FrameTimer::gpu_percentile(double p) const {
+    return percentile(true, p);
+}
+
+std::vector<std::string> FrameTimer::summary() const {
+    std::vector<std::string> lines;
+    std::ostringstream line;
+
+    line << std::fixed << std::setprecision(2);
+    line << "cpu ms  p50 " << cpu_percentile(50) << "  p95 " << cpu_percentile(95)
+         << "  p99 " << cpu_percentile(99);
+    lines.push_back(line.str());
+
+    line.str("");
+    if (_gpu_timing) {
+        line << "gpu ms  p50 " << gpu_percentile(50) << "  p95 " << gpu_percentile(95)
+             << "  p99 " << gpu_percentile(99);
+    } else {
+        line << "gpu ms  n/a";
+    }
+    lines.push_back(line.str());
+
+    line.str("");
+    line << "triangles " << _triangles;
+    lines.push_back(line.str());
+
+    line.str("");
+    line << "uploaded " << std::setprecision(3) << _total_bytes / (1024.0 * 1024.0) << " MiB";
+    lines.push_back(line.str());
+
+    return lines;
+}
+
+bool FrameTimer::write_csv(const std::string &file_path) const {
+    std::ofstream out(file_path.c_str());
+
+    if (!out.good()) {
+        std::cerr << "Fail to write frame statistics to " << file_path << std::endl;
+        return false;
+    }
+
+    out << "frame,cpu_ms,gpu_ms,triangles,bytes_uploaded\n";
+    out << std::fixed << std::setprecision(4);
+    for (auto &rec : _records) {
+        out << rec.frame << ',' << rec.cpu_ms << ',';
+        if (rec.gpu_ms >= 0.0) {
+            out << rec.gpu_ms;
+        }
+        out << ',' << rec.triangles << ',' << rec.bytes_uploaded << '\n';
+    }
+
+    out.close();
+    return true;
+}
+
+void FrameTimer::print_report(std::ostream &out) const {
+    out << "frames " << _records.size();
+    if (_dropped_queries) {
+        out << " (" << _dropped_queries << " gpu samples dropped)";
+    }
+    out << std::endl;
+    for (auto &line : summary()) {
+        out << line << std::endl;
+    }
+}
+
+void draw_text_overlay(const std::vector<std::string> &lines) {
+    // the bitmap font goes through the fixed function raster path, so get the
+    // shader program and the depth test out of the way while drawing it
+    GLint program = 0;
+    glGetIntegerv(GL_CURRENT_PROGRAM, &program);
+    glUseProgram(0);
+    glDisable(GL_DEPTH_TEST);
+
+    int height = glutGet(GLUT_WINDOW_HEIGHT);
+    glColor3f(0.0, 0.0, 0.0);
+    for (size_t i = 0; i < lines.size(); ++i) {
+        glWindowPos2i(8, height - 16 - 15 * (int) i);
+        glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char *) lines[i].c_str());
+    }
+
+    glEnable(GL_DEPTH_TEST);
+    glUseProgram(program);
+}
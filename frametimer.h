@@ -0,0 +1,93 @@
+#ifndef GLRENDER_FRAMETIMER_H
+#define GLRENDER_FRAMETIMER_H
+
+#include <chrono>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "amath.h"
+
+// Per-frame CPU and GPU timing.
+//
+// CPU time is the wall clock spent between begin_frame() and end_frame().
+// GPU time comes from GL_TIME_ELAPSED queries; two query objects are used in
+// turn so that the result of a frame is only read back one frame later, once
+// it is available, and the pipeline is never stalled waiting on it.
+class FrameTimer {
+public:
+    struct Record {
+        long frame;
+        double cpu_ms;
+        double gpu_ms;          // negative until (or unless) the query result arrives
+        size_t triangles;
+        size_t bytes_uploaded;  // bytes sent to the GPU during this frame
+    };
+
+    explicit FrameTimer(size_t window = 240);
+
+    // must be called once a GL context exists
+    void init_gl();
+
+    void begin_frame();
+
+    void end_frame();
+
+    // blocks until the outstanding GPU queries have been resolved, so that the
+    // last frames are complete before writing a report
+    void finish();
+
+    inline void add_uploaded_bytes(size_t bytes) {
+        _frame_bytes += bytes;
+        _total_bytes += bytes;
+    }
+
+    inline void set_triangles(size_t triangles) {
+        _triangles = triangles;
+    }
+
+    inline long frames() const {
+        return (long) _records.size();
+    }
+
+    inline size_t total_uploaded_bytes() const {
+        return _total_bytes;
+    }
+
+    // p in [0, 100], computed over the last `window` frames
+    double cpu_percentile(double p) const;
+
+    double gpu_percentile(double p) const;
+
+    // the text lines shown by the overlay and printed by the report
+    std::vector<std::string> summary() const;
+
+    bool write_csv(const std::string &file_path) const;
+
+    void print_report(std::ostream &out) const;
+
+private:
+    double percentile(bool gpu, double p) const;
+
+    void collect_gpu_result(int slot, bool wait);
+
+    size_t _window;
+    std::vector<Record> _records;
+
+    std::chrono::steady_clock::time_point _frame_start;
+    size_t _frame_bytes;
+    size_t _total_bytes;
+    size_t _triangles;
+
+    bool _gpu_timing;
+    GLuint _queries[2];
+    long _query_frame[2];       // record index owning each query, -1 if idle
+    int _slot;
+    long _dropped_queries;
+};
+
+// draws lines of text in the upper left corner of the current window, on top
+// of whatever has been rendered so far
+void draw_text_overlay(const std::vector<std::string> &lines);
+
+#endif //GLRENDER_FRAMETIMER_H
@@ -0,0 +1,65 @@
+#include "frustum.h"
+
+#include <cfloat>
+
+Bounds::Bounds()
+        : min(FLT_MAX, FLT_MAX, FLT_MAX), max(-FLT_MAX, -FLT_MAX, -FLT_MAX) {
+}
+
+void Bounds::extend(const vec3 &p) {
+    for (int i = 0; i < 3; ++i) {
+        if (p[i] < min[i]) min[i] = p[i];
+        if (p[i] > max[i]) max[i] = p[i];
+    }
+}
+
+void Bounds::extend(const Bounds &b) {
+    if (!b.empty()) {
+        extend(b.min);
+        extend(b.max);
+    }
+}
+
+// the planes fall out of the rows of the matrix: a point is inside if
+// -w <= x, y, z <= w in clip space (Gribb and Hartmann)
+ViewFrustum::ViewFrustum(const mat4 &projection_view) {
+    const vec4 &x = projection_view[0];
+    const vec4 &y = projection_view[1];
+    const vec4 &z = projection_view[2];
+    const vec4 &w = projection_view[3];
+
+    _planes[0] = w + x;
+    _planes[1] = w - x;
+    _planes[2] = w + y;
+    _planes[3] = w - y;
+    _planes[4] = w + z;
+    _planes[5] = w - z;
+
+    for (int i = 0; i < 6; ++i) {
+        _planes[i] /= length(vec3(_planes[i].x, _planes[i].y, _planes[i].z));
+    }
+}
+
+ViewFrustum::Visibility ViewFrustum::classify(const Bounds &bounds) const {
+    Visibility visibility = INSIDE;
+
+    for (int i = 0; i < 6; ++i) {
+        const vec4 &plane = _planes[i];
+
+        // the corners of the box furthest along and against the plane normal
+        vec3 p_vertex, n_vertex;
+        for (int k = 0; k < 3; ++k) {
+            p_vertex[k] = plane[k] >= 0 ? bounds.max[k] : bounds.min[k];
+            n_vertex[k] = plane[k] >= 0 ? bounds.min[k] : bounds.max[k];
+        }
+
+        if (plane.x * p_vertex.x + plane.y * p_vertex.y + plane.z * p_vertex.z + plane.w < 0) {
+            return OUTSIDE;
+        }
+        if (plane.x * n_vertex.x + plane.y * n_vertex.y + plane.z * n_vertex.z + plane.w < 0) {
+            visibility = INTERSECTS;
+        }
+    }
+
+    return visibility;
+}
@@ -0,0 +1,64 @@
+#ifndef GLRENDER_FRUSTUM_H
+#define GLRENDER_FRUSTUM_H
+
+#include "amath.h"
+
+// axis aligned bounding box; empty until something is added
+struct Bounds {
+    vec3 min;
+    vec3 max;
+
+    Bounds();
+
+    void extend(const vec3 &p);
+
+    void extend(const Bounds &b);
+
+    inline bool empty() const {
+        return min.x > max.x;
+    }
+
+    inline vec3 center() const {
+        return (min + max) * 0.5;
+    }
+
+    inline vec3 extent() const {
+        return max - min;
+    }
+};
+
+// The six clip planes of a projection * view transform, for culling bounding
+// volumes before they are drawn.
+class ViewFrustum {
+public:
+    enum Visibility {
+        OUTSIDE,
+        INTERSECTS,
+        INSIDE
+    };
+
+    explicit ViewFrustum(const mat4 &projection_view);
+
+    Visibility classify(const Bounds &bounds) const;
+
+    inline bool outside(const vec3 &center, float radius) const {
+        for (int i = 0; i < 6; ++i) {
+            const vec4 &p = _planes[i];
+            if (p.x * center.x + p.y * center.y + p.z * center.z + p.w < -radius) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    inline const vec4 &plane(int i) const {
+        return _planes[i];
+    }
+
+private:
+    // (a, b, c, d) with ax + by + cz + d the distance to the plane, positive
+    // inside
+    vec4 _planes[6];
+};
+
+#endif //GLRENDER_FRUSTUM_H
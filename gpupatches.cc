@@ -0,0 +1,228 @@
+#include "gpupatches.h"
+
+#include <algorithm>
+
+#include "memstats.h"
+
+GpuPatches::GpuPatches()
+        : _vao(0), _buffer(0), _bytes(0), _query(0), _query_pending(false), _triangles(0) {
+}
+
+GpuPatches::~GpuPatches() {
+    // the context is usually gone by now, and the driver cleans up with it
+}
+
+bool GpuPatches::supported() {
+#ifdef __APPLE__
+    return false;
+#else
+    return GLEW_VERSION_4_0 || GLEW_ARB_tessellation_shader;
+#endif
+}
+
+// The patches of a group go into the buffer next to each other, in the order
+// of the file, so that a run of visible patches is one draw range.
+bool GpuPatches::upload(const std::vector<BezierSurface> &surfaces) {
+    release();
+    if (surfaces.empty()) {
+        return false;
+    }
+
+    GLint max_points = 0;
+    glGetIntegerv(GL_MAX_PATCH_VERTICES, &max_points);
+    for (auto &surf : surfaces) {
+        if ((surf.u_deg() + 1) * (surf.v_deg() + 1) > max_points) {
+            std::cerr << "Bezier patch of degree " << surf.u_deg() << " by " << surf.v_deg()
+                      << " has too many control points for the tessellation shaders" << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<size_t> order(surfaces.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        order[i] = i;
+    }
+    std::stable_sort(order.begin(), order.end(), [&surfaces](size_t a, size_t b) {
+        const BezierSurface &sa = surfaces[a], &sb = surfaces[b];
+        return sa.u_deg() != sb.u_deg() ? sa.u_deg() < sb.u_deg() : sa.v_deg() < sb.v_deg();
+    });
+
+    size_t total = 0;
+    for (auto &surf : surfaces) {
+        total += (surf.u_deg() + 1) * (surf.v_deg() + 1);
+    }
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> points(total);
+
+    _first.resize(surfaces.size());
+    _group.resize(surfaces.size());
+    GLint next = 0;
+    for (size_t i : order) {
+        const BezierSurface &surf = surfaces[i];
+        if (_groups.empty() || _groups.back().u_deg != surf.u_deg() || _groups.back().v_deg != surf.v_deg()) {
+            Group group;
+            group.u_deg = surf.u_deg();
+            group.v_deg = surf.v_deg();
+            _groups.push_back(group);
+        }
+        _first[i] = next;
+        _group[i] = (int) _groups.size() - 1;
+        surf.copy_control_points(&points[next]);
+        next += (surf.u_deg() + 1) * (surf.v_deg() + 1);
+    }
+
+    // a vertex array of its own, so the one of the triangle paths keeps its
+    // bindings
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    _bytes = sizeof(vec4) * total;
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+    glBufferData(GL_ARRAY_BUFFER, _bytes, points.data(), GL_STATIC_DRAW);
+    mem_track_alloc(MEM_GPU_BUFFERS, _bytes);
+
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+    glBindVertexArray((GLuint) previous);
+
+    glGenQueries(1, &_query);
+    return true;
+}
+
+size_t GpuPatches::update(size_t patch, const BezierSurface &surface) {
+    size_t count = (surface.u_deg() + 1) * (surface.v_deg() + 1);
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> points(count);
+    surface.copy_control_points(points.data());
+    // not through GL_ARRAY_BUFFER, whose binding the triangle paths set up
+    glBindBuffer(GL_COPY_WRITE_BUFFER, _buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, sizeof(vec4) * _first[patch], sizeof(vec4) * count, points.data());
+    return sizeof(vec4) * count;
+}
+
+void GpuPatches::release() {
+    if (_buffer) {
+        glDeleteBuffers(1, &_buffer);
+        glDeleteVertexArrays(1, &_vao);
+        glDeleteQueries(1, &_query);
+        mem_track_free(MEM_GPU_BUFFERS, _bytes);
+    }
+    _vao = _buffer = _query = 0;
+    _bytes = 0;
+    _query_pending = false;
+    _triangles = 0;
+    _groups.clear();
+    _first.clear();
+    _group.clear();
+}
+
+void GpuPatches::add_draw(size_t patch) {
+    Group &group = _groups[_group[patch]];
+    GLsizei count = (group.u_deg + 1) * (group.v_deg + 1);
+    if (!group.draw_firsts.empty() && group.draw_firsts.back() + group.draw_counts.back() == _first[patch]) {
+        group.draw_counts.back() += count;
+    } else {
+        group.draw_firsts.push_back(_first[patch]);
+        group.draw_counts.push_back(count);
+    }
+}
+
+// the count of the query before, if the GPU is done with it
+void GpuPatches::read_query() {
+    if (!_query_pending) {
+        return;
+    }
+    GLuint available = 0;
+    glGetQueryObjectuiv(_query, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (available) {
+        GLuint primitives = 0;
+        glGetQueryObjectuiv(_query, GL_QUERY_RESULT, &primitives);
+        _triangles = primitives;
+        _query_pending = false;
+    }
+}
+
+size_t GpuPatches::draw(const std::vector<size_t> *visible, ShaderVariants &variants, int features,
+                        int light_count, float samples, float edge_pixels, int width, int height) {
+    if (empty()) {
+        return 0;
+    }
+
+    for (auto &group : _groups) {
+        group.draw_firsts.clear();
+        group.draw_counts.clear();
+    }
+    size_t drawn = visible ? visible->size() : _first.size();
+    for (size_t i = 0; i < drawn; ++i) {
+        add_draw(visible ? (*visible)[i] : i);
+    }
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+
+    read_query();
+    bool counting = !_query_pending;
+    if (counting) {
+        glBeginQuery(GL_PRIMITIVES_GENERATED, _query);
+    }
+
+    for (auto &group : _groups) {
+        if (group.draw_counts.empty()) {
+            continue;
+        }
+        GLuint program = variants.get_patches(features, light_count, group.u_deg, group.v_deg);
+        if (!program) {
+            continue;
+        }
+        glUseProgram(program);
+        glUniform1f(glGetUniformLocation(program, "samples"), samples);
+        glUniform1f(glGetUniformLocation(program, "edge_pixels"), edge_pixels);
+        glUniform2f(glGetUniformLocation(program, "viewport"), (GLfloat) width, (GLfloat) height);
+
+        glPatchParameteri(GL_PATCH_VERTICES, (group.u_deg + 1) * (group.v_deg + 1));
+        glMultiDrawArrays(GL_PATCHES, group.draw_firsts.data(), group.draw_counts.data(),
+                          (GLsizei) group.draw_counts.size());
+    }
+
+    if (counting) {
+        glEndQuery(GL_PRIMITIVES_GENERATED);
+        _query_pending = true;
+    }
+    glBindVertexArray((GLuint) previous);
+    return drawn;
+}
+
+size_t GpuPatches::capture(size_t patch, ShaderVariants &variants, float samples) {
+    const Group &group = _groups[_group[patch]];
+    GLuint program = variants.get_patches(SHADER_CAPTURE, 0, group.u_deg, group.v_deg);
+    if (!program) {
+        return 0;
+    }
+    // the program can't change while transform feedback is on
+    glUseProgram(program);
+    glUniform1f(glGetUniformLocation(program, "samples"), samples);
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+    GLsizei points = (group.u_deg + 1) * (group.v_deg + 1);
+    glPatchParameteri(GL_PATCH_VERTICES, points);
+
+    GLuint query = 0;
+    glGenQueries(1, &query);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN, query);
+    glBeginTransformFeedback(GL_TRIANGLES);
+    glDrawArrays(GL_PATCHES, _first[patch], points);
+    glEndTransformFeedback();
+    glEndQuery(GL_TRANSFORM_FEEDBACK_PRIMITIVES_WRITTEN);
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindVertexArray((GLuint) previous);
+
+    GLuint written = 0;
+    glGetQueryObjectuiv(query, GL_QUERY_RESULT, &written);
+    glDeleteQueries(1, &query);
+    return written;
+}
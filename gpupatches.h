@@ -0,0 +1,94 @@
+#ifndef GLRENDER_GPUPATCHES_H
+#define GLRENDER_GPUPATCHES_H
+
+#include <vector>
+
+#include "amath.h"
+#include "beziersurface.h"
+#include "shadervariants.h"
+
+// Bezier patches drawn by the tessellation shaders: only the control points
+// go to the GPU, once, as GL_PATCHES, and tcshader.glsl and teshader.glsl cut
+// each patch up and evaluate its points and normals. A new resolution is a
+// uniform, with no tessellation on the CPU and nothing to upload.
+//
+// The number of control points of a patch is fixed per program, so the
+// patches are grouped by degree, each group drawn with its own program
+// variant in one multi-draw call.
+class GpuPatches {
+public:
+    GpuPatches();
+
+    ~GpuPatches();
+
+    GpuPatches(const GpuPatches &) = delete;
+
+    GpuPatches &operator=(const GpuPatches &) = delete;
+
+    // whether the context has tessellation shaders; needs a current context
+    static bool supported();
+
+    // puts the control points of the surfaces into a buffer of their own;
+    // false, with nothing uploaded, if a patch has more control points than
+    // the driver takes in one patch
+    bool upload(const std::vector<BezierSurface> &surfaces);
+
+    // replaces the control points of a patch with those of `surface`, which
+    // has the same degrees; returns the bytes uploaded
+    size_t update(size_t patch, const BezierSurface &surface);
+
+    void release();
+
+    inline bool empty() const {
+        return _groups.empty();
+    }
+
+    // draws the patches in `visible`, in increasing order, or every patch if
+    // it is NULL. With `samples` above 0 every patch is cut into that many
+    // segments per degree, like the CPU path; at 0 each edge gets enough
+    // segments to be about `edge_pixels` long on a `width` by `height`
+    // viewport. Leaves the program of the last group current, and the vertex
+    // array binding as it was; returns the number of patches drawn.
+    size_t draw(const std::vector<size_t> *visible, ShaderVariants &variants, int features, int light_count,
+                float samples, float edge_pixels, int width, int height);
+
+    // draws one patch at `samples` segments per degree with its
+    // SHADER_CAPTURE variant and the rasterizer off, the points going to the
+    // transform feedback buffer bound at index 0 (see tessverify.h). Leaves
+    // the program current; returns the number of triangles written, 0 if the
+    // variant doesn't build.
+    size_t capture(size_t patch, ShaderVariants &variants, float samples);
+
+    // triangles the tessellator made in a recent draw, read back without
+    // waiting for the GPU
+    inline size_t triangles() const {
+        return _triangles;
+    }
+
+private:
+    struct Group {
+        int u_deg;
+        int v_deg;
+        std::vector<GLint> draw_firsts;
+        std::vector<GLsizei> draw_counts;
+    };
+
+    // adds the control points of a patch to its group's draw ranges, merged
+    // with the one before if they follow each other in the buffer
+    void add_draw(size_t patch);
+
+    void read_query();
+
+    GLuint _vao;
+    GLuint _buffer;
+    size_t _bytes;
+    std::vector<Group> _groups;
+    std::vector<GLint> _first;      // per surface, in vertices of the buffer
+    std::vector<int> _group;        // per surface
+
+    GLuint _query;
+    bool _query_pending;
+    size_t _triangles;
+};
+
+#endif //GLRENDER_GPUPATCHES_H
@@ -1,8 +1,22 @@
 
 #include "amath.h"
+#include "cachedir.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+#include <fstream>
 
 namespace amath {
 
+static bool shaderCacheEnabled = true;
+
+void
+EnableShaderCache( bool enable )
+{
+    shaderCacheEnabled = enable;
+}
+
 // Create a NULL-terminated string by reading the provided file
 static char*
 readShaderSource(const char* shaderFile)
@@ -16,7 +30,7 @@ readShaderSource(const char* shaderFile)
 
     fseek(fp, 0L, SEEK_SET);
     char* buf = new char[size + 1];
-    fread(buf, 1, size, fp);
+    size = fread(buf, 1, size, fp);
 
     buf[size] = '\0';
     fclose(fp);
@@ -24,68 +38,332 @@ readShaderSource(const char* shaderFile)
     return buf;
 }
 
+//----------------------------------------------------------------------------
+//
+//  --- Program binary cache ---
+//
+//  Linked programs are kept on disk as glGetProgramBinary output, under a
+//  key hashed from the shader sources and the driver that built them. A
+//  binary the driver refuses (after an update, say) is rebuilt from source.
+//
+
+static const char  ProgramCacheMagic[8] = { 'G', 'L', 'R', 'P', 'R', 'O', 'G', '1' };
+
+// 64 bit FNV-1a
+static unsigned long long
+hashString( unsigned long long hash, const char* s )
+{
+    if ( hash == 0 ) { hash = 14695981039346656037ULL; }
+    for ( ; *s; ++s ) {
+	hash ^= (unsigned char) *s;
+	hash *= 1099511628211ULL;
+    }
+    // terminate, so that "ab" + "c" and "a" + "bc" differ
+    hash ^= 0xff;
+    hash *= 1099511628211ULL;
+    return hash;
+}
+
+static std::string
+driverString()
+{
+    std::string driver;
+    const GLenum  names[] = { GL_VENDOR, GL_RENDERER, GL_VERSION };
+    for ( int i = 0; i < 3; ++i ) {
+	const GLubyte* s = glGetString( names[i] );
+	driver += s ? (const char*) s : "?";
+	driver += '|';
+    }
+    return driver;
+}
+
+// $GLRENDER_SHADER_CACHE, else the glrender cache directory
+static std::string
+shaderCacheDir()
+{
+    const char* dir = getenv( "GLRENDER_SHADER_CACHE" );
+    return dir ? dir : cache_dir();
+}
+
+static bool
+programBinarySupported()
+{
+#ifdef __APPLE__
+    return false;
+#else
+    if ( !(GLEW_VERSION_4_1 || GLEW_ARB_get_program_binary) ) { return false; }
+    GLint  formats = 0;
+    glGetIntegerv( GL_NUM_PROGRAM_BINARY_FORMATS, &formats );
+    return formats > 0;
+#endif
+}
+
+static bool
+loadProgramBinary( GLuint program, const std::string& path, const std::string& driver )
+{
+    std::ifstream in( path.c_str(), std::ios::binary );
+    if ( !in.good() ) { return false; }
+
+    char  magic[8];
+    GLuint  driverLength = 0, format = 0, length = 0;
+    in.read( magic, sizeof(magic) );
+    in.read( (char*) &driverLength, sizeof(driverLength) );
+    if ( !in || std::string( magic, 8 ) != std::string( ProgramCacheMagic, 8 ) ||
+	 driverLength != driver.size() ) {
+	return false;
+    }
+
+    std::string  storedDriver( driverLength, '\0' );
+    in.read( &storedDriver[0], driverLength );
+    in.read( (char*) &format, sizeof(format) );
+    in.read( (char*) &length, sizeof(length) );
+    if ( !in || storedDriver != driver ) { return false; }
+
+    // the binary is the rest of the file; a length that says otherwise is
+    // a broken entry, turned away before it sizes anything
+    std::streamoff  start = in.tellg();
+    in.seekg( 0, std::ios::end );
+    std::streamoff  end = in.tellg();
+    if ( start < 0 || end < start || (std::streamoff) length != end - start ) { return false; }
+    in.seekg( start );
+
+    std::vector<char>  binary( length );
+    in.read( binary.data(), length );
+    if ( !in ) { return false; }
+
+    glProgramBinary( program, format, binary.data(), length );
+
+    GLint  linked;
+    glGetProgramiv( program, GL_LINK_STATUS, &linked );
+    return linked;
+}
+
+static void
+saveProgramBinary( GLuint program, const std::string& path, const std::string& driver )
+{
+    GLint  length = 0;
+    glGetProgramiv( program, GL_PROGRAM_BINARY_LENGTH, &length );
+    if ( length <= 0 ) { return; }
+
+    std::vector<char>  binary( length );
+    GLenum  format;
+    glGetProgramBinary( program, length, NULL, &format, binary.data() );
 
-// Create a GLSL program object from vertex and fragment shader files
+    // write to the side and rename, so a concurrent reader never sees half
+    // a file
+    std::string  tmp = path + ".tmp";
+    std::ofstream out( tmp.c_str(), std::ios::binary );
+    if ( !out.good() ) { return; }
+
+    GLuint  driverLength = driver.size(), binaryFormat = format, binaryLength = length;
+    out.write( ProgramCacheMagic, sizeof(ProgramCacheMagic) );
+    out.write( (const char*) &driverLength, sizeof(driverLength) );
+    out.write( driver.data(), driverLength );
+    out.write( (const char*) &binaryFormat, sizeof(binaryFormat) );
+    out.write( (const char*) &binaryLength, sizeof(binaryLength) );
+    out.write( binary.data(), length );
+    out.close();
+
+    if ( out.good() ) {
+	rename( tmp.c_str(), path.c_str() );
+    } else {
+	remove( tmp.c_str() );
+    }
+}
+
+//----------------------------------------------------------------------------
+
+// Compile one shader stage, 0 on failure.  The prelude goes in right after
+// the #version line, which has to stay first.
+static GLuint
+compileShader( GLenum type, const char* filename, const char* source, const char* prelude )
+{
+    const char*  body = source;
+    std::string  version;
+    if ( strncmp( source, "#version", 8 ) == 0 ) {
+	body = strchr( source, '\n' );
+	body = body ? body + 1 : source + strlen( source );
+	version.assign( source, body - source );
+    }
+
+    // keep the line numbers in compiler messages matching the file
+    std::string  header = version + (prelude ? prelude : "") + "\n#line " +
+	std::to_string( version.empty() ? 1 : 2 ) + "\n";
+    const GLchar*  strings[2] = { header.c_str(), body };
+
+    GLuint shader = glCreateShader( type );
+    glShaderSource( shader, 2, strings, NULL );
+    glCompileShader( shader );
+
+    GLint  compiled;
+    glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
+    if ( !compiled ) {
+	std::cerr << filename << " failed to compile:" << std::endl;
+	GLint  logSize;
+	glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
+	char* logMsg = new char[logSize];
+	glGetShaderInfoLog( shader, logSize, NULL, logMsg );
+	std::cerr << logMsg << std::endl;
+	delete [] logMsg;
+
+	glDeleteShader( shader );
+	return 0;
+    }
+
+    return shader;
+}
+
+static GLuint buildProgram( const char* const* files, const char* prelude,
+			    const char* const* attributes,
+			    const char* const* feedback = NULL );
+
+// Create a GLSL program object from vertex and fragment shader files.
+// Returns 0 if the program can't be built.
 GLuint
-InitShader(const char* vShaderFile, const char* fShaderFile)
+InitShader(const char* vShaderFile, const char* fShaderFile,
+	   const char* prelude, const char* const* attributes)
+{
+    return InitShader( vShaderFile, NULL, NULL, fShaderFile, prelude, attributes );
+}
+
+// Create a GLSL program object from vertex, tessellation and fragment shader
+// files, skipping the stages without a file.
+GLuint
+InitShader(const char* vShaderFile, const char* tcShaderFile,
+	   const char* teShaderFile, const char* fShaderFile,
+	   const char* prelude, const char* const* attributes,
+	   const char* const* feedback)
+{
+    const char*  files[5] = { vShaderFile, tcShaderFile, teShaderFile, fShaderFile, NULL };
+    return buildProgram( files, prelude, attributes, feedback );
+}
+
+// Create a GLSL program object from a compute shader file.
+GLuint
+InitComputeShader(const char* cShaderFile, const char* prelude)
+{
+    const char*  files[5] = { NULL, NULL, NULL, NULL, cShaderFile };
+    return buildProgram( files, prelude, NULL );
+}
+
+// Build a program from one file per stage, in the order of the shaders
+// array below; NULL files are skipped.
+static GLuint
+buildProgram(const char* const* files, const char* prelude,
+	     const char* const* attributes, const char* const* feedback)
 {
     struct Shader {
 	const char*  filename;
 	GLenum       type;
 	GLchar*      source;
-    }  shaders[2] = {
-	{ vShaderFile, GL_VERTEX_SHADER, NULL },
-	{ fShaderFile, GL_FRAGMENT_SHADER, NULL }
+	GLuint       object;
+    }  shaders[5] = {
+	{ files[0], GL_VERTEX_SHADER, NULL, 0 },
+	{ files[1], GL_TESS_CONTROL_SHADER, NULL, 0 },
+	{ files[2], GL_TESS_EVALUATION_SHADER, NULL, 0 },
+	{ files[3], GL_FRAGMENT_SHADER, NULL, 0 },
+	{ files[4], GL_COMPUTE_SHADER, NULL, 0 }
     };
+    const int  stages = 5;
 
-    GLuint program = glCreateProgram();
-    
-    for ( int i = 0; i < 2; ++i ) {
+    for ( int i = 0; i < stages; ++i ) {
 	Shader& s = shaders[i];
+	if ( s.filename == NULL ) { continue; }
 	s.source = readShaderSource( s.filename );
-	if ( shaders[i].source == NULL ) {
+	if ( s.source == NULL ) {
 	    std::cerr << "Failed to read " << s.filename << std::endl;
-	    exit( EXIT_FAILURE );
+	    for ( int j = 0; j < i; ++j ) { delete [] shaders[j].source; }
+	    return 0;
+	}
+    }
+
+    GLuint program = glCreateProgram();
+
+    bool  cached = shaderCacheEnabled && programBinarySupported();
+    std::string  driver, cachePath;
+    if ( cached ) {
+	driver = driverString();
+	unsigned long long key = hashString( 0, driver.c_str() );
+	for ( int i = 0; i < stages; ++i ) {
+	    key = hashString( key, shaders[i].source ? shaders[i].source : "" );
+	}
+	key = hashString( key, prelude ? prelude : "" );
+	for ( int i = 0; attributes && attributes[i]; ++i ) {
+	    key = hashString( key, attributes[i] );
+	}
+	// the captured outputs are part of the linked program
+	for ( int i = 0; feedback && feedback[i]; ++i ) {
+	    key = hashString( key, feedback[i] );
 	}
 
-	GLuint shader = glCreateShader( s.type );
-	glShaderSource( shader, 1, (const GLchar**) &s.source, NULL );
-	glCompileShader( shader );
+	char  name[32];
+	snprintf( name, sizeof(name), "/%016llx.bin", key );
+	std::string  dir = shaderCacheDir();
+	if ( !dir.empty() ) { cachePath = dir + name; }
 
-	GLint  compiled;
-	glGetShaderiv( shader, GL_COMPILE_STATUS, &compiled );
-	if ( !compiled ) {
-	    std::cerr << s.filename << " failed to compile:" << std::endl;
+	if ( !cachePath.empty() && loadProgramBinary( program, cachePath, driver ) ) {
+	    for ( int i = 0; i < stages; ++i ) { delete [] shaders[i].source; }
+	    glUseProgram( program );
+	    return program;
+	}
+    }
+
+    bool  ok = true;
+    for ( int i = 0; i < stages && ok; ++i ) {
+	Shader& s = shaders[i];
+	if ( s.source == NULL ) { continue; }
+	s.object = compileShader( s.type, s.filename, s.source, prelude );
+	ok = s.object != 0;
+	if ( ok ) { glAttachShader( program, s.object ); }
+    }
+
+    if ( ok ) {
+	for ( int i = 0; attributes && attributes[i]; ++i ) {
+	    glBindAttribLocation( program, i, attributes[i] );
+	}
+	if ( feedback ) {
+	    GLsizei  count = 0;
+	    while ( feedback[count] ) { ++count; }
+	    glTransformFeedbackVaryings( program, count, feedback, GL_INTERLEAVED_ATTRIBS );
+	}
+	if ( cached ) {
+	    glProgramParameteri( program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE );
+	}
+
+	/* link  and error check */
+	glLinkProgram(program);
+
+	GLint  linked;
+	glGetProgramiv( program, GL_LINK_STATUS, &linked );
+	if ( !linked ) {
+	    std::cerr << "Shader program failed to link" << std::endl;
 	    GLint  logSize;
-	    glGetShaderiv( shader, GL_INFO_LOG_LENGTH, &logSize );
+	    glGetProgramiv( program, GL_INFO_LOG_LENGTH, &logSize);
 	    char* logMsg = new char[logSize];
-	    glGetShaderInfoLog( shader, logSize, NULL, logMsg );
+	    glGetProgramInfoLog( program, logSize, NULL, logMsg );
 	    std::cerr << logMsg << std::endl;
 	    delete [] logMsg;
-
-	    exit( EXIT_FAILURE );
+	    ok = false;
 	}
+    }
 
+    // the program keeps what it needs of the shaders once linked
+    for ( int i = 0; i < stages; ++i ) {
+	Shader& s = shaders[i];
+	if ( s.object ) {
+	    glDetachShader( program, s.object );
+	    glDeleteShader( s.object );
+	}
 	delete [] s.source;
-
-	glAttachShader( program, shader );
     }
 
-    /* link  and error check */
-    glLinkProgram(program);
-
-    GLint  linked;
-    glGetProgramiv( program, GL_LINK_STATUS, &linked );
-    if ( !linked ) {
-	std::cerr << "Shader program failed to link" << std::endl;
-	GLint  logSize;
-	glGetProgramiv( program, GL_INFO_LOG_LENGTH, &logSize);
-	char* logMsg = new char[logSize];
-	glGetProgramInfoLog( program, logSize, NULL, logMsg );
-	std::cerr << logMsg << std::endl;
-	delete [] logMsg;
+    if ( !ok ) {
+	glDeleteProgram( program );
+	return 0;
+    }
 
-	exit( EXIT_FAILURE );
+    if ( cached && !cachePath.empty() ) {
+	saveProgramBinary( program, cachePath, driver );
     }
 
     /* use program object */
@@ -0,0 +1,71 @@
+// Uniform blocks and Blinn/Phong lighting, shared by all the shaders and
+// pasted into each after the feature #defines:
+//
+//   LIGHT_COUNT          number of lights, 0 to skip lighting altogether
+//   SPECULAR             add the specular term
+//   PER_VERTEX_LIGHTING  light in the vertex shader and interpolate the color
+//   PACKED_NORMALS       normals arrive octahedron encoded in a vec2
+//   TESSELLATION         the vertices are the control points of Bezier
+//                        patches of U_DEGREE by V_DEGREE (CONTROL_POINTS in
+//                        all), evaluated in tcshader.glsl and teshader.glsl
+
+#ifndef LIGHT_COUNT
+#define LIGHT_COUNT 1
+#endif
+
+// room in the Lighting block, the same for every variant so that they can all
+// share one buffer (MAX_LIGHTS in shadervariants.h)
+#define MAX_LIGHTS 4
+
+// camera and projection transforms and camera position, bound to
+// UNIFORM_BLOCK_CAMERA. Row major, like amath's mat4.
+layout(std140, row_major) uniform Camera {
+  mat4 ctm;
+  mat4 ptm;
+  vec4 pos;
+};
+
+// light and material parameters, bound to UNIFORM_BLOCK_LIGHTING
+layout(std140) uniform Lighting {
+  vec4 lpos[MAX_LIGHTS];
+  vec4 ldiff[MAX_LIGHTS];
+  vec4 lspec[MAX_LIGHTS];
+  vec4 lamb;
+
+  vec4 mamb;
+  vec4 mdiff;
+  vec4 mspec;
+
+  float ms;
+};
+
+// color of a surface point p with normal n, as seen from pos
+vec4 shade(vec4 n, vec4 p)
+{
+#if LIGHT_COUNT == 0
+  vec4 color = mdiff;
+#else
+  n = normalize(n);
+
+  // first, ambient light
+  vec4 color = lamb * mamb;
+
+  for (int i = 0; i < LIGHT_COUNT; ++i) {
+    vec4 ld = normalize(lpos[i] - p);
+
+    // next, diffuse
+    float dd = dot(ld, n);
+    if (dd > 0.0) color += dd * (ldiff[i] * mdiff);
+
+#ifdef SPECULAR
+    // last, specular
+    vec4 vd = normalize(pos - p);
+    float sd = dot(normalize(ld + vd), n);
+    if (sd > 0.0) color += pow(sd, ms) * (lspec[i] * mspec);
+#endif
+  }
+#endif
+
+  color[3] = 1.0;
+  return color;
+}
@@ -0,0 +1,430 @@
+#include "loader.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+
+#include "meshfile.h"
+#include "meshnormals.h"
+#include "misc.h"
+#include "patchfile.h"
+#include "patchweld.h"
+
+// how much of the file a pipeline chunk holds, and how many chunks may wait
+// between two stages
+static const size_t READ_BLOCK_SIZE = 4 << 20;
+static const size_t QUEUE_CAPACITY = 4;
+
+// patches per chunk handed to tessellation
+static const size_t PATCHES_PER_CHUNK = 256;
+
+// faces per normal-only chunk once the smooth OBJ normals are known
+static const size_t FINAL_NORMALS_FACES = 1 << 18;
+
+// faces per chunk of a decoded mesh file
+static const size_t MESH_CHUNK_FACES = 1 << 18;
+
+ModelLoader::ModelLoader()
+        : _sampling_resolution(1), _weld_epsilon(0), _text_queue(QUEUE_CAPACITY), _parsed_queue(QUEUE_CAPACITY),
+          _geometry_queue(2 * QUEUE_CAPACITY), _cancelled(false), _failed(false) {
+    _clean_stats.welded_vertices = 0;
+    _clean_stats.unused_vertices = 0;
+    _clean_stats.degenerate_faces = 0;
+    _clean_stats.duplicate_faces = 0;
+}
+
+ModelLoader::~ModelLoader() {
+    cancel();
+    join();
+}
+
+void ModelLoader::start(const std::string &file_path, bool bezier, int sampling_resolution, float weld_epsilon) {
+    cancel();
+    join();
+    _text_queue.reopen();
+    _parsed_queue.reopen();
+    _geometry_queue.reopen();
+    _cancelled = false;
+    _failed = false;
+    _surfaces.clear();
+    _bvh.clear();
+    _meshlets.clear();
+    _verts.clear();
+    _tris.clear();
+
+    _file_path = file_path;
+    _sampling_resolution = sampling_resolution;
+    _weld_epsilon = weld_epsilon;
+
+    if (bezier) {
+        _threads.push_back(std::thread(&ModelLoader::read_bezier_stage, this));
+        _threads.push_back(std::thread(&ModelLoader::tessellate_stage, this));
+    } else if (is_mesh_file(file_path)) {
+        _threads.push_back(std::thread(&ModelLoader::read_mesh_stage, this));
+        _threads.push_back(std::thread(&ModelLoader::obj_normals_stage, this));
+    } else {
+        _threads.push_back(std::thread(&ModelLoader::read_stage, this));
+        _threads.push_back(std::thread(&ModelLoader::parse_obj_stage, this));
+        _threads.push_back(std::thread(&ModelLoader::obj_normals_stage, this));
+    }
+}
+
+bool ModelLoader::poll(GeometryChunk &chunk) {
+    return _geometry_queue.try_pop(chunk);
+}
+
+bool ModelLoader::finished() {
+    if (!_geometry_queue.drained()) {
+        return false;
+    }
+    join();
+    return true;
+}
+
+void ModelLoader::cancel() {
+    _cancelled = true;
+    _text_queue.close();
+    _parsed_queue.close();
+    _geometry_queue.close();
+}
+
+void ModelLoader::join() {
+    for (auto &thread : _threads) {
+        thread.join();
+    }
+    _threads.clear();
+}
+
+void ModelLoader::take_surfaces(std::vector<BezierSurface> &surfaces) {
+    surfaces.swap(_surfaces);
+    _surfaces.clear();
+}
+
+void ModelLoader::take_bvh(MeshBvh &bvh, MeshletSet &meshlets) {
+    bvh = std::move(_bvh);
+    _bvh.clear();
+    meshlets = std::move(_meshlets);
+    _meshlets.clear();
+}
+
+void ModelLoader::take_mesh(tracked_vector<float, MEM_PARSER> &verts, tracked_vector<int, MEM_PARSER> &tris) {
+    verts = std::move(_verts);
+    _verts.clear();
+    tris = std::move(_tris);
+    _tris.clear();
+}
+
+// cuts the file into blocks that end at a line end, so that no line or
+// number is split between two chunks
+void ModelLoader::read_stage() {
+    FILE *fp = fopen(_file_path.c_str(), "rb");
+
+    if (fp == NULL) {
+        std::cerr << "Fails at reading file " << _file_path << std::endl;
+        _failed = true;
+        _text_queue.close();
+        return;
+    }
+
+    TextBlock carry;
+    while (!_cancelled) {
+        TextBlock block;
+        block.reserve(carry.size() + READ_BLOCK_SIZE + 1);
+        block.insert(block.end(), carry.begin(), carry.end());
+        carry.clear();
+
+        size_t start = block.size();
+        block.resize(start + READ_BLOCK_SIZE);
+        size_t n = fread(block.data() + start, 1, READ_BLOCK_SIZE, fp);
+        block.resize(start + n);
+        if (block.empty()) {
+            break;
+        }
+
+        if (n > 0) {
+            size_t end = block.size();
+            while (end > 0 && block[end - 1] != '\n') {
+                --end;
+            }
+            if (end == 0) {
+                // no line end in the whole block, keep reading
+                carry.swap(block);
+                continue;
+            }
+            carry.assign(block.begin() + end, block.end());
+            block.resize(end);
+        }
+
+        block.push_back('\0');
+        if (!_text_queue.push(std::move(block)) || n == 0) {
+            break;
+        }
+    }
+
+    if (ferror(fp)) {
+        std::cerr << "Fails at reading file " << _file_path << std::endl;
+        _failed = true;
+    }
+    fclose(fp);
+    _text_queue.close();
+}
+
+void ModelLoader::parse_obj_stage() {
+    TextBlock block;
+    int line = 1;
+
+    while (!_cancelled && _text_queue.pop(block)) {
+        ParsedChunk chunk;
+
+        char *p = block.data();
+        char *end = p + block.size() - 1;
+        while (p < end) {
+            char *eol = p;
+            while (eol < end && *eol != '\n') {
+                ++eol;
+            }
+            *eol = '\0';
+
+            if (!parseObjLine(p, chunk.tris, chunk.verts)) {
+                std::cerr << "Parser error: invalid command at line " << line << std::endl;
+            }
+
+            p = eol + 1;
+            ++line;
+        }
+
+        if (!_parsed_queue.push(std::move(chunk))) {
+            break;
+        }
+    }
+
+    _parsed_queue.close();
+}
+
+// the whole file is parsed at once, in parallel (see patchfile.h), and the
+// patches handed on in chunks, so that tessellation and upload still overlap
+void ModelLoader::read_bezier_stage() {
+    std::vector<BezierSurface> surfaces;
+    {
+        ThreadPool pool;
+        if (!read_patch_file(_file_path, surfaces, pool)) {
+            _failed = true;
+        }
+    }
+
+    for (size_t first = 0; first < surfaces.size() && !_cancelled; first += PATCHES_PER_CHUNK) {
+        size_t last = std::min(surfaces.size(), first + PATCHES_PER_CHUNK);
+        ParsedChunk chunk;
+        chunk.patches.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            chunk.patches.push_back(std::move(surfaces[i]));
+        }
+        if (!_parsed_queue.push(std::move(chunk))) {
+            break;
+        }
+    }
+    _parsed_queue.close();
+}
+
+// the whole file is decoded at once, in parallel (see meshfile.h), and the
+// triangles handed on in chunks, the vertices with the first, so that the
+// normals and upload still overlap
+void ModelLoader::read_mesh_stage() {
+    ParsedChunk mesh;
+    {
+        ThreadPool pool;
+        if (!read_mesh_file(_file_path, mesh.verts, mesh.tris, pool)) {
+            _failed = true;
+        }
+    }
+
+    for (size_t first = 0; first < mesh.tris.size() && !_cancelled; first += 3 * MESH_CHUNK_FACES) {
+        size_t last = std::min(mesh.tris.size(), first + 3 * MESH_CHUNK_FACES);
+        ParsedChunk chunk;
+        if (!first) {
+            chunk.verts.swap(mesh.verts);
+        }
+        chunk.tris.assign(mesh.tris.begin() + first, mesh.tris.begin() + last);
+        if (!_parsed_queue.push(std::move(chunk))) {
+            break;
+        }
+    }
+    _parsed_queue.close();
+}
+
+// compute all these norms
+// The easiest way to compute these normals is as follows:
+// 1. make an array of normals that contain the normals for each triangle: e.g. tri_norms[] (computed via crossproduct)
+// 2. make an array of vectors, one for each unique vertex, each initialized to the zero vector, e.g. vert_norms[]
+// 3. go through the array of triangle vertex ids:
+//  if triangle i has vertex j, add tri_norms[i] to vert_nroms[j] (you will be adding each triangle's normal to 3 different vertex normals)
+// 4. when done, normalize all the vert_norms.
+// Here the triangle normals of each chunk go out with it as flat shading, and
+// the vertex normals are sent once all the triangles are in.
+void ModelLoader::obj_normals_stage() {
+    tracked_vector<float, MEM_PARSER> verts;
+    tracked_vector<int, MEM_PARSER> tris;
+    tracked_vector<vec4, MEM_NORMALS> vert_norms;     // norms per vertex (vertices are unique)
+    size_t next_vertex = 0;
+    size_t bad_faces = 0;
+    ThreadPool pool;
+    MeshCleaner cleaner(_weld_epsilon);
+
+    ParsedChunk parsed;
+    while (!_cancelled && _parsed_queue.pop(parsed)) {
+        verts.insert(verts.end(), parsed.verts.begin(), parsed.verts.end());
+        cleaner.add_vertices(verts, pool);
+        vert_norms.resize(verts.size() / 3, vec4(0.0, 0.0, 0.0, 0.0));
+
+        GeometryChunk chunk;
+        chunk.first_vertex = next_vertex;
+        chunk.positions.reserve(parsed.tris.size());
+        chunk.normals.reserve(parsed.tris.size());
+
+        int num_verts = (int) vert_norms.size();
+        for (size_t f = 0; f + 2 < parsed.tris.size(); f += 3) {
+            int *tri = &parsed.tris[f];
+            if (tri[0] < 0 || tri[0] >= num_verts || tri[1] < 0 || tri[1] >= num_verts ||
+                tri[2] < 0 || tri[2] >= num_verts) {
+                ++bad_faces;
+                continue;
+            }
+            if (!cleaner.add_face(tri, verts)) {
+                continue;
+            }
+
+            vec4 v[3];
+            for (int k = 0; k < 3; ++k) {
+                v[k] = vec4(verts[3 * tri[k]], verts[3 * tri[k] + 1], verts[3 * tri[k] + 2], 1.0);
+            }
+
+            // until the rest of the file is in, the face normal has to do
+            vec4 tri_norm = face_normal(v[0], v[1], v[2]);
+            for (int k = 0; k < 3; ++k) {
+                chunk.positions.push_back(v[k]);
+                chunk.normals.push_back(tri_norm);
+                vert_norms[tri[k]] += tri_norm;
+                tris.push_back(tri[k]);
+            }
+        }
+
+        next_vertex += chunk.positions.size();
+        if (!chunk.positions.empty() && !_geometry_queue.push(std::move(chunk))) {
+            break;
+        }
+    }
+
+    if (bad_faces) {
+        std::cerr << "Dropped " << bad_faces << " faces referring to undefined vertices" << std::endl;
+    }
+
+    if (!_cancelled) {
+        normalize_sums(vert_norms.data(), vert_norms.size());
+
+        for (size_t first = 0; first < tris.size(); first += 3 * FINAL_NORMALS_FACES) {
+            size_t last = std::min(tris.size(), first + 3 * FINAL_NORMALS_FACES);
+
+            GeometryChunk chunk;
+            chunk.first_vertex = first;
+            chunk.normals.reserve(last - first);
+            for (size_t i = first; i < last; ++i) {
+                chunk.normals.push_back(vert_norms[tris[i]]);
+            }
+            if (!_geometry_queue.push(std::move(chunk))) {
+                break;
+            }
+        }
+    }
+
+    if (!_cancelled) {
+        cleaner.compact(verts, tris);
+        _clean_stats = cleaner.stats();
+        if (_clean_stats.welded_vertices || _clean_stats.degenerate_faces || _clean_stats.duplicate_faces) {
+            std::cerr << "Welded " << _clean_stats.welded_vertices << " duplicate vertices, dropped "
+                      << _clean_stats.degenerate_faces << " degenerate and " << _clean_stats.duplicate_faces
+                      << " duplicate faces" << std::endl;
+        }
+        _bvh.build(verts.data(), tris.data(), tris.size());
+        _meshlets.build(verts.data(), tris.data(), _bvh);
+        _verts.swap(verts);
+        _tris.swap(tris);
+        if (_tris.empty()) {
+            _failed = true;
+        }
+    }
+
+    _geometry_queue.close();
+}
+
+void ModelLoader::tessellate_stage() {
+    LinearArena scratch(MEM_TESSELLATOR);
+    size_t next_vertex = 0;
+
+    ParsedChunk parsed;
+    while (!_cancelled && _parsed_queue.pop(parsed)) {
+        size_t count = 0;
+        for (auto &surf : parsed.patches) {
+            count += surf.triangle_vertex_count(_sampling_resolution);
+        }
+
+        GeometryChunk chunk;
+        chunk.first_vertex = next_vertex;
+        chunk.positions.resize(count);
+        chunk.normals.resize(count);
+
+        size_t vn_index = 0;
+        for (auto &surf : parsed.patches) {
+            scratch.reset();
+            surf.eval_triangles(_sampling_resolution, &chunk.positions[vn_index], &chunk.normals[vn_index], scratch);
+            vn_index += surf.triangle_vertex_count(_sampling_resolution);
+            _surfaces.push_back(std::move(surf));
+        }
+
+        next_vertex += count;
+        if (count && !_geometry_queue.push(std::move(chunk))) {
+            break;
+        }
+    }
+
+    if (!_cancelled && !next_vertex) {
+        _failed = true;
+    }
+    _geometry_queue.close();
+}
+
+bool load_indexed_mesh(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance,
+                       ThreadPool &pool, tracked_vector<float, MEM_PARSER> &verts,
+                       tracked_vector<int, MEM_PARSER> &tris) {
+    if (is_mesh_file(path) || isObjFile(path)) {
+        // the geometry is dropped as it comes, only the mesh is kept
+        ModelLoader loader;
+        loader.start(path, false, sampling_resolution, weld_epsilon);
+        GeometryChunk chunk;
+        while (!loader.finished()) {
+            if (!loader.poll(chunk)) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+        }
+        loader.take_mesh(verts, tris);
+    } else {
+        std::vector<BezierSurface> patches;
+        WeldedMesh mesh;
+        if (!read_patch_file(path, patches, pool)) {
+            return false;
+        }
+        weld_patches(patches, sampling_resolution, weld_tolerance, pool, mesh);
+        verts.resize(3 * mesh.positions.size());
+        for (size_t i = 0; i < mesh.positions.size(); ++i) {
+            verts[3 * i] = mesh.positions[i].x;
+            verts[3 * i + 1] = mesh.positions[i].y;
+            verts[3 * i + 2] = mesh.positions[i].z;
+        }
+        tris.assign(mesh.indices.begin(), mesh.indices.end());
+    }
+    if (verts.empty() || tris.empty()) {
+        std::cerr << "No triangles in " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,214 @@
+#ifndef GLRENDER_LOADER_H
+#define GLRENDER_LOADER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amath.h"
+#include "memstats.h"
+#include "arena.h"
+#include "beziersurface.h"
+#include "meshbvh.h"
+#include "meshclean.h"
+#include "meshlets.h"
+#include "threadpool.h"
+
+// Fixed capacity queue between two pipeline stages. push() blocks while the
+// queue is full, pop() while it is empty, so a fast producer can't run ahead
+// of its consumer by more than `capacity` items.
+template<typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+            : _capacity(capacity), _closed(false) { }
+
+    // false if the queue was closed, and the item dropped
+    bool push(T &&item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+        if (_closed) {
+            return false;
+        }
+        _items.push_back(std::move(item));
+        _not_empty.notify_one();
+        return true;
+    }
+
+    // false once the queue is closed and empty
+    bool pop(T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_empty.wait(lock, [this] { return _closed || !_items.empty(); });
+        return take(item);
+    }
+
+    bool try_pop(T &item) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return take(item);
+    }
+
+    // empty and taking pushes again, once no producer or consumer is left
+    void reopen() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _items.clear();
+        _closed = false;
+    }
+
+    // no more pushes; consumers drain what is left
+    void close() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _closed = true;
+        _not_empty.notify_all();
+        _not_full.notify_all();
+    }
+
+    bool drained() {
+        std::unique_lock<std::mutex> lock(_mutex);
+        return _closed && _items.empty();
+    }
+
+private:
+    bool take(T &item) {
+        if (_items.empty()) {
+            return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        _not_full.notify_one();
+        return true;
+    }
+
+    size_t _capacity;
+    bool _closed;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _not_empty;
+    std::condition_variable _not_full;
+};
+
+// Vertices ready to go into the vertex buffer, starting at first_vertex.
+// A chunk with no positions only replaces the normals of vertices that were
+// uploaded before.
+struct GeometryChunk {
+    size_t first_vertex;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> positions;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> normals;
+};
+
+// Loads a model on background threads, in a pipeline of four stages that
+// work on consecutive chunks of the file at the same time:
+//
+//   read       the file, in blocks cut at line ends
+//   parse      OBJ lines out of each block
+//   normals    OBJ face normals / Bezier tessellation
+//   upload     on the GL thread, which polls for finished geometry
+//
+// Bezier files are read and parsed in one stage instead, in parallel over the
+// whole mapped file, before the patches go on to tessellation in chunks, and
+// so are mesh files (see meshfile.h), whose triangles go on to the normals
+// stage like parsed OBJ chunks.
+//
+// OBJ vertices are welded and bad faces dropped on the way, by MeshCleaner.
+// OBJ chunks first go out flat shaded, since the smooth normal of a vertex
+// depends on faces that may not have been read yet. Once the whole file is in,
+// the smooth normals follow as normal-only chunks, and the stage goes on to
+// build the culling hierarchy and meshlets over the triangles. The parsed
+// mesh is kept for the levels of detail.
+class ModelLoader {
+public:
+    ModelLoader();
+
+    ~ModelLoader();
+
+    // OBJ (or mesh file) vertices within weld_epsilon of each other are welded, see
+    // meshclean.h. A load still running is cancelled, and what it made is
+    // dropped.
+    void start(const std::string &file_path, bool bezier, int sampling_resolution, float weld_epsilon = 0);
+
+    // next chunk of geometry, if one is ready. Never blocks.
+    bool poll(GeometryChunk &chunk);
+
+    // true once every chunk has been handed out by poll()
+    bool finished();
+
+    // false if the file couldn't be read or made no triangles; only valid
+    // once finished()
+    inline bool succeeded() const {
+        return !_failed;
+    }
+
+    // stops the stages early, e.g. when quitting during a load
+    void cancel();
+
+    // the parsed patches, for re-tessellation; only valid once finished()
+    void take_surfaces(std::vector<BezierSurface> &surfaces);
+
+    // the OBJ mesh's culling hierarchy and meshlets; only valid once
+    // finished()
+    void take_bvh(MeshBvh &bvh, MeshletSet &meshlets);
+
+    // the OBJ vertices and triangles as parsed, for building levels of
+    // detail; only valid once finished()
+    void take_mesh(tracked_vector<float, MEM_PARSER> &verts, tracked_vector<int, MEM_PARSER> &tris);
+
+    // what the cleanup of the OBJ mesh removed; only valid once finished()
+    inline const MeshCleaner::Stats &clean_stats() const {
+        return _clean_stats;
+    }
+
+private:
+    struct ParsedChunk {
+        tracked_vector<float, MEM_PARSER> verts;
+        tracked_vector<int, MEM_PARSER> tris;
+        std::vector<BezierSurface> patches;
+    };
+
+    void read_stage();
+
+    void parse_obj_stage();
+
+    void read_bezier_stage();
+
+    void read_mesh_stage();
+
+    void obj_normals_stage();
+
+    void tessellate_stage();
+
+    void join();
+
+    std::string _file_path;
+    int _sampling_resolution;
+    float _weld_epsilon;
+
+    typedef tracked_vector<char, MEM_PARSER> TextBlock;
+
+    BoundedQueue<TextBlock> _text_queue;
+    BoundedQueue<ParsedChunk> _parsed_queue;
+    BoundedQueue<GeometryChunk> _geometry_queue;
+    std::vector<std::thread> _threads;
+    std::atomic<bool> _cancelled;
+    std::atomic<bool> _failed;
+
+    std::vector<BezierSurface> _surfaces;
+    MeshBvh _bvh;
+    MeshletSet _meshlets;
+    tracked_vector<float, MEM_PARSER> _verts;
+    tracked_vector<int, MEM_PARSER> _tris;
+    MeshCleaner::Stats _clean_stats;
+};
+
+// loads a whole model at once as an indexed mesh: an OBJ mesh (or mesh file)
+// as ModelLoader cleans it up, or the Bezier patches welded at
+// `sampling_resolution` within `weld_tolerance` (see patchweld.h). False if
+// the file can't be read or has no triangles. Brick and scene files only
+// draw, and are for the caller to turn away.
+bool load_indexed_mesh(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance,
+                       ThreadPool &pool, tracked_vector<float, MEM_PARSER> &verts,
+                       tracked_vector<int, MEM_PARSER> &tris);
+
+#endif //GLRENDER_LOADER_H
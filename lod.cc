@@ -0,0 +1,697 @@
+#include "lod.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <queue>
+
+#include "cachedir.h"
+
+static const char LOD_CACHE_MAGIC[8] = {'G', 'L', 'R', 'L', 'O', 'D', '0', '3'};
+
+namespace {
+
+// error quadric of Garland and Heckbert: the sum of the squared distances of
+// a point to a set of planes, each weighted by the area of its triangle, as a
+// symmetric 4x4 matrix kept by its upper triangle
+struct Quadric {
+    double a[10];   // xx xy xz xw yy yz yw zz zw ww
+    double area;
+
+    void clear() {
+        memset(a, 0, sizeof(a));
+        area = 0;
+    }
+
+    // the plane x * nx + y * ny + z * nz + d = 0, with n of unit length
+    void add_plane(double nx, double ny, double nz, double d, double weight) {
+        a[0] += weight * nx * nx;
+        a[1] += weight * nx * ny;
+        a[2] += weight * nx * nz;
+        a[3] += weight * nx * d;
+        a[4] += weight * ny * ny;
+        a[5] += weight * ny * nz;
+        a[6] += weight * ny * d;
+        a[7] += weight * nz * nz;
+        a[8] += weight * nz * d;
+        a[9] += weight * d * d;
+        area += weight;
+    }
+
+    void add(const Quadric &q) {
+        for (int i = 0; i < 10; ++i) {
+            a[i] += q.a[i];
+        }
+        area += q.area;
+    }
+
+    double error(const double p[3]) const {
+        double x = p[0], y = p[1], z = p[2];
+        return a[0] * x * x + 2 * a[1] * x * y + 2 * a[2] * x * z + 2 * a[3] * x + a[4] * y * y +
+               2 * a[5] * y * z + 2 * a[6] * y + a[7] * z * z + 2 * a[8] * z + a[9];
+    }
+
+    // the point of least error; false if there isn't a single one, as on a
+    // flat or cylindrical piece of surface
+    bool minimum(double p[3]) const {
+        double m00 = a[0], m01 = a[1], m02 = a[2], m11 = a[4], m12 = a[5], m22 = a[7];
+        double c0 = m11 * m22 - m12 * m12;
+        double c1 = m02 * m12 - m01 * m22;
+        double c2 = m01 * m12 - m02 * m11;
+        double det = m00 * c0 + m01 * c1 + m02 * c2;
+        double trace = m00 + m11 + m22;
+        if (std::fabs(det) <= 1e-6 * trace * trace * trace) {
+            return false;
+        }
+
+        double b0 = -a[3], b1 = -a[6], b2 = -a[8];
+        p[0] = (c0 * b0 + c1 * b1 + c2 * b2) / det;
+        p[1] = (c1 * b0 + (m00 * m22 - m02 * m02) * b1 + (m01 * m02 - m00 * m12) * b2) / det;
+        p[2] = (c2 * b0 + (m01 * m02 - m00 * m12) * b1 + (m00 * m11 - m01 * m01) * b2) / det;
+        return true;
+    }
+};
+
+struct Collapse {
+    double cost;
+    double distance;    // root mean square distance to the planes, by area
+    int keep;           // local vertices
+    int gone;
+    unsigned keep_stamp;
+    unsigned gone_stamp;
+    double target[3];
+
+    bool operator>(const Collapse &other) const {
+        return cost > other.cost;
+    }
+};
+
+// One cell of the partition, simplified by collapsing its cheapest edges
+// first. Vertices are numbered locally; `positions` and `locked` are indexed
+// by the global numbers in `global`.
+class PartitionSimplifier {
+public:
+    PartitionSimplifier(float *positions, const std::vector<char> &locked)
+            : _positions(positions), _locked(locked), _live(0), _max_distance(0) { }
+
+    // the triangles tris[3 * f ...] for every f in `faces`
+    void init(const std::vector<size_t> &faces, const int *tris) {
+        for (size_t f : faces) {
+            _global.insert(_global.end(), tris + 3 * f, tris + 3 * f + 3);
+        }
+        std::sort(_global.begin(), _global.end());
+        _global.erase(std::unique(_global.begin(), _global.end()), _global.end());
+
+        size_t n = _global.size();
+        _quadrics.resize(n);
+        _faces_of.resize(n);
+        _stamps.assign(n, 0);
+        _removed.assign(n, 0);
+        for (auto &q : _quadrics) {
+            q.clear();
+        }
+
+        _tris.reserve(3 * faces.size());
+        for (size_t f : faces) {
+            int t = (int) (_tris.size() / 3);
+            for (int k = 0; k < 3; ++k) {
+                int local = (int) (std::lower_bound(_global.begin(), _global.end(), tris[3 * f + k]) -
+                                   _global.begin());
+                _tris.push_back(local);
+                _faces_of[local].push_back(t);
+            }
+        }
+
+        // every corner gets the plane of the triangle
+        for (size_t t = 0; t < _tris.size() / 3; ++t) {
+            vec3 n = face_normal((int) t, -1, NULL);
+            float len = length(n);
+            if (len <= 0) {
+                continue;
+            }
+            n /= len;
+            const float *p = position(_tris[3 * t]);
+            double d = -(n.x * p[0] + n.y * p[1] + n.z * p[2]);
+            for (int k = 0; k < 3; ++k) {
+                _quadrics[_tris[3 * t + k]].add_plane(n.x, n.y, n.z, d, len / 2);
+            }
+        }
+
+        _alive.assign(_tris.size() / 3, 1);
+        _live = _tris.size() / 3;
+        for (size_t t = 0; t < _live; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                push(_tris[3 * t + k], _tris[3 * t + (k + 1) % 3]);
+            }
+        }
+    }
+
+    // collapses edges until there are no more than `target` triangles left,
+    // or no edge can go; the remaining triangles are appended to `out` in
+    // global vertex numbers. Returns the largest distance of a collapse.
+    double run(size_t target, std::vector<int> &out) {
+        while (_live > target && !_heap.empty()) {
+            Collapse c = _heap.top();
+            _heap.pop();
+            if (_removed[c.keep] || _removed[c.gone] || _stamps[c.keep] != c.keep_stamp ||
+                _stamps[c.gone] != c.gone_stamp) {
+                continue;
+            }
+            if (!keeps_topology(c.keep, c.gone) || flips(c.keep, c.gone, c.target)) {
+                continue;
+            }
+            collapse(c);
+        }
+
+        for (size_t t = 0; t < _alive.size(); ++t) {
+            if (_alive[t]) {
+                for (int k = 0; k < 3; ++k) {
+                    out.push_back(_global[_tris[3 * t + k]]);
+                }
+            }
+        }
+        return _max_distance;
+    }
+
+private:
+    float *position(int local) {
+        return _positions + 3 * _global[local];
+    }
+
+    bool locked(int local) const {
+        return _locked[_global[local]] != 0;
+    }
+
+    // cross product of the edges of triangle t, with vertex `moved` (if one
+    // of its corners) at `target`
+    vec3 face_normal(int t, int moved, const double *target) {
+        vec3 p[3];
+        for (int k = 0; k < 3; ++k) {
+            int v = _tris[3 * t + k];
+            if (v == moved) {
+                p[k] = vec3((float) target[0], (float) target[1], (float) target[2]);
+            } else {
+                const float *q = position(v);
+                p[k] = vec3(q[0], q[1], q[2]);
+            }
+        }
+        return cross(p[1] - p[0], p[2] - p[0]);
+    }
+
+    // queues the collapse of the edge between u and v; a locked vertex is
+    // the one that stays
+    void push(int u, int v) {
+        if (u == v || (locked(u) && locked(v))) {
+            return;
+        }
+        if (locked(v)) {
+            std::swap(u, v);
+        }
+
+        Quadric q = _quadrics[u];
+        q.add(_quadrics[v]);
+
+        Collapse c;
+        const float *pu = position(u), *pv = position(v);
+        if (locked(u) || !q.minimum(c.target)) {
+            // the best of the two ends and the middle
+            double candidates[3][3] = {{pu[0], pu[1], pu[2]},
+                                       {pv[0], pv[1], pv[2]},
+                                       {(pu[0] + pv[0]) / 2, (pu[1] + pv[1]) / 2, (pu[2] + pv[2]) / 2}};
+            int count = locked(u) ? 1 : 3;
+            int best = 0;
+            for (int i = 1; i < count; ++i) {
+                if (q.error(candidates[i]) < q.error(candidates[best])) {
+                    best = i;
+                }
+            }
+            memcpy(c.target, candidates[best], sizeof(c.target));
+        }
+
+        c.cost = std::max(q.error(c.target), 0.0);
+        c.distance = q.area > 0 ? std::sqrt(c.cost / q.area) : 0.0;
+        c.keep = u;
+        c.gone = v;
+        c.keep_stamp = _stamps[u];
+        c.gone_stamp = _stamps[v];
+        _heap.push(c);
+    }
+
+    void neighbours(int v, std::vector<int> &out) {
+        out.clear();
+        for (int t : _faces_of[v]) {
+            if (_alive[t]) {
+                for (int k = 0; k < 3; ++k) {
+                    if (_tris[3 * t + k] != v) {
+                        out.push_back(_tris[3 * t + k]);
+                    }
+                }
+            }
+        }
+        std::sort(out.begin(), out.end());
+        out.erase(std::unique(out.begin(), out.end()), out.end());
+    }
+
+    // the link condition: the two ends may only share the neighbours across
+    // the triangles on the edge, or the collapse pinches the surface
+    bool keeps_topology(int keep, int gone) {
+        neighbours(keep, _keep_ring);
+        neighbours(gone, _gone_ring);
+        size_t shared_faces = 0;
+        for (int t : _faces_of[gone]) {
+            if (_alive[t] && (_tris[3 * t] == keep || _tris[3 * t + 1] == keep || _tris[3 * t + 2] == keep)) {
+                ++shared_faces;
+            }
+        }
+        size_t common = 0;
+        for (int v : _gone_ring) {
+            common += std::binary_search(_keep_ring.begin(), _keep_ring.end(), v);
+        }
+        return shared_faces > 0 && common <= shared_faces;
+    }
+
+    // true if moving both ends to `target` turns a triangle that stays over
+    bool flips(int keep, int gone, const double *target) {
+        const int ends[2] = {keep, gone};
+        for (int e = 0; e < 2; ++e) {
+            for (int t : _faces_of[ends[e]]) {
+                if (!_alive[t]) {
+                    continue;
+                }
+                const int *tri = &_tris[3 * t];
+                if ((tri[0] == keep || tri[1] == keep || tri[2] == keep) &&
+                    (tri[0] == gone || tri[1] == gone || tri[2] == gone)) {
+                    continue;   // goes away
+                }
+                vec3 before = face_normal(t, -1, NULL);
+                vec3 after = face_normal(t, ends[e], target);
+                if (dot(before, after) <= 0) {
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void collapse(const Collapse &c) {
+        float *p = position(c.keep);
+        p[0] = (float) c.target[0];
+        p[1] = (float) c.target[1];
+        p[2] = (float) c.target[2];
+        _quadrics[c.keep].add(_quadrics[c.gone]);
+        _removed[c.gone] = 1;
+        _max_distance = std::max(_max_distance, c.distance);
+
+        for (int t : _faces_of[c.gone]) {
+            if (!_alive[t]) {
+                continue;
+            }
+            int *tri = &_tris[3 * t];
+            if (tri[0] == c.keep || tri[1] == c.keep || tri[2] == c.keep) {
+                _alive[t] = 0;
+                --_live;
+                continue;
+            }
+            for (int k = 0; k < 3; ++k) {
+                if (tri[k] == c.gone) {
+                    tri[k] = c.keep;
+                }
+            }
+            _faces_of[c.keep].push_back(t);
+        }
+        _faces_of[c.gone].clear();
+
+        std::vector<int> &faces = _faces_of[c.keep];
+        faces.erase(std::remove_if(faces.begin(), faces.end(), [this](int t) { return !_alive[t]; }), faces.end());
+
+        ++_stamps[c.keep];
+        neighbours(c.keep, _keep_ring);
+        for (int v : _keep_ring) {
+            push(c.keep, v);
+        }
+    }
+
+    float *_positions;
+    const std::vector<char> &_locked;
+
+    std::vector<int> _global;               // local to global vertex numbers
+    std::vector<Quadric> _quadrics;
+    std::vector<std::vector<int> > _faces_of;
+    std::vector<unsigned> _stamps;          // bumped when a vertex moves, to spot stale collapses
+    std::vector<char> _removed;
+    std::vector<int> _tris;
+    std::vector<char> _alive;
+    size_t _live;
+    double _max_distance;
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse> > _heap;
+    std::vector<int> _keep_ring, _gone_ring;
+};
+
+}
+
+void LodChain::clear() {
+    _levels.clear();
+    _center = vec3(0.0, 0.0, 0.0);
+    _radius = 0;
+}
+
+void LodChain::release_geometry() {
+    for (auto &level : _levels) {
+        tracked_vector<float, MEM_LOD>().swap(level.verts);
+        tracked_vector<int, MEM_LOD>().swap(level.tris);
+    }
+}
+
+void LodChain::build(const float *verts, size_t vertex_count, const int *tris, size_t index_count,
+                     ThreadPool &pool, const std::atomic<bool> *cancelled) {
+    clear();
+    if (!vertex_count) {
+        return;
+    }
+
+    vec3 lo(verts[0], verts[1], verts[2]), hi = lo;
+    for (size_t i = 1; i < vertex_count; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            lo[k] = std::min(lo[k], verts[3 * i + k]);
+            hi[k] = std::max(hi[k], verts[3 * i + k]);
+        }
+    }
+    _center = (lo + hi) / 2;
+    _radius = length(hi - _center);
+
+    float error = 0;
+    while (_levels.size() < (size_t) MAX_LEVELS && index_count / 3 > MIN_TRIANGLES &&
+           !(cancelled && *cancelled)) {
+        LodLevel next;
+        float level_error = simplify(verts, vertex_count, tris, index_count, _levels.size() % 2 == 1, pool, next);
+        if (next.tris.size() > (1 - MIN_REDUCTION) * index_count) {
+            break;
+        }
+
+        // each level is simplified from the one before, and its error is
+        // against that one; the sum bounds how far it is from the original
+        error += level_error;
+        next.error = error;
+        _levels.push_back(std::move(next));
+        verts = _levels.back().verts.data();
+        vertex_count = _levels.back().verts.size() / 3;
+        tris = _levels.back().tris.data();
+        index_count = _levels.back().tris.size();
+    }
+}
+
+float LodChain::simplify(const float *verts, size_t vertex_count, const int *tris, size_t index_count,
+                         bool shifted, ThreadPool &pool, LodLevel &next) const {
+    size_t face_count = index_count / 3;
+    std::vector<float> positions(verts, verts + 3 * vertex_count);
+
+    // the grid, a bit larger than the mesh so that no centroid falls on its
+    // far side
+    vec3 lo(verts[0], verts[1], verts[2]), hi = lo;
+    for (size_t i = 1; i < vertex_count; ++i) {
+        for (int k = 0; k < 3; ++k) {
+            lo[k] = std::min(lo[k], verts[3 * i + k]);
+            hi[k] = std::max(hi[k], verts[3 * i + k]);
+        }
+    }
+    int cells = (int) std::cbrt((double) face_count / PARTITION_TRIANGLES + 0.5);
+    cells = std::max(1, std::min(cells, 16));
+    vec3 cell_size = (hi - lo) * (1.0001f / cells);
+    for (int k = 0; k < 3; ++k) {
+        cell_size[k] = std::max(cell_size[k], 1e-20f);
+    }
+    float shift = shifted ? 0.5f : 0.0f;
+    int cells_per_axis = cells + (shifted ? 1 : 0);
+
+    std::vector<int> cell_of(face_count);
+    std::vector<int> owner(vertex_count, -1);      // the one cell using a vertex, -2 if several
+    for (size_t f = 0; f < face_count; ++f) {
+        int index[3];
+        for (int k = 0; k < 3; ++k) {
+            float centroid = (verts[3 * tris[3 * f] + k] + verts[3 * tris[3 * f + 1] + k] +
+                              verts[3 * tris[3 * f + 2] + k]) / 3;
+            index[k] = (int) ((centroid - lo[k]) / cell_size[k] + shift);
+            index[k] = std::max(0, std::min(index[k], cells_per_axis - 1));
+        }
+        int cell = (index[2] * cells_per_axis + index[1]) * cells_per_axis + index[0];
+        cell_of[f] = cell;
+        for (int k = 0; k < 3; ++k) {
+            int &o = owner[tris[3 * f + k]];
+            o = o == -1 || o == cell ? cell : -2;
+        }
+    }
+
+    std::vector<char> locked(vertex_count, 0);
+    for (size_t v = 0; v < vertex_count; ++v) {
+        locked[v] = owner[v] == -2;
+    }
+
+    // the ends of edges with a single triangle are on the open border
+    std::vector<unsigned long long> edges;
+    edges.reserve(index_count);
+    for (size_t f = 0; f < face_count; ++f) {
+        for (int k = 0; k < 3; ++k) {
+            unsigned long long a = (unsigned) tris[3 * f + k], b = (unsigned) tris[3 * f + (k + 1) % 3];
+            edges.push_back(a < b ? a << 32 | b : b << 32 | a);
+        }
+    }
+    std::sort(edges.begin(), edges.end());
+    for (size_t i = 0; i < edges.size();) {
+        size_t j = i + 1;
+        while (j < edges.size() && edges[j] == edges[i]) {
+            ++j;
+        }
+        if (j - i == 1) {
+            locked[edges[i] >> 32] = 1;
+            locked[edges[i] & 0xffffffffu] = 1;
+        }
+        i = j;
+    }
+
+    std::vector<std::vector<size_t> > faces(cells_per_axis * cells_per_axis * cells_per_axis);
+    for (size_t f = 0; f < face_count; ++f) {
+        faces[cell_of[f]].push_back(f);
+    }
+    faces.erase(std::remove_if(faces.begin(), faces.end(), [](const std::vector<size_t> &cell) {
+        return cell.empty();
+    }), faces.end());
+
+    // each cell moves only the vertices it owns, so the cells don't get in
+    // each other's way; their output goes back together in cell order
+    std::vector<std::vector<int> > cell_tris(faces.size());
+    std::vector<double> cell_error(faces.size(), 0.0);
+    pool.run(faces.size(), [&](size_t cell) {
+        PartitionSimplifier simplifier(positions.data(), locked);
+        simplifier.init(faces[cell], tris);
+        cell_error[cell] = simplifier.run(faces[cell].size() / 2, cell_tris[cell]);
+    });
+
+    // keep only the vertices still in use
+    std::vector<int> remap(vertex_count, -1);
+    next.verts.clear();
+    next.tris.clear();
+    double error = 0;
+    for (size_t cell = 0; cell < faces.size(); ++cell) {
+        error = std::max(error, cell_error[cell]);
+        for (int v : cell_tris[cell]) {
+            if (remap[v] < 0) {
+                remap[v] = (int) (next.verts.size() / 3);
+                next.verts.insert(next.verts.end(), &positions[3 * v], &positions[3 * v] + 3);
+            }
+            next.tris.push_back(remap[v]);
+        }
+    }
+
+    return (float) error;
+}
+
+int LodChain::select(float distance, float fovy, int viewport_height, float max_pixels) const {
+    distance = std::max(distance, 1e-6f);
+    float pixels_per_unit = viewport_height / (2 * distance * tanf(DegreesToRadians * fovy / 2));
+
+    int level = 0;
+    while (level < (int) _levels.size() && _levels[level].error * pixels_per_unit <= max_pixels) {
+        ++level;
+    }
+    return level;
+}
+
+void LodChain::expand(size_t level, vec4 *positions, vec4 *normals) const {
+    const LodLevel &lod = _levels[level];
+    std::vector<vec3> vert_norms(lod.verts.size() / 3, vec3(0.0, 0.0, 0.0));
+    for (size_t f = 0; f + 2 < lod.tris.size(); f += 3) {
+        vec3 v[3];
+        for (int k = 0; k < 3; ++k) {
+            const float *p = &lod.verts[3 * lod.tris[f + k]];
+            v[k] = vec3(p[0], p[1], p[2]);
+            positions[f + k] = vec4(v[k], 1.0);
+        }
+        vec3 n = cross(v[1] - v[0], v[2] - v[1]);
+        float len = length(n);
+        if (len > 0) {
+            for (int k = 0; k < 3; ++k) {
+                vert_norms[lod.tris[f + k]] += n / len;
+            }
+        }
+    }
+    for (size_t i = 0; i < lod.tris.size(); ++i) {
+        vec3 n = vert_norms[lod.tris[i]];
+        float len = length(n);
+        normals[i] = len > 0 ? vec4(n / len, 0.0) : vec4(0.0, 0.0, 1.0, 0.0);
+    }
+}
+
+bool LodChain::load(const std::string &path, unsigned long long key) {
+    clear();
+    std::ifstream in(path.c_str(), std::ios::binary);
+    if (!in.good()) {
+        return false;
+    }
+
+    char magic[8];
+    unsigned long long stored_key = 0;
+    unsigned level_count = 0;
+    float sphere[4];
+    in.read(magic, sizeof(magic));
+    in.read((char *) &stored_key, sizeof(stored_key));
+    in.read((char *) sphere, sizeof(sphere));
+    in.read((char *) &level_count, sizeof(level_count));
+    if (!in || memcmp(magic, LOD_CACHE_MAGIC, sizeof(magic)) != 0 || stored_key != key ||
+        level_count > (unsigned) MAX_LEVELS) {
+        return false;
+    }
+
+    for (unsigned i = 0; i < level_count; ++i) {
+        LodLevel level;
+        unsigned long long floats = 0, indices = 0;
+        in.read((char *) &level.error, sizeof(level.error));
+        in.read((char *) &floats, sizeof(floats));
+        in.read((char *) &indices, sizeof(indices));
+        if (!in || floats % 3 || indices % 3 || floats > (1ULL << 34) || indices > (1ULL << 34)) {
+            clear();
+            return false;
+        }
+        level.verts.resize(floats);
+        level.tris.resize(indices);
+        in.read((char *) level.verts.data(), sizeof(float) * floats);
+        in.read((char *) level.tris.data(), sizeof(int) * indices);
+        if (!in) {
+            clear();
+            return false;
+        }
+        for (int v : level.tris) {
+            if (v < 0 || (unsigned long long) v >= floats / 3) {
+                clear();
+                return false;
+            }
+        }
+        _levels.push_back(std::move(level));
+    }
+
+    _center = vec3(sphere[0], sphere[1], sphere[2]);
+    _radius = sphere[3];
+    return true;
+}
+
+bool LodChain::save(const std::string &path, unsigned long long key) const {
+    // write to the side and rename, so a concurrent reader never sees half
+    // a file
+    std::string tmp = path + ".tmp";
+    std::ofstream out(tmp.c_str(), std::ios::binary);
+    if (!out.good()) {
+        return false;
+    }
+
+    unsigned level_count = (unsigned) _levels.size();
+    float sphere[4] = {_center.x, _center.y, _center.z, _radius};
+    out.write(LOD_CACHE_MAGIC, sizeof(LOD_CACHE_MAGIC));
+    out.write((const char *) &key, sizeof(key));
+    out.write((const char *) sphere, sizeof(sphere));
+    out.write((const char *) &level_count, sizeof(level_count));
+    for (auto &level : _levels) {
+        unsigned long long floats = level.verts.size(), indices = level.tris.size();
+        out.write((const char *) &level.error, sizeof(level.error));
+        out.write((const char *) &floats, sizeof(floats));
+        out.write((const char *) &indices, sizeof(indices));
+        out.write((const char *) level.verts.data(), sizeof(float) * floats);
+        out.write((const char *) level.tris.data(), sizeof(int) * indices);
+    }
+    out.close();
+
+    if (!out.good()) {
+        remove(tmp.c_str());
+        return false;
+    }
+    return rename(tmp.c_str(), path.c_str()) == 0;
+}
+
+LodBuilder::LodBuilder()
+        : _done(false), _cancelled(false), _from_cache(false), _build_ms(0) {
+}
+
+LodBuilder::~LodBuilder() {
+    cancel();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void LodBuilder::start(const std::string &model_path, tracked_vector<float, MEM_PARSER> &&verts,
+                       tracked_vector<int, MEM_PARSER> &&tris) {
+    cancel();
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    _cancelled = false;
+    _model_path = model_path;
+    _verts = std::move(verts);
+    _tris = std::move(tris);
+    _done = false;
+    _thread = std::thread(&LodBuilder::run, this);
+}
+
+bool LodBuilder::finished() {
+    if (!_done) {
+        return false;
+    }
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    return true;
+}
+
+void LodBuilder::take(LodChain &chain) {
+    chain = std::move(_chain);
+    _chain.clear();
+}
+
+void LodBuilder::cancel() {
+    _cancelled = true;
+}
+
+void LodBuilder::run() {
+    auto start = std::chrono::steady_clock::now();
+
+    unsigned long long key = 0;
+    std::string cache_path = model_cache_file(_model_path, "lod", key);
+    _from_cache = !cache_path.empty() && _chain.load(cache_path, key);
+    if (!_from_cache) {
+        // a pool of its own: the one of the render thread is busy every frame
+        ThreadPool pool;
+        _chain.build(_verts.data(), _verts.size() / 3, _tris.data(), _tris.size(), pool, &_cancelled);
+        if (!_cancelled && !cache_path.empty() && !_chain.save(cache_path, key)) {
+            std::cerr << "Can't write levels of detail to " << cache_path << std::endl;
+        }
+    }
+
+    // the mesh is on the GPU already; this was the last copy
+    tracked_vector<float, MEM_PARSER>().swap(_verts);
+    tracked_vector<int, MEM_PARSER>().swap(_tris);
+
+    _build_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _done = true;
+}
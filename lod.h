@@ -0,0 +1,144 @@
+#ifndef GLRENDER_LOD_H
+#define GLRENDER_LOD_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amath.h"
+#include "memstats.h"
+#include "threadpool.h"
+
+// One simplified version of a mesh, as indexed triangles.
+struct LodLevel {
+    tracked_vector<float, MEM_LOD> verts;   // x, y, z
+    tracked_vector<int, MEM_LOD> tris;
+    // distance of the surface from the original, in model units, at most: the
+    // sum over this level and those before of the largest root mean square
+    // distance (by area) that a collapse left around a vertex
+    float error;
+};
+
+// A chain of ever coarser versions of a triangle mesh, each with about half
+// the triangles of the one before, made by quadric error edge collapses
+// (Garland and Heckbert).
+//
+// The mesh is cut into cells of a grid that are simplified on their own, in
+// parallel; vertices that cells share stay where they are, and so do those
+// on the open border of the mesh, so the pieces still fit. The grid moves by
+// half a cell from one level to the next, so that the seams it leaves behind
+// get simplified in the level after.
+class LodChain {
+public:
+    static const int MAX_LEVELS = 8;
+
+    // fills levels() for the mesh; stops early if `cancelled` becomes true
+    void build(const float *verts, size_t vertex_count, const int *tris, size_t index_count, ThreadPool &pool,
+               const std::atomic<bool> *cancelled = NULL);
+
+    void clear();
+
+    // frees the vertices and triangles of the levels once they are on the
+    // GPU, keeping what select() needs
+    void release_geometry();
+
+    // the chain as written by save() for a model identified by `key`; false
+    // (and an empty chain) if there isn't one
+    bool load(const std::string &path, unsigned long long key);
+
+    bool save(const std::string &path, unsigned long long key) const;
+
+    // the coarsest level whose error, seen from `distance` with a vertical
+    // field of view of `fovy` degrees over `viewport_height` pixels, covers
+    // at most `max_pixels`. 0 is the original mesh, i is levels()[i - 1].
+    int select(float distance, float fovy, int viewport_height, float max_pixels) const;
+
+    // the triangles of levels()[level] as separate vertices with smooth
+    // normals, the way OBJ meshes are drawn; each array takes
+    // levels()[level].tris.size() elements
+    void expand(size_t level, vec4 *positions, vec4 *normals) const;
+
+    inline const std::vector<LodLevel> &levels() const {
+        return _levels;
+    }
+
+    // bounding sphere of the mesh, for the distance to select() by
+    inline const vec3 &center() const {
+        return _center;
+    }
+
+    inline float radius() const {
+        return _radius;
+    }
+
+private:
+    // triangles per cell of the partition grid, roughly
+    static const size_t PARTITION_TRIANGLES = 16384;
+
+    // a level stops the chain unless it drops at least this share of the
+    // triangles of the one before
+    static constexpr float MIN_REDUCTION = 0.15f;
+
+    static const size_t MIN_TRIANGLES = 256;
+
+    // simplifies one level down to about half, into `next`; returns the
+    // largest error of the collapses made
+    float simplify(const float *verts, size_t vertex_count, const int *tris, size_t index_count, bool shifted,
+                   ThreadPool &pool, LodLevel &next) const;
+
+    std::vector<LodLevel> _levels;
+    vec3 _center;
+    float _radius;
+};
+
+// Builds the chain of an OBJ mesh on a thread of its own once the model is
+// loaded, or reads it from the cache directory when it was built before for
+// the same file.
+class LodBuilder {
+public:
+    LodBuilder();
+
+    ~LodBuilder();
+
+    LodBuilder(const LodBuilder &) = delete;
+
+    LodBuilder &operator=(const LodBuilder &) = delete;
+
+    // takes over the mesh as the loader parsed it; a build still running is
+    // cancelled
+    void start(const std::string &model_path, tracked_vector<float, MEM_PARSER> &&verts,
+               tracked_vector<int, MEM_PARSER> &&tris);
+
+    // true once the chain is ready to take(). Never blocks.
+    bool finished();
+
+    void take(LodChain &chain);
+
+    void cancel();
+
+    inline bool from_cache() const {
+        return _from_cache;
+    }
+
+    // time spent building or reading the chain
+    inline double build_ms() const {
+        return _build_ms;
+    }
+
+private:
+    void run();
+
+    std::string _model_path;
+    tracked_vector<float, MEM_PARSER> _verts;
+    tracked_vector<int, MEM_PARSER> _tris;
+    LodChain _chain;
+
+    std::thread _thread;
+    std::atomic<bool> _done;
+    std::atomic<bool> _cancelled;
+    bool _from_cache;
+    double _build_ms;
+};
+
+#endif //GLRENDER_LOD_H
@@ -17,10 +17,36 @@
 
 #endif
 
+#include <chrono>
+#include <thread>
 #include <vector>
 #include "amath.h"
 #include "misc.h"
 #include "beziersurface.h"
+#include "frametimer.h"
+#include "camerapath.h"
+#include "memstats.h"
+#include "arena.h"
+#include "loader.h"
+#include "streambuffer.h"
+#include "shadervariants.h"
+#include "renderstate.h"
+#include "frustum.h"
+#include "meshbvh.h"
+#include "patchculler.h"
+#include "meshlets.h"
+#include "threadpool.h"
+#include "lod.h"
+#include "gpupatches.h"
+#include "computetessellator.h"
+#include "patchfile.h"
+#include "meshfile.h"
+#include "bricks.h"
+#include "filewatcher.h"
+#include "patchweld.h"
+#include "quantize.h"
+#include "scene.h"
+#include "tessverify.h"
 
 // type alias
 typedef amath::vec4 point4;
@@ -43,6 +69,25 @@ bool changed_sampling_resolution = false;
 int sampling_resolution = 1;
 
 bool bezier_file = false;
+std::string model_file;
+std::string save_patches_file;  // converts the model to the binary patch format
+float dedupe_epsilon = 0;       // OBJ vertices closer than this are welded
+std::string save_mesh_file;     // converts the model to the compressed mesh format
+int mesh_bits = 16;             // per position coordinate in a mesh file
+std::string save_bricks_file;   // converts the model to bricks for drawing out of core
+
+// frame statistics, shown with 'o' and written out on exit
+FrameTimer frame_timer;
+bool show_overlay = false;
+bool print_stats = false;
+std::string stats_csv_file;
+
+// camera trajectory recording and benchmark replay
+CameraPath camera_path;
+std::string record_file;
+bool replaying = false;
+long replay_frames = 0;     // total frames of the replay
+long replay_frame = 0;      // next frame to render
 
 // light positions (needed for shading) and the material spec:
 vec4 light_position = vec4(100.0, 100.0, 100.0, 1.0);
@@ -56,139 +101,671 @@ vec4 material_specular = vec4(1.0, 0.8, 0.0, 1.0);
 float material_shininess = 100.0;
 
 // variables for opengl
-GLuint buffers[2];
-GLint pos, ctm, ptm, lpos, lamb, ldiff, lspec, mamb, mdiff, mspec, ms;
+GLuint buffers[2];          // vertex positions, vertex normals
+size_t buffer_capacity = 0; // vertices the buffers have room for
+
+// the vertical field of view of the projection, in degrees
+const float FIELD_OF_VIEW = 40.0;
+
+// once loaded, re-tessellated Bezier geometry is written straight into a
+// mapped stream buffer instead of going through vertices/norms and buffers[]
+StreamBuffer stream_buffer;
+bool streaming = false;
 GLuint program; //shaders
 
+// camera, light and material uniforms, shared by all programs
+RenderState render_state;
+mat4 projection;
+
+// frustum culling of OBJ meshes, once loaded: the visible nodes of the
+// hierarchy are drawn from an index buffer in one multi-draw call
+MeshBvh mesh_bvh;
+GLuint index_buffer = 0;
+bool culling = true;
+std::vector<GLsizei> draw_counts;
+std::vector<const GLvoid *> draw_offsets;
+MeshBvh::CullStats cull_stats = {0, 0, 0};
+size_t culled_frames = 0;
+size_t visible_clusters_total = 0;
+size_t culled_clusters_total = 0;
+
+// within the clusters in view, meshlets off screen or facing away are
+// dropped as well, tested on the pool's threads
+MeshletSet meshlets;
+ThreadPool cull_pool;
+bool meshlet_culling = true;
+MeshletSet::Stats meshlet_stats = {0, 0, 0, 0, 0};
+double cull_us = 0;                     // time of the last culling pass
+size_t submitted_triangles_total = 0;
+
+// levels of detail of OBJ meshes, built in the background (or read from the
+// cache) once the model is in. Far away a simplified level is drawn whole
+// instead of the culled full mesh, as long as its error stays under
+// LOD_PIXEL_ERROR pixels on screen. Each level is in lod_buffers as separate
+// triangles from lod_firsts[level - 1].
+LodBuilder lod_builder;
+LodChain lod_chain;
+bool building_lods = false;
+bool auto_lod = true;
+GLuint lod_buffers[2];      // vertex positions, vertex normals
+std::vector<GLint> lod_firsts;
+std::vector<GLsizei> lod_counts;
+int lod_level = 0;          // level drawn in the last frame, 0 is the full mesh
+size_t lod_frames = 0;      // frames drawn from a simplified level
+const float LOD_PIXEL_ERROR = 1.0;
+
+// patch culling of Bezier models, once loaded: only the patches in view are
+// tessellated, each into its own slot of the vertex buffers, and drawn in one
+// multi-draw call. With backface_culling, culling also rejects patches (and
+// meshlets) facing away from the camera. It is off unless asked for: open
+// surfaces show their inside, and GL draws it, so rejecting it would cut
+// holes.
+PatchCuller patch_culler;
+bool backface_culling = false;
+std::vector<size_t> missing_patches;
+size_t patch_frames = 0;
+size_t visible_patches_total = 0;
+size_t tessellated_patches_total = 0;
+
+// automatic resolution of Bezier models, toggled with 'a': each patch in view
+// gets a resolution from its size on screen. Changes are made within
+// tessellation_budget_ms per frame, the rest wait for the next frames;
+// patches coming into view are always tessellated, or there would be holes.
+bool auto_resolution = false;
+double tessellation_budget_ms = 2.0;
+std::vector<int> wanted_samples;
+std::vector<size_t> resampled_patches;
+size_t resampled_last_frame = 0;
+size_t deferred_last_frame = 0;
+size_t resampled_patches_total = 0;
+
+// the tessellation shader path of Bezier models, toggled with 't': only the
+// control points are on the GPU, and the shaders evaluate the patches at the
+// sampling resolution, or with automatic resolution at a level per patch edge
+// for triangles about TRIANGLE_PIXELS across. Culling still picks the patches
+// to draw, but nothing is tessellated or uploaded on the CPU.
+GpuPatches gpu_patches;
+bool gpu_tessellation = false;
+size_t gpu_patch_frames = 0;
+
+// compute shader tessellation of Bezier models, toggled with 'g': the same
+// triangles as on the CPU, written by one dispatch per frame (or resolution
+// change) straight into the vertex buffers the triangle paths draw from
+ComputeTessellator compute_tessellator;
+bool compute_tessellation = false;
+
+// --verify-tessellation: once the patches are in, what the GPU tessellation
+// paths make is compared with the CPU (see tessverify.h) and the program
+// exits, with -1 if a point is further off than the tolerances. Normals are
+// allowed more: where the tangents are short, the two evaluators' rounding
+// turns them further.
+bool verifying_tessellation = false;
+const float POSITION_TOLERANCE = 1e-4f;     // of the patches' size
+const float NORMAL_TOLERANCE = 1e-3f;
+
+// Bezier models welded into one indexed mesh, toggled with 'w': one vertex
+// per grid point at the sampling resolution, shared with the neighbouring
+// patch along a seam and with its normals averaged there. Culling still
+// picks the patches to draw.
+WeldedPatches welded_patches;
+bool welding = false;
+float weld_tolerance = 0;       // 0: picked from the size of the model
+WeldedMesh::Stats weld_stats;
+size_t welded_frames = 0;
+
+// positions quantized to 16 bits over the model's bounding box, toggled with
+// 'p': the full detail OBJ mesh (with --quantize, which keeps a copy of its
+// positions in quantized_buffer) and the welded Bezier mesh. They are drawn
+// with the quantized variant of the shading mode.
+bool quantizing = false;
+GLuint quantized_buffer = 0;
+PositionQuantization obj_quantization;
+
+// meshes bigger than memory, drawn out of core from a brick file (see
+// bricks.h) through brick_budget bytes of GPU memory. The bricks in view from
+// where the orbit will be BRICK_PREFETCH_FRAMES from now, at the speed of the
+// last frame, are read ahead.
+BrickStreamer brick_streamer;
+bool brick_file = false;
+size_t brick_budget = 256 << 20;
+const float BRICK_PREFETCH_FRAMES = 30;
+float last_thetax = 90.0, last_thetay = 0.0, last_radius = 8.0;
+
+// a scene file, of meshes drawn in as many copies as it places (see
+// scene.h), in a draw call per mesh
+Scene scene;
+bool scene_file = false;
+
+// shading modes, cycled with 'l'; each one is its own specialized program
+struct ShadingMode {
+    const char *name;
+    int features;
+    int light_count;
+};
+
+const ShadingMode shading_modes[] = {
+        {"per-fragment Blinn-Phong", SHADER_SPECULAR,                              1},
+        {"per-fragment diffuse",     0,                                            1},
+        {"per-vertex Blinn-Phong",   SHADER_PER_VERTEX_LIGHTING | SHADER_SPECULAR, 1},
+        {"per-vertex diffuse",       SHADER_PER_VERTEX_LIGHTING,                   1},
+        {"unlit",                    0,                                            0},
+};
+const int SHADING_MODE_COUNT = sizeof(shading_modes) / sizeof(shading_modes[0]);
+
+ShaderVariants shader_variants("vshader.glsl", "fshader.glsl", "lighting.glsl", "tcshader.glsl", "teshader.glsl");
+int shading_mode = 0;
+
 // added bezier support
 std::vector<BezierSurface> surfaces;
 
-// initialize all dynamic data
-// compute all these norms
-// The easiest way to compute these normals is as follows:
-// 1. make an array of normals that contain the normals for each triangle: e.g. tri_norms[] (computed via crossproduct)
-// 2. make an array of vectors, one for each unique vertex, each initialized to the zero vector, e.g. vert_norms[]
-// 3. go through the array of triangle vertex ids:
-//  if triangle i has vertex j, add tri_norms[i] to vert_nroms[j] (you will be adding each triangle's normal to 3 different vertex normals)
-// 4. when done, normalize all the vert_norms.
-void init_obj_vertices_norm(const std::string &file) {
-    std::vector<int> tris;
-    std::vector<float> verts;
+// temporaries of re-tessellation. They are reset rather than freed, so that
+// after the first few resolution changes no pass allocates.
+LinearArena tess_arena(MEM_TESSELLATOR);
+SizeClassPool staging_pool(MEM_UPLOAD_STAGING);
+size_t reload_heap_allocations = 0;    // heap allocations of the last reload_vertices_norm
+
+// the model is loaded in the background while the window is already up
+ModelLoader loader;
+std::chrono::steady_clock::time_point start_time;
+bool loading = false;
+double first_frame_ms = -1.0;   // time to the first frame showing any geometry
+double load_ms = -1.0;          // time until the whole model was on the GPU
+double shader_ms = -1.0;        // time to build (or fetch from the cache) the shader program
+
+// bytes moved into the vertex buffers per idle call while loading, so that
+// the window stays responsive
+const size_t UPLOAD_BUDGET = 32 << 20;
+
+// the model file is watched (see filewatcher.h) and reloaded when it changes.
+// Bezier patches are read again at once and only the ones that changed go to
+// the GPU; OBJ meshes are loaded again in the background, the old one drawn
+// until the new one is in and swapped in whole.
+FileWatcher model_watcher;
+bool watching = true;
+const int WATCH_INTERVAL_MS = 20;
+bool model_changed = false;     // a reload waiting for the load to finish
+bool reloading = false;
+std::vector<GeometryChunk> reload_chunks;   // held back until the reload is done
+std::chrono::steady_clock::time_point reload_start;
+size_t reloads = 0;
+size_t reloaded_patches = 0;    // that changed in the last reload
+double reload_ms = -1.0;        // from noticing the change to the new model on the GPU
+
+void free_vertices_norm() {
+    staging_pool.release(vertices, sizeof(point4) * NumVertices);
+    staging_pool.release(norms, sizeof(vec4) * NumVertices);
+    vertices = nullptr;
+    norms = nullptr;
+}
+
+// (re)allocate the vertex and normal arrays that are uploaded to the GPU
+void alloc_vertices_norm(int num_vertices) {
+    free_vertices_norm();
 
-    parseObjFile(file, tris, verts);
+    NumVertices = num_vertices;
+    vertices = static_cast<point4 *>(staging_pool.acquire(sizeof(point4) * NumVertices));
+    norms = static_cast<vec4 *>(staging_pool.acquire(sizeof(vec4) * NumVertices));
+}
 
-    NumVertices = (int) tris.size();
-    vertices = new point4[NumVertices];
-    norms = new vec4[NumVertices];                      // norms per vertex per triangle
+// number of vertices the surfaces tessellate into at the current resolution
+int count_vertices_norm() {
+    int points_num = 0;
+    for (auto &surf : surfaces) {
+        points_num += surf.triangle_vertex_count(sampling_resolution);
+    }
+    return points_num;
+}
 
-    std::vector<vec4> tri_norms(tris.size() / 3);       // norms per triangle
-    std::vector<vec4> vert_norms(verts.size() / 3);     // norms per vertex (vertices are unique)
+// tessellate all surfaces into out_vertices and out_norms, which must have
+// room for count_vertices_norm() elements
+void reload_vertices_norm(point4 *out_vertices, vec4 *out_norms) {
+    size_t heap_allocations_before = heap_allocation_count();
 
-    int n = NumVertices / 3;
-    for (int i = 0; i < n; ++i) {
-        // get the vertices
-        vertices[3 * i] = point4(verts[3 * tris[3 * i]],
-                                 verts[3 * tris[3 * i] + 1],
-                                 verts[3 * tris[3 * i] + 2], 1.0);
-        vertices[3 * i + 1] = point4(verts[3 * tris[3 * i + 1]],
-                                     verts[3 * tris[3 * i + 1] + 1],
-                                     verts[3 * tris[3 * i + 1] + 2], 1.0);
-        vertices[3 * i + 2] = point4(verts[3 * tris[3 * i + 2]],
-                                     verts[3 * tris[3 * i + 2] + 1],
-                                     verts[3 * tris[3 * i + 2] + 2], 1.0);
+    int vn_index = 0;
 
-        tri_norms[i] = normalize(
-                vec4(cross(vertices[3 * i + 1] - vertices[3 * i], vertices[3 * i + 2] - vertices[3 * i + 1]), 0.0));
-        vert_norms[tris[3 * i]] += tri_norms[i];
-        vert_norms[tris[3 * i + 1]] += tri_norms[i];
-        vert_norms[tris[3 * i + 2]] += tri_norms[i];
+    for (auto &surf : surfaces) {
+        surf.eval_triangles(sampling_resolution, out_vertices + vn_index, out_norms + vn_index, tess_arena);
+        vn_index += surf.triangle_vertex_count(sampling_resolution);
     }
 
-    for (size_t i = 0; i < vert_norms.size(); i++) {
-        vert_norms[i] = normalize(vert_norms[i]);
+    tess_arena.reset();
+    reload_heap_allocations = heap_allocation_count() - heap_allocations_before;
+}
+
+
+// point the two shader attributes at their buffers
+void bind_vertex_attributes(GLuint position_buffer, size_t position_offset, GLuint norm_buffer, size_t norm_offset) {
+    // this time, we are sending TWO attributes through: the position of each
+    // transformed vertex, and its normal. Every shader variant has them at
+    // the same locations.
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+
+    // the vPosition attribute is a series of 4-vecs of floats
+    glBindBuffer(GL_ARRAY_BUFFER, position_buffer);
+    glVertexAttribPointer(ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(position_offset));
+
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+
+    // and so is the vNorm attribute
+    glBindBuffer(GL_ARRAY_BUFFER, norm_buffer);
+    glVertexAttribPointer(ATTRIB_NORMAL, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(norm_offset));
+}
+
+
+// make sure both vertex buffers hold at least num_vertices. Growing keeps the
+// first `keep` vertices, copied over on the GPU.
+void reserve_vertex_buffers(size_t num_vertices, size_t keep) {
+    if (num_vertices <= buffer_capacity) {
+        return;
     }
 
-    for (int i = 0; i < n; i++) {
-        norms[3 * i] = vert_norms[tris[3 * i]];
-        norms[3 * i + 1] = vert_norms[tris[3 * i + 1]];
-        norms[3 * i + 2] = vert_norms[tris[3 * i + 2]];
+    size_t capacity = std::max(num_vertices, 2 * buffer_capacity);
+    GLuint grown[2];
+    glGenBuffers(2, grown);
+    for (int i = 0; i < 2; ++i) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, grown[i]);
+        glBufferData(GL_COPY_WRITE_BUFFER, sizeof(vec4) * capacity, NULL, GL_STATIC_DRAW);
+        if (keep) {
+            glBindBuffer(GL_COPY_READ_BUFFER, buffers[i]);
+            glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, sizeof(vec4) * keep);
+        }
     }
+    if (buffer_capacity) {
+        glDeleteBuffers(2, buffers);
+    }
+
+    mem_track_free(MEM_GPU_BUFFERS, 2 * sizeof(vec4) * buffer_capacity);
+    mem_track_alloc(MEM_GPU_BUFFERS, 2 * sizeof(vec4) * capacity);
+    buffers[0] = grown[0];
+    buffers[1] = grown[1];
+    buffer_capacity = capacity;
+
+    bind_vertex_attributes(buffers[0], 0, buffers[1], 0);
 }
 
-void reload_vertices_norm() {
-    int points_num = 0;
-    for (auto &surf : surfaces) {
-        points_num += (2 * surf.u_deg() * sampling_resolution) * ((surf.v_deg() * sampling_resolution)) * 3;
+
+void release_vertex_buffers() {
+    if (buffer_capacity) {
+        glDeleteBuffers(2, buffers);
+        mem_track_free(MEM_GPU_BUFFERS, 2 * sizeof(vec4) * buffer_capacity);
+        buffer_capacity = 0;
     }
-    NumVertices = points_num;
+}
+
 
-    if (vertices) {
-        delete[] vertices;
+// send the vertices and norms arrays to the GPU
+void upload_vertices_norm() {
+    reserve_vertex_buffers(NumVertices, 0);
+    if (streaming) {
+        bind_vertex_attributes(buffers[0], 0, buffers[1], 0);
+        streaming = false;
     }
-    if (norms) {
-        delete[] norms;
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(point4) * NumVertices, vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(vec4) * NumVertices, norms);
+
+    frame_timer.add_uploaded_bytes(sizeof(point4) * NumVertices + sizeof(vec4) * NumVertices);
+    frame_timer.set_triangles(NumVertices / 3);
+}
+
+
+// whether patches go to compute_tessellator instead of the CPU
+bool tessellating_on_gpu() {
+    return compute_tessellation && !compute_tessellator.empty();
+}
+
+
+// re-tessellate the surfaces with the compute shader, into the vertex buffers
+void reload_compute() {
+    int num_vertices = count_vertices_norm();
+    reserve_vertex_buffers(num_vertices, 0);
+    if (streaming) {
+        bind_vertex_attributes(buffers[0], 0, buffers[1], 0);
+        streaming = false;
     }
 
-    vertices = new point4[NumVertices];
-    norms = new point4[NumVertices];
+    GLint first = 0;
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+        compute_tessellator.add(i, sampling_resolution, first);
+        first += surfaces[i].triangle_vertex_count(sampling_resolution);
+    }
+    size_t bytes = compute_tessellator.dispatch(buffers[0], buffers[1]);
+    NumVertices = num_vertices;
 
-    std::vector<vec4> points_vec;
-    std::vector<vec4> norm_vec;
+    frame_timer.add_uploaded_bytes(bytes);
+    frame_timer.set_triangles(NumVertices / 3);
+}
 
-    int vn_index = 0;
 
-    for (auto &surf : surfaces) {
-        surf.eval_surface(sampling_resolution, points_vec, norm_vec);
+// weld the surfaces at the current resolution and upload the mesh
+void weld_surfaces() {
+    WeldedMesh mesh;
+    weld_patches(surfaces, sampling_resolution, weld_tolerance, cull_pool, mesh);
+    welded_patches.upload(mesh, sampling_resolution, quantizing);
+    weld_stats = mesh.stats;
+    frame_timer.add_uploaded_bytes(welded_patches.bytes());
+}
 
-        int u_sample_num = sampling_resolution * surf.u_deg() + 1;
-        int v_sample_num = sampling_resolution * surf.v_deg() + 1;
 
-        for (int i = 0; i < v_sample_num - 1; ++i) {
-            for (int j = 0; j < u_sample_num - 1; ++j) {
-                vec4 tri1_v1 = points_vec[i * u_sample_num + j];
-                vec4 tri1_v2 = points_vec[(i + 1) * u_sample_num + j + 1];
-                vec4 tri1_v3 = points_vec[(i + 1) * u_sample_num + j];
+// re-tessellate the surfaces directly into GPU memory
+void reload_stream_buffer() {
+    if (tessellating_on_gpu()) {
+        reload_compute();
+        return;
+    }
 
-                vec4 tri2_v1 = tri1_v2;
-                vec4 tri2_v2 = tri1_v1;
-                vec4 tri2_v3 = points_vec[i * u_sample_num + j + 1];
+    int num_vertices = count_vertices_norm();
+    size_t bytes = (sizeof(point4) + sizeof(vec4)) * num_vertices;
+    void *mapped = num_vertices ? stream_buffer.map(bytes) : NULL;
 
-                vec4 tri1_n1 = norm_vec[i * u_sample_num + j];
-                vec4 tri1_n2 = norm_vec[(i + 1) * u_sample_num + j + 1];
-                vec4 tri1_n3 = norm_vec[(i + 1) * u_sample_num + j];
+    if (!mapped) {
+        // no mapping, go the long way through the staging arrays
+        alloc_vertices_norm(num_vertices);
+        reload_vertices_norm(vertices, norms);
+        upload_vertices_norm();
+        return;
+    }
+
+    point4 *mapped_vertices = static_cast<point4 *>(mapped);
+    vec4 *mapped_norms = reinterpret_cast<vec4 *>(mapped_vertices + num_vertices);
+    reload_vertices_norm(mapped_vertices, mapped_norms);
+    stream_buffer.commit();
+    NumVertices = num_vertices;
+
+    bind_vertex_attributes(stream_buffer.buffer(), stream_buffer.offset(),
+                           stream_buffer.buffer(), stream_buffer.offset() + sizeof(point4) * num_vertices);
+    if (!streaming) {
+        // the geometry from loading is not needed anymore
+        free_vertices_norm();
+        release_vertex_buffers();
+        streaming = true;
+    }
 
-                vec4 tri2_n1 = tri1_n2;
-                vec4 tri2_n2 = tri1_n1;
-                vec4 tri2_n3 = norm_vec[i * u_sample_num + j + 1];
+    frame_timer.add_uploaded_bytes(bytes);
+    frame_timer.set_triangles(NumVertices / 3);
+}
 
-                vertices[vn_index] = tri1_v1;
-                vertices[vn_index + 1] = tri1_v2;
-                vertices[vn_index + 2] = tri1_v3;
 
-                vertices[vn_index + 3] = tri2_v1;
-                vertices[vn_index + 4] = tri2_v2;
-                vertices[vn_index + 5] = tri2_v3;
+// copy a chunk of geometry from the loader into the vertex buffers
+size_t upload_chunk(const GeometryChunk &chunk) {
+    size_t bytes = 0;
 
-                norms[vn_index] = tri1_n1;
-                norms[vn_index + 1] = tri1_n2;
-                norms[vn_index + 2] = tri1_n3;
+    if (!chunk.positions.empty()) {
+        size_t end = chunk.first_vertex + chunk.positions.size();
+        reserve_vertex_buffers(end, NumVertices);
 
-                norms[vn_index + 3] = tri2_n1;
-                norms[vn_index + 4] = tri2_n2;
-                norms[vn_index + 5] = tri2_n3;
+        glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+        glBufferSubData(GL_ARRAY_BUFFER, sizeof(point4) * chunk.first_vertex,
+                        sizeof(point4) * chunk.positions.size(), chunk.positions.data());
+        bytes += sizeof(point4) * chunk.positions.size();
+        NumVertices = (int) std::max((size_t) NumVertices, end);
+    }
 
-                vn_index += 6;
-            }
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec4) * chunk.first_vertex,
+                    sizeof(vec4) * chunk.normals.size(), chunk.normals.data());
+    bytes += sizeof(vec4) * chunk.normals.size();
+
+    frame_timer.add_uploaded_bytes(bytes);
+    frame_timer.set_triangles(NumVertices / 3);
+    return bytes;
+}
+
+
+// tessellate a patch into its slot of the vertex buffers; returns the bytes
+// uploaded. With the compute shader the patch is only queued, for
+// update_patches to dispatch.
+size_t tessellate_patch(size_t patch) {
+    GLint first = patch_culler.first(patch);
+    GLsizei count = patch_culler.count(patch);
+    if (tessellating_on_gpu()) {
+        compute_tessellator.add(patch, patch_culler.samples(patch), first);
+        patch_culler.set_resident(patch);
+        return 0;
+    }
+
+    point4 *patch_vertices = tess_arena.alloc_array<point4>(count);
+    vec4 *patch_norms = tess_arena.alloc_array<vec4>(count);
+    surfaces[patch].eval_triangles(patch_culler.samples(patch), patch_vertices, patch_norms, tess_arena);
+
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(point4) * first, sizeof(point4) * count, patch_vertices);
+    glBindBuffer(GL_ARRAY_BUFFER, buffers[1]);
+    glBufferSubData(GL_ARRAY_BUFFER, sizeof(vec4) * first, sizeof(vec4) * count, patch_norms);
+
+    patch_culler.set_resident(patch);
+    tess_arena.reset();
+    return (sizeof(point4) + sizeof(vec4)) * count;
+}
+
+
+// moves a patch to a slot for its new resolution, growing the vertex buffers
+// (and keeping what is in them) if the slot is new
+void resample_patch(size_t patch, int samples) {
+    patch_culler.resample(surfaces, patch, samples);
+    reserve_vertex_buffers(patch_culler.vertex_end(), NumVertices);
+    NumVertices = (int) std::max((size_t) NumVertices, patch_culler.vertex_end());
+}
+
+
+// tessellate the patches that came into view into their slots of the vertex
+// buffers, and with automatic resolution, the ones whose resolution changed
+// as long as the frame's budget lasts. With relayout the slots are laid out
+// for the current resolution first, and every patch has to be tessellated
+// again.
+void update_patches(const ViewFrustum &frustum, bool relayout) {
+    if (relayout) {
+        size_t total = patch_culler.layout(surfaces, sampling_resolution);
+        reserve_vertex_buffers(total, 0);
+        if (streaming) {
+            bind_vertex_attributes(buffers[0], 0, buffers[1], 0);
+            streaming = false;
         }
+        NumVertices = (int) total;
+    } else if (patch_culler.free_vertices() > patch_culler.vertex_end() / 2) {
+        // resampling left more of the buffers unused than in use; the patches
+        // in view are tessellated again right away
+        NumVertices = (int) patch_culler.compact(surfaces);
+    }
+
+    vec3 eye(viewer.x, viewer.y, viewer.z);
+    patch_culler.cull(surfaces, frustum, eye, backface_culling, missing_patches);
+    resampled_patches.clear();
+    if (auto_resolution) {
+        float pixels_per_unit = glutGet(GLUT_WINDOW_HEIGHT) / (2 * tanf(DegreesToRadians * FIELD_OF_VIEW / 2));
+        patch_culler.pick_resolutions(surfaces, eye, pixels_per_unit, wanted_samples, resampled_patches);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    size_t heap_allocations_before = heap_allocation_count();
+    size_t bytes = 0;
+    for (size_t patch : missing_patches) {
+        if (auto_resolution) {
+            resample_patch(patch, wanted_samples[patch]);
+        }
+        bytes += tessellate_patch(patch);
+    }
+
+    size_t resampled = 0;
+    for (size_t patch : resampled_patches) {
+        double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        if (elapsed >= tessellation_budget_ms) {
+            break;
+        }
+        resample_patch(patch, wanted_samples[patch]);
+        bytes += tessellate_patch(patch);
+        ++resampled;
+    }
+    resampled_last_frame = resampled;
+    deferred_last_frame = resampled_patches.size() - resampled;
+    resampled_patches_total += resampled;
+    if (tessellating_on_gpu()) {
+        // after every resample, so that the buffers are done growing
+        bytes += compute_tessellator.dispatch(buffers[0], buffers[1]);
+    }
+
+    patch_culler.build_draws();
+    if (bytes) {
+        reload_heap_allocations = heap_allocation_count() - heap_allocations_before;
+        frame_timer.add_uploaded_bytes(bytes);
+    }
+}
+
+
+// put the hierarchy's triangle order into an index buffer; the CPU copy is
+// not needed after that
+void upload_mesh_bvh() {
+    if (mesh_bvh.empty()) {
+        return;
+    }
+
+    size_t bytes = sizeof(GLuint) * mesh_bvh.indices().size();
+    glGenBuffers(1, &index_buffer);
+    // the element array binding is part of the VAO
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, index_buffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, bytes, mesh_bvh.indices().data(), GL_STATIC_DRAW);
+    mem_track_alloc(MEM_GPU_BUFFERS, bytes);
+    frame_timer.add_uploaded_bytes(bytes);
+    mesh_bvh.release_indices();
+}
+
+
+// quantize the OBJ positions into quantized_buffer, in the triangle order of
+// the full detail vertex buffer
+void upload_quantized_positions(const tracked_vector<float, MEM_PARSER> &verts,
+                                const tracked_vector<int, MEM_PARSER> &tris) {
+    size_t count = verts.size() / 3;
+    if (!count || tris.empty()) {
+        return;
+    }
+
+    Bounds bounds;
+    for (size_t v = 0; v < count; ++v) {
+        bounds.extend(vec3(verts[3 * v], verts[3 * v + 1], verts[3 * v + 2]));
+    }
+    obj_quantization = PositionQuantization(bounds);
+    tracked_vector<GLushort, MEM_UPLOAD_STAGING> quantized(4 * count), expanded(4 * tris.size());
+    quantize_positions(verts.data(), count, 3, obj_quantization, quantized.data());
+    for (size_t i = 0; i < tris.size(); ++i) {
+        std::copy(&quantized[4 * tris[i]], &quantized[4 * tris[i]] + 4, &expanded[4 * i]);
+    }
+
+    size_t bytes = sizeof(GLushort) * expanded.size();
+    glGenBuffers(1, &quantized_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, quantized_buffer);
+    glBufferData(GL_ARRAY_BUFFER, bytes, expanded.data(), GL_STATIC_DRAW);
+    mem_track_alloc(MEM_GPU_BUFFERS, bytes);
+    frame_timer.add_uploaded_bytes(bytes);
+}
+
+
+// put every level of detail into lod_buffers
+void upload_lods() {
+    size_t total = 0;
+    for (auto &level : lod_chain.levels()) {
+        lod_firsts.push_back((GLint) total);
+        lod_counts.push_back((GLsizei) level.tris.size());
+        total += level.tris.size();
+    }
+    if (!total) {
+        return;
+    }
+
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> positions(total), normals(total);
+    for (size_t i = 0; i < lod_counts.size(); ++i) {
+        lod_chain.expand(i, &positions[lod_firsts[i]], &normals[lod_firsts[i]]);
     }
+    lod_chain.release_geometry();
+
+    glGenBuffers(2, lod_buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, lod_buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(point4) * total, positions.data(), GL_STATIC_DRAW);
+    glBindBuffer(GL_ARRAY_BUFFER, lod_buffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * total, normals.data(), GL_STATIC_DRAW);
+    mem_track_alloc(MEM_GPU_BUFFERS, 2 * sizeof(vec4) * total);
+    frame_timer.add_uploaded_bytes(2 * sizeof(vec4) * total);
+}
+
+
+// deletes a buffer, and untracks its bytes
+void delete_tracked_buffer(GLuint &buffer) {
+    if (!buffer) {
+        return;
+    }
+    GLint bytes = 0;
+    glBindBuffer(GL_COPY_READ_BUFFER, buffer);
+    glGetBufferParameteriv(GL_COPY_READ_BUFFER, GL_BUFFER_SIZE, &bytes);
+    glDeleteBuffers(1, &buffer);
+    mem_track_free(MEM_GPU_BUFFERS, bytes);
+    buffer = 0;
+}
+
+
+// drops what the OBJ mesh has on the GPU besides the vertex buffers, which a
+// reload fills again
+void release_obj_mesh() {
+    delete_tracked_buffer(index_buffer);
+    delete_tracked_buffer(quantized_buffer);
+    delete_tracked_buffer(lod_buffers[0]);
+    delete_tracked_buffer(lod_buffers[1]);
+    lod_firsts.clear();
+    lod_counts.clear();
+    lod_chain.clear();
+}
+
+
+// the level of detail to draw from the current camera
+int select_lod() {
+    if (!auto_lod || lod_counts.empty()) {
+        return 0;
+    }
+    vec3 eye(viewer.x, viewer.y, viewer.z);
+    float distance = length(eye - lod_chain.center()) - lod_chain.radius();
+    // from inside the bounding sphere, the mesh may be as close as the near plane
+    return lod_chain.select(std::max(distance, 1.0f), FIELD_OF_VIEW, glutGet(GLUT_WINDOW_HEIGHT), LOD_PIXEL_ERROR);
+}
+
+
+// make the program of a shading mode current; false if the program doesn't
+// build. The uniforms come from render_state's blocks.
+bool use_shading_mode(int mode) {
+    GLuint variant = shader_variants.get(shading_modes[mode].features, shading_modes[mode].light_count);
+    if (!variant) {
+        return false;
+    }
+
+    // ...and set them to be active
+    program = variant;
+    shading_mode = mode;
+    glUseProgram(program);
+    return true;
 }
 
 
-// initialize all dynamic data
-void init_bezier_vertices_norm(const std::string &file) {
-    parse_bezier_surface(file, surfaces);
+// make the variant of the shading mode with the `extra` features current;
+// 0 if it doesn't build. `program` stays what it was, for after.
+GLuint use_variant(int extra) {
+    const ShadingMode &mode = shading_modes[shading_mode];
+    GLuint variant = shader_variants.get(mode.features | extra, mode.light_count);
+    if (variant) {
+        glUseProgram(variant);
+    }
+    return variant;
+}
+
 
-    reload_vertices_norm();
+// make the quantized variant of the shading mode current, with the box of
+// `q`; false if it doesn't build
+bool use_quantized_program(const PositionQuantization &q) {
+    GLuint variant = use_variant(SHADER_QUANTIZED_POSITIONS);
+    if (!variant) {
+        return false;
+    }
+    glUniform3fv(glGetUniformLocation(variant, "position_offset"), 1, &q.offset.x);
+    glUniform3fv(glGetUniformLocation(variant, "position_extent"), 1, &q.extent.x);
+    return true;
 }
 
 
@@ -208,137 +785,710 @@ void init() {
     glBindVertexArray(vao);       // make it active
 #endif
 
-    // set up vertex buffer object - this will be memory on the GPU where
-    // we are going to store our vertex data (that is currently in the "points"
-    // array)
-    glGenBuffers(1, buffers);
-    glBindBuffer(GL_ARRAY_BUFFER, buffers[0]);  // make it active
-
-    // specify that its part of a VAO, what its size is, and where the
-    // data is located, and finally a "hint" about how we are going to use
-    // the data (the driver will put it in a good memory location, hopefully)
-    // vertices position, and normals
-    glBufferData(GL_ARRAY_BUFFER, sizeof(point4) * NumVertices + sizeof(vec4) * NumVertices, NULL, GL_STATIC_DRAW);
-
     // load in these two shaders...  (note: InitShader is defined in the
     // accompanying initshader.c code).
     // the shaders themselves must be text glsl files in the same directory
     // as we are running this program:
-    program = InitShader("vshader.glsl", "fshader.glsl");
+    auto shader_start = std::chrono::steady_clock::now();
+    if (!use_shading_mode(shading_mode)) {
+        exit(EXIT_FAILURE);
+    }
+    shader_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - shader_start).count();
+
+    // set up vertex buffer objects - this will be memory on the GPU where
+    // we are going to store our vertex data. They start out small and grow
+    // as the loader delivers geometry.
+    reserve_vertex_buffers(1024, 0);
+    stream_buffer.init();
+
+    // the light, the material and the projection don't change from here on
+    render_state.init();
+    render_state.set_light(0, light_position, light_diffuse, light_specular);
+    render_state.set_ambient_light(light_ambient);
+    render_state.set_material(material_ambient, material_diffuse, material_specular, material_shininess);
+    projection = Perspective(FIELD_OF_VIEW, 1, 1, 51);
+    render_state.set_projection(projection);
 
-    // ...and set them to be active
-    glUseProgram(program);
+    // set the background color (white)
+    glClearColor(1.0, 1.0, 1.0, 1.0);
+}
 
 
-    // this time, we are sending TWO attributes through: the position of each
-    // transformed vertex, and its normal.
-    GLuint loc, loc2;
+// the error of a quantized mesh, against the size of its box, and what the
+// positions of its `vertices` take instead of floats
+void print_quantization(std::ostream &out, const char *name, const PositionQuantization &q, size_t vertices) {
+    out << name << " positions quantized to 16 bits, max error " << q.max_error << " ("
+        << q.max_error / std::max(length(q.extent), 1e-30f) << " of the bounding box diagonal), "
+        << 8 * vertices << " bytes for " << 16 * vertices << std::endl;
+}
 
-    loc = glGetAttribLocation(program, "vPosition");
-    glEnableVertexAttribArray(loc);
 
-    // the vPosition attribute is a series of 4-vecs of floats, starting at the
-    // beginning of the buffer
-    glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+// write out the frame statistics requested on the command line, and release
+// the geometry; only the first call does anything
+void cleanup() {
+    static bool done = false;
+    if (done) {
+        return;
+    }
+    done = true;
+    loader.cancel();
+    lod_builder.cancel();
+    frame_timer.finish();
+    if (print_stats || replaying) {
+        std::cout << "time to first frame " << first_frame_ms << " ms, load time " << load_ms << " ms, shaders "
+                  << shader_ms << " ms" << std::endl;
+        frame_timer.print_report(std::cout);
+        mem_print_report(std::cout);
+        if (bezier_file) {
+            std::cout << "heap allocations in last reload " << reload_heap_allocations << std::endl;
+        }
+        if (patch_frames) {
+            std::cout << "patches " << surfaces.size() << ", per frame on average "
+                      << visible_patches_total / (double) patch_frames << " visible, "
+                      << tessellated_patches_total / (double) patch_frames << " tessellated, "
+                      << resampled_patches_total / (double) patch_frames << " resampled" << std::endl;
+        }
+        if (welded_frames) {
+            std::cout << "welded patches: " << weld_stats.vertices << " vertices for " << weld_stats.list_vertices
+                      << " in triangle lists (" << weld_stats.grid_points << " grid points), "
+                      << welded_patches.bytes() << " bytes for " << weld_stats.list_bytes << ", "
+                      << weld_stats.degenerate << " collapsed triangles dropped, welded in " << weld_stats.ms
+                      << " ms, drawn in " << welded_frames << " frames" << std::endl;
+            if (welded_patches.quantized()) {
+                print_quantization(std::cout, "welded patches", welded_patches.quantization(), weld_stats.vertices);
+            }
+        }
+        if (gpu_patch_frames) {
+            std::cout << "patches evaluated by the tessellation shaders in " << gpu_patch_frames << " frames"
+                      << std::endl;
+        }
+        if (!bezier_file) {
+            const MeshCleaner::Stats &cleaned = loader.clean_stats();
+            std::cout << "mesh cleanup: " << cleaned.welded_vertices << " duplicate vertices welded, "
+                      << cleaned.unused_vertices << " unused vertices dropped, " << cleaned.degenerate_faces
+                      << " degenerate and " << cleaned.duplicate_faces << " duplicate faces dropped" << std::endl;
+            if (quantized_buffer) {
+                print_quantization(std::cout, "mesh", obj_quantization, NumVertices);
+            }
+        }
+        if (reloads) {
+            std::cout << "reloads " << reloads << ", the last in " << reload_ms << " ms";
+            if (bezier_file) {
+                std::cout << " for " << reloaded_patches << " changed patches";
+            }
+            std::cout << std::endl;
+        }
+        if (scene_file) {
+            const Scene::Stats &loaded = scene.stats();
+            std::cout << "scene: " << loaded.meshes << " meshes of " << loaded.vertices << " vertices in all, "
+                      << loaded.instances << " instances of " << loaded.triangles << " triangles in all, drawn in "
+                      << scene.draws() << " draw calls from " << scene.bytes() << " bytes, loaded in " << loaded.ms
+                      << " ms" << std::endl;
+        }
+        if (brick_file) {
+            const BrickStreamer::Stats &bricks = brick_streamer.stats();
+            std::cout << "bricks " << brick_streamer.brick_count() << ", " << brick_streamer.slot_count()
+                      << " on the GPU at a time in " << brick_streamer.bytes() << " bytes, " << bricks.loads
+                      << " loaded (" << bricks.prefetched_loads << " read ahead), " << bricks.evictions
+                      << " evicted" << std::endl;
+        }
+        if (culled_frames) {
+            std::cout << "clusters " << mesh_bvh.clusters() << ", per frame on average "
+                      << visible_clusters_total / (double) culled_frames << " visible, "
+                      << culled_clusters_total / (double) culled_frames << " culled" << std::endl;
+            std::cout << "meshlets " << meshlets.size() << ", triangles submitted per frame on average "
+                      << submitted_triangles_total / (double) culled_frames << " of " << NumVertices / 3
+                      << std::endl;
+        }
+        if (!lod_counts.empty()) {
+            std::cout << "levels of detail " << lod_counts.size() << ", "
+                      << (lod_builder.from_cache() ? "read from the cache in " : "built in ")
+                      << lod_builder.build_ms() << " ms, a simplified level drawn in " << lod_frames
+                      << " frames" << std::endl;
+        }
+    }
+    if (!stats_csv_file.empty()) {
+        frame_timer.write_csv(stats_csv_file);
+    }
+    if (!record_file.empty()) {
+        camera_path.save(record_file);
+    }
 
-    loc2 = glGetAttribLocation(program, "vNorm");
-    glEnableVertexAttribArray(loc2);
+    scene.release();
+    free_vertices_norm();
+}
 
-    // the vColor attribute is a series of 4-vecs of floats, starting just after
-    // the points in the buffer
-    glVertexAttribPointer(loc2, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(point4) * NumVertices));
 
-    // display callback
-    glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(point4) * NumVertices, vertices);
-    glBufferSubData(GL_ARRAY_BUFFER, sizeof(point4) * NumVertices, sizeof(vec4) * NumVertices, norms);
-
-    // all uniform variables
-    pos = glGetUniformLocation(program, "pos");
-    ctm = glGetUniformLocation(program, "ctm");
-    ptm = glGetUniformLocation(program, "ptm");
-    lpos = glGetUniformLocation(program, "lpos");
-    lamb = glGetUniformLocation(program, "lamb");
-    ldiff = glGetUniformLocation(program, "ldiff");
-    lspec = glGetUniformLocation(program, "lspec");
-    mamb = glGetUniformLocation(program, "mamb");
-    mdiff = glGetUniformLocation(program, "mdiff");
-    mspec = glGetUniformLocation(program, "mspec");
-    ms = glGetUniformLocation(program, "ms");
-
-    // lpos, lamb, ldiff, lspec, mamb, mdiff, mspec, ms;
-    glUniform4fv(lpos, 1, light_position);
-    glUniform4fv(lamb, 1, light_ambient);
-    glUniform4fv(ldiff, 1, light_diffuse);
-    glUniform4fv(lspec, 1, light_specular);
-    glUniform4fv(mamb, 1, material_ambient);
-    glUniform4fv(mdiff, 1, material_diffuse);
-    glUniform4fv(mspec, 1, material_specular);
-    glUniform1f(ms, material_shininess);
+// sets the camera (and sampling resolution) for the next replayed frame
+void apply_camera_sample(const CameraSample &sample) {
+    thetax = sample.thetax;
+    thetay = sample.thetay;
+    radius = sample.radius;
+    if (bezier_file && sample.sampling_resolution != sampling_resolution) {
+        sampling_resolution = sample.sampling_resolution;
+        changed_sampling_resolution = true;
+    }
+}
 
-    // set the background color (white)
-    glClearColor(1.0, 1.0, 1.0, 1.0);
+
+// the eye and view transform of the orbit camera at the given angles and
+// distance
+mat4 orbit_view(float angle_x, float angle_y, float distance, vec4 &eye) {
+    GLfloat anglex = DegreesToRadians * angle_x;
+    GLfloat angley = DegreesToRadians * angle_y;
+    eye = vec4(sinf(anglex) * sinf(angley) * distance, cosf(anglex) * distance,
+               sinf(anglex) * cosf(angley) * distance, 1.0);
+    vec4 v_o = normalize(origin - eye);
+    vec4 v = normalize(vec4(cross(v_o, vec4(0.0, 1.0, 0.0, 0.0)), 0.0));
+    vec4 u = normalize(vec4(cross(v, v_o), 0.0));
+    return LookAt(eye, origin, u);
 }
 
 
+void idle();
+
+
 void display(void) {
+    if (replaying && !loading) {
+        apply_camera_sample(camera_path.at(replay_frame, replay_frames));
+    } else if (!record_file.empty()) {
+        CameraSample sample = {thetax, thetay, radius, sampling_resolution};
+        camera_path.record(sample);
+    }
+
+    // frames of a replay drawn while the model is still loading aren't part
+    // of the benchmark
+    bool timed = !(replaying && loading);
+    if (timed) {
+        frame_timer.begin_frame();
+    }
 
     // clear the window (with white) and clear the z-buffer (which isn't used
     // for this example).
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // based on where the mouse has moved to:
-    GLfloat anglex = DegreesToRadians * thetax;
-    GLfloat angley = DegreesToRadians * thetay;
-    viewer = vec4(sinf(anglex) * sinf(angley) * radius, cosf(anglex) * radius, sinf(anglex) * cosf(angley) * radius,
-                  1.0);
-    vec4 v_o = normalize(origin - viewer);
-    vec4 v = normalize(vec4(cross(v_o, vec4(0.0, 1.0, 0.0, 0.0)), 0.0));
-    vec4 u = normalize(vec4(cross(v, v_o), 0.0));
+    mat4 view = orbit_view(thetax, thetay, radius, viewer);
+    // only uploaded if the camera moved
+    render_state.set_view(view, viewer);
+    frame_timer.add_uploaded_bytes(render_state.upload());
+
+    ViewFrustum frustum(projection * view);
+    if (brick_file) {
+        // thetay wraps around
+        float turn = thetay - last_thetay;
+        turn -= turn > 180 ? 360 : turn < -180 ? -360 : 0;
+        float ahead_x = std::max(5.0f, std::min(175.0f, thetax + (thetax - last_thetax) * BRICK_PREFETCH_FRAMES));
+        float ahead_radius = std::max(1.0f, radius + (radius - last_radius) * BRICK_PREFETCH_FRAMES);
+        vec4 ahead_eye;
+        mat4 ahead_view = orbit_view(ahead_x, thetay + turn * BRICK_PREFETCH_FRAMES, ahead_radius, ahead_eye);
+        brick_streamer.update(frustum, vec3(viewer.x, viewer.y, viewer.z), ViewFrustum(projection * ahead_view),
+                              vec3(ahead_eye.x, ahead_eye.y, ahead_eye.z), UPLOAD_BUDGET);
+        if (brick_streamer.pending()) {
+            glutIdleFunc(idle);
+        }
+    }
+    last_thetax = thetax;
+    last_thetay = thetay;
+    last_radius = radius;
+    bool culling_patches = bezier_file && culling && !loading;
+    bool gpu_drawing = gpu_tessellation && !gpu_patches.empty();
+    bool welded_drawing = welding && bezier_file && !loading && !gpu_drawing;
+    if (welded_drawing &&
+        (welded_patches.samples() != sampling_resolution || welded_patches.quantized() != quantizing)) {
+        weld_surfaces();
+    }
+    if (gpu_drawing || welded_drawing) {
+        // the patches are already on the GPU, so culling is all the CPU does;
+        // the triangle paths catch up when switched back to
+        if (culling_patches) {
+            patch_culler.cull(surfaces, frustum, vec3(viewer.x, viewer.y, viewer.z), backface_culling,
+                              missing_patches);
+        }
+    } else if (culling_patches) {
+        update_patches(frustum, changed_sampling_resolution);
+        changed_sampling_resolution = false;
+    } else if (bezier_file && changed_sampling_resolution && !loading) {
+        reload_stream_buffer();
+        changed_sampling_resolution = false;
+    }
+
+    int level = select_lod();
+    bool quantized_drawing = quantizing && quantized_buffer && !level;
+    if (quantized_drawing && !use_quantized_program(obj_quantization)) {
+        quantizing = false;
+        quantized_drawing = false;
+        lod_level = -1;
+    }
+    if (level != lod_level) {
+        if (level) {
+            bind_vertex_attributes(lod_buffers[0], 0, lod_buffers[1], 0);
+        } else {
+            bind_vertex_attributes(buffers[0], 0, buffers[1], 0);
+            if (quantized_drawing) {
+                glBindBuffer(GL_ARRAY_BUFFER, quantized_buffer);
+                glVertexAttribPointer(ATTRIB_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0, BUFFER_OFFSET(0));
+            }
+        }
+        lod_level = level;
+    }
+
+    // draw the VAO:
+    if (brick_file) {
+        if (use_variant(SHADER_PACKED_NORMALS)) {
+            frame_timer.set_triangles(brick_streamer.draw());
+            glUseProgram(program);
+        }
+    } else if (scene_file) {
+        if (use_variant(SHADER_INSTANCED)) {
+            frame_timer.set_triangles(scene.draw());
+            glUseProgram(program);
+        }
+    } else if (gpu_drawing) {
+        const ShadingMode &mode = shading_modes[shading_mode];
+        size_t drawn = gpu_patches.draw(culling_patches ? &patch_culler.visible() : NULL, shader_variants,
+                                        mode.features, mode.light_count, auto_resolution ? 0 : sampling_resolution,
+                                        PatchCuller::TRIANGLE_PIXELS, glutGet(GLUT_WINDOW_WIDTH),
+                                        glutGet(GLUT_WINDOW_HEIGHT));
+        glUseProgram(program);
+        frame_timer.set_triangles(gpu_patches.triangles());
+        ++patch_frames;
+        ++gpu_patch_frames;
+        visible_patches_total += drawn;
+    } else if (welded_drawing) {
+        const std::vector<size_t> *visible = culling_patches ? &patch_culler.visible() : NULL;
+        if (welded_patches.quantized() && !use_quantized_program(welded_patches.quantization())) {
+            // drawn with floats from the next frame on
+            quantizing = false;
+        }
+        frame_timer.set_triangles(welded_patches.draw(visible));
+        glUseProgram(program);
+        ++patch_frames;
+        ++welded_frames;
+        visible_patches_total += visible ? visible->size() : surfaces.size();
+    } else if (level) {
+        glDrawArrays(GL_TRIANGLES, lod_firsts[level - 1], lod_counts[level - 1]);
+        frame_timer.set_triangles(lod_counts[level - 1] / 3);
+        ++lod_frames;
+    } else if (culling_patches) {
+        glMultiDrawArrays(GL_TRIANGLES, patch_culler.draw_firsts().data(), patch_culler.draw_counts().data(),
+                          (GLsizei) patch_culler.draw_counts().size());
+        frame_timer.set_triangles(patch_culler.visible_vertices() / 3);
+        ++patch_frames;
+        visible_patches_total += patch_culler.stats().visible;
+        tessellated_patches_total += patch_culler.stats().tessellated;
+    } else if (index_buffer && culling) {
+        auto cull_start = std::chrono::steady_clock::now();
+        mesh_bvh.cull(frustum, draw_counts, draw_offsets, cull_stats);
+        size_t triangles = cull_stats.visible_triangles;
+        if (meshlet_culling) {
+            meshlets.cull(frustum, vec3(viewer.x, viewer.y, viewer.z), backface_culling, cull_pool, draw_counts,
+                          draw_offsets, meshlet_stats);
+            triangles = meshlet_stats.visible_triangles;
+        }
+        cull_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - cull_start).count();
+
+        glMultiDrawElements(GL_TRIANGLES, draw_counts.data(), GL_UNSIGNED_INT, draw_offsets.data(),
+                            (GLsizei) draw_counts.size());
+        frame_timer.set_triangles(triangles);
+        submitted_triangles_total += triangles;
+        ++culled_frames;
+        visible_clusters_total += cull_stats.visible_clusters;
+        culled_clusters_total += cull_stats.culled_clusters;
+    } else {
+        glDrawArrays(GL_TRIANGLES, 0, NumVertices);
+        frame_timer.set_triangles(NumVertices / 3);
+    }
+    if (quantized_drawing) {
+        glUseProgram(program);
+    }
+    if (streaming) {
+        stream_buffer.fence();
+    }
 
-    glUniform4fv(pos, 1, viewer);
+    if (first_frame_ms < 0 && (NumVertices > 0 || brick_streamer.stats().drawn || !scene.empty())) {
+        first_frame_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    }
 
-    glUniformMatrix4fv(ctm, 1, GL_TRUE, LookAt(viewer, origin, u));
-    glUniformMatrix4fv(ptm, 1, GL_TRUE, Perspective(40, 1, 1, 51));
+    if (show_overlay) {
+        std::vector<std::string> lines = frame_timer.summary();
+        std::vector<std::string> mem_lines = mem_summary();
+        lines.insert(lines.end(), mem_lines.begin(), mem_lines.end());
+        if (bezier_file) {
+            lines.push_back("heap allocations in last reload " + std::to_string(reload_heap_allocations));
+        }
+        lines.push_back(std::string("shading ") + shading_modes[shading_mode].name);
+        if (reloading) {
+            lines.push_back("reloading " + model_file);
+        } else if (reloads) {
+            lines.push_back("reloaded " + std::to_string(reloads) + " times, the last in " +
+                            std::to_string((int) (1000 * reload_ms)) + " us");
+        }
+        if (scene_file) {
+            lines.push_back("scene " + std::to_string(scene.stats().meshes) + " meshes, " +
+                            std::to_string(scene.stats().instances) + " instances, " +
+                            std::to_string(scene.draws()) + " draw calls");
+        }
+        if (brick_file) {
+            const BrickStreamer::Stats &bricks = brick_streamer.stats();
+            lines.push_back("bricks visible " + std::to_string(bricks.visible) + "  drawn " +
+                            std::to_string(bricks.drawn) + "  of " + std::to_string(brick_streamer.brick_count()) +
+                            ", " + std::to_string(brick_streamer.slot_count()) + " slots");
+            lines.push_back("bricks loaded " + std::to_string(bricks.uploaded) + " this frame, " +
+                            std::to_string(bricks.loads) + " in all, " + std::to_string(bricks.prefetched_loads) +
+                            " read ahead");
+        }
+        if (index_buffer) {
+            lines.push_back(culling ? "clusters visible " + std::to_string(cull_stats.visible_clusters) + "  culled " +
+                                      std::to_string(cull_stats.culled_clusters) + "  draws " +
+                                      std::to_string(draw_counts.size())
+                                    : "culling off");
+            if (culling && meshlet_culling) {
+                lines.push_back("meshlets tested " + std::to_string(meshlet_stats.tested) + "  visible " +
+                                std::to_string(meshlet_stats.visible) + "  outside " +
+                                std::to_string(meshlet_stats.outside) + "  backfacing " +
+                                std::to_string(meshlet_stats.backfacing));
+            }
+            if (culling) {
+                lines.push_back("culling " + std::to_string((int) cull_us) + " us on " +
+                                std::to_string(cull_pool.size()) + " threads");
+            }
+            if (quantized_drawing) {
+                lines.push_back("quantized positions, max error " + std::to_string(obj_quantization.max_error));
+            }
+            if (building_lods) {
+                lines.push_back("building levels of detail");
+            } else if (!lod_counts.empty()) {
+                lines.push_back(!auto_lod ? "levels of detail off"
+                                          : lod_level ? "level of detail " + std::to_string(lod_level) + " of " +
+                                                        std::to_string(lod_counts.size()) + ", " +
+                                                        std::to_string(lod_counts[lod_level - 1] / 3) + " triangles"
+                                                      : "full detail");
+            }
+        }
+        if (bezier_file && !loading) {
+            const PatchCuller::Stats &stats = patch_culler.stats();
+            lines.push_back(!culling ? "culling off"
+                                     : "patches visible " + std::to_string(stats.visible) + "  outside " +
+                                       std::to_string(stats.outside) + "  backfacing " +
+                                       std::to_string(stats.backfacing) +
+                                       (gpu_drawing || welded_drawing ? "" : "  tessellated " +
+                                                                           std::to_string(stats.tessellated)));
+            if (welded_drawing) {
+                lines.push_back("welded, " + std::to_string(weld_stats.vertices) + " vertices for " +
+                                std::to_string(weld_stats.list_vertices) + " in triangle lists, " +
+                                std::to_string(welded_patches.bytes() >> 10) + " of " +
+                                std::to_string(weld_stats.list_bytes >> 10) + " KB" +
+                                (welded_patches.quantized() ? ", quantized, max error " +
+                                                              std::to_string(welded_patches.quantization().max_error)
+                                                            : ""));
+            } else if (!gpu_drawing && tessellating_on_gpu()) {
+                lines.push_back("compute shader tessellation");
+            }
+            if (gpu_drawing) {
+                lines.push_back("tessellation shaders, " +
+                                (auto_resolution ? std::string("automatic resolution")
+                                                 : "resolution " + std::to_string(sampling_resolution)));
+            } else if (culling && auto_resolution) {
+                lines.push_back("automatic resolution, resampled " + std::to_string(resampled_last_frame) +
+                                "  deferred " + std::to_string(deferred_last_frame));
+            }
+        }
+        draw_text_overlay(lines);
+    }
 
-    if (bezier_file && changed_sampling_resolution) {
-        reload_vertices_norm();
-        // specify that its part of a VAO, what its size is, and where the
-        // data is located, and finally a "hint" about how we are going to use
-        // the data (the driver will put it in a good memory location, hopefully)
-        // vertices position, and normals
-        glBufferData(GL_ARRAY_BUFFER, sizeof(point4) * NumVertices + sizeof(vec4) * NumVertices, NULL, GL_STATIC_DRAW);
+    // move the buffer we drew into to the screen, and give us access to the one
+    // that was there before:
+    glutSwapBuffers();
 
-        // this time, we are sending TWO attributes through: the position of each
-        // transformed vertex, and its normal.
-        GLuint loc, loc2;
+    if (timed) {
+        frame_timer.end_frame();
+    }
 
-        loc = glGetAttribLocation(program, "vPosition");
-        glEnableVertexAttribArray(loc);
+    if (replaying && !loading && ++replay_frame == replay_frames) {
+        cleanup();
+        exit(0);
+    }
+}
 
-        // the vPosition attribute is a series of 4-vecs of floats, starting at the
-        // beginning of the buffer
-        glVertexAttribPointer(loc, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
 
-        loc2 = glGetAttribLocation(program, "vNorm");
-        glEnableVertexAttribArray(loc2);
+// takes what the loader made besides the geometry chunks, once it is finished
+void finish_loading() {
+    loader.take_surfaces(surfaces);
+    loader.take_bvh(mesh_bvh, meshlets);
+    upload_mesh_bvh();
+    if (!bezier_file) {
+        tracked_vector<float, MEM_PARSER> verts;
+        tracked_vector<int, MEM_PARSER> tris;
+        loader.take_mesh(verts, tris);
+        if (quantizing) {
+            upload_quantized_positions(verts, tris);
+        }
+        lod_builder.start(model_file, std::move(verts), std::move(tris));
+        building_lods = true;
+    }
+    // the loader tessellated every patch, in order, into what are now their
+    // slots
+    patch_culler.layout(surfaces, sampling_resolution);
+    patch_culler.set_all_resident();
+    if (bezier_file && GpuPatches::supported()) {
+        gpu_patches.upload(surfaces);
+    } else if (gpu_tessellation) {
+        std::cerr << "No tessellation shaders, the patches are tessellated on the CPU" << std::endl;
+    }
+    if (bezier_file && ComputeTessellator::supported()) {
+        compute_tessellator.upload(surfaces, "tessellate.glsl");
+    } else if (compute_tessellation) {
+        std::cerr << "No compute shaders, the patches are tessellated on the CPU" << std::endl;
+    }
+}
 
-        // the vColor attribute is a series of 4-vecs of floats, starting just after
-        // the points in the buffer
-        glVertexAttribPointer(loc2, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(sizeof(point4) * NumVertices));
 
-        // display callback
-        glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(point4) * NumVertices, vertices);
-        glBufferSubData(GL_ARRAY_BUFFER, sizeof(point4) * NumVertices, sizeof(vec4) * NumVertices, norms);
-        changed_sampling_resolution = false;
+// puts the reloaded OBJ mesh in place of the old one, all in the same frame
+void swap_reloaded_mesh() {
+    release_obj_mesh();
+    NumVertices = 0;
+    for (auto &chunk : reload_chunks) {
+        upload_chunk(chunk);
     }
+    std::vector<GeometryChunk>().swap(reload_chunks);
+    finish_loading();
+    // the attributes may point at buffers that are gone
+    lod_level = -1;
+}
 
-    // draw the VAO:
-    glDrawArrays(GL_TRIANGLES, 0, NumVertices);
 
+// prints how far a GPU tessellation path is from the CPU; false if further
+// than the tolerances
+bool report_tessellation_check(const char *path, const TessellationCheck &check) {
+    bool ok = check.position_error <= POSITION_TOLERANCE && check.normal_error <= NORMAL_TOLERANCE;
+    std::cout << path << ": " << check.patches << " patches, " << check.points << " points at resolution "
+              << sampling_resolution << ", largest position error " << check.position_error
+              << " of the size, largest normal error " << check.normal_error << (ok ? ", ok" : ", too large")
+              << std::endl;
+    return ok;
+}
 
-    // move the buffer we drew into to the screen, and give us access to the one
-    // that was there before:
-    glutSwapBuffers();
+
+// compares the GPU tessellation paths with the CPU, on the patches as loaded,
+// and exits
+void verify_tessellation() {
+    TessellationCheck check;
+    bool ok = true;
+    if (gpu_patches.empty()) {
+        std::cerr << "No tessellation shaders to verify" << std::endl;
+        ok = false;
+    } else {
+        ok = check_gpu_patches(gpu_patches, shader_variants, surfaces, sampling_resolution, check) &&
+             report_tessellation_check("tessellation shaders", check);
+    }
+    if (compute_tessellator.empty()) {
+        std::cerr << "No compute shader tessellation to verify" << std::endl;
+        ok = false;
+    } else {
+        ok = check_compute_tessellator(compute_tessellator, surfaces, sampling_resolution, check) &&
+             report_tessellation_check("compute shader", check) && ok;
+    }
+    cleanup();
+    exit(ok ? 0 : -1);
+}
+
+
+// moves finished geometry from the loader to the GPU while loading; during a
+// replay frames are rendered back to back, as fast as they go
+void idle() {
+    if (reloading && scene_file) {
+        if (scene.finished()) {
+            reloading = false;
+            if (scene.succeeded()) {
+                scene.upload();
+                reload_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                      reload_start).count();
+                ++reloads;
+                std::cout << "Reloaded " << model_file << " in " << reload_ms << " ms" << std::endl;
+            } else {
+                std::cerr << "Reload of " << model_file << " failed, keeping the scene" << std::endl;
+            }
+            glutPostRedisplay();
+        } else if (!replaying) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+    } else if (reloading) {
+        GeometryChunk chunk;
+        while (loader.poll(chunk)) {
+            reload_chunks.push_back(std::move(chunk));
+        }
+        if (loader.finished()) {
+            reloading = false;
+            if (loader.succeeded()) {
+                swap_reloaded_mesh();
+                reload_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                      reload_start).count();
+                ++reloads;
+                std::cout << "Reloaded " << model_file << " in " << reload_ms << " ms" << std::endl;
+            } else {
+                // the old mesh, its buffers and levels of detail stay as they were
+                std::vector<GeometryChunk>().swap(reload_chunks);
+                std::cerr << "Reload of " << model_file << " failed, keeping the model" << std::endl;
+            }
+            glutPostRedisplay();
+        } else if (!replaying) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+    }
+
+    if (loading) {
+        GeometryChunk chunk;
+        size_t uploaded = 0;
+        while (uploaded < UPLOAD_BUDGET && loader.poll(chunk)) {
+            uploaded += upload_chunk(chunk);
+        }
+
+        if (loader.finished()) {
+            loading = false;
+            finish_loading();
+            load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+            if (verifying_tessellation) {
+                verify_tessellation();
+            }
+        } else if (!uploaded) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+        glutPostRedisplay();
+        return;
+    }
+
+    if (building_lods) {
+        if (lod_builder.finished()) {
+            building_lods = false;
+            lod_builder.take(lod_chain);
+            upload_lods();
+            glutPostRedisplay();
+        } else if (!replaying) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            return;
+        }
+    }
+
+    if (replaying || (brick_file && brick_streamer.pending())) {
+        glutPostRedisplay();
+    } else if (!building_lods && !reloading) {
+        glutIdleFunc(NULL);
+    }
+}
+
+
+// reads the Bezier file again and brings the patches that changed, by their
+// content hash, to the GPU. While the patch count stays and the changed
+// patches keep their degrees, each goes into the slot it had, and the shader
+// paths get its new control points; anything else starts every path over
+// with the new patches. Either way nothing is parsed but the file.
+void reload_patches() {
+    std::vector<BezierSurface> patches;
+    if (!read_patch_file(model_file, patches, cull_pool)) {
+        std::cerr << "Keeping the patches of " << model_file << " as they were" << std::endl;
+        return;
+    }
+
+    std::vector<size_t> changed;
+    bool in_place = patches.size() == surfaces.size();
+    for (size_t i = 0; i < patches.size() && in_place; ++i) {
+        if (patches[i].content_hash() != surfaces[i].content_hash()) {
+            in_place = patches[i].u_deg() == surfaces[i].u_deg() && patches[i].v_deg() == surfaces[i].v_deg();
+            changed.push_back(i);
+        }
+    }
+
+    size_t bytes = 0;
+    if (in_place) {
+        for (size_t patch : changed) {
+            surfaces[patch] = std::move(patches[patch]);
+            if (!gpu_patches.empty()) {
+                bytes += gpu_patches.update(patch, surfaces[patch]);
+            }
+            if (!compute_tessellator.empty()) {
+                bytes += compute_tessellator.update(patch, surfaces[patch]);
+            }
+            // the stream buffer has no slots; it is filled again whole
+            if (!streaming && patch_culler.resident(patch)) {
+                bytes += tessellate_patch(patch);
+            }
+        }
+        if (tessellating_on_gpu()) {
+            bytes += compute_tessellator.dispatch(buffers[0], buffers[1]);
+        }
+        changed_sampling_resolution = changed_sampling_resolution || (streaming && !changed.empty());
+        reloaded_patches = changed.size();
+    } else {
+        surfaces.swap(patches);
+        patch_culler.layout(surfaces, sampling_resolution);
+        changed_sampling_resolution = true;
+        if (!gpu_patches.empty()) {
+            gpu_patches.upload(surfaces);
+        }
+        if (!compute_tessellator.empty()) {
+            compute_tessellator.upload(surfaces, "tessellate.glsl");
+        }
+        reloaded_patches = surfaces.size();
+    }
+    // welded again from the new patches, when next drawn welded
+    if (reloaded_patches) {
+        welded_patches.release();
+    }
+    frame_timer.add_uploaded_bytes(bytes);
+
+    reload_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - reload_start).count();
+    ++reloads;
+    std::cout << "Reloaded " << reloaded_patches << " of " << surfaces.size() << " patches of " << model_file
+              << " in " << reload_ms << " ms" << std::endl;
+    glutPostRedisplay();
+}
+
+
+// brings the model up to date with its file
+void reload_model() {
+    reload_start = std::chrono::steady_clock::now();
+    if (brick_file) {
+        // the old file stays open and drawn unless the new one checks out
+        if (brick_streamer.open(model_file, brick_budget)) {
+            reload_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() -
+                                                                  reload_start).count();
+            ++reloads;
+            std::cout << "Reloaded " << model_file << " in " << reload_ms << " ms" << std::endl;
+        }
+        glutPostRedisplay();
+    } else if (scene_file) {
+        // the old scene is drawn while the new one loads, and idle() puts it
+        // on the GPU
+        scene.start(model_file, sampling_resolution, dedupe_epsilon, weld_tolerance);
+        reloading = true;
+        glutIdleFunc(idle);
+    } else if (bezier_file) {
+        reload_patches();
+    } else {
+        // a reload still running is dropped for the newer file
+        loader.start(model_file, false, sampling_resolution, dedupe_epsilon);
+        reload_chunks.clear();
+        reloading = true;
+        glutIdleFunc(idle);
+    }
+}
+
+
+// polls the watcher every WATCH_INTERVAL_MS; a change during the first load,
+// or while a scene is loaded again, waits for it to finish
+void check_model_file(int) {
+    if (model_watcher.changed()) {
+        model_changed = true;
+    }
+    if (model_changed && !loading && !(scene_file && reloading)) {
+        model_changed = false;
+        reload_model();
+    }
+    glutTimerFunc(WATCH_INTERVAL_MS, check_model_file, 0);
 }
 
 
@@ -347,6 +1497,9 @@ void display(void) {
 // to generate the transformation, ctm, that is applied
 // to all the vertices before they are displayed:
 void mouse_move_rotate(int x, int y) {
+    if (replaying) {
+        return;
+    }
 
     int amntX = x - lastx;
     int amntY = y - lasty;
@@ -383,11 +1536,106 @@ void mouse_enter(int button, int state, int x, int y) {
 // regular keys.
 void mykey(unsigned char key, int mousex, int mousey) {
     if (key == 'q' || key == 'Q') {
-        delete [] vertices;
-        delete [] norms;
+        cleanup();
         exit(0);
     }
 
+    // o toggles the statistics overlay
+    if (key == 'o') {
+        show_overlay = !show_overlay;
+        glutPostRedisplay();
+    }
+
+    // l cycles through the shading modes
+    if (key == 'l') {
+        int next = (shading_mode + 1) % SHADING_MODE_COUNT;
+        if (!use_shading_mode(next)) {
+            use_shading_mode(shading_mode);
+        }
+        glutPostRedisplay();
+    }
+
+    // a toggles automatic per-patch resolution, which needs the patch slots
+    // of the culling path
+    if (key == 'a' && bezier_file) {
+        auto_resolution = !auto_resolution;
+        if (!auto_resolution && !loading) {
+            changed_sampling_resolution = true;
+        }
+        glutPostRedisplay();
+    }
+
+    // t switches Bezier patches between the tessellation shaders and the
+    // CPU
+    if (key == 't' && bezier_file && !loading && !gpu_patches.empty()) {
+        gpu_tessellation = !gpu_tessellation;
+        if (!gpu_tessellation) {
+            changed_sampling_resolution = true;
+        }
+        glutPostRedisplay();
+    }
+
+    // g switches the tessellation of the triangle paths between the compute
+    // shader and the CPU; everything is tessellated again in the other
+    if (key == 'g' && bezier_file && !loading && !compute_tessellator.empty()) {
+        compute_tessellation = !compute_tessellation;
+        changed_sampling_resolution = true;
+        glutPostRedisplay();
+    }
+
+    // p switches between quantized and float positions, for the welded
+    // Bezier mesh or, loaded with --quantize, the OBJ mesh at full detail
+    if (key == 'p' && (bezier_file || quantized_buffer)) {
+        quantizing = !quantizing;
+        if (quantized_buffer) {
+            lod_level = -1;     // binds the other positions
+        }
+        glutPostRedisplay();
+    }
+
+    // w switches Bezier patches between the welded mesh and the triangle
+    // paths
+    if (key == 'w' && bezier_file && !loading) {
+        welding = !welding;
+        if (!welding) {
+            changed_sampling_resolution = true;
+        }
+        glutPostRedisplay();
+    }
+
+    // c toggles culling, b just the rejection of patches facing away
+    if (key == 'c') {
+        culling = !culling;
+        // the patch slots and the stream buffer don't know each other's
+        // geometry, start over in the other one
+        if (bezier_file && !loading) {
+            changed_sampling_resolution = true;
+        }
+        glutPostRedisplay();
+    }
+
+    if (key == 'b') {
+        backface_culling = !backface_culling;
+        glutPostRedisplay();
+    }
+
+    // m toggles the meshlet pass, leaving the clusters of the hierarchy
+    if (key == 'm') {
+        meshlet_culling = !meshlet_culling;
+        glutPostRedisplay();
+    }
+
+    // d toggles the automatic levels of detail
+    if (key == 'd') {
+        auto_lod = !auto_lod;
+        glutPostRedisplay();
+    }
+
+    // the replay owns the camera
+    if (replaying) {
+        return;
+    }
+
     // and r resets the view:
     if (key == 'r') {
         thetax = 90.0;
@@ -408,13 +1656,19 @@ void mykey(unsigned char key, int mousex, int mousey) {
         glutPostRedisplay();
     }
 
-    if (key == '<' && sampling_resolution > 1 && bezier_file) {
+    // stepping the resolution by hand ends the automatic one
+    if ((key == '<' || key == '>') && auto_resolution && bezier_file && !loading) {
+        auto_resolution = false;
+        changed_sampling_resolution = true;
+    }
+
+    if (key == '<' && sampling_resolution > 1 && bezier_file && !loading) {
         sampling_resolution--;
         changed_sampling_resolution = true;
         glutPostRedisplay();
     }
 
-    if (key == '>' && sampling_resolution < 10 && bezier_file) {
+    if (key == '>' && sampling_resolution < 10 && bezier_file && !loading) {
         sampling_resolution++;
         changed_sampling_resolution = true;
         glutPostRedisplay();
@@ -422,18 +1676,201 @@ void mykey(unsigned char key, int mousex, int mousey) {
 }
 
 
+void usage() {
+    std::cerr << "Usage: glrender [OPTIONS] FILE" << std::endl
+              << "  --stats       print frame time and memory statistics on exit" << std::endl
+              << "  --csv FILE    write per-frame statistics to FILE on exit" << std::endl
+              << "  --record FILE record the camera path to FILE" << std::endl
+              << "  --replay FILE replay the camera path in FILE and print a report" << std::endl
+              << "  --frames N    number of frames the replay is stretched over" << std::endl
+              << "  --no-shader-cache  always compile the shaders from source" << std::endl
+              << "  --auto-resolution  pick the Bezier resolution per patch from its size on screen" << std::endl
+              << "  --tess-budget MS   time per frame for re-tessellating patches (default 2)" << std::endl
+              << "  --gpu-tessellation evaluate the Bezier patches in tessellation shaders" << std::endl
+              << "  --compute-tessellation  tessellate the Bezier patches in a compute shader" << std::endl
+              << "  --verify-tessellation   compare the GPU tessellation of the Bezier patches with the CPU at"
+              << std::endl
+              << "                          the resolution, and exit" << std::endl
+              << "  --weld        draw the Bezier patches as one mesh, welded along their seams" << std::endl
+              << "  --weld-tolerance D  distance under which boundary points are welded (default from size)"
+              << std::endl
+              << "  --quantize    draw positions as 16 bit integers over the bounding box" << std::endl
+              << "  --backface-culling  leave out patches and meshlets facing away, for closed models"
+              << std::endl
+              << "  --dedupe-epsilon D  weld OBJ vertices closer than D (default: exact duplicates only)"
+              << std::endl
+              << "  --save-patches OUT  convert the Bezier FILE to the binary patch format and exit" << std::endl
+              << "  --save-mesh OUT     convert FILE to the compressed mesh format and exit" << std::endl
+              << "  --save-bricks OUT   cut FILE into bricks for drawing out of core, and exit; the whole mesh"
+              << std::endl
+              << "                      has to fit in RAM, about 200 bytes a triangle" << std::endl
+              << "  --brick-budget MB   GPU memory for the bricks of a brick file (default 256)" << std::endl
+              << "  --mesh-bits N       bits per position coordinate in --save-mesh (default 16, at most 24)"
+              << std::endl
+              << "  --no-watch          don't reload FILE when it changes" << std::endl
+              << "  --resolution N      Bezier sampling resolution to start at, and to convert at (default 1)"
+              << std::endl;
+}
+
+
+// false, and says so, if the model is a brick or scene file, which only draw
+// and can't be converted
+bool convertible_model() {
+    const char *kind = is_brick_file(model_file) ? "brick" : is_scene_file(model_file) ? "scene" : NULL;
+    if (kind) {
+        std::cerr << model_file << " is a " << kind << " file, which only draws" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+
+// converts the model to a mesh file
+bool save_mesh() {
+    ThreadPool pool;
+    tracked_vector<float, MEM_PARSER> verts;
+    tracked_vector<int, MEM_PARSER> tris;
+    MeshFileStats stats;
+    // the loader only keeps indices of vertices it has, none negative
+    if (!load_indexed_mesh(model_file, sampling_resolution, dedupe_epsilon, weld_tolerance, pool, verts, tris) ||
+        !write_mesh_file(save_mesh_file, verts.data(), verts.size() / 3, 3,
+                         reinterpret_cast<const uint32_t *>(tris.data()), tris.size(), mesh_bits, pool, stats)) {
+        return false;
+    }
+    std::cout << "Saved " << verts.size() / 3 << " vertices and " << tris.size() / 3 << " triangles to "
+              << save_mesh_file << ", " << stats.bytes << " bytes for " << 4 * (verts.size() + tris.size())
+              << " uncompressed, max position error " << stats.max_error << ", encoded in " << stats.ms << " ms"
+              << std::endl;
+    return true;
+}
+
+
+// converts the model to a brick file
+bool save_bricks() {
+    ThreadPool pool;
+    tracked_vector<float, MEM_PARSER> verts;
+    tracked_vector<int, MEM_PARSER> tris;
+    BrickFileStats stats;
+    if (!load_indexed_mesh(model_file, sampling_resolution, dedupe_epsilon, weld_tolerance, pool, verts, tris) ||
+        !write_brick_file(save_bricks_file, verts.data(), verts.size() / 3, tris.data(), tris.size(), stats)) {
+        return false;
+    }
+    std::cout << "Saved " << verts.size() / 3 << " vertices and " << tris.size() / 3 << " triangles to "
+              << save_bricks_file << " in " << stats.bricks << " bricks, " << stats.bytes << " bytes, written in "
+              << stats.ms << " ms" << std::endl;
+    return true;
+}
+
+
 int main(int argc, char **argv) {
-    if (argc != 2) {
-        std::cerr << "Usage: glrender FILE" << std::endl;
+    start_time = std::chrono::steady_clock::now();
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--stats") {
+            print_stats = true;
+        } else if (arg == "--csv" && i + 1 < argc) {
+            stats_csv_file = argv[++i];
+        } else if (arg == "--record" && i + 1 < argc) {
+            record_file = argv[++i];
+        } else if (arg == "--replay" && i + 1 < argc) {
+            if (!camera_path.load(argv[++i])) {
+                return -1;
+            }
+            replaying = true;
+        } else if (arg == "--frames" && i + 1 < argc) {
+            replay_frames = atol(argv[++i]);
+        } else if (arg == "--no-shader-cache") {
+            EnableShaderCache(false);
+        } else if (arg == "--auto-resolution") {
+            auto_resolution = true;
+        } else if (arg == "--tess-budget" && i + 1 < argc) {
+            tessellation_budget_ms = atof(argv[++i]);
+        } else if (arg == "--gpu-tessellation") {
+            gpu_tessellation = true;
+        } else if (arg == "--compute-tessellation") {
+            compute_tessellation = true;
+        } else if (arg == "--verify-tessellation") {
+            verifying_tessellation = true;
+        } else if (arg == "--no-watch") {
+            watching = false;
+        } else if (arg == "--quantize") {
+            quantizing = true;
+        } else if (arg == "--backface-culling") {
+            backface_culling = true;
+        } else if (arg == "--weld") {
+            welding = true;
+        } else if (arg == "--weld-tolerance" && i + 1 < argc) {
+            weld_tolerance = (float) atof(argv[++i]);
+        } else if (arg == "--dedupe-epsilon" && i + 1 < argc) {
+            dedupe_epsilon = (float) atof(argv[++i]);
+        } else if (arg == "--save-patches" && i + 1 < argc) {
+            save_patches_file = argv[++i];
+        } else if (arg == "--save-mesh" && i + 1 < argc) {
+            save_mesh_file = argv[++i];
+        } else if (arg == "--save-bricks" && i + 1 < argc) {
+            save_bricks_file = argv[++i];
+        } else if (arg == "--brick-budget" && i + 1 < argc) {
+            brick_budget = (size_t) std::max(1, atoi(argv[++i])) << 20;
+        } else if (arg == "--mesh-bits" && i + 1 < argc) {
+            mesh_bits = atoi(argv[++i]);
+        } else if (arg == "--resolution" && i + 1 < argc) {
+            sampling_resolution = std::max(1, std::min(10, atoi(argv[++i])));
+        } else if (arg[0] != '-' && model_file.empty()) {
+            model_file = arg;
+        } else {
+            usage();
+            return -1;
+        }
+    }
+
+    if (model_file.empty() || (replaying && !record_file.empty())) {
+        usage();
         return -1;
     }
 
-    if (isObjFile(argv[1])) {
-        bezier_file = false;
-        init_obj_vertices_norm(argv[1]);
-    } else {
-        bezier_file = true;
-        init_bezier_vertices_norm(argv[1]);
+    // converting needs no window
+    if (!save_patches_file.empty()) {
+        ThreadPool pool;
+        std::vector<BezierSurface> patches;
+        if (!read_patch_file(model_file, patches, pool) || !write_patch_file(save_patches_file, patches)) {
+            return -1;
+        }
+        std::cout << "Saved " << patches.size() << " patches to " << save_patches_file << std::endl;
+        return 0;
+    }
+    if (!save_mesh_file.empty()) {
+        return convertible_model() && save_mesh() ? 0 : -1;
+    }
+    if (!save_bricks_file.empty()) {
+        return convertible_model() && save_bricks() ? 0 : -1;
+    }
+
+    if (replaying) {
+        if (replay_frames <= 0) {
+            replay_frames = (long) camera_path.size();
+        }
+        // the replay starts from the recorded resolution, not a re-tessellation
+        sampling_resolution = camera_path.at(0, replay_frames).sampling_resolution;
+    }
+
+    // the loader gets going on its own threads while the window is set up
+    // brick files are never loaded whole, only streamed once there is a window
+    brick_file = is_brick_file(model_file);
+    scene_file = is_scene_file(model_file);
+    bezier_file = !brick_file && !scene_file && !is_mesh_file(model_file) && !isObjFile(model_file);
+    if (verifying_tessellation && !bezier_file) {
+        std::cerr << "--verify-tessellation needs a Bezier patch file" << std::endl;
+        return -1;
+    }
+    if (scene_file) {
+        // the meshes are loaded whole before the window is up, each once
+        if (!scene.load(model_file, sampling_resolution, dedupe_epsilon, weld_tolerance, cull_pool)) {
+            return -1;
+        }
+    } else if (!brick_file) {
+        loader.start(model_file, bezier_file, sampling_resolution, dedupe_epsilon);
+        loading = true;
     }
 
     // initialize glut, and set the display modes
@@ -455,6 +1892,17 @@ int main(int argc, char **argv) {
     // for any keyboard activity, here is the callback:
     glutKeyboardFunc(mykey);
 
+    // closing the window ends the program without leaving the main loop, so
+    // the statistics have to be written out on the way
+#ifdef __APPLE__
+    atexit(cleanup);
+#else
+    glutCloseFunc(cleanup);
+#endif
+
+    // geometry is picked up from the loader whenever there is nothing else to do
+    glutIdleFunc(idle);
+
 #ifndef __APPLE__
     // initialize the extension manager: sometimes needed, sometimes not!
     glewInit();
@@ -462,6 +1910,17 @@ int main(int argc, char **argv) {
 
     // call the init() function, defined above:
     init();
+    frame_timer.init_gl();
+    if (brick_file && !brick_streamer.open(model_file, brick_budget)) {
+        return -1;
+    }
+    if (scene_file) {
+        scene.upload();
+        load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    }
+    if (watching && model_watcher.watch(model_file)) {
+        glutTimerFunc(WATCH_INTERVAL_MS, check_model_file, 0);
+    }
 
     // enable the z-buffer for hidden surface removel:
     glEnable(GL_DEPTH_TEST);
@@ -470,7 +1929,6 @@ int main(int argc, char **argv) {
     glutMainLoop();
 
     // clean up all the memory allocation on heap
-    delete[] vertices;
-    delete[] norms;
+    cleanup();
     return 0;
 }
\ No newline at end of file
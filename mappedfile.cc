@@ -0,0 +1,50 @@
+#include "mappedfile.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+MappedFile::MappedFile()
+        : _data(NULL), _size(0) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string &path) {
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+        ::close(fd);
+        return false;
+    }
+
+    _size = (size_t) info.st_size;
+    if (_size) {
+        void *mapped = mmap(NULL, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapped == MAP_FAILED) {
+            _size = 0;
+            ::close(fd);
+            return false;
+        }
+        _data = static_cast<const char *>(mapped);
+    }
+    // the mapping stays valid without the descriptor
+    ::close(fd);
+    return true;
+}
+
+void MappedFile::close() {
+    if (_data) {
+        munmap(const_cast<char *>(_data), _size);
+    }
+    _data = NULL;
+    _size = 0;
+}
@@ -0,0 +1,39 @@
+#ifndef GLRENDER_MAPPEDFILE_H
+#define GLRENDER_MAPPEDFILE_H
+
+#include <cstddef>
+#include <string>
+
+// A file mapped read-only into memory, for parsers that want all of it at
+// once without reading it into a buffer first. Pages are only read in as
+// they are touched.
+class MappedFile {
+public:
+    MappedFile();
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile &operator=(const MappedFile &) = delete;
+
+    // false if the file can't be opened or mapped; an empty file maps to no
+    // data and size() 0
+    bool open(const std::string &path);
+
+    void close();
+
+    inline const char *data() const {
+        return _data;
+    }
+
+    inline size_t size() const {
+        return _size;
+    }
+
+private:
+    const char *_data;
+    size_t _size;
+};
+
+#endif //GLRENDER_MAPPEDFILE_H
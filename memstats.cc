@@ -0,0 +1,70 @@
+#include "memstats.h"
+
+#include <atomic>
+#include <iomanip>
+#include <sstream>
+
+static std::atomic<size_t> mem_current_bytes[MEM_TAG_COUNT];
+static std::atomic<size_t> mem_peak_bytes[MEM_TAG_COUNT];
+
+const char *mem_tag_name(MemTag tag) {
+    switch (tag) {
+        case MEM_PARSER:
+            return "parser";
+        case MEM_TESSELLATOR:
+            return "tessellator";
+        case MEM_NORMALS:
+            return "normals";
+        case MEM_UPLOAD_STAGING:
+            return "upload staging";
+        case MEM_GPU_BUFFERS:
+            return "gpu buffers";
+        case MEM_CLUSTERS:
+            return "clusters";
+        case MEM_LOD:
+            return "levels of detail";
+        default:
+            return "?";
+    }
+}
+
+void mem_track_alloc(MemTag tag, size_t bytes) {
+    size_t now = mem_current_bytes[tag].fetch_add(bytes) + bytes;
+    size_t peak = mem_peak_bytes[tag].load();
+    while (now > peak && !mem_peak_bytes[tag].compare_exchange_weak(peak, now)) {
+    }
+}
+
+void mem_track_free(MemTag tag, size_t bytes) {
+    mem_current_bytes[tag].fetch_sub(bytes);
+}
+
+size_t mem_current(MemTag tag) {
+    return mem_current_bytes[tag].load();
+}
+
+size_t mem_peak(MemTag tag) {
+    return mem_peak_bytes[tag].load();
+}
+
+std::vector<std::string> mem_summary() {
+    std::vector<std::string> lines;
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(2);
+
+    for (int tag = 0; tag < MEM_TAG_COUNT; ++tag) {
+        line.str("");
+        line << std::left << std::setw(15) << mem_tag_name((MemTag) tag) << std::right
+             << std::setw(10) << mem_current((MemTag) tag) / (1024.0 * 1024.0) << " MiB  peak "
+             << std::setw(10) << mem_peak((MemTag) tag) / (1024.0 * 1024.0) << " MiB";
+        lines.push_back(line.str());
+    }
+    return lines;
+}
+
+void mem_print_report(std::ostream &out) {
+    out << "memory" << std::endl;
+    for (auto &line : mem_summary()) {
+        out << "  " << line << std::endl;
+    }
+}
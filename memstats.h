@@ -0,0 +1,80 @@
+#ifndef GLRENDER_MEMSTATS_H
+#define GLRENDER_MEMSTATS_H
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// Memory accounting for the geometry path. Every allocation the loader,
+// tessellator and renderer make on behalf of the model is charged to the
+// subsystem that made it, so that the stage which peaks on a large model can
+// be told apart from the others. GPU buffers are charged with the size handed
+// to the driver.
+enum MemTag {
+    MEM_PARSER,             // model files as parsed: OBJ verts/tris, control points
+    MEM_TESSELLATOR,        // sampled Bezier surface points and normals
+    MEM_NORMALS,            // per triangle and per vertex normal accumulation
+    MEM_UPLOAD_STAGING,     // CPU side vertex arrays waiting to be uploaded
+    MEM_GPU_BUFFERS,        // buffer objects on the GPU
+    MEM_CLUSTERS,           // cluster index lists and bounding volume hierarchies
+    MEM_LOD,                // simplified levels of detail of OBJ meshes
+    MEM_TAG_COUNT
+};
+
+const char *mem_tag_name(MemTag tag);
+
+void mem_track_alloc(MemTag tag, size_t bytes);
+
+void mem_track_free(MemTag tag, size_t bytes);
+
+size_t mem_current(MemTag tag);
+
+size_t mem_peak(MemTag tag);
+
+// one line per tag with current and peak usage, for the overlay and reports
+std::vector<std::string> mem_summary();
+
+void mem_print_report(std::ostream &out);
+
+// std allocator that charges a tag for everything it hands out
+template<typename T, MemTag Tag>
+class TrackedAllocator {
+public:
+    typedef T value_type;
+
+    template<typename U>
+    struct rebind {
+        typedef TrackedAllocator<U, Tag> other;
+    };
+
+    TrackedAllocator() { }
+
+    template<typename U>
+    TrackedAllocator(const TrackedAllocator<U, Tag> &) { }
+
+    T *allocate(size_t n) {
+        mem_track_alloc(Tag, n * sizeof(T));
+        return static_cast<T *>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T *p, size_t n) {
+        mem_track_free(Tag, n * sizeof(T));
+        ::operator delete(p);
+    }
+
+    template<typename U>
+    bool operator==(const TrackedAllocator<U, Tag> &) const {
+        return true;
+    }
+
+    template<typename U>
+    bool operator!=(const TrackedAllocator<U, Tag> &) const {
+        return false;
+    }
+};
+
+template<typename T, MemTag Tag>
+using tracked_vector = std::vector<T, TrackedAllocator<T, Tag> >;
+
+#endif //GLRENDER_MEMSTATS_H
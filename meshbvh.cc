@@ -0,0 +1,130 @@
+#include "meshbvh.h"
+
+#include <algorithm>
+
+static vec3 corner_position(const float *verts, const int *corners, size_t i) {
+    const float *v = verts + 3 * corners[i];
+    return vec3(v[0], v[1], v[2]);
+}
+
+void MeshBvh::build(const float *verts, const int *corners, size_t corner_count) {
+    clear();
+
+    size_t triangles = corner_count / 3;
+    if (!triangles) {
+        return;
+    }
+
+    tracked_vector<vec3, MEM_CLUSTERS> centroids(triangles);
+    _triangles.resize(triangles);
+    for (size_t t = 0; t < triangles; ++t) {
+        centroids[t] = (corner_position(verts, corners, 3 * t) + corner_position(verts, corners, 3 * t + 1) +
+                        corner_position(verts, corners, 3 * t + 2)) / 3.0;
+        _triangles[t] = (GLuint) t;
+    }
+
+    _nodes.reserve(2 * (triangles / CLUSTER_TRIANGLES + 1));
+    build_node(0, (GLuint) triangles, verts, corners, centroids);
+
+    _indices.resize(3 * triangles);
+    for (size_t t = 0; t < triangles; ++t) {
+        for (int k = 0; k < 3; ++k) {
+            _indices[3 * t + k] = 3 * _triangles[t] + k;
+        }
+    }
+    tracked_vector<GLuint, MEM_CLUSTERS>().swap(_triangles);
+}
+
+// builds the node over _triangles[begin, end) and returns its index
+int MeshBvh::build_node(GLuint begin, GLuint end, const float *verts, const int *corners,
+                        tracked_vector<vec3, MEM_CLUSTERS> &centroids) {
+    int index = (int) _nodes.size();
+    _nodes.push_back(Node());
+
+    Node node;
+    node.first = 3 * begin;
+    node.count = 3 * (end - begin);
+    node.clusters = 1;
+    node.left = node.right = -1;
+
+    if (end - begin <= CLUSTER_TRIANGLES) {
+        for (GLuint t = begin; t < end; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                node.bounds.extend(corner_position(verts, corners, 3 * _triangles[t] + k));
+            }
+        }
+        _nodes[index] = node;
+        return index;
+    }
+
+    Bounds centers;
+    for (GLuint t = begin; t < end; ++t) {
+        centers.extend(centroids[_triangles[t]]);
+    }
+    vec3 extent = centers.extent();
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    GLuint middle = begin + (end - begin) / 2;
+    std::nth_element(_triangles.begin() + begin, _triangles.begin() + middle, _triangles.begin() + end,
+                     [&centroids, axis](GLuint a, GLuint b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    // _nodes may move while the children are built
+    node.left = build_node(begin, middle, verts, corners, centroids);
+    node.right = build_node(middle, end, verts, corners, centroids);
+    node.bounds = _nodes[node.left].bounds;
+    node.bounds.extend(_nodes[node.right].bounds);
+    node.clusters = _nodes[node.left].clusters + _nodes[node.right].clusters;
+    _nodes[index] = node;
+    return index;
+}
+
+void MeshBvh::clear() {
+    _nodes.clear();
+    _triangles.clear();
+    _indices.clear();
+}
+
+void MeshBvh::release_indices() {
+    tracked_vector<GLuint, MEM_CLUSTERS>().swap(_indices);
+}
+
+void MeshBvh::cull(const ViewFrustum &frustum, std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets,
+                   CullStats &stats) const {
+    counts.clear();
+    offsets.clear();
+    stats.visible_clusters = stats.culled_clusters = stats.visible_triangles = 0;
+    if (_nodes.empty()) {
+        return;
+    }
+
+    GLuint next = 0;    // end of the last range, to merge with
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+
+    while (top > 0) {
+        const Node &node = _nodes[stack[--top]];
+
+        ViewFrustum::Visibility visibility = frustum.classify(node.bounds);
+        if (visibility == ViewFrustum::OUTSIDE) {
+            stats.culled_clusters += node.clusters;
+            continue;
+        }
+        if (visibility == ViewFrustum::INTERSECTS && node.left >= 0) {
+            // right first, so that ranges come out in order and merge
+            stack[top++] = node.right;
+            stack[top++] = node.left;
+            continue;
+        }
+
+        if (!counts.empty() && node.first == next) {
+            counts.back() += node.count;
+        } else {
+            counts.push_back(node.count);
+            offsets.push_back(BUFFER_OFFSET(sizeof(GLuint) * node.first));
+        }
+        next = node.first + node.count;
+        stats.visible_clusters += node.clusters;
+        stats.visible_triangles += node.count / 3;
+    }
+}
@@ -0,0 +1,82 @@
+#ifndef GLRENDER_MESHBVH_H
+#define GLRENDER_MESHBVH_H
+
+#include <vector>
+
+#include "amath.h"
+#include "memstats.h"
+#include "frustum.h"
+
+// A bounding volume hierarchy over the triangles of a mesh, for frustum
+// culling.
+//
+// The triangles are split at the median of their centroids along the longest
+// axis until no more than CLUSTER_TRIANGLES are left; those leaves are the
+// clusters. indices() lists the vertices of the triangles in leaf order, so
+// that every node, leaf or not, covers one contiguous range of it: a node
+// found entirely inside the frustum is drawn as a single range, without
+// looking at its children.
+class MeshBvh {
+public:
+    static const size_t CLUSTER_TRIANGLES = 512;
+
+    struct Node {
+        Bounds bounds;
+        GLuint first;       // range of indices()
+        GLuint count;
+        GLuint clusters;    // leaves below (or 1 for a leaf)
+        int left;           // children, -1 for a leaf
+        int right;
+    };
+
+    struct CullStats {
+        size_t visible_clusters;
+        size_t culled_clusters;
+        size_t visible_triangles;
+    };
+
+    // triangles whose vertex i, in draw order, is vertex corners[i] of the
+    // xyz triples in verts
+    void build(const float *verts, const int *corners, size_t corner_count);
+
+    void clear();
+
+    // draw ranges (in index counts and byte offsets into indices()) of the
+    // nodes the frustum sees, adjacent ones merged
+    void cull(const ViewFrustum &frustum, std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets,
+              CullStats &stats) const;
+
+    inline const tracked_vector<GLuint, MEM_CLUSTERS> &indices() const {
+        return _indices;
+    }
+
+    // triangles may be reordered within a leaf, e.g. into meshlets
+    inline tracked_vector<GLuint, MEM_CLUSTERS> &indices() {
+        return _indices;
+    }
+
+    inline const tracked_vector<Node, MEM_CLUSTERS> &nodes() const {
+        return _nodes;
+    }
+
+    // once the indices are in a buffer object
+    void release_indices();
+
+    inline bool empty() const {
+        return _nodes.empty();
+    }
+
+    inline size_t clusters() const {
+        return _nodes.empty() ? 0 : _nodes[0].clusters;
+    }
+
+private:
+    int build_node(GLuint begin, GLuint end, const float *verts, const int *corners,
+                   tracked_vector<vec3, MEM_CLUSTERS> &centroids);
+
+    tracked_vector<Node, MEM_CLUSTERS> _nodes;
+    tracked_vector<GLuint, MEM_CLUSTERS> _triangles;    // in leaf order, while building
+    tracked_vector<GLuint, MEM_CLUSTERS> _indices;
+};
+
+#endif //GLRENDER_MESHBVH_H
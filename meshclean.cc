@@ -0,0 +1,206 @@
+#include "meshclean.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// vertices per task of the parallel passes
+static const size_t VERTICES_PER_TASK = 1 << 14;
+
+// a face whose cross product is this small against its longest edge squared
+// has no area that the float math of its normal could tell from none
+static const double DEGENERATE_AREA = 1e-6;
+
+// the most cells out from the origin along an axis, with room for the cells
+// around them
+static const double CELL_LIMIT = (double) (1LL << 62);
+
+// the cell of a coordinate, divided in double so that vertices within
+// epsilon are at most a cell apart; clamped, so that no vertex (not even a
+// NaN) makes a cell out of range
+static inline int64_t cell_coordinate(float x, float epsilon) {
+    double cell = floor((double) x / epsilon);
+    return (int64_t) std::max(-CELL_LIMIT, std::min(CELL_LIMIT, cell));
+}
+
+MeshCleaner::MeshCleaner(float epsilon)
+        : _epsilon(epsilon), _shards(SHARDS) {
+    _stats.welded_vertices = 0;
+    _stats.unused_vertices = 0;
+    _stats.degenerate_faces = 0;
+    _stats.duplicate_faces = 0;
+}
+
+MeshCleaner::Cell MeshCleaner::cell_of(const float *p) const {
+    Cell cell;
+    if (_epsilon > 0) {
+        cell.x = cell_coordinate(p[0], _epsilon);
+        cell.y = cell_coordinate(p[1], _epsilon);
+        cell.z = cell_coordinate(p[2], _epsilon);
+    } else {
+        // the position itself; adding 0 turns -0 into 0
+        float position[3] = {p[0] + 0.0f, p[1] + 0.0f, p[2] + 0.0f};
+        uint32_t bits[3];
+        memcpy(bits, position, sizeof(bits));
+        cell.x = bits[0];
+        cell.y = bits[1];
+        cell.z = bits[2];
+    }
+    return cell;
+}
+
+// the first vertex within epsilon of v, which may be v itself. Two vertices
+// within epsilon are at most a cell apart; at 0 they share the cell.
+int MeshCleaner::first_close(int v, const float *verts) const {
+    const float *p = verts + 3 * v;
+    const Cell &cell = _cells[v];
+    int reach = _epsilon > 0 ? 1 : 0;
+    float epsilon2 = _epsilon * _epsilon;
+    int best = v;
+    for (int dx = -reach; dx <= reach; ++dx) {
+        for (int dy = -reach; dy <= reach; ++dy) {
+            for (int dz = -reach; dz <= reach; ++dz) {
+                Cell key = {cell.x + dx, cell.y + dy, cell.z + dz};
+                const CellMap &shard = _shards[CellHash()(key) % SHARDS];
+                auto it = shard.find(key);
+                if (it == shard.end()) {
+                    continue;
+                }
+                for (int u = it->second; u >= 0; u = _next[u]) {
+                    if (u >= best) {
+                        continue;
+                    }
+                    const float *q = verts + 3 * u;
+                    float d0 = q[0] - p[0], d1 = q[1] - p[1], d2 = q[2] - p[2];
+                    if (d0 * d0 + d1 * d1 + d2 * d2 <= epsilon2) {
+                        best = u;
+                    }
+                }
+            }
+        }
+    }
+    return best;
+}
+
+void MeshCleaner::add_vertices(const tracked_vector<float, MEM_PARSER> &verts, ThreadPool &pool) {
+    size_t first = _cells.size();
+    size_t count = verts.size() / 3;
+    if (count <= first) {
+        return;
+    }
+    _cells.resize(count);
+    _next.resize(count, -1);
+    _root.resize(count);
+
+    size_t tasks = (count - first + VERTICES_PER_TASK - 1) / VERTICES_PER_TASK;
+    std::vector<unsigned char> shard_of(count - first);
+    pool.run(tasks, [&](size_t task) {
+        size_t begin = first + task * VERTICES_PER_TASK;
+        size_t end = std::min(count, begin + VERTICES_PER_TASK);
+        for (size_t v = begin; v < end; ++v) {
+            _cells[v] = cell_of(&verts[3 * v]);
+            shard_of[v - first] = (unsigned char) (CellHash()(_cells[v]) % SHARDS);
+        }
+    });
+
+    // every shard takes its cells' vertices in file order
+    pool.run(SHARDS, [&](size_t s) {
+        CellMap &shard = _shards[s];
+        for (size_t v = first; v < count; ++v) {
+            if (shard_of[v - first] != s) {
+                continue;
+            }
+            auto inserted = shard.insert(std::make_pair(_cells[v], (int) v));
+            if (!inserted.second) {
+                _next[v] = inserted.first->second;
+                inserted.first->second = (int) v;
+            }
+        }
+    });
+
+    pool.run(tasks, [&](size_t task) {
+        size_t begin = first + task * VERTICES_PER_TASK;
+        size_t end = std::min(count, begin + VERTICES_PER_TASK);
+        for (size_t v = begin; v < end; ++v) {
+            _root[v] = first_close((int) v, verts.data());
+        }
+    });
+
+    // a vertex is welded to one before it, so in file order the root of
+    // that one is already final
+    for (size_t v = first; v < count; ++v) {
+        _root[v] = _root[_root[v]];
+        if (_root[v] != (int) v) {
+            ++_stats.welded_vertices;
+        }
+    }
+}
+
+bool MeshCleaner::add_face(int *tri, const tracked_vector<float, MEM_PARSER> &verts) {
+    for (int k = 0; k < 3; ++k) {
+        tri[k] = _root[tri[k]];
+    }
+    if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+        ++_stats.degenerate_faces;
+        return false;
+    }
+
+    const float *a = &verts[3 * tri[0]], *b = &verts[3 * tri[1]], *c = &verts[3 * tri[2]];
+    double e1[3], e2[3], e3[3];
+    for (int k = 0; k < 3; ++k) {
+        e1[k] = b[k] - a[k];
+        e2[k] = c[k] - a[k];
+        e3[k] = c[k] - b[k];
+    }
+    double n[3] = {e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0]};
+    double area2 = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+    double longest2 = std::max(e1[0] * e1[0] + e1[1] * e1[1] + e1[2] * e1[2],
+                               std::max(e2[0] * e2[0] + e2[1] * e2[1] + e2[2] * e2[2],
+                                        e3[0] * e3[0] + e3[1] * e3[1] + e3[2] * e3[2]));
+    double least = DEGENERATE_AREA * longest2;
+    if (!(area2 > least * least)) {
+        ++_stats.degenerate_faces;
+        return false;
+    }
+
+    // a face turned the other way is a duplicate as well: it covers the
+    // same area, and its normal cancels the other one's at the corners
+    Face face = {tri[0], tri[1], tri[2]};
+    if (face.a > face.b) {
+        std::swap(face.a, face.b);
+    }
+    if (face.b > face.c) {
+        std::swap(face.b, face.c);
+    }
+    if (face.a > face.b) {
+        std::swap(face.a, face.b);
+    }
+    if (!_faces.insert(face).second) {
+        ++_stats.duplicate_faces;
+        return false;
+    }
+    return true;
+}
+
+void MeshCleaner::compact(tracked_vector<float, MEM_PARSER> &verts, tracked_vector<int, MEM_PARSER> &tris) {
+    size_t count = verts.size() / 3;
+    std::vector<int> index(count, -1);
+    for (int v : tris) {
+        index[v] = 0;
+    }
+
+    int next = 0;
+    for (size_t v = 0; v < count; ++v) {
+        if (index[v] < 0) {
+            continue;
+        }
+        index[v] = next;
+        std::copy(verts.begin() + 3 * v, verts.begin() + 3 * v + 3, verts.begin() + 3 * next);
+        ++next;
+    }
+    verts.resize(3 * (size_t) next);
+    for (int &v : tris) {
+        v = index[v];
+    }
+    _stats.unused_vertices = count - next;
+}
@@ -0,0 +1,108 @@
+#ifndef GLRENDER_MESHCLEAN_H
+#define GLRENDER_MESHCLEAN_H
+
+#include <stdint.h>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "memstats.h"
+#include "threadpool.h"
+
+// Cleans up an OBJ mesh as it is parsed: vertices at the same position, or
+// within `epsilon` of each other, are welded into the first of them, and
+// faces that are left with no area, or that repeat a face before them, are
+// dropped. Scanned meshes are full of both, and a face with no area has no
+// normal to add to its vertices.
+//
+// Vertices are put in a spatial hash of cells `epsilon` wide (or, at 0, of
+// exact positions), split into shards by cell that are filled in parallel.
+// Each vertex is then welded, in parallel, to the first vertex of the file
+// within reach in the cells around it, so the result is the same however
+// the work is split.
+class MeshCleaner {
+public:
+    struct Stats {
+        size_t welded_vertices;     // merged into a vertex before them
+        size_t unused_vertices;     // dropped by compact(), welded or not
+        size_t degenerate_faces;    // no area, or a repeated corner
+        size_t duplicate_faces;     // the corners of a face before, in either turn
+    };
+
+    explicit MeshCleaner(float epsilon = 0);
+
+    MeshCleaner(const MeshCleaner &) = delete;
+
+    MeshCleaner &operator=(const MeshCleaner &) = delete;
+
+    // welds the vertices appended to `verts` since the last call, to each
+    // other and to the ones before
+    void add_vertices(const tracked_vector<float, MEM_PARSER> &verts, ThreadPool &pool);
+
+    // points the corners of a face at the welded vertices; false if the face
+    // is to be dropped. The corners have to be vertices added before.
+    bool add_face(int *tri, const tracked_vector<float, MEM_PARSER> &verts);
+
+    // leaves out of `verts` the vertices no face uses, those welded away
+    // among them, and renumbers `tris` to match
+    void compact(tracked_vector<float, MEM_PARSER> &verts, tracked_vector<int, MEM_PARSER> &tris);
+
+    inline const Stats &stats() const {
+        return _stats;
+    }
+
+private:
+    // 64 bits wide, so that a small epsilon on a large mesh still has a
+    // cell for every vertex
+    struct Cell {
+        int64_t x, y, z;
+
+        inline bool operator==(const Cell &o) const {
+            return x == o.x && y == o.y && z == o.z;
+        }
+    };
+
+    struct CellHash {
+        inline size_t operator()(const Cell &c) const {
+            return (size_t) ((uint64_t) c.x * 73856093u ^ (uint64_t) c.y * 19349663u ^ (uint64_t) c.z * 83492791u);
+        }
+    };
+
+    // a face by its corners, in increasing order
+    struct Face {
+        int a, b, c;
+
+        inline bool operator==(const Face &o) const {
+            return a == o.a && b == o.b && c == o.c;
+        }
+    };
+
+    struct FaceHash {
+        inline size_t operator()(const Face &f) const {
+            return (size_t) ((uint32_t) f.a * 73856093u ^ (uint32_t) f.b * 19349663u ^ (uint32_t) f.c * 83492791u);
+        }
+    };
+
+    static const int SHARDS = 16;
+
+    // the cleaner's tables are the largest the parser makes, and are charged
+    // to it like the rest
+    typedef std::unordered_map<Cell, int, CellHash, std::equal_to<Cell>,
+                               TrackedAllocator<std::pair<const Cell, int>, MEM_PARSER> > CellMap;
+    typedef std::unordered_set<Face, FaceHash, std::equal_to<Face>, TrackedAllocator<Face, MEM_PARSER> > FaceSet;
+
+    Cell cell_of(const float *p) const;
+
+    // the first vertex within epsilon of v, v itself if there is none
+    int first_close(int v, const float *verts) const;
+
+    float _epsilon;
+    std::vector<CellMap> _shards;
+    tracked_vector<Cell, MEM_PARSER> _cells;
+    tracked_vector<int, MEM_PARSER> _next;      // per vertex, the one before it in its cell, or -1
+    tracked_vector<int, MEM_PARSER> _root;      // per vertex, the vertex it is welded into
+    FaceSet _faces;
+    Stats _stats;
+};
+
+#endif //GLRENDER_MESHCLEAN_H
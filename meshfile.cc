@@ -0,0 +1,450 @@
+#include "meshfile.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <vector>
+
+#include "mappedfile.h"
+
+static const char MESH_MAGIC[8] = {'G', 'L', 'R', 'M', 'S', 'H', '0', '1'};
+
+// the header after the magic, in uint32s and floats
+static const size_t HEADER_WORDS = 5 + 6;
+static const size_t HEADER_BYTES = sizeof(MESH_MAGIC) + 4 * HEADER_WORDS;
+
+// a block is a task of the encoder and the decoder, and a few hundred KB.
+// The reader takes no bigger blocks than the writer makes, so that a block
+// can't ask for more memory than that.
+static const uint32_t VERTICES_PER_BLOCK = 1 << 16;
+static const uint32_t INDICES_PER_BLOCK = 3 << 16;
+
+// a varint is 1 to 5 bytes
+static const size_t MAX_VARINT_BYTES = 5;
+
+static const int MAX_POSITION_BITS = 24;
+
+// rANS with 12 bit frequencies and a 32 bit state renormalized a byte at a
+// time, kept in [RANS_LOW, RANS_LOW << 8)
+static const int PROB_BITS = 12;
+static const uint32_t PROB_SCALE = 1 << PROB_BITS;
+static const uint32_t RANS_LOW = 1u << 23;
+static const size_t FREQUENCY_BYTES = 256 * sizeof(uint16_t);
+
+static inline uint32_t zigzag(uint32_t delta) {
+    return (delta << 1) ^ (uint32_t) ((int32_t) delta >> 31);
+}
+
+static inline uint32_t unzigzag(uint32_t v) {
+    return (v >> 1) ^ (0u - (v & 1));
+}
+
+static inline void put_varint(std::vector<uint8_t> &out, uint32_t v) {
+    while (v >= 0x80) {
+        out.push_back((uint8_t) (v | 0x80));
+        v >>= 7;
+    }
+    out.push_back((uint8_t) v);
+}
+
+// a varint of at most 5 bytes at p; NULL if it runs past end. Most are a
+// single byte.
+static inline const uint8_t *get_varint(const uint8_t *p, const uint8_t *end, uint32_t &v) {
+    if (p < end && *p < 0x80) {
+        v = *p;
+        return p + 1;
+    }
+    v = 0;
+    for (int shift = 0; shift < 35 && p < end; shift += 7) {
+        uint8_t b = *p++;
+        v |= (uint32_t) (b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return p;
+        }
+    }
+    return NULL;
+}
+
+static bool decode_positions(const uint8_t *p, const uint8_t *end, size_t count, const float *offset,
+                             const float *step, float *out) {
+    uint32_t q[3] = {0, 0, 0};
+    for (size_t i = 0; i < 3 * count; i += 3) {
+        for (int k = 0; k < 3; ++k) {
+            uint32_t v;
+            if (!(p = get_varint(p, end, v))) {
+                return false;
+            }
+            q[k] += unzigzag(v);
+            out[i + k] = offset[k] + (float) q[k] * step[k];
+        }
+    }
+    return p == end;
+}
+
+static bool decode_indices(const uint8_t *p, const uint8_t *end, size_t count, int *out) {
+    uint32_t index = 0;
+    for (size_t i = 0; i < count; ++i) {
+        uint32_t v;
+        if (!(p = get_varint(p, end, v))) {
+            return false;
+        }
+        index += unzigzag(v);
+        out[i] = (int) index;
+    }
+    return p == end;
+}
+
+// one rANS state's step for the symbol in its low bits: the state goes down
+// by the symbol's share and takes in bytes until it is back over RANS_LOW.
+// A slot holds the symbol, its frequency - 1 and how far into the symbol's
+// range the slot is.
+static inline uint8_t rans_step(uint32_t &x, const uint32_t *slots, const uint8_t *&p, const uint8_t *end) {
+    uint32_t slot = slots[x & (PROB_SCALE - 1)];
+    x = (((slot >> 8) & (PROB_SCALE - 1)) + 1) * (x >> PROB_BITS) + (slot >> 20);
+    while (x < RANS_LOW && p < end) {
+        x = (x << 8) | *p++;
+    }
+    return (uint8_t) slot;
+}
+
+// decodes the `count` varint bytes of an entropy coded block into `out`;
+// false if the block is broken. Even and odd symbols are coded by two
+// states, so that the two chains of multiplies overlap.
+static bool rans_decode(const uint8_t *data, size_t size, uint8_t *out, size_t count) {
+    if (size < FREQUENCY_BYTES + 8) {
+        return false;
+    }
+    uint16_t freq[256];
+    memcpy(freq, data, FREQUENCY_BYTES);
+    std::vector<uint32_t> slots(PROB_SCALE);
+    uint32_t next = 0;
+    for (uint32_t s = 0; s < 256; ++s) {
+        if (next + freq[s] > PROB_SCALE) {
+            return false;
+        }
+        for (uint32_t i = 0; i < freq[s]; ++i) {
+            slots[next + i] = s | (freq[s] - 1u) << 8 | i << 20;
+        }
+        next += freq[s];
+    }
+    if (next != PROB_SCALE) {
+        return false;
+    }
+
+    const uint8_t *p = data + FREQUENCY_BYTES;
+    const uint8_t *end = data + size;
+    uint32_t x[2];
+    for (int j = 0; j < 2; ++j, p += 4) {
+        x[j] = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16 | (uint32_t) p[3] << 24;
+    }
+    size_t i = 0;
+    for (; i + 1 < count; i += 2) {
+        out[i] = rans_step(x[0], slots.data(), p, end);
+        out[i + 1] = rans_step(x[1], slots.data(), p, end);
+    }
+    if (i < count) {
+        out[i] = rans_step(x[0], slots.data(), p, end);
+    }
+    // the encoder started both states from RANS_LOW, so a stream decoded to
+    // its end is back there
+    return p == end && x[0] == RANS_LOW && x[1] == RANS_LOW;
+}
+
+// frequencies summing to PROB_SCALE, at least 1 for every symbol that occurs
+static void normalize_frequencies(const size_t *counts, size_t total, uint16_t *freq) {
+    uint32_t sum = 0;
+    int largest = 0;
+    for (int s = 0; s < 256; ++s) {
+        freq[s] = counts[s] ? (uint16_t) std::max<uint64_t>(1, (uint64_t) counts[s] * PROB_SCALE / total) : 0;
+        sum += freq[s];
+        if (counts[s] > counts[largest]) {
+            largest = s;
+        }
+    }
+    // rounding down leaves the sum short, which the most frequent symbol
+    // makes up; rounding rare symbols up to 1 can overshoot, which the most
+    // frequent ones give back
+    while (sum > PROB_SCALE) {
+        int most = 0;
+        for (int s = 1; s < 256; ++s) {
+            if (freq[s] > freq[most]) {
+                most = s;
+            }
+        }
+        --freq[most];
+        --sum;
+    }
+    freq[largest] += (uint16_t) (PROB_SCALE - sum);
+}
+
+// entropy codes `coded` into `block`, or copies it if that comes out no
+// smaller
+static void encode_block(const std::vector<uint8_t> &coded, std::vector<uint8_t> &block) {
+    size_t counts[256] = {0};
+    for (uint8_t b : coded) {
+        ++counts[b];
+    }
+    uint16_t freq[256];
+    uint16_t start[256];
+    normalize_frequencies(counts, coded.size(), freq);
+    uint32_t next = 0;
+    for (int s = 0; s < 256; ++s) {
+        start[s] = (uint16_t) next;
+        next += freq[s];
+    }
+
+    // rANS encodes backwards, so that the decoder goes forwards; a symbol
+    // puts out at most two bytes
+    std::vector<uint8_t> stream(2 * coded.size() + 8);
+    uint8_t *p = stream.data() + stream.size();
+    uint32_t x[2] = {RANS_LOW, RANS_LOW};
+    for (size_t i = coded.size(); i-- > 0;) {
+        uint32_t &state = x[i & 1];
+        uint8_t s = coded[i];
+        uint32_t x_max = ((RANS_LOW >> PROB_BITS) << 8) * freq[s];
+        while (state >= x_max) {
+            *--p = (uint8_t) state;
+            state >>= 8;
+        }
+        state = ((state / freq[s]) << PROB_BITS) + state % freq[s] + start[s];
+    }
+    for (int j = 1; j >= 0; --j) {
+        p -= 4;
+        p[0] = (uint8_t) x[j];
+        p[1] = (uint8_t) (x[j] >> 8);
+        p[2] = (uint8_t) (x[j] >> 16);
+        p[3] = (uint8_t) (x[j] >> 24);
+    }
+
+    size_t stream_bytes = stream.data() + stream.size() - p;
+    if (FREQUENCY_BYTES + stream_bytes >= coded.size()) {
+        block = coded;
+        return;
+    }
+    block.resize(FREQUENCY_BYTES + stream_bytes);
+    memcpy(block.data(), freq, FREQUENCY_BYTES);
+    memcpy(block.data() + FREQUENCY_BYTES, p, stream_bytes);
+}
+
+bool is_mesh_file(const std::string &path) {
+    char magic[sizeof(MESH_MAGIC)];
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (!fp) {
+        return false;
+    }
+    bool match = fread(magic, sizeof(magic), 1, fp) == 1 && memcmp(magic, MESH_MAGIC, sizeof(magic)) == 0;
+    fclose(fp);
+    return match;
+}
+
+bool read_mesh_file(const std::string &path, tracked_vector<float, MEM_PARSER> &verts,
+                    tracked_vector<int, MEM_PARSER> &tris, ThreadPool &pool) {
+    verts.clear();
+    tris.clear();
+
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Fail to read mesh file " << path << std::endl;
+        return false;
+    }
+    if (file.size() < HEADER_BYTES || memcmp(file.data(), MESH_MAGIC, sizeof(MESH_MAGIC)) != 0) {
+        std::cerr << "Mesh file " << path << " is cut short or not a mesh file" << std::endl;
+        return false;
+    }
+
+    // the mapping is page aligned, and everything after the magic is 4 bytes
+    // wide
+    const uint32_t *header = reinterpret_cast<const uint32_t *>(file.data() + sizeof(MESH_MAGIC));
+    size_t vertex_count = header[0];
+    size_t index_count = header[1];
+    int bits = (int) header[2];
+    size_t vertices_per_block = header[3];
+    size_t indices_per_block = header[4];
+    const float *offset = reinterpret_cast<const float *>(header + 5);
+    const float *extent = offset + 3;
+    if (bits < 1 || bits > MAX_POSITION_BITS || !vertices_per_block || !indices_per_block ||
+        vertices_per_block > VERTICES_PER_BLOCK || indices_per_block > INDICES_PER_BLOCK) {
+        std::cerr << "Mesh file " << path << " has a broken header" << std::endl;
+        return false;
+    }
+
+    // the counts only go as far as the file has blocks for, and every block
+    // as far as its varints can decode to, before anything is allocated
+    size_t vertex_blocks = (vertex_count + vertices_per_block - 1) / vertices_per_block;
+    size_t blocks = vertex_blocks + (index_count + indices_per_block - 1) / indices_per_block;
+    if ((file.size() - HEADER_BYTES) / (2 * sizeof(uint32_t)) < blocks) {
+        std::cerr << "Mesh file " << path << " is cut short" << std::endl;
+        return false;
+    }
+    const uint32_t *table = header + HEADER_WORDS;
+    for (size_t b = 0; b < blocks; ++b) {
+        size_t size = table[2 * b];
+        size_t coded = table[2 * b + 1];
+        bool vertex_block = b < vertex_blocks;
+        size_t first = vertex_block ? b * vertices_per_block : (b - vertex_blocks) * indices_per_block;
+        size_t values = vertex_block ? 3 * std::min(vertices_per_block, vertex_count - first)
+                                     : std::min(indices_per_block, index_count - first);
+        bool raw = size == coded;
+        if (coded < values || coded > MAX_VARINT_BYTES * values ||
+            (!raw && (size < FREQUENCY_BYTES + 8 || size > coded))) {
+            std::cerr << "Mesh file " << path << " has a broken block " << b << std::endl;
+            return false;
+        }
+    }
+    std::vector<size_t> starts(blocks + 1, HEADER_BYTES + 2 * sizeof(uint32_t) * blocks);
+    for (size_t b = 0; b < blocks; ++b) {
+        starts[b + 1] = starts[b] + table[2 * b];
+    }
+    if (file.size() != starts[blocks]) {
+        std::cerr << "Mesh file " << path << " doesn't have the size its header gives" << std::endl;
+        return false;
+    }
+
+    float step[3];
+    for (int k = 0; k < 3; ++k) {
+        step[k] = extent[k] / (float) ((1u << bits) - 1);
+    }
+    verts.resize(3 * vertex_count);
+    tris.resize(index_count);
+
+    std::vector<unsigned char> broken(blocks, 0);
+    pool.run(blocks, [&](size_t b) {
+        const uint8_t *data = reinterpret_cast<const uint8_t *>(file.data()) + starts[b];
+        size_t size = table[2 * b];
+        size_t coded = table[2 * b + 1];
+        bool vertex_block = b < vertex_blocks;
+        size_t first = vertex_block ? b * vertices_per_block : (b - vertex_blocks) * indices_per_block;
+        size_t count = vertex_block ? std::min(vertices_per_block, vertex_count - first)
+                                    : std::min(indices_per_block, index_count - first);
+        tracked_vector<uint8_t, MEM_PARSER> scratch;
+        if (size != coded) {
+            scratch.resize(coded);
+            if (!rans_decode(data, size, scratch.data(), coded)) {
+                broken[b] = 1;
+                return;
+            }
+            data = scratch.data();
+        }
+        bool ok = vertex_block ? decode_positions(data, data + coded, count, offset, step, &verts[3 * first])
+                               : decode_indices(data, data + coded, count, &tris[first]);
+        broken[b] = !ok;
+    });
+
+    for (size_t b = 0; b < blocks; ++b) {
+        if (broken[b]) {
+            std::cerr << "Mesh file " << path << " has a broken block " << b << std::endl;
+            verts.clear();
+            tris.clear();
+            return false;
+        }
+    }
+    return true;
+}
+
+bool write_mesh_file(const std::string &path, const float *positions, size_t vertex_count, size_t stride,
+                     const uint32_t *indices, size_t index_count, int position_bits, ThreadPool &pool,
+                     MeshFileStats &stats) {
+    auto start_time = std::chrono::steady_clock::now();
+    stats.bytes = 0;
+    stats.max_error = 0;
+    if (position_bits < 1 || position_bits > MAX_POSITION_BITS) {
+        std::cerr << "Mesh positions can't be quantized to " << position_bits << " bits" << std::endl;
+        return false;
+    }
+
+    float box[6] = {0, 0, 0, 0, 0, 0};
+    if (vertex_count) {
+        float high[3];
+        for (int k = 0; k < 3; ++k) {
+            box[k] = high[k] = positions[k];
+        }
+        for (size_t i = 1; i < vertex_count; ++i) {
+            for (int k = 0; k < 3; ++k) {
+                box[k] = std::min(box[k], positions[i * stride + k]);
+                high[k] = std::max(high[k], positions[i * stride + k]);
+            }
+        }
+        for (int k = 0; k < 3; ++k) {
+            box[3 + k] = high[k] - box[k];
+        }
+    }
+    uint32_t top = (1u << position_bits) - 1;
+    float step[3], inverse[3];
+    for (int k = 0; k < 3; ++k) {
+        // a flat axis has a step of 0, and everything on it lands on the offset
+        step[k] = box[3 + k] / (float) top;
+        inverse[k] = box[3 + k] > 0 ? (float) top / box[3 + k] : 0.0f;
+    }
+
+    size_t vertex_blocks = (vertex_count + VERTICES_PER_BLOCK - 1) / VERTICES_PER_BLOCK;
+    size_t blocks = vertex_blocks + (index_count + INDICES_PER_BLOCK - 1) / INDICES_PER_BLOCK;
+    std::vector<std::vector<uint8_t> > encoded(blocks);
+    std::vector<uint32_t> table(2 * blocks);
+    std::vector<float> errors(blocks, 0.0f);
+    pool.run(blocks, [&](size_t b) {
+        std::vector<uint8_t> coded;
+        if (b < vertex_blocks) {
+            size_t first = b * VERTICES_PER_BLOCK;
+            size_t last = std::min<size_t>(vertex_count, first + VERTICES_PER_BLOCK);
+            coded.reserve(4 * (last - first));
+            uint32_t previous[3] = {0, 0, 0};
+            for (size_t i = first; i < last; ++i) {
+                for (int k = 0; k < 3; ++k) {
+                    float p = positions[i * stride + k];
+                    float scaled = std::min(std::max((p - box[k]) * inverse[k] + 0.5f, 0.0f), (float) top);
+                    uint32_t q = (uint32_t) scaled;
+                    errors[b] = std::max(errors[b], std::fabs(box[k] + (float) q * step[k] - p));
+                    put_varint(coded, zigzag(q - previous[k]));
+                    previous[k] = q;
+                }
+            }
+        } else {
+            size_t first = (b - vertex_blocks) * INDICES_PER_BLOCK;
+            size_t last = std::min<size_t>(index_count, first + INDICES_PER_BLOCK);
+            coded.reserve(2 * (last - first));
+            uint32_t previous = 0;
+            for (size_t i = first; i < last; ++i) {
+                put_varint(coded, zigzag(indices[i] - previous));
+                previous = indices[i];
+            }
+        }
+        encode_block(coded, encoded[b]);
+        table[2 * b] = (uint32_t) encoded[b].size();
+        table[2 * b + 1] = (uint32_t) coded.size();
+    });
+
+    uint32_t header[5] = {(uint32_t) vertex_count, (uint32_t) index_count, (uint32_t) position_bits,
+                          VERTICES_PER_BLOCK, INDICES_PER_BLOCK};
+
+    // write to the side and rename, so a reader never sees half a file
+    std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Fail to write mesh file " << path << std::endl;
+        return false;
+    }
+    bool ok = fwrite(MESH_MAGIC, sizeof(MESH_MAGIC), 1, fp) == 1 &&
+              fwrite(header, sizeof(header), 1, fp) == 1 &&
+              fwrite(box, sizeof(box), 1, fp) == 1 &&
+              fwrite(table.data(), sizeof(uint32_t), table.size(), fp) == table.size();
+    stats.bytes = HEADER_BYTES + sizeof(uint32_t) * table.size();
+    for (size_t b = 0; b < blocks && ok; ++b) {
+        ok = fwrite(encoded[b].data(), 1, encoded[b].size(), fp) == encoded[b].size();
+        stats.bytes += encoded[b].size();
+    }
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        std::cerr << "Fail to write mesh file " << path << std::endl;
+        return false;
+    }
+
+    for (float error : errors) {
+        stats.max_error = std::max(stats.max_error, error);
+    }
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_time).count();
+    return true;
+}
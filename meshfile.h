@@ -0,0 +1,58 @@
+#ifndef GLRENDER_MESHFILE_H
+#define GLRENDER_MESHFILE_H
+
+#include <stdint.h>
+#include <string>
+
+#include "memstats.h"
+#include "threadpool.h"
+
+// Compressed triangle meshes, a fraction of the size of the OBJ text and
+// decoded in parallel at memory speed instead of parsed.
+//
+// Positions are quantized to `position_bits` per coordinate on a grid over
+// the bounding box. The vertices and the triangle indices are cut into
+// blocks that decode on their own; in each block every value is stored as
+// the difference to the one before it (per coordinate for positions), zig-zag
+// mapped and written as a varint of 7 bits a byte. Neighbouring vertices and
+// the corners of a triangle are mostly close, so most differences take a
+// byte or two. The bytes of a block are then entropy coded with rANS over
+// their own frequencies, unless that wouldn't make the block smaller.
+//
+//   char     magic[8]                  "GLRMSH01"
+//   uint32   vertex count
+//   uint32   index count, 3 per triangle
+//   uint32   position bits
+//   uint32   vertices per block
+//   uint32   indices per block
+//   float    offset[3], extent[3]      the grid's box
+//   uint32   size, coded size          per block, vertex blocks first
+//   ...      the blocks, back to back
+//
+// A block whose size is its coded size holds the varints as they are; any
+// other is a table of 256 uint16 symbol frequencies summing to 4096, then
+// the rANS stream, which starts with the coder's 32 bit state.
+
+// what write_mesh_file did
+struct MeshFileStats {
+    size_t bytes;           // of the file
+    float max_error;        // furthest any coordinate moved on the grid
+    double ms;
+};
+
+// true if the file is a mesh file, by its magic
+bool is_mesh_file(const std::string &path);
+
+// decodes a mesh file into xyz positions and triangle indices, a block per
+// task; false if the file can't be read or is malformed
+bool read_mesh_file(const std::string &path, tracked_vector<float, MEM_PARSER> &verts,
+                    tracked_vector<int, MEM_PARSER> &tris, ThreadPool &pool);
+
+// encodes `vertex_count` positions, `stride` floats apart, and the indices
+// of their triangles, a block per task. `position_bits` is at most 24, as
+// many as a float holds; false if the file can't be written.
+bool write_mesh_file(const std::string &path, const float *positions, size_t vertex_count, size_t stride,
+                     const uint32_t *indices, size_t index_count, int position_bits, ThreadPool &pool,
+                     MeshFileStats &stats);
+
+#endif //GLRENDER_MESHFILE_H
@@ -0,0 +1,332 @@
+#include "meshlets.h"
+
+#include <algorithm>
+#include <cmath>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// triangles a leaf is cut down to before the meshlets are packed
+static const size_t SORT_GROUP = 8;
+
+static vec3 vertex_position(const float *verts, const int *corners, GLuint index) {
+    const float *v = verts + 3 * corners[index];
+    return vec3(v[0], v[1], v[2]);
+}
+
+// orders triangles[begin, end) so that triangles close in space are close in
+// the order, by splitting at the median centroid along the longest axis
+static void sort_spatially(GLuint *triangles, size_t begin, size_t end,
+                           const tracked_vector<vec3, MEM_CLUSTERS> &centroids) {
+    if (end - begin <= SORT_GROUP) {
+        return;
+    }
+
+    Bounds centers;
+    for (size_t t = begin; t < end; ++t) {
+        centers.extend(centroids[triangles[t]]);
+    }
+    vec3 extent = centers.extent();
+    int axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+
+    size_t middle = begin + (end - begin) / 2;
+    std::nth_element(triangles + begin, triangles + middle, triangles + end,
+                     [&centroids, axis](GLuint a, GLuint b) { return centroids[a][axis] < centroids[b][axis]; });
+    sort_spatially(triangles, begin, middle, centroids);
+    sort_spatially(triangles, middle, end, centroids);
+}
+
+void MeshletSet::build(const float *verts, const int *corners, MeshBvh &bvh) {
+    clear();
+
+    tracked_vector<GLuint, MEM_CLUSTERS> &indices = bvh.indices();
+    tracked_vector<GLuint, MEM_CLUSTERS> triangles;
+    tracked_vector<GLuint, MEM_CLUSTERS> sorted;
+    tracked_vector<vec3, MEM_CLUSTERS> centroids;
+
+    // leaves come in index order, and so do the meshlets
+    for (auto &node : bvh.nodes()) {
+        if (node.left >= 0) {
+            continue;
+        }
+
+        GLuint *leaf = &indices[node.first];
+        size_t count = node.count / 3;
+        triangles.resize(count);
+        centroids.resize(count);
+        for (size_t t = 0; t < count; ++t) {
+            triangles[t] = (GLuint) t;
+            centroids[t] = (vertex_position(verts, corners, leaf[3 * t]) +
+                            vertex_position(verts, corners, leaf[3 * t + 1]) +
+                            vertex_position(verts, corners, leaf[3 * t + 2])) / 3.0;
+        }
+        sort_spatially(triangles.data(), 0, count, centroids);
+
+        sorted.resize(3 * count);
+        for (size_t t = 0; t < count; ++t) {
+            for (int k = 0; k < 3; ++k) {
+                sorted[3 * t + k] = leaf[3 * triangles[t] + k];
+            }
+        }
+        std::copy(sorted.begin(), sorted.end(), leaf);
+
+        // pack consecutive triangles while they fit
+        int distinct[MAX_VERTICES];
+        int vertex_count = 0;
+        size_t meshlet_start = 0;
+        for (size_t t = 0; t < count; ++t) {
+            int added[3];
+            int added_count = 0;
+            for (int k = 0; k < 3; ++k) {
+                int vertex = corners[leaf[3 * t + k]];
+                if (std::find(distinct, distinct + vertex_count, vertex) == distinct + vertex_count &&
+                    std::find(added, added + added_count, vertex) == added + added_count) {
+                    added[added_count++] = vertex;
+                }
+            }
+
+            if (vertex_count + added_count > MAX_VERTICES || t - meshlet_start == (size_t) MAX_TRIANGLES) {
+                add_meshlet(verts, corners, indices.data(), node.first + 3 * (GLuint) meshlet_start,
+                            3 * (GLuint) (t - meshlet_start));
+                meshlet_start = t;
+                vertex_count = 0;
+                // a triangle's own vertices are distinct from each other already
+                added_count = 0;
+                for (int k = 0; k < 3; ++k) {
+                    int vertex = corners[leaf[3 * t + k]];
+                    if (std::find(added, added + added_count, vertex) == added + added_count) {
+                        added[added_count++] = vertex;
+                    }
+                }
+            }
+            std::copy(added, added + added_count, distinct + vertex_count);
+            vertex_count += added_count;
+        }
+        if (count > meshlet_start) {
+            add_meshlet(verts, corners, indices.data(), node.first + 3 * (GLuint) meshlet_start,
+                        3 * (GLuint) (count - meshlet_start));
+        }
+    }
+}
+
+void MeshletSet::add_meshlet(const float *verts, const int *corners, const GLuint *indices, GLuint first,
+                             GLuint count) {
+    Bounds bounds;
+    for (GLuint i = first; i < first + count; ++i) {
+        bounds.extend(vertex_position(verts, corners, indices[i]));
+    }
+    vec3 center = bounds.center();
+    float radius = 0;
+    for (GLuint i = first; i < first + count; ++i) {
+        radius = std::max(radius, length(vertex_position(verts, corners, indices[i]) - center));
+    }
+
+    // the same orientation as the normals of the loader
+    vec3 normals[MAX_TRIANGLES];
+    int normal_count = 0;
+    vec3 sum(0.0, 0.0, 0.0);
+    for (GLuint i = first; i < first + count; i += 3) {
+        vec3 v0 = vertex_position(verts, corners, indices[i]);
+        vec3 v1 = vertex_position(verts, corners, indices[i + 1]);
+        vec3 v2 = vertex_position(verts, corners, indices[i + 2]);
+        vec3 n = cross(v1 - v0, v2 - v1);
+        float n_length = length(n);
+        if (n_length > 0) {
+            normals[normal_count] = n / n_length;
+            sum += normals[normal_count++];
+        }
+    }
+
+    vec3 axis(0.0, 0.0, 1.0);
+    float min_cos = 0;
+    float sum_length = length(sum);
+    if (normal_count && sum_length > 1e-6f) {
+        axis = sum / sum_length;
+        min_cos = 1;
+        for (int i = 0; i < normal_count; ++i) {
+            min_cos = std::min(min_cos, dot(axis, normals[i]));
+        }
+        min_cos = std::max(min_cos, 0.0f);
+    }
+
+    _cx.push_back(center.x);
+    _cy.push_back(center.y);
+    _cz.push_back(center.z);
+    _radius.push_back(radius);
+    _ax.push_back(axis.x);
+    _ay.push_back(axis.y);
+    _az.push_back(axis.z);
+    _cos.push_back(min_cos);
+    _sin.push_back(std::sqrt(1 - min_cos * min_cos));
+    _first.push_back(first);
+    _count.push_back(count);
+}
+
+void MeshletSet::clear() {
+    for (auto *field : {&_cx, &_cy, &_cz, &_radius, &_ax, &_ay, &_az, &_cos, &_sin}) {
+        field->clear();
+    }
+    _first.clear();
+    _count.clear();
+}
+
+// A meshlet faces away if every normal of its cone makes more than 90 degrees
+// with the direction to every point of its sphere. With w the vector from the
+// eye to the center, and d its part along the cone axis, that is
+//
+//   d cos(angle) - sqrt(|w|^2 - d^2) sin(angle) > radius
+//
+// (the distance of the sphere, in the direction the cone's nearest normal
+// points, beyond the eye), which needs no trigonometry per frame.
+int MeshletSet::test(size_t m, size_t count, const ViewFrustum &frustum, const vec3 &eye, bool backfaces,
+                     size_t &outside, size_t &backfacing) const {
+#ifdef __SSE2__
+    if (count == 4) {
+        __m128 cx = _mm_loadu_ps(&_cx[m]);
+        __m128 cy = _mm_loadu_ps(&_cy[m]);
+        __m128 cz = _mm_loadu_ps(&_cz[m]);
+        __m128 radius = _mm_loadu_ps(&_radius[m]);
+        __m128 neg_radius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+        __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+        for (int i = 0; i < 6; ++i) {
+            const vec4 &p = frustum.plane(i);
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.x), cx), _mm_mul_ps(_mm_set1_ps(p.y), cy)),
+                                         _mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.z), cz), _mm_set1_ps(p.w)));
+            inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, neg_radius));
+        }
+        int inside_mask = _mm_movemask_ps(inside);
+        outside += 4 - __builtin_popcount(inside_mask);
+
+        if (!backfaces || !inside_mask) {
+            return inside_mask;
+        }
+
+        __m128 wx = _mm_sub_ps(cx, _mm_set1_ps(eye.x));
+        __m128 wy = _mm_sub_ps(cy, _mm_set1_ps(eye.y));
+        __m128 wz = _mm_sub_ps(cz, _mm_set1_ps(eye.z));
+        __m128 d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_loadu_ps(&_ax[m]), wx), _mm_mul_ps(_mm_loadu_ps(&_ay[m]), wy)),
+                              _mm_mul_ps(_mm_loadu_ps(&_az[m]), wz));
+        __m128 w2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(wx, wx), _mm_mul_ps(wy, wy)), _mm_mul_ps(wz, wz));
+        __m128 across = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(w2, _mm_mul_ps(d, d)), _mm_setzero_ps()));
+        __m128 beyond = _mm_sub_ps(_mm_mul_ps(d, _mm_loadu_ps(&_cos[m])), _mm_mul_ps(across, _mm_loadu_ps(&_sin[m])));
+        int back_mask = _mm_movemask_ps(_mm_cmpgt_ps(beyond, radius)) & inside_mask;
+        backfacing += __builtin_popcount(back_mask);
+
+        return inside_mask & ~back_mask;
+    }
+#endif
+
+    int mask = 0;
+    for (size_t i = 0; i < count; ++i) {
+        size_t k = m + i;
+        if (frustum.outside(vec3(_cx[k], _cy[k], _cz[k]), _radius[k])) {
+            ++outside;
+            continue;
+        }
+        if (backfaces) {
+            float wx = _cx[k] - eye.x, wy = _cy[k] - eye.y, wz = _cz[k] - eye.z;
+            float d = _ax[k] * wx + _ay[k] * wy + _az[k] * wz;
+            float across = std::sqrt(std::max(wx * wx + wy * wy + wz * wz - d * d, 0.0f));
+            if (d * _cos[k] - across * _sin[k] > _radius[k]) {
+                ++backfacing;
+                continue;
+            }
+        }
+        mask |= 1 << i;
+    }
+    return mask;
+}
+
+void MeshletSet::cull_task(size_t begin, size_t end, const ViewFrustum &frustum, const vec3 &eye, bool backfaces,
+                           TaskOutput &out) const {
+    out.counts.clear();
+    out.offsets.clear();
+    out.stats = Stats();
+    out.stats.tested = end - begin;
+
+    // the candidate range holding `begin`
+    size_t r = std::upper_bound(_ranges.begin(), _ranges.end(), begin,
+                                [](size_t pos, const Range &range) { return pos < range.start; }) - _ranges.begin() - 1;
+
+    GLuint next = 0;    // end of the last draw range, to merge with
+    size_t pos = begin;
+    while (pos < end) {
+        const Range &range = _ranges[r];
+        size_t m = range.begin + (pos - range.start);
+        size_t n = std::min(std::min((size_t) 4, range.end - m), end - pos);
+
+        int mask = test(m, n, frustum, eye, backfaces, out.stats.outside, out.stats.backfacing);
+        for (size_t i = 0; i < n; ++i) {
+            if (!(mask & (1 << i))) {
+                continue;
+            }
+            GLuint first = _first[m + i];
+            GLuint count = _count[m + i];
+            if (!out.counts.empty() && first == next) {
+                out.counts.back() += count;
+            } else {
+                out.counts.push_back(count);
+                out.offsets.push_back(BUFFER_OFFSET(sizeof(GLuint) * first));
+            }
+            next = first + count;
+            ++out.stats.visible;
+            out.stats.visible_triangles += count / 3;
+        }
+
+        pos += n;
+        if (m + n == range.end) {
+            ++r;
+        }
+    }
+}
+
+void MeshletSet::cull(const ViewFrustum &frustum, const vec3 &eye, bool backfaces, ThreadPool &pool,
+                      std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets, Stats &stats) {
+    // the meshlets each draw range covers; draw ranges are made of whole
+    // leaves, and so of whole meshlets
+    _ranges.clear();
+    size_t total = 0;
+    for (size_t i = 0; i < counts.size(); ++i) {
+        GLuint first = (GLuint) ((size_t) offsets[i] / sizeof(GLuint));
+        Range range;
+        range.begin = std::lower_bound(_first.begin(), _first.end(), first) - _first.begin();
+        range.end = std::lower_bound(_first.begin(), _first.end(), first + counts[i]) - _first.begin();
+        range.start = total;
+        if (range.end > range.begin) {
+            _ranges.push_back(range);
+            total += range.end - range.begin;
+        }
+    }
+
+    size_t tasks = (total + TASK_MESHLETS - 1) / TASK_MESHLETS;
+    if (_outputs.size() < tasks) {
+        _outputs.resize(tasks);
+    }
+    pool.run(tasks, [&](size_t task) {
+        cull_task(task * TASK_MESHLETS, std::min(total, (task + 1) * TASK_MESHLETS), frustum, eye, backfaces,
+                  _outputs[task]);
+    });
+
+    counts.clear();
+    offsets.clear();
+    stats = Stats();
+    for (size_t task = 0; task < tasks; ++task) {
+        const TaskOutput &out = _outputs[task];
+        for (size_t i = 0; i < out.counts.size(); ++i) {
+            if (i == 0 && !counts.empty() &&
+                (const char *) offsets.back() + sizeof(GLuint) * counts.back() == (const char *) out.offsets[0]) {
+                counts.back() += out.counts[0];
+            } else {
+                counts.push_back(out.counts[i]);
+                offsets.push_back(out.offsets[i]);
+            }
+        }
+        stats.tested += out.stats.tested;
+        stats.visible += out.stats.visible;
+        stats.outside += out.stats.outside;
+        stats.backfacing += out.stats.backfacing;
+        stats.visible_triangles += out.stats.visible_triangles;
+    }
+}
@@ -0,0 +1,88 @@
+#ifndef GLRENDER_MESHLETS_H
+#define GLRENDER_MESHLETS_H
+
+#include <vector>
+
+#include "amath.h"
+#include "memstats.h"
+#include "frustum.h"
+#include "meshbvh.h"
+#include "threadpool.h"
+
+// Small clusters of triangles, of at most MAX_VERTICES distinct vertices and
+// MAX_TRIANGLES triangles, for culling finer than the leaves of a MeshBvh.
+//
+// Each meshlet has a bounding sphere and a cone holding the normals of its
+// triangles, which together tell when the meshlet is off screen or faces away
+// from the camera as a whole. They are kept as arrays per field, so that the
+// culling pass tests four meshlets at a time with SSE.
+class MeshletSet {
+public:
+    static const int MAX_VERTICES = 64;
+    static const int MAX_TRIANGLES = 124;
+
+    struct Stats {
+        size_t tested;
+        size_t visible;
+        size_t outside;
+        size_t backfacing;
+        size_t visible_triangles;
+    };
+
+    // splits every leaf of `bvh` into meshlets, reordering the triangles of
+    // the leaf in bvh.indices() so that each meshlet is a contiguous range
+    void build(const float *verts, const int *corners, MeshBvh &bvh);
+
+    void clear();
+
+    // narrows draw ranges from MeshBvh::cull down to the meshlets in them that
+    // can be seen from `eye`, adjacent ones merged. Large sets are tested on
+    // the pool's threads.
+    void cull(const ViewFrustum &frustum, const vec3 &eye, bool backfaces, ThreadPool &pool,
+              std::vector<GLsizei> &counts, std::vector<const GLvoid *> &offsets, Stats &stats);
+
+    inline size_t size() const {
+        return _first.size();
+    }
+
+private:
+    // meshlets a culling task takes on
+    static const size_t TASK_MESHLETS = 2048;
+
+    struct Range {
+        size_t begin;       // meshlets
+        size_t end;
+        size_t start;       // position in the sequence of all candidates
+    };
+
+    struct TaskOutput {
+        std::vector<GLsizei> counts;
+        std::vector<const GLvoid *> offsets;
+        Stats stats;
+    };
+
+    void add_meshlet(const float *verts, const int *corners, const GLuint *indices, GLuint first, GLuint count);
+
+    // culls the candidates at positions [begin, end)
+    void cull_task(size_t begin, size_t end, const ViewFrustum &frustum, const vec3 &eye, bool backfaces,
+                   TaskOutput &out) const;
+
+    // bit i set if meshlet m + i is visible, of `count` <= 4; outside and
+    // backfacing get the meshlets rejected for each reason
+    int test(size_t m, size_t count, const ViewFrustum &frustum, const vec3 &eye, bool backfaces,
+             size_t &outside, size_t &backfacing) const;
+
+    // bounding spheres
+    tracked_vector<float, MEM_CLUSTERS> _cx, _cy, _cz, _radius;
+    // normal cones: axis, and cosine and sine of the half angle (0 and 1 when
+    // there is no cone under 90 degrees)
+    tracked_vector<float, MEM_CLUSTERS> _ax, _ay, _az, _cos, _sin;
+    // index ranges
+    tracked_vector<GLuint, MEM_CLUSTERS> _first, _count;
+
+    // per frame, kept to avoid reallocating
+    std::vector<Range> _ranges;
+    std::vector<TaskOutput> _outputs;
+};
+
+#endif //GLRENDER_MESHLETS_H
@@ -0,0 +1,30 @@
+#include "meshnormals.h"
+
+vec4 face_normal(const vec4 &a, const vec4 &b, const vec4 &c) {
+    vec4 n = vec4(cross(b - a, c - b), 0.0);
+    float l = length(n);
+    return l > 0 ? n / l : vec4(0.0, 0.0, 0.0, 0.0);
+}
+
+void add_face_normals(const float *verts, const int *tris, size_t index_count, vec4 *normals) {
+    for (size_t f = 0; f + 2 < index_count; f += 3) {
+        const int *tri = tris + f;
+        vec4 v[3];
+        for (int k = 0; k < 3; ++k) {
+            v[k] = vec4(verts[3 * tri[k]], verts[3 * tri[k] + 1], verts[3 * tri[k] + 2], 1.0);
+        }
+        vec4 n = face_normal(v[0], v[1], v[2]);
+        for (int k = 0; k < 3; ++k) {
+            normals[tri[k]] += n;
+        }
+    }
+}
+
+void normalize_sums(vec4 *normals, size_t count) {
+    for (size_t v = 0; v < count; ++v) {
+        float l = length(normals[v]);
+        if (l > 0) {
+            normals[v] = normals[v] / l;
+        }
+    }
+}
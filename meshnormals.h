@@ -0,0 +1,23 @@
+#ifndef GLRENDER_MESHNORMALS_H
+#define GLRENDER_MESHNORMALS_H
+
+#include <cstddef>
+
+#include "amath.h"
+
+// Smooth normals of an indexed mesh, made the one way everything that loads
+// or converts a mesh makes them: the unit normal of every face is added to
+// its three corners, and the sums are then scaled to unit length. A face
+// with no area adds nothing.
+
+// the unit normal of the triangle a, b, c as it winds, or 0 if it has no area
+vec4 face_normal(const vec4 &a, const vec4 &b, const vec4 &c);
+
+// adds the face normal of every triangle of `tris`, indices into the xyz
+// positions `verts`, to the normals of its corners
+void add_face_normals(const float *verts, const int *tris, size_t index_count, vec4 *normals);
+
+// scales the sums to unit length; those of vertices without a face stay 0
+void normalize_sums(vec4 *normals, size_t count);
+
+#endif //GLRENDER_MESHNORMALS_H
@@ -12,13 +12,14 @@
 #include <sstream>
 
 #include "amath.h"
+#include "memstats.h"
 
 // product of components, which we will use for shading calculations:
-vec4 product(vec4 a, vec4 b) {
+inline vec4 product(vec4 a, vec4 b) {
     return vec4(a[0] * b[0], a[1] * b[1], a[2] * b[2], a[3] * b[3]);
 }
 
-bool isObjFile(const std::string &file) {
+inline bool isObjFile(const std::string &file) {
     std::ifstream in(file.c_str());
 
     if (!in.good()) {
@@ -53,7 +54,53 @@ bool isObjFile(const std::string &file) {
     return false;
 }
 
-void parseObjFile(const std::string &file, std::vector<int> &tris, std::vector<float> &verts) {
+// parse a single line of an OBJ file, appending what it defines to tris and
+// verts. Returns false if the line holds a command we don't understand.
+inline bool parseObjLine(const char *buffer, tracked_vector<int, MEM_PARSER> &tris,
+                         tracked_vector<float, MEM_PARSER> &verts) {
+    std::string cmd;
+
+    std::istringstream iss(buffer);
+
+    iss >> cmd;
+
+    if (cmd[0] == '#' or cmd.empty()) {
+        // ignore comments or blank lines
+        return true;
+    }
+    else if (cmd == "v") {
+        // got a vertex:
+
+        // read in the parameters:
+        float pa, pb, pc;
+        iss >> pa >> pb >> pc;
+
+        verts.push_back(pa);
+        verts.push_back(pb);
+        verts.push_back(pc);
+    }
+    else if (cmd == "f") {
+        // got a face (triangle)
+
+        // read in the parameters:
+        int i, j, k;
+        iss >> i >> j >> k;
+
+        // vertex numbers in OBJ files start with 1, but in C++ array
+        // indices start with 0, so we're shifting everything down by
+        // 1
+        tris.push_back(i - 1);
+        tris.push_back(j - 1);
+        tris.push_back(k - 1);
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+inline void parseObjFile(const std::string &file, tracked_vector<int, MEM_PARSER> &tris,
+                         tracked_vector<float, MEM_PARSER> &verts) {
     // clear out the tris and verts vectors:
     tris.clear();
     verts.clear();
@@ -66,48 +113,12 @@ void parseObjFile(const std::string &file, std::vector<int> &tris, std::vector<f
     }
 
     char buffer[1025];
-    std::string cmd;
 
     for (int line = 1; in.good(); line++) {
         in.getline(buffer, 1024);
         buffer[in.gcount()] = 0;
 
-        cmd = "";
-
-        std::istringstream iss(buffer);
-
-        iss >> cmd;
-
-        if (cmd[0] == '#' or cmd.empty()) {
-            // ignore comments or blank lines
-            continue;
-        }
-        else if (cmd == "v") {
-            // got a vertex:
-
-            // read in the parameters:
-            float pa, pb, pc;
-            iss >> pa >> pb >> pc;
-
-            verts.push_back(pa);
-            verts.push_back(pb);
-            verts.push_back(pc);
-        }
-        else if (cmd == "f") {
-            // got a face (triangle)
-
-            // read in the parameters:
-            int i, j, k;
-            iss >> i >> j >> k;
-
-            // vertex numbers in OBJ files start with 1, but in C++ array
-            // indices start with 0, so we're shifting everything down by
-            // 1
-            tris.push_back(i - 1);
-            tris.push_back(j - 1);
-            tris.push_back(k - 1);
-        }
-        else {
+        if (!parseObjLine(buffer, tris, verts)) {
             std::cerr << "Parser error: invalid command at line " << line << std::endl;
         }
 
@@ -0,0 +1,157 @@
+#include "patchculler.h"
+
+#include <algorithm>
+#include <cmath>
+
+PatchCuller::PatchCuller()
+        : _end(0), _free_vertices(0), _visible_vertices(0), _stats() {
+}
+
+size_t PatchCuller::layout(const std::vector<BezierSurface> &surfaces, int samples) {
+    _samples.assign(surfaces.size(), samples);
+    return compact(surfaces);
+}
+
+size_t PatchCuller::compact(const std::vector<BezierSurface> &surfaces) {
+    _first.resize(surfaces.size());
+    _count.resize(surfaces.size());
+    _end = 0;
+    for (size_t i = 0; i < surfaces.size(); ++i) {
+        _first[i] = _end;
+        _count[i] = surfaces[i].triangle_vertex_count(_samples[i]);
+        _end += _count[i];
+    }
+    _resident.assign(surfaces.size(), false);
+    _free_slots.clear();
+    _free_vertices = 0;
+    return _end;
+}
+
+void PatchCuller::set_all_resident() {
+    _resident.assign(_resident.size(), true);
+}
+
+// Shirman and Abi-Ezzi: seen from the eye, the patch lies in a cone around
+// the direction to its bounding sphere, of half angle asin(r / distance). If
+// every normal points away by more than 90 degrees from every direction in that
+// cone, no point of the patch faces the eye.
+bool PatchCuller::facing_away(const BezierSurface &surface, const vec3 &eye) {
+    vec3 axis;
+    float cone_angle;
+    if (!surface.normal_cone(axis, cone_angle)) {
+        return false;
+    }
+
+    const Bounds &bounds = surface.bounds();
+    vec3 to_eye = eye - bounds.center();
+    float distance = length(to_eye);
+    float radius = 0.5f * length(bounds.extent());
+    if (distance <= radius) {
+        return false;
+    }
+
+    float spread = cone_angle + asinf(radius / distance);
+    if (spread >= M_PI / 2) {
+        return false;
+    }
+    return dot(axis, to_eye) / distance < -sinf(spread);
+}
+
+void PatchCuller::cull(const std::vector<BezierSurface> &surfaces, const ViewFrustum &frustum, const vec3 &eye,
+                       bool backfaces, std::vector<size_t> &missing) {
+    missing.clear();
+    _visible.clear();
+    _stats = Stats();
+
+    for (size_t i = 0; i < surfaces.size() && i < _resident.size(); ++i) {
+        if (frustum.classify(surfaces[i].bounds()) == ViewFrustum::OUTSIDE) {
+            ++_stats.outside;
+            continue;
+        }
+        if (backfaces && facing_away(surfaces[i], eye)) {
+            ++_stats.backfacing;
+            continue;
+        }
+
+        ++_stats.visible;
+        _visible.push_back(i);
+        if (!_resident[i]) {
+            missing.push_back(i);
+            ++_stats.tessellated;
+        }
+    }
+}
+
+void PatchCuller::pick_resolutions(const std::vector<BezierSurface> &surfaces, const vec3 &eye,
+                                   float pixels_per_unit, std::vector<int> &wanted,
+                                   std::vector<size_t> &changed) const {
+    wanted.resize(surfaces.size());
+    changed.clear();
+    std::vector<std::pair<float, size_t> > changes;
+
+    for (size_t i : _visible) {
+        const Bounds &bounds = surfaces[i].bounds();
+        float size = length(bounds.extent());
+        // the nearest the patch can be, but not closer than the near plane
+        float distance = std::max(length(eye - bounds.center()) - size / 2, 1.0f);
+        float edges = size * pixels_per_unit / distance / TRIANGLE_PIXELS;
+        float ideal = edges / std::max(surfaces[i].u_deg(), surfaces[i].v_deg());
+        ideal = std::max(1.0f, std::min(ideal, (float) MAX_SAMPLES));
+
+        float off = std::fabs(ideal - _samples[i]);
+        if (off <= 0.5f + HYSTERESIS) {
+            wanted[i] = _samples[i];
+            continue;
+        }
+        wanted[i] = (int) std::lround(ideal);
+        if (_resident[i]) {
+            changes.push_back(std::make_pair(-off, i));
+        }
+    }
+
+    std::sort(changes.begin(), changes.end());
+    for (auto &change : changes) {
+        changed.push_back(change.second);
+    }
+}
+
+void PatchCuller::resample(const std::vector<BezierSurface> &surfaces, size_t patch, int samples) {
+    _resident[patch] = false;
+    if (samples == _samples[patch]) {
+        return;
+    }
+
+    _free_slots[_count[patch]].push_back(_first[patch]);
+    _free_vertices += _count[patch];
+    _samples[patch] = samples;
+    _count[patch] = surfaces[patch].triangle_vertex_count(samples);
+
+    std::vector<GLint> &free = _free_slots[_count[patch]];
+    if (free.empty()) {
+        _first[patch] = _end;
+        _end += _count[patch];
+    } else {
+        _first[patch] = free.back();
+        free.pop_back();
+        _free_vertices -= _count[patch];
+    }
+}
+
+void PatchCuller::build_draws() {
+    _draw_firsts.clear();
+    _draw_counts.clear();
+    _visible_vertices = 0;
+
+    for (size_t i : _visible) {
+        if (!_resident[i]) {
+            continue;
+        }
+        if (!_draw_counts.empty() && _draw_firsts.back() + _draw_counts.back() == _first[i]) {
+            _draw_counts.back() += count(i);
+        } else {
+            _draw_firsts.push_back(_first[i]);
+            _draw_counts.push_back(count(i));
+        }
+        _visible_vertices += count(i);
+    }
+}
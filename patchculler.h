@@ -0,0 +1,149 @@
+#ifndef GLRENDER_PATCHCULLER_H
+#define GLRENDER_PATCHCULLER_H
+
+#include <map>
+#include <vector>
+
+#include "amath.h"
+#include "beziersurface.h"
+#include "frustum.h"
+
+// Decides which Bezier patches need to be tessellated and drawn, and at what
+// resolution.
+//
+// Every patch owns a slot of the vertex buffer, big enough for its triangles
+// at its resolution. A patch is rejected when its control point box is
+// outside the view frustum, or when its normal cone shows it facing away from
+// the camera everywhere. Patches are only tessellated once they come into
+// view, and stay tessellated in their slot after they leave it, so that a
+// moving camera only costs the patches it newly uncovers.
+//
+// With automatic resolution, each visible patch is sampled finely enough for
+// its triangles to be about TRIANGLE_PIXELS across on screen. A patch only
+// changes resolution once its ideal one is off by more than HYSTERESIS past
+// the rounding point, so that one sitting on the boundary doesn't flip back
+// and forth as the camera moves. A patch that changes resolution moves to a
+// slot of the new size; slots given up are reused for patches of the same
+// size, or else new ones are added at the end of the buffer.
+class PatchCuller {
+public:
+    static const int MAX_SAMPLES = 10;
+
+    // how big, in pixels, a triangle of a patch should get with automatic
+    // resolution
+    static constexpr float TRIANGLE_PIXELS = 8.0f;
+
+    struct Stats {
+        size_t visible;
+        size_t outside;         // rejected by the frustum
+        size_t backfacing;      // rejected by the normal cone
+        size_t tessellated;     // visible patches that had to be tessellated
+    };
+
+    PatchCuller();
+
+    // new slots for the surfaces at this resolution, with nothing tessellated
+    // yet; returns the vertices the slots need
+    size_t layout(const std::vector<BezierSurface> &surfaces, int samples);
+
+    // the patches visible from `eye`. Those not tessellated yet are listed in
+    // `missing`, for the caller to tessellate into their slots and pass to
+    // set_resident(); after that, build_draws().
+    void cull(const std::vector<BezierSurface> &surfaces, const ViewFrustum &frustum, const vec3 &eye,
+              bool backfaces, std::vector<size_t> &missing);
+
+    // for automatic resolution: the resolution every visible patch should
+    // have seen from `eye`, into `wanted`, and in `changed` the resident ones
+    // that have to change, the largest changes first. `pixels_per_unit` is
+    // the size on screen of one unit at distance one.
+    void pick_resolutions(const std::vector<BezierSurface> &surfaces, const vec3 &eye, float pixels_per_unit,
+                          std::vector<int> &wanted, std::vector<size_t> &changed) const;
+
+    // moves a patch to a slot for `samples`, to be tessellated again;
+    // vertex_end() may grow
+    void resample(const std::vector<BezierSurface> &surfaces, size_t patch, int samples);
+
+    // lays the slots out again without the free ones in between, every patch
+    // keeping its resolution but none tessellated; returns vertex_end()
+    size_t compact(const std::vector<BezierSurface> &surfaces);
+
+    // draw ranges of the visible patches, from the slots they are in now
+    void build_draws();
+
+    inline void set_resident(size_t patch) {
+        _resident[patch] = true;
+    }
+
+    // whether the patch's slot holds its triangles
+    inline bool resident(size_t patch) const {
+        return _resident[patch];
+    }
+
+    // every slot already holds its patch, e.g. after loading
+    void set_all_resident();
+
+    inline GLint first(size_t patch) const {
+        return _first[patch];
+    }
+
+    inline GLsizei count(size_t patch) const {
+        return _count[patch];
+    }
+
+    inline int samples(size_t patch) const {
+        return _samples[patch];
+    }
+
+    // the vertices the slots take up, free ones included
+    inline size_t vertex_end() const {
+        return _end;
+    }
+
+    inline size_t free_vertices() const {
+        return _free_vertices;
+    }
+
+    // draw ranges of the visible patches, adjacent ones merged
+    inline const std::vector<GLint> &draw_firsts() const {
+        return _draw_firsts;
+    }
+
+    inline const std::vector<GLsizei> &draw_counts() const {
+        return _draw_counts;
+    }
+
+    // the patches of the last cull(), in increasing order
+    inline const std::vector<size_t> &visible() const {
+        return _visible;
+    }
+
+    inline const Stats &stats() const {
+        return _stats;
+    }
+
+    inline size_t visible_vertices() const {
+        return _visible_vertices;
+    }
+
+private:
+    // how far past the point of rounding to the next resolution the ideal
+    // one has to be before a patch changes
+    static constexpr float HYSTERESIS = 0.25f;
+
+    static bool facing_away(const BezierSurface &surface, const vec3 &eye);
+
+    std::vector<GLint> _first;
+    std::vector<GLsizei> _count;
+    std::vector<int> _samples;
+    std::vector<bool> _resident;
+    std::vector<size_t> _visible;
+    GLint _end;
+    size_t _free_vertices;
+    std::map<GLsizei, std::vector<GLint> > _free_slots;     // by size
+    std::vector<GLint> _draw_firsts;
+    std::vector<GLsizei> _draw_counts;
+    size_t _visible_vertices;
+    Stats _stats;
+};
+
+#endif //GLRENDER_PATCHCULLER_H
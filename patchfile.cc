@@ -0,0 +1,297 @@
+#include "patchfile.h"
+
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+
+#include "mappedfile.h"
+
+static const char BINARY_MAGIC[8] = {'G', 'L', 'R', 'B', 'E', 'Z', '0', '1'};
+
+// bytes of text per parallel parsing task, and patches per building task
+static const size_t TEXT_BLOCK_SIZE = 1 << 20;
+static const size_t PATCHES_PER_TASK = 256;
+
+// where each patch's control points start, and its degrees
+struct PatchIndex {
+    std::vector<const float *> points;
+    std::vector<int> u_deg;
+    std::vector<int> v_deg;
+};
+
+// the numbers of [p, end), skipping tokens that aren't; returns how many
+// were skipped
+static size_t parse_numbers(const char *p, const char *end, tracked_vector<float, MEM_PARSER> &numbers) {
+    size_t skipped = 0;
+    char token[64];
+    while (p < end) {
+        while (p < end && isspace((unsigned char) *p)) {
+            ++p;
+        }
+        const char *start = p;
+        while (p < end && !isspace((unsigned char) *p)) {
+            ++p;
+        }
+        size_t length = p - start;
+        if (length == 0) {
+            break;
+        }
+        // the mapping isn't terminated, strtof gets a copy that is
+        if (length >= sizeof(token)) {
+            ++skipped;
+            continue;
+        }
+        memcpy(token, start, length);
+        token[length] = '\0';
+        char *next;
+        float value = strtof(token, &next);
+        if (next != token + length) {
+            ++skipped;
+            continue;
+        }
+        numbers.push_back(value);
+    }
+    return skipped;
+}
+
+// the patch count at the start of [p, end), as an integer: a float holds
+// integers exactly only up to 2^24. False if the first word isn't one.
+static bool parse_count(const char *p, const char *end, long &count) {
+    while (p < end && isspace((unsigned char) *p)) {
+        ++p;
+    }
+    const char *start = p;
+    while (p < end && !isspace((unsigned char) *p)) {
+        ++p;
+    }
+    char token[32];
+    size_t length = p - start;
+    if (length == 0 || length >= sizeof(token)) {
+        return false;
+    }
+    memcpy(token, start, length);
+    token[length] = '\0';
+    char *next;
+    count = strtol(token, &next, 10);
+    return next == token + length && count >= 0;
+}
+
+static bool valid_degrees(int u_deg, int v_deg) {
+    return u_deg >= 1 && v_deg >= 1 && u_deg <= 64 && v_deg <= 64;
+}
+
+// a degree as the text gives it: whole and in range, so that "3.7" isn't
+// taken for 3; the range is checked first, so the cast is defined
+static bool whole_degree(float value) {
+    return value >= 1 && value <= 64 && value == floorf(value);
+}
+
+// builds the patches of `index` in parallel, in order, after those already in
+// `surfaces`
+static void build_surfaces(const PatchIndex &index, ThreadPool &pool, std::vector<BezierSurface> &surfaces) {
+    size_t count = index.points.size();
+    size_t tasks = (count + PATCHES_PER_TASK - 1) / PATCHES_PER_TASK;
+    std::vector<std::vector<BezierSurface> > parts(tasks);
+    pool.run(tasks, [&](size_t task) {
+        size_t first = task * PATCHES_PER_TASK;
+        size_t last = std::min(count, first + PATCHES_PER_TASK);
+        parts[task].reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            parts[task].emplace_back(index.points[i], index.u_deg[i], index.v_deg[i]);
+        }
+    });
+
+    surfaces.reserve(surfaces.size() + count);
+    for (auto &part : parts) {
+        for (auto &surface : part) {
+            surfaces.push_back(std::move(surface));
+        }
+    }
+}
+
+static bool read_text(const MappedFile &file, const std::string &path, std::vector<BezierSurface> &surfaces,
+                      ThreadPool &pool) {
+    // blocks end at whitespace, so that no number is cut in two
+    const char *data = file.data();
+    std::vector<size_t> cuts(1, 0);
+    while (cuts.back() < file.size()) {
+        size_t cut = std::min(file.size(), cuts.back() + TEXT_BLOCK_SIZE);
+        while (cut < file.size() && !isspace((unsigned char) data[cut])) {
+            ++cut;
+        }
+        cuts.push_back(cut);
+    }
+
+    size_t blocks = cuts.size() - 1;
+    std::vector<tracked_vector<float, MEM_PARSER> > block_numbers(blocks);
+    std::vector<size_t> skipped(blocks);
+    pool.run(blocks, [&](size_t block) {
+        block_numbers[block].reserve((cuts[block + 1] - cuts[block]) / 8);
+        skipped[block] = parse_numbers(data + cuts[block], data + cuts[block + 1], block_numbers[block]);
+    });
+
+    size_t total = 0, total_skipped = 0;
+    for (size_t block = 0; block < blocks; ++block) {
+        total += block_numbers[block].size();
+        total_skipped += skipped[block];
+    }
+    tracked_vector<float, MEM_PARSER> numbers;
+    numbers.reserve(total);
+    for (auto &block : block_numbers) {
+        numbers.insert(numbers.end(), block.begin(), block.end());
+        tracked_vector<float, MEM_PARSER>().swap(block);
+    }
+    if (total_skipped) {
+        std::cerr << "Skipped " << total_skipped << " words that aren't numbers in " << path << std::endl;
+    }
+
+    if (numbers.empty()) {
+        std::cerr << "Bezier surface file " << path << " is empty" << std::endl;
+        return false;
+    }
+
+    // numbers[0] is the count, parsed again exactly
+    long remaining = 0;
+    if (!parse_count(data, data + file.size(), remaining)) {
+        std::cerr << "Bezier surface file " << path << " doesn't start with a patch count" << std::endl;
+        return false;
+    }
+
+    PatchIndex index;
+    size_t pos = 1;
+    bool ok = true;
+    while (remaining > 0) {
+        if (numbers.size() - pos < 2) {
+            ok = false;
+            break;
+        }
+        if (!whole_degree(numbers[pos]) || !whole_degree(numbers[pos + 1])) {
+            std::cerr << "Bezier surface file " << path << " has a patch of degree " << numbers[pos] << " by "
+                      << numbers[pos + 1] << std::endl;
+            return false;
+        }
+        int u_deg = (int) numbers[pos];
+        int v_deg = (int) numbers[pos + 1];
+        size_t needed = 2 + (u_deg + 1) * (v_deg + 1) * 3;
+        if (numbers.size() - pos < needed) {
+            ok = false;
+            break;
+        }
+        index.points.push_back(&numbers[pos + 2]);
+        index.u_deg.push_back(u_deg);
+        index.v_deg.push_back(v_deg);
+        pos += needed;
+        --remaining;
+    }
+    if (!ok) {
+        std::cerr << "Bezier surface file " << path << " ends " << remaining << " patches early" << std::endl;
+        return false;
+    }
+
+    build_surfaces(index, pool, surfaces);
+    return true;
+}
+
+static bool read_binary(const MappedFile &file, const std::string &path, std::vector<BezierSurface> &surfaces,
+                        ThreadPool &pool) {
+    // the mapping is page aligned, and everything after the magic is 4 bytes
+    // wide
+    const uint32_t *header = reinterpret_cast<const uint32_t *>(file.data() + sizeof(BINARY_MAGIC));
+    size_t header_bytes = sizeof(BINARY_MAGIC) + 2 * sizeof(uint32_t);
+    if (file.size() < header_bytes) {
+        std::cerr << "Bezier patch file " << path << " is cut short" << std::endl;
+        return false;
+    }
+    size_t patch_count = header[0];
+    size_t point_count = header[1];
+    const int32_t *degrees = reinterpret_cast<const int32_t *>(header + 2);
+    const float *points = reinterpret_cast<const float *>(degrees + 2 * patch_count);
+    if (file.size() != header_bytes + sizeof(int32_t) * 2 * patch_count + sizeof(float) * 3 * point_count) {
+        std::cerr << "Bezier patch file " << path << " doesn't have the size its header gives" << std::endl;
+        return false;
+    }
+
+    PatchIndex index;
+    index.points.reserve(patch_count);
+    index.u_deg.reserve(patch_count);
+    index.v_deg.reserve(patch_count);
+    size_t next = 0;
+    for (size_t i = 0; i < patch_count; ++i) {
+        int u_deg = degrees[2 * i];
+        int v_deg = degrees[2 * i + 1];
+        size_t patch_points = valid_degrees(u_deg, v_deg) ? (u_deg + 1) * (v_deg + 1) : 0;
+        if (!patch_points || next + patch_points > point_count) {
+            std::cerr << "Bezier patch file " << path << " has a broken patch " << i << std::endl;
+            return false;
+        }
+        index.points.push_back(points + 3 * next);
+        index.u_deg.push_back(u_deg);
+        index.v_deg.push_back(v_deg);
+        next += patch_points;
+    }
+
+    build_surfaces(index, pool, surfaces);
+    return true;
+}
+
+bool read_patch_file(const std::string &path, std::vector<BezierSurface> &surfaces, ThreadPool &pool) {
+    surfaces.clear();
+
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Fail to read bezier surface file " << path << std::endl;
+        return false;
+    }
+
+    if (file.size() >= sizeof(BINARY_MAGIC) && memcmp(file.data(), BINARY_MAGIC, sizeof(BINARY_MAGIC)) == 0) {
+        return read_binary(file, path, surfaces, pool);
+    }
+    return read_text(file, path, surfaces, pool);
+}
+
+bool write_patch_file(const std::string &path, const std::vector<BezierSurface> &surfaces) {
+    std::vector<int32_t> degrees;
+    degrees.reserve(2 * surfaces.size());
+    size_t point_count = 0;
+    for (auto &surf : surfaces) {
+        degrees.push_back(surf.u_deg());
+        degrees.push_back(surf.v_deg());
+        point_count += (surf.u_deg() + 1) * (surf.v_deg() + 1);
+    }
+
+    std::vector<float> coordinates;
+    coordinates.reserve(3 * point_count);
+    std::vector<BezierSurface::point> patch_points;
+    for (auto &surf : surfaces) {
+        patch_points.resize((surf.u_deg() + 1) * (surf.v_deg() + 1));
+        surf.copy_control_points(patch_points.data());
+        for (auto &p : patch_points) {
+            coordinates.push_back(p.x);
+            coordinates.push_back(p.y);
+            coordinates.push_back(p.z);
+        }
+    }
+
+    // write to the side and rename, so a reader never sees half a file
+    std::string tmp = path + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "wb");
+    if (!fp) {
+        std::cerr << "Fail to write bezier patch file " << path << std::endl;
+        return false;
+    }
+    uint32_t header[2] = {(uint32_t) surfaces.size(), (uint32_t) point_count};
+    bool ok = fwrite(BINARY_MAGIC, sizeof(BINARY_MAGIC), 1, fp) == 1 &&
+              fwrite(header, sizeof(header), 1, fp) == 1 &&
+              fwrite(degrees.data(), sizeof(int32_t), degrees.size(), fp) == degrees.size() &&
+              fwrite(coordinates.data(), sizeof(float), coordinates.size(), fp) == coordinates.size();
+    ok = fclose(fp) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0) {
+        remove(tmp.c_str());
+        std::cerr << "Fail to write bezier patch file " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,36 @@
+#ifndef GLRENDER_PATCHFILE_H
+#define GLRENDER_PATCHFILE_H
+
+#include <string>
+#include <vector>
+
+#include "beziersurface.h"
+#include "threadpool.h"
+
+// Bezier patch files, read through a memory mapping.
+//
+// The text format is the number of patches, then for each patch its u and v
+// degree and its (u_deg + 1) * (v_deg + 1) control points as x y z, a row of
+// u_deg + 1 at a time. The file is cut into blocks at whitespace that are
+// turned into numbers in parallel; only the walk over the numbers that finds
+// where each patch starts is serial, and the patches are built in parallel
+// again from there.
+//
+// The binary format holds the same numbers ready to use, so reading it is
+// only building the patches:
+//
+//   char     magic[8]                  "GLRBEZ01"
+//   uint32   patch count
+//   uint32   control point count, of all patches
+//   int32    u_deg, v_deg              per patch
+//   float    x, y, z                   per control point, in the text order
+
+// reads either format, told apart by the magic, into `surfaces`. False if
+// the file can't be read or is malformed, and then nothing is read.
+bool read_patch_file(const std::string &path, std::vector<BezierSurface> &surfaces, ThreadPool &pool);
+
+// writes the surfaces in the binary format; false if the file can't be
+// written
+bool write_patch_file(const std::string &path, const std::vector<BezierSurface> &surfaces);
+
+#endif //GLRENDER_PATCHFILE_H
@@ -0,0 +1,400 @@
+#include "patchweld.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdint.h>
+
+#include "arena.h"
+#include "frustum.h"
+#include "shadervariants.h"
+
+// patches per task of the parallel passes, points per sorted run, and the
+// tolerance picked when none is given, as a part of the model's diagonal
+static const size_t PATCHES_PER_TASK = 64;
+static const size_t SORT_RUN = 1 << 14;
+static const float TOLERANCE_PART = 1e-5f;
+
+// the most cells out from the origin along an axis, with room for the cells
+// around them in an int32
+static const double CELL_LIMIT = 1 << 30;
+
+// a boundary point and the cell it falls in; ordered by cell, then by point
+struct WeldCandidate {
+    int32_t x, y, z;
+    uint32_t point;
+
+    inline bool operator<(const WeldCandidate &o) const {
+        if (x != o.x) return x < o.x;
+        if (y != o.y) return y < o.y;
+        if (z != o.z) return z < o.z;
+        return point < o.point;
+    }
+};
+
+// the cell of a coordinate, divided in double so that points within the
+// tolerance are at most a cell apart; clamped, so that no point (not even a
+// NaN) makes a cell out of range
+static inline int32_t cell_of(float x, float tolerance) {
+    double cell = floor((double) x / tolerance);
+    return (int32_t) std::max(-CELL_LIMIT, std::min(CELL_LIMIT, cell));
+}
+
+static inline bool finite_normal(const vec4 &n) {
+    return std::isfinite(n.x) && std::isfinite(n.y) && std::isfinite(n.z);
+}
+
+// runs task(first, last) over the patches in blocks of PATCHES_PER_TASK
+template<typename Task>
+static void for_patch_blocks(size_t patches, ThreadPool &pool, const Task &task) {
+    size_t tasks = (patches + PATCHES_PER_TASK - 1) / PATCHES_PER_TASK;
+    pool.run(tasks, [&](size_t t) {
+        task(t * PATCHES_PER_TASK, std::min(patches, (t + 1) * PATCHES_PER_TASK));
+    });
+}
+
+// sorts the candidates as runs in parallel, then merges pairs of runs, the
+// pairs of a round in parallel
+static void sort_candidates(std::vector<WeldCandidate> &candidates, ThreadPool &pool) {
+    size_t n = candidates.size();
+    size_t runs = (n + SORT_RUN - 1) / SORT_RUN;
+    pool.run(runs, [&](size_t r) {
+        std::sort(candidates.begin() + r * SORT_RUN, candidates.begin() + std::min(n, (r + 1) * SORT_RUN));
+    });
+    for (size_t width = SORT_RUN; width < n; width *= 2) {
+        size_t pairs = (n + 2 * width - 1) / (2 * width);
+        pool.run(pairs, [&](size_t p) {
+            size_t first = p * 2 * width;
+            size_t middle = std::min(n, first + width);
+            size_t last = std::min(n, first + 2 * width);
+            std::inplace_merge(candidates.begin() + first, candidates.begin() + middle, candidates.begin() + last);
+        });
+    }
+}
+
+void weld_patches(std::vector<BezierSurface> &surfaces, int samples, float tolerance, ThreadPool &pool,
+                  WeldedMesh &mesh) {
+    auto start = std::chrono::steady_clock::now();
+    size_t patches = surfaces.size();
+
+    // where each patch's grid points, boundary points and indices start
+    std::vector<size_t> first_point(patches + 1, 0), first_boundary(patches + 1, 0);
+    mesh.first_index.assign(patches + 1, 0);
+    size_t list_vertices = 0;
+    Bounds bounds;
+    for (size_t p = 0; p < patches; ++p) {
+        BezierSurface &surf = surfaces[p];
+        int u_count = samples * surf.u_deg() + 1;
+        int v_count = samples * surf.v_deg() + 1;
+        first_point[p + 1] = first_point[p] + surf.sample_count(samples);
+        first_boundary[p + 1] = first_boundary[p] + 2 * u_count + 2 * (v_count - 2);
+        mesh.first_index[p + 1] = mesh.first_index[p] + surf.triangle_vertex_count(samples);
+        list_vertices += surf.triangle_vertex_count(samples);
+        bounds.extend(surf.bounds());
+    }
+    size_t grid_points = first_point[patches];
+    if (tolerance <= 0) {
+        tolerance = std::max(length(bounds.extent()) * TOLERANCE_PART, 1e-12f);
+    }
+    // a tolerance so small that the model spans more cells than there are
+    // is raised, rather than piling the points at the edges into one cell
+    if (!bounds.empty()) {
+        float reach = std::max(std::max(std::max(fabsf(bounds.min.x), fabsf(bounds.max.x)),
+                                        std::max(fabsf(bounds.min.y), fabsf(bounds.max.y))),
+                               std::max(fabsf(bounds.min.z), fabsf(bounds.max.z)));
+        tolerance = std::max(tolerance, (float) (reach / CELL_LIMIT));
+    }
+
+    // sample every patch, and put its boundary points in their cells
+    tracked_vector<vec4, MEM_TESSELLATOR> points(grid_points), point_normals(grid_points);
+    std::vector<WeldCandidate> candidates(first_boundary[patches]);
+    for_patch_blocks(patches, pool, [&](size_t first, size_t last) {
+        LinearArena scratch(MEM_TESSELLATOR, 64 << 10);
+        for (size_t p = first; p < last; ++p) {
+            BezierSurface &surf = surfaces[p];
+            scratch.reset();
+            surf.eval_surface(samples, &points[first_point[p]], &point_normals[first_point[p]], scratch);
+
+            int u_count = samples * surf.u_deg() + 1;
+            int v_count = samples * surf.v_deg() + 1;
+            WeldCandidate *out = &candidates[first_boundary[p]];
+            for (int i = 0; i < v_count; ++i) {
+                for (int j = 0; j < u_count; ++j) {
+                    if (i != 0 && i != v_count - 1 && j != 0 && j != u_count - 1) {
+                        continue;
+                    }
+                    uint32_t point = (uint32_t) (first_point[p] + i * u_count + j);
+                    const vec4 &pos = points[point];
+                    out->x = cell_of(pos.x, tolerance);
+                    out->y = cell_of(pos.y, tolerance);
+                    out->z = cell_of(pos.z, tolerance);
+                    out->point = point;
+                    ++out;
+                }
+            }
+        }
+    });
+
+    // the boundary points in file order, for the serial passes below
+    std::vector<uint32_t> boundary(candidates.size());
+    for (size_t k = 0; k < candidates.size(); ++k) {
+        boundary[k] = candidates[k].point;
+    }
+    sort_candidates(candidates, pool);
+
+    // every boundary point looks for the first point close enough in the
+    // cells around it; a point within the tolerance is at most one cell over
+    std::vector<uint32_t> root(grid_points);
+    for (size_t i = 0; i < grid_points; ++i) {
+        root[i] = (uint32_t) i;
+    }
+    float tolerance2 = tolerance * tolerance;
+    size_t runs = (candidates.size() + SORT_RUN - 1) / SORT_RUN;
+    pool.run(runs, [&](size_t r) {
+        size_t last = std::min(candidates.size(), (r + 1) * SORT_RUN);
+        for (size_t k = r * SORT_RUN; k < last; ++k) {
+            const WeldCandidate &c = candidates[k];
+            const vec4 &pos = points[c.point];
+            uint32_t best = c.point;
+            for (int dx = -1; dx <= 1; ++dx) {
+                for (int dy = -1; dy <= 1; ++dy) {
+                    for (int dz = -1; dz <= 1; ++dz) {
+                        WeldCandidate key = {c.x + dx, c.y + dy, c.z + dz, 0};
+                        auto it = std::lower_bound(candidates.begin(), candidates.end(), key);
+                        for (; it != candidates.end() && it->x == key.x && it->y == key.y && it->z == key.z &&
+                               it->point < best; ++it) {
+                            const vec4 &other = points[it->point];
+                            vec3 d(other.x - pos.x, other.y - pos.y, other.z - pos.z);
+                            if (dot(d, d) <= tolerance2) {
+                                best = it->point;
+                            }
+                        }
+                    }
+                }
+            }
+            root[c.point] = best;
+        }
+    });
+
+    // a point is welded to one before it, so in file order the root of
+    // that one is already final
+    for (uint32_t point : boundary) {
+        root[point] = root[root[point]];
+    }
+
+    // number the roots in file order, each patch's from its own count on
+    std::vector<size_t> first_vertex(patches + 1, 0);
+    for_patch_blocks(patches, pool, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            size_t count = 0;
+            for (size_t i = first_point[p]; i < first_point[p + 1]; ++i) {
+                count += root[i] == i;
+            }
+            first_vertex[p + 1] = count;
+        }
+    });
+    for (size_t p = 0; p < patches; ++p) {
+        first_vertex[p + 1] += first_vertex[p];
+    }
+    size_t vertices = first_vertex[patches];
+
+    std::vector<uint32_t> vertex(grid_points);
+    mesh.positions.resize(vertices);
+    mesh.normals.resize(vertices);
+    for_patch_blocks(patches, pool, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            uint32_t next = (uint32_t) first_vertex[p];
+            for (size_t i = first_point[p]; i < first_point[p + 1]; ++i) {
+                if (root[i] == i) {
+                    vertex[i] = next;
+                    mesh.positions[next] = points[i];
+                    mesh.normals[next] = point_normals[i];
+                    ++next;
+                }
+            }
+        }
+    });
+
+    // welded points average their normals, leaving out the undefined ones
+    // of collapsed edges
+    for (uint32_t point : boundary) {
+        if (root[point] == point) {
+            vec4 &n = mesh.normals[vertex[point]];
+            if (!finite_normal(n)) {
+                n = vec4(0.0, 0.0, 0.0, 0.0);
+            }
+        }
+    }
+    for (uint32_t point : boundary) {
+        if (root[point] != point) {
+            vertex[point] = vertex[root[point]];
+            if (finite_normal(point_normals[point])) {
+                mesh.normals[vertex[point]] += point_normals[point];
+            }
+        }
+    }
+    for (uint32_t point : boundary) {
+        if (root[point] == point) {
+            vec4 &n = mesh.normals[vertex[point]];
+            vec3 sum(n.x, n.y, n.z);
+            n = length(sum) > 1e-12f ? vec4(normalize(sum), 0.0) : point_normals[point];
+        }
+    }
+
+    // the triangles of eval_triangles, by vertex; those that welding
+    // collapsed are left out, and each patch's are moved to the front of its
+    // range
+    mesh.indices.resize(mesh.first_index[patches]);
+    std::vector<size_t> kept(patches);
+    for_patch_blocks(patches, pool, [&](size_t first, size_t last) {
+        for (size_t p = first; p < last; ++p) {
+            BezierSurface &surf = surfaces[p];
+            int u_count = samples * surf.u_deg() + 1;
+            int v_count = samples * surf.v_deg() + 1;
+            const uint32_t *grid = &vertex[first_point[p]];
+            GLuint *out = &mesh.indices[mesh.first_index[p]];
+            GLuint *begin = out;
+            for (int i = 0; i < v_count - 1; ++i) {
+                for (int j = 0; j < u_count - 1; ++j) {
+                    GLuint a = grid[i * u_count + j];
+                    GLuint b = grid[(i + 1) * u_count + j + 1];
+                    GLuint c = grid[(i + 1) * u_count + j];
+                    GLuint d = grid[i * u_count + j + 1];
+                    if (a != b && b != c && c != a) {
+                        *out++ = a;
+                        *out++ = b;
+                        *out++ = c;
+                    }
+                    if (a != b && a != d && d != b) {
+                        *out++ = b;
+                        *out++ = a;
+                        *out++ = d;
+                    }
+                }
+            }
+            kept[p] = out - begin;
+        }
+    });
+    size_t next = 0;
+    for (size_t p = 0; p < patches; ++p) {
+        size_t from = mesh.first_index[p];
+        mesh.first_index[p] = (GLuint) next;
+        std::copy(mesh.indices.begin() + from, mesh.indices.begin() + from + kept[p], mesh.indices.begin() + next);
+        next += kept[p];
+    }
+    mesh.first_index[patches] = (GLuint) next;
+    mesh.indices.resize(next);
+
+    WeldedMesh::Stats &stats = mesh.stats;
+    stats.list_vertices = list_vertices;
+    stats.grid_points = grid_points;
+    stats.vertices = vertices;
+    stats.degenerate = (list_vertices - next) / 3;
+    stats.list_bytes = 2 * sizeof(vec4) * list_vertices;
+    stats.indexed_bytes = 2 * sizeof(vec4) * vertices + sizeof(GLuint) * next;
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+WeldedPatches::WeldedPatches()
+        : _vao(0), _bytes(0), _samples(0), _quantized(false) {
+    _buffers[0] = _buffers[1] = _buffers[2] = 0;
+}
+
+WeldedPatches::~WeldedPatches() {
+    // the context is usually gone by now, and the driver cleans up with it
+}
+
+void WeldedPatches::upload(const WeldedMesh &mesh, int samples, bool quantize) {
+    release();
+    size_t vertices = mesh.positions.size();
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+
+    glGenBuffers(3, _buffers);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[0]);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    if (quantize) {
+        Bounds bounds;
+        for (auto &p : mesh.positions) {
+            bounds.extend(vec3(p.x, p.y, p.z));
+        }
+        _quantization = PositionQuantization(bounds);
+        tracked_vector<GLushort, MEM_UPLOAD_STAGING> shorts(4 * vertices);
+        quantize_positions(&mesh.positions[0].x, vertices, 4, _quantization, shorts.data());
+        glBufferData(GL_ARRAY_BUFFER, sizeof(GLushort) * shorts.size(), shorts.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(ATTRIB_POSITION, 4, GL_UNSIGNED_SHORT, GL_TRUE, 0, BUFFER_OFFSET(0));
+        _bytes = 4 * sizeof(GLushort) * vertices;
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * vertices, mesh.positions.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+        _bytes = sizeof(vec4) * vertices;
+    }
+    _quantized = quantize;
+
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * mesh.normals.size(), mesh.normals.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_NORMAL, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    // the element array binding is part of the vertex array
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[2]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * mesh.indices.size(), mesh.indices.data(),
+                 GL_STATIC_DRAW);
+    glBindVertexArray((GLuint) previous);
+
+    _bytes += sizeof(vec4) * vertices + sizeof(GLuint) * mesh.indices.size();
+    mem_track_alloc(MEM_GPU_BUFFERS, _bytes);
+    _samples = samples;
+    _first_index = mesh.first_index;
+}
+
+void WeldedPatches::release() {
+    if (_vao) {
+        glDeleteBuffers(3, _buffers);
+        glDeleteVertexArrays(1, &_vao);
+        mem_track_free(MEM_GPU_BUFFERS, _bytes);
+    }
+    _vao = 0;
+    _buffers[0] = _buffers[1] = _buffers[2] = 0;
+    _bytes = 0;
+    _samples = 0;
+    _quantized = false;
+    _first_index.clear();
+}
+
+size_t WeldedPatches::draw(const std::vector<size_t> *visible) {
+    if (empty()) {
+        return 0;
+    }
+
+    // runs of consecutive patches are one range of the index buffer
+    _draw_counts.clear();
+    _draw_offsets.clear();
+    size_t patches = _first_index.size() - 1;
+    size_t drawn = visible ? visible->size() : patches;
+    size_t indices = 0;
+    for (size_t k = 0; k < drawn; ++k) {
+        size_t patch = visible ? (*visible)[k] : k;
+        GLsizei count = (GLsizei) (_first_index[patch + 1] - _first_index[patch]);
+        const GLvoid *offset = BUFFER_OFFSET(sizeof(GLuint) * _first_index[patch]);
+        indices += count;
+        if (!_draw_counts.empty() &&
+            (const char *) _draw_offsets.back() + sizeof(GLuint) * _draw_counts.back() == offset) {
+            _draw_counts.back() += count;
+        } else {
+            _draw_counts.push_back(count);
+            _draw_offsets.push_back(offset);
+        }
+    }
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+    glMultiDrawElements(GL_TRIANGLES, _draw_counts.data(), GL_UNSIGNED_INT, _draw_offsets.data(),
+                        (GLsizei) _draw_counts.size());
+    glBindVertexArray((GLuint) previous);
+    return indices / 3;
+}
@@ -0,0 +1,106 @@
+#ifndef GLRENDER_PATCHWELD_H
+#define GLRENDER_PATCHWELD_H
+
+#include <vector>
+
+#include "amath.h"
+#include "beziersurface.h"
+#include "memstats.h"
+#include "quantize.h"
+#include "threadpool.h"
+
+// Bezier patches tessellated into one indexed mesh, with the points that
+// neighbouring patches both sample on their shared boundary welded into one
+// vertex. The triangle paths keep each patch's samples to itself, six times
+// per grid cell, and the two patches along a seam each have their own normal
+// there; here every grid point is one vertex, and a welded point gets the
+// average of the normals it was sampled with.
+//
+// Only boundary points are welded, since the inside of a patch never meets
+// another one. Points are snapped to a grid of cells as wide as the
+// tolerance and sorted by cell, and each point is welded to the first point,
+// in file order, within the tolerance in its own or a neighbouring cell. The
+// sampling, the matching and the triangles are spread over a thread pool,
+// and the result doesn't depend on how the work was split.
+struct WeldedMesh {
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> positions;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> normals;
+    tracked_vector<GLuint, MEM_UPLOAD_STAGING> indices;
+    std::vector<GLuint> first_index;    // per patch, and one past the last
+
+    struct Stats {
+        size_t list_vertices;       // the triangle lists of eval_triangles
+        size_t grid_points;         // the points eval_surface samples
+        size_t vertices;            // left after welding
+        size_t degenerate;          // triangles dropped, collapsed by welding
+        size_t list_bytes;          // positions and normals of the lists
+        size_t indexed_bytes;       // positions, normals and indices
+        double ms;
+    } stats;
+};
+
+// welds the patches at `samples` segments per degree. A `tolerance` of 0
+// picks one from the size of the model, and one too small for the cells to
+// span the model is raised to the smallest that does.
+void weld_patches(std::vector<BezierSurface> &surfaces, int samples, float tolerance, ThreadPool &pool,
+                  WeldedMesh &mesh);
+
+// A welded mesh on the GPU, with a vertex array of its own.
+class WeldedPatches {
+public:
+    WeldedPatches();
+
+    ~WeldedPatches();
+
+    WeldedPatches(const WeldedPatches &) = delete;
+
+    WeldedPatches &operator=(const WeldedPatches &) = delete;
+
+    // replaces what was uploaded before; the CPU copy is not needed after.
+    // With `quantize` the positions go up as shorts, see quantize.h, and
+    // have to be drawn with a program that takes them.
+    void upload(const WeldedMesh &mesh, int samples, bool quantize);
+
+    void release();
+
+    inline bool empty() const {
+        return _first_index.empty();
+    }
+
+    // the resolution the mesh was welded at
+    inline int samples() const {
+        return _samples;
+    }
+
+    inline bool quantized() const {
+        return _quantized;
+    }
+
+    inline const PositionQuantization &quantization() const {
+        return _quantization;
+    }
+
+    // of positions, normals and indices on the GPU
+    inline size_t bytes() const {
+        return _bytes;
+    }
+
+    // draws the patches in `visible`, in increasing order, or every patch if
+    // it is NULL, leaving the vertex array binding as it was; returns the
+    // number of triangles drawn
+    size_t draw(const std::vector<size_t> *visible);
+
+private:
+    GLuint _vao;
+    GLuint _buffers[3];         // positions, normals, indices
+    size_t _bytes;
+    int _samples;
+    bool _quantized;
+    PositionQuantization _quantization;
+    std::vector<GLuint> _first_index;
+
+    std::vector<GLsizei> _draw_counts;
+    std::vector<const GLvoid *> _draw_offsets;
+};
+
+#endif //GLRENDER_PATCHWELD_H
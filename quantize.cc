@@ -0,0 +1,61 @@
+#include "quantize.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include <emmintrin.h>
+
+static const float LEVELS = 65535.0f;
+
+PositionQuantization::PositionQuantization()
+        : offset(0.0, 0.0, 0.0), extent(0.0, 0.0, 0.0), max_error(0) {
+}
+
+PositionQuantization::PositionQuantization(const Bounds &bounds)
+        : offset(bounds.min), extent(bounds.extent()), max_error(0) {
+}
+
+void quantize_positions(const float *positions, size_t count, size_t stride, PositionQuantization &q,
+                        GLushort *out) {
+    // a flat axis has a step of 0, and everything on it lands on the offset
+    float step[3], inverse[3];
+    for (int k = 0; k < 3; ++k) {
+        step[k] = q.extent[k] / LEVELS;
+        inverse[k] = q.extent[k] > 0 ? LEVELS / q.extent[k] : 0.0f;
+    }
+    const __m128 offset = _mm_setr_ps(q.offset.x, q.offset.y, q.offset.z, 0.0f);
+    const __m128 steps = _mm_setr_ps(step[0], step[1], step[2], 0.0f);
+    const __m128 inverses = _mm_setr_ps(inverse[0], inverse[1], inverse[2], 0.0f);
+    const __m128 half = _mm_set1_ps(0.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 top = _mm_set1_ps(LEVELS);
+    const __m128 xyz = _mm_castsi128_ps(_mm_setr_epi32(-1, -1, -1, 0));
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    // SSE2 only packs to signed shorts, so the values are moved down by
+    // 32768 to fit and flipped back by the top bit
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i flip = _mm_set1_epi16((short) 0x8000);
+
+    __m128 max_error = zero;
+    for (size_t i = 0; i < count; ++i) {
+        const float *p = positions + i * stride;
+        // the last xyz position has no fourth float after it to load
+        __m128 position = stride >= 4 || i + 1 < count ? _mm_loadu_ps(p) : _mm_setr_ps(p[0], p[1], p[2], 0.0f);
+        position = _mm_and_ps(position, xyz);
+
+        __m128 scaled = _mm_mul_ps(_mm_sub_ps(position, offset), inverses);
+        scaled = _mm_min_ps(_mm_max_ps(_mm_add_ps(scaled, half), zero), top);
+        __m128i levels = _mm_cvttps_epi32(scaled);
+
+        __m128 restored = _mm_add_ps(_mm_mul_ps(_mm_cvtepi32_ps(levels), steps), offset);
+        __m128 error = _mm_andnot_ps(sign, _mm_sub_ps(restored, position));
+        max_error = _mm_max_ps(max_error, _mm_and_ps(error, xyz));
+
+        __m128i packed = _mm_packs_epi32(_mm_sub_epi32(levels, bias), _mm_setzero_si128());
+        _mm_storel_epi64(reinterpret_cast<__m128i *>(out + 4 * i), _mm_xor_si128(packed, flip));
+    }
+
+    float errors[4];
+    _mm_storeu_ps(errors, max_error);
+    q.max_error = std::max(q.max_error, std::max(errors[0], std::max(errors[1], errors[2])));
+}
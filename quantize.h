@@ -0,0 +1,32 @@
+#ifndef GLRENDER_QUANTIZE_H
+#define GLRENDER_QUANTIZE_H
+
+#include <cstddef>
+
+#include "amath.h"
+#include "frustum.h"
+
+// Positions stored as four 16 bit unsigned integers on a grid over a
+// bounding box, x, y, z and one unused to keep vertices 8 byte aligned:
+// 8 bytes a vertex instead of the 16 of four floats, half the vertex
+// bandwidth. The attribute is read normalized, so
+// the vertex shader gets each coordinate in [0, 1] and puts it back with
+// position = value * extent + offset, both uniforms.
+struct PositionQuantization {
+    vec3 offset;        // the corner of the box
+    vec3 extent;        // its size
+    float max_error;    // furthest any coordinate moved, in model units
+
+    // the grid over `bounds`
+    explicit PositionQuantization(const Bounds &bounds);
+
+    PositionQuantization();
+};
+
+// quantizes `count` positions, `stride` floats apart (3 for xyz, 4 for
+// vec4), four shorts each into `out`. Done four coordinates at a time with
+// SSE2; the largest error goes into q.max_error.
+void quantize_positions(const float *positions, size_t count, size_t stride, PositionQuantization &q,
+                        GLushort *out);
+
+#endif //GLRENDER_QUANTIZE_H
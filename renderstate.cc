@@ -0,0 +1,80 @@
+#include "renderstate.h"
+
+#include <cstring>
+
+RenderState::RenderState()
+        : _camera_dirty(true), _lighting_dirty(true) {
+    memset(&_camera, 0, sizeof(_camera));
+    memset(&_lighting, 0, sizeof(_lighting));
+    _buffers[0] = _buffers[1] = 0;
+}
+
+void RenderState::init() {
+    glGenBuffers(2, _buffers);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffers[0]);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_CAMERA, _buffers[0]);
+
+    glBindBuffer(GL_UNIFORM_BUFFER, _buffers[1]);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(LightingBlock), NULL, GL_DYNAMIC_DRAW);
+    glBindBufferBase(GL_UNIFORM_BUFFER, UNIFORM_BLOCK_LIGHTING, _buffers[1]);
+
+    _camera_dirty = _lighting_dirty = true;
+}
+
+void RenderState::assign(GLfloat *to, const GLfloat *from, int count, bool &dirty) {
+    if (memcmp(to, from, sizeof(GLfloat) * count) != 0) {
+        memcpy(to, from, sizeof(GLfloat) * count);
+        dirty = true;
+    }
+}
+
+void RenderState::set_view(const mat4 &view, const vec4 &eye) {
+    assign(_camera.ctm, view, 16, _camera_dirty);
+    assign(_camera.pos, eye, 4, _camera_dirty);
+}
+
+void RenderState::set_projection(const mat4 &projection) {
+    assign(_camera.ptm, projection, 16, _camera_dirty);
+}
+
+void RenderState::set_light(int i, const vec4 &position, const vec4 &diffuse, const vec4 &specular) {
+    if (i < 0 || i >= MAX_LIGHTS) {
+        return;
+    }
+    assign(_lighting.lpos[i], position, 4, _lighting_dirty);
+    assign(_lighting.ldiff[i], diffuse, 4, _lighting_dirty);
+    assign(_lighting.lspec[i], specular, 4, _lighting_dirty);
+}
+
+void RenderState::set_ambient_light(const vec4 &ambient) {
+    assign(_lighting.lamb, ambient, 4, _lighting_dirty);
+}
+
+void RenderState::set_material(const vec4 &ambient, const vec4 &diffuse, const vec4 &specular, float shininess) {
+    assign(_lighting.mamb, ambient, 4, _lighting_dirty);
+    assign(_lighting.mdiff, diffuse, 4, _lighting_dirty);
+    assign(_lighting.mspec, specular, 4, _lighting_dirty);
+    assign(&_lighting.ms, &shininess, 1, _lighting_dirty);
+}
+
+size_t RenderState::upload() {
+    size_t bytes = 0;
+
+    if (_camera_dirty) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffers[0]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(CameraBlock), &_camera);
+        bytes += sizeof(CameraBlock);
+        _camera_dirty = false;
+    }
+
+    if (_lighting_dirty) {
+        glBindBuffer(GL_UNIFORM_BUFFER, _buffers[1]);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(LightingBlock), &_lighting);
+        bytes += sizeof(LightingBlock);
+        _lighting_dirty = false;
+    }
+
+    return bytes;
+}
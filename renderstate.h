@@ -0,0 +1,72 @@
+#ifndef GLRENDER_RENDERSTATE_H
+#define GLRENDER_RENDERSTATE_H
+
+#include "amath.h"
+#include "shadervariants.h"
+
+// The uniform state shared by all shader variants, kept in two std140 uniform
+// buffers bound to fixed binding points (see lighting.glsl):
+//
+//   Camera     view and projection matrices, camera position
+//   Lighting   lights and material
+//
+// Setters only change a CPU copy and mark its block dirty if a value really
+// changed; upload() then sends the dirty blocks, each in one call. Programs
+// pick the blocks up from their binding points, so switching programs (or
+// drawing many meshes) costs no uniform traffic at all.
+class RenderState {
+public:
+    RenderState();
+
+    RenderState(const RenderState &) = delete;
+
+    RenderState &operator=(const RenderState &) = delete;
+
+    // creates the buffers and binds them; needs a current GL context
+    void init();
+
+    void set_view(const mat4 &view, const vec4 &eye);
+
+    void set_projection(const mat4 &projection);
+
+    void set_light(int i, const vec4 &position, const vec4 &diffuse, const vec4 &specular);
+
+    void set_ambient_light(const vec4 &ambient);
+
+    void set_material(const vec4 &ambient, const vec4 &diffuse, const vec4 &specular, float shininess);
+
+    // sends the blocks changed since the last upload; returns the bytes sent
+    size_t upload();
+
+private:
+    // std140: vec4 and mat4 (row major, like mat4) need no padding, the
+    // trailing float is padded to a vec4
+    struct CameraBlock {
+        GLfloat ctm[16];
+        GLfloat ptm[16];
+        GLfloat pos[4];
+    };
+
+    struct LightingBlock {
+        GLfloat lpos[MAX_LIGHTS][4];
+        GLfloat ldiff[MAX_LIGHTS][4];
+        GLfloat lspec[MAX_LIGHTS][4];
+        GLfloat lamb[4];
+        GLfloat mamb[4];
+        GLfloat mdiff[4];
+        GLfloat mspec[4];
+        GLfloat ms;
+        GLfloat padding[3];
+    };
+
+    // copies `count` floats to `to`, marking `dirty` if they differ
+    static void assign(GLfloat *to, const GLfloat *from, int count, bool &dirty);
+
+    CameraBlock _camera;
+    LightingBlock _lighting;
+    bool _camera_dirty;
+    bool _lighting_dirty;
+    GLuint _buffers[2];     // camera, lighting
+};
+
+#endif //GLRENDER_RENDERSTATE_H
@@ -0,0 +1,289 @@
+#include "scene.h"
+
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <map>
+#include <sstream>
+
+#include "bricks.h"
+#include "loader.h"
+#include "meshnormals.h"
+#include "shadervariants.h"
+
+static const char *SCENE_HEADER = "glrender-scene";
+static const int SCENE_VERSION = 1;
+
+bool is_scene_file(const std::string &path) {
+    std::ifstream in(path.c_str());
+    std::string header;
+    int version = 0;
+    return in >> header >> version && header == SCENE_HEADER && version == SCENE_VERSION;
+}
+
+Scene::Scene()
+        : _done(true), _succeeded(false), _vao(0), _bytes(0) {
+    _buffers[0] = _buffers[1] = _buffers[2] = _buffers[3] = 0;
+    _stats.meshes = 0;
+    _stats.instances = 0;
+    _stats.vertices = 0;
+    _stats.triangles = 0;
+    _stats.ms = 0;
+    _loaded_stats = _stats;
+}
+
+Scene::~Scene() {
+    // what is on the GPU goes with release(), while there is a context
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+}
+
+void Scene::start(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance) {
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    _done = false;
+    _thread = std::thread(&Scene::run, this, path, sampling_resolution, weld_epsilon, weld_tolerance);
+}
+
+bool Scene::finished() {
+    if (!_done) {
+        return false;
+    }
+    if (_thread.joinable()) {
+        _thread.join();
+    }
+    return true;
+}
+
+void Scene::run(std::string path, int sampling_resolution, float weld_epsilon, float weld_tolerance) {
+    // a pool of its own: the one of the render thread is busy every frame
+    ThreadPool pool;
+    _succeeded = load(path, sampling_resolution, weld_epsilon, weld_tolerance, pool);
+    _done = true;
+}
+
+bool Scene::load(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance,
+                 ThreadPool &pool) {
+    auto start = std::chrono::steady_clock::now();
+    std::ifstream in(path.c_str());
+    if (!in.good()) {
+        std::cerr << "Fail to read scene file " << path << std::endl;
+        return false;
+    }
+    std::string header;
+    int version = 0;
+    in >> header >> version;
+    if (header != SCENE_HEADER || version != SCENE_VERSION) {
+        std::cerr << path << " is not a scene file" << std::endl;
+        return false;
+    }
+
+    size_t slash = path.rfind('/');
+    std::string directory = slash == std::string::npos ? "" : path.substr(0, slash + 1);
+
+    // the meshes in the order they are named, with the transforms of their
+    // instances
+    std::map<std::string, size_t> names;
+    std::vector<std::string> files;
+    std::vector<std::vector<vec4> > transforms;
+    std::string line;
+    std::getline(in, line);
+    for (int number = 2; std::getline(in, line); ++number) {
+        std::istringstream words(line.substr(0, line.find('#')));
+        std::string command, name;
+        if (!(words >> command)) {
+            continue;
+        }
+        if (command == "mesh") {
+            std::string file;
+            if (!(words >> name >> file)) {
+                std::cerr << "Scene file " << path << " has a mesh without a name or file at line " << number
+                          << std::endl;
+                return false;
+            }
+            if (names.count(name)) {
+                std::cerr << "Scene file " << path << " names mesh " << name << " again at line " << number
+                          << std::endl;
+                return false;
+            }
+            names[name] = files.size();
+            files.push_back(file[0] == '/' ? file : directory + file);
+            transforms.push_back(std::vector<vec4>());
+        } else if (command == "instance") {
+            float x, y, z, turn = 0, scale = 1;
+            if (!(words >> name >> x >> y >> z)) {
+                std::cerr << "Scene file " << path << " has an instance without a mesh or position at line "
+                          << number << std::endl;
+                return false;
+            }
+            if (words >> turn && !(words >> scale)) {
+                scale = 1;
+            }
+            auto found = names.find(name);
+            if (found == names.end()) {
+                std::cerr << "Scene file " << path << " has an instance of unknown mesh " << name << " at line "
+                          << number << std::endl;
+                return false;
+            }
+            // the columns of scale, then turn about y, then move
+            float c = cosf(DegreesToRadians * turn) * scale;
+            float s = sinf(DegreesToRadians * turn) * scale;
+            std::vector<vec4> &columns = transforms[found->second];
+            columns.push_back(vec4(c, 0.0, -s, 0.0));
+            columns.push_back(vec4(0.0, scale, 0.0, 0.0));
+            columns.push_back(vec4(s, 0.0, c, 0.0));
+            columns.push_back(vec4(x, y, z, 1.0));
+        } else {
+            std::cerr << "Scene file " << path << " has an unknown command " << command << " at line " << number
+                      << std::endl;
+            return false;
+        }
+    }
+
+    std::vector<Draw> draws;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> positions, normals, instances;
+    tracked_vector<GLuint, MEM_UPLOAD_STAGING> indices;
+    Stats stats = {0, 0, 0, 0, 0};
+    for (size_t m = 0; m < files.size(); ++m) {
+        // a mesh nothing uses isn't loaded at all
+        if (transforms[m].empty()) {
+            continue;
+        }
+        // a brick file is never loaded whole, and scenes don't nest
+        if (is_brick_file(files[m]) || is_scene_file(files[m])) {
+            std::cerr << "Scene file " << path << " has a mesh " << files[m] << " that is a brick or scene file"
+                      << std::endl;
+            return false;
+        }
+        tracked_vector<float, MEM_PARSER> verts;
+        tracked_vector<int, MEM_PARSER> tris;
+        if (!load_indexed_mesh(files[m], sampling_resolution, weld_epsilon, weld_tolerance, pool, verts, tris)) {
+            return false;
+        }
+
+        Draw draw;
+        draw.first_vertex = (GLint) positions.size();
+        draw.first_index = indices.size();
+        draw.index_count = (GLsizei) tris.size();
+        draw.first_instance = instances.size() / 4;
+        draw.instance_count = (GLsizei) (transforms[m].size() / 4);
+        draws.push_back(draw);
+
+        size_t count = verts.size() / 3;
+        positions.reserve(positions.size() + count);
+        for (size_t v = 0; v < count; ++v) {
+            positions.push_back(vec4(verts[3 * v], verts[3 * v + 1], verts[3 * v + 2], 1.0));
+        }
+        normals.resize(normals.size() + count, vec4(0.0, 0.0, 0.0, 0.0));
+        add_face_normals(verts.data(), tris.data(), tris.size(), &normals[draw.first_vertex]);
+        normalize_sums(&normals[draw.first_vertex], count);
+        indices.insert(indices.end(), tris.begin(), tris.end());
+        instances.insert(instances.end(), transforms[m].begin(), transforms[m].end());
+
+        ++stats.meshes;
+        stats.instances += draw.instance_count;
+        stats.triangles += tris.size() / 3 * draw.instance_count;
+    }
+    if (draws.empty()) {
+        std::cerr << "Scene file " << path << " has no instances" << std::endl;
+        return false;
+    }
+
+    _loaded.swap(draws);
+    _positions.swap(positions);
+    _normals.swap(normals);
+    _indices.swap(indices);
+    _instances.swap(instances);
+    stats.vertices = _positions.size();
+    stats.ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    _loaded_stats = stats;
+    return true;
+}
+
+void Scene::upload() {
+    if (_loaded.empty()) {
+        return;
+    }
+    release();
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glGenVertexArrays(1, &_vao);
+    glBindVertexArray(_vao);
+    glGenBuffers(4, _buffers);
+
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[0]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * _positions.size(), _positions.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_POSITION);
+    glVertexAttribPointer(ATTRIB_POSITION, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[1]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * _normals.size(), _normals.data(), GL_STATIC_DRAW);
+    glEnableVertexAttribArray(ATTRIB_NORMAL);
+    glVertexAttribPointer(ATTRIB_NORMAL, 4, GL_FLOAT, GL_FALSE, 0, BUFFER_OFFSET(0));
+
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _buffers[2]);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(GLuint) * _indices.size(), _indices.data(), GL_STATIC_DRAW);
+
+    // a mat4 attribute takes four locations, a column each; draw() points
+    // them at the instances of each mesh
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[3]);
+    glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * _instances.size(), _instances.data(), GL_STATIC_DRAW);
+    for (GLuint k = 0; k < 4; ++k) {
+        glEnableVertexAttribArray(ATTRIB_INSTANCE + k);
+        glVertexAttribDivisor(ATTRIB_INSTANCE + k, 1);
+    }
+    glBindVertexArray((GLuint) previous);
+
+    _bytes = sizeof(vec4) * (_positions.size() + _normals.size() + _instances.size()) +
+             sizeof(GLuint) * _indices.size();
+    mem_track_alloc(MEM_GPU_BUFFERS, _bytes);
+
+    _draws.swap(_loaded);
+    _loaded.clear();
+    _stats = _loaded_stats;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING>().swap(_positions);
+    tracked_vector<vec4, MEM_UPLOAD_STAGING>().swap(_normals);
+    tracked_vector<GLuint, MEM_UPLOAD_STAGING>().swap(_indices);
+    tracked_vector<vec4, MEM_UPLOAD_STAGING>().swap(_instances);
+}
+
+void Scene::release() {
+    if (_vao) {
+        glDeleteBuffers(4, _buffers);
+        glDeleteVertexArrays(1, &_vao);
+        mem_track_free(MEM_GPU_BUFFERS, _bytes);
+    }
+    _vao = 0;
+    _buffers[0] = _buffers[1] = _buffers[2] = _buffers[3] = 0;
+    _bytes = 0;
+    _draws.clear();
+}
+
+size_t Scene::draw() {
+    if (!_vao) {
+        return 0;
+    }
+
+    GLint previous = 0;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previous);
+    glBindVertexArray(_vao);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffers[3]);
+    size_t triangles = 0;
+    for (const Draw &draw : _draws) {
+        // without base instances (GL 4.2) the instance attribute is pointed
+        // at the mesh's first instance instead
+        for (GLuint k = 0; k < 4; ++k) {
+            glVertexAttribPointer(ATTRIB_INSTANCE + k, 4, GL_FLOAT, GL_FALSE, 4 * sizeof(vec4),
+                                  BUFFER_OFFSET(sizeof(vec4) * (4 * draw.first_instance + k)));
+        }
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, draw.index_count, GL_UNSIGNED_INT,
+                                          BUFFER_OFFSET(sizeof(GLuint) * draw.first_index), draw.instance_count,
+                                          draw.first_vertex);
+        triangles += (size_t) draw.index_count / 3 * draw.instance_count;
+    }
+    glBindVertexArray((GLuint) previous);
+    return triangles;
+}
@@ -0,0 +1,137 @@
+#ifndef GLRENDER_SCENE_H
+#define GLRENDER_SCENE_H
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "amath.h"
+#include "memstats.h"
+#include "threadpool.h"
+
+// Scenes of many copies of a few meshes. A scene file names every mesh once
+// and places its instances:
+//
+//   glrender-scene 1
+//   # anything after a # is a comment
+//   mesh NAME FILE                         an OBJ, mesh or Bezier file, its
+//                                          path relative to the scene file
+//   instance NAME x y z [turn [scale]]     a copy of mesh NAME turned `turn`
+//                                          degrees about y, scaled by
+//                                          `scale`, and moved to x y z
+//
+// Each mesh is loaded once, however many instances it has, and all meshes
+// share one vertex and one index buffer. The instance transforms are in a
+// buffer of their own, grouped by mesh, and go to the vertex shader as a
+// per-instance attribute, so that all instances of a mesh are one
+// glDrawElementsInstancedBaseVertex: the draw calls, and the work on the
+// CPU, grow with the meshes, not the instances. The scale is uniform so
+// that the transform turns the normals as well.
+
+// true if the file starts like a scene file
+bool is_scene_file(const std::string &path);
+
+// The meshes of a scene file and their instances, loaded on the CPU and then
+// uploaded, so that a scene can be loaded again, on a thread of its own,
+// while the one before is still drawn.
+class Scene {
+public:
+    struct Stats {
+        size_t meshes;              // loaded, those with instances
+        size_t instances;
+        size_t vertices;            // of the meshes, once each
+        size_t triangles;           // drawn per frame, of all instances
+        double ms;                  // to read the scene and load the meshes
+    };
+
+    Scene();
+
+    ~Scene();
+
+    Scene(const Scene &) = delete;
+
+    Scene &operator=(const Scene &) = delete;
+
+    // reads the scene file and loads the meshes its instances use, on the
+    // CPU, replacing a scene loaded before but not what is on the GPU. Bezier
+    // meshes are welded at `sampling_resolution` within `weld_tolerance`,
+    // OBJ vertices within `weld_epsilon`, see load_indexed_mesh. False if the
+    // file or one of the meshes can't be read or the file is malformed.
+    bool load(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance,
+              ThreadPool &pool);
+
+    // load() on a thread of its own, with a pool of its own, after waiting
+    // for a load still running
+    void start(const std::string &path, int sampling_resolution, float weld_epsilon, float weld_tolerance);
+
+    // true once the load start() began is done, or if there is none. Never
+    // blocks.
+    bool finished();
+
+    // what the last load() returned; only valid once finished()
+    inline bool succeeded() const {
+        return _succeeded;
+    }
+
+    // replaces what is on the GPU with the loaded scene; the CPU copy is not
+    // needed after
+    void upload();
+
+    // lets go of what is on the GPU, while there is still a context
+    void release();
+
+    inline bool empty() const {
+        return !_vao;
+    }
+
+    // draws every instance, leaving the vertex array binding as it was;
+    // returns the number of triangles drawn. The program has to be a
+    // SHADER_INSTANCED variant.
+    size_t draw();
+
+    // of the buffers on the GPU
+    inline size_t bytes() const {
+        return _bytes;
+    }
+
+    // how many draw calls a frame takes
+    inline size_t draws() const {
+        return _draws.size();
+    }
+
+    inline const Stats &stats() const {
+        return _stats;
+    }
+
+private:
+    struct Draw {
+        GLint first_vertex;
+        size_t first_index;
+        GLsizei index_count;
+        size_t first_instance;
+        GLsizei instance_count;
+    };
+
+    void run(std::string path, int sampling_resolution, float weld_epsilon, float weld_tolerance);
+
+    // the loaded scene, waiting for upload()
+    std::vector<Draw> _loaded;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> _positions;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> _normals;
+    tracked_vector<GLuint, MEM_UPLOAD_STAGING> _indices;
+    tracked_vector<vec4, MEM_UPLOAD_STAGING> _instances;    // the four columns of each transform
+    Stats _loaded_stats;
+
+    std::thread _thread;
+    std::atomic<bool> _done;
+    bool _succeeded;
+
+    std::vector<Draw> _draws;
+    GLuint _vao;
+    GLuint _buffers[4];             // positions, normals, indices, instances
+    size_t _bytes;
+    Stats _stats;                   // of the scene on the GPU
+};
+
+#endif //GLRENDER_SCENE_H
@@ -0,0 +1,119 @@
+#include "shadervariants.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+ShaderVariants::ShaderVariants(const char *vertex_file, const char *fragment_file, const char *lighting_file,
+                               const char *tess_control_file, const char *tess_evaluation_file)
+        : _vertex_file(vertex_file), _fragment_file(fragment_file),
+          _tess_control_file(tess_control_file ? tess_control_file : ""),
+          _tess_evaluation_file(tess_evaluation_file ? tess_evaluation_file : ""), _lighting_file(lighting_file) {
+}
+
+ShaderVariants::~ShaderVariants() {
+    // the context is usually gone by now, and the driver cleans up with it
+}
+
+std::string ShaderVariants::prelude(int features, int light_count) {
+    if (_lighting.empty()) {
+        std::ifstream in(_lighting_file.c_str());
+        if (!in.good()) {
+            std::cerr << "Fail to read " << _lighting_file << std::endl;
+            return "";
+        }
+        std::stringstream contents;
+        contents << in.rdbuf();
+        _lighting = contents.str();
+    }
+
+    std::string defines = "#define LIGHT_COUNT " + std::to_string(light_count) + "\n";
+    if (features & SHADER_PER_VERTEX_LIGHTING) {
+        defines += "#define PER_VERTEX_LIGHTING\n";
+    }
+    if (features & SHADER_SPECULAR) {
+        defines += "#define SPECULAR\n";
+    }
+    if (features & SHADER_PACKED_NORMALS) {
+        defines += "#define PACKED_NORMALS\n";
+    }
+    if (features & SHADER_QUANTIZED_POSITIONS) {
+        defines += "#define QUANTIZED_POSITIONS\n";
+    }
+    if (features & SHADER_INSTANCED) {
+        defines += "#define INSTANCED\n";
+    }
+    if (features & SHADER_CAPTURE) {
+        defines += "#define CAPTURE\n";
+    }
+    return defines + _lighting;
+}
+
+GLuint ShaderVariants::get(int features, int light_count) {
+    light_count = std::min(light_count, MAX_LIGHTS);
+
+    // a few bits of features, and the light count above them
+    int key = features | (light_count << 8);
+    auto found = _programs.find(key);
+    if (found != _programs.end()) {
+        return found->second;
+    }
+
+    std::string source = prelude(features, light_count);
+    if (source.empty()) {
+        return 0;
+    }
+    return build(key, source, false);
+}
+
+GLuint ShaderVariants::get_patches(int features, int light_count, int u_deg, int v_deg) {
+    if (_tess_control_file.empty() || _tess_evaluation_file.empty()) {
+        return 0;
+    }
+    light_count = std::min(light_count, MAX_LIGHTS);
+
+    // the degrees above the light count, and a bit to tell patch variants
+    // from the others
+    int key = features | (light_count << 8) | (u_deg << 12) | (v_deg << 18) | (1 << 24);
+    auto found = _programs.find(key);
+    if (found != _programs.end()) {
+        return found->second;
+    }
+
+    std::string source = prelude(features, light_count);
+    if (source.empty()) {
+        return 0;
+    }
+    std::string defines = "#define TESSELLATION\n#define U_DEGREE " + std::to_string(u_deg) +
+                          "\n#define V_DEGREE " + std::to_string(v_deg) + "\n#define CONTROL_POINTS " +
+                          std::to_string((u_deg + 1) * (v_deg + 1)) + "\n";
+    return build(key, defines + source, true);
+}
+
+GLuint ShaderVariants::build(int key, const std::string &source, bool tessellation) {
+    static const char *const attributes[] = {"vPosition", "vNorm", "vInstance", NULL};
+    // what teshader.glsl writes for each point, in the layout of CapturedPoint
+    static const char *const captured[] = {"uv", "position", "norm", NULL};
+    GLuint program = InitShader(_vertex_file.c_str(), tessellation ? _tess_control_file.c_str() : NULL,
+                                tessellation ? _tess_evaluation_file.c_str() : NULL, _fragment_file.c_str(),
+                                source.c_str(), attributes,
+                                tessellation && (key & SHADER_CAPTURE) ? captured : NULL);
+    if (!program) {
+        // remembered, so that a broken variant isn't compiled every frame
+        _programs[key] = 0;
+        return 0;
+    }
+
+    // a block the variant doesn't use is optimized out
+    GLuint camera = glGetUniformBlockIndex(program, "Camera");
+    if (camera != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, camera, UNIFORM_BLOCK_CAMERA);
+    }
+    GLuint lighting = glGetUniformBlockIndex(program, "Lighting");
+    if (lighting != GL_INVALID_INDEX) {
+        glUniformBlockBinding(program, lighting, UNIFORM_BLOCK_LIGHTING);
+    }
+
+    _programs[key] = program;
+    return program;
+}
@@ -0,0 +1,79 @@
+#ifndef GLRENDER_SHADERVARIANTS_H
+#define GLRENDER_SHADERVARIANTS_H
+
+#include <map>
+#include <string>
+
+#include "amath.h"
+
+// fixed attribute locations, the same in every variant
+const GLuint ATTRIB_POSITION = 0;
+const GLuint ATTRIB_NORMAL = 1;
+const GLuint ATTRIB_INSTANCE = 2;   // a mat4, a column in each of this and the next three
+
+// uniform block binding points, and the lights the Lighting block has room
+// for; both have to agree with lighting.glsl
+const GLuint UNIFORM_BLOCK_CAMERA = 0;
+const GLuint UNIFORM_BLOCK_LIGHTING = 1;
+const int MAX_LIGHTS = 4;
+
+// features a shader variant is specialized for, or-ed together
+enum ShaderFeature {
+    SHADER_PER_VERTEX_LIGHTING = 1,     // light per vertex rather than per fragment
+    SHADER_SPECULAR = 2,                // add the specular term
+    SHADER_PACKED_NORMALS = 4,          // normals come in as octahedron encoded vec2
+    SHADER_QUANTIZED_POSITIONS = 8,     // positions come in as normalized shorts, see quantize.h
+    SHADER_INSTANCED = 16,              // every instance has its own model transform, see scene.h
+    SHADER_CAPTURE = 32                 // patch variants keep every patch and capture its points, see tessverify.h
+};
+
+// The programs built from vshader.glsl and fshader.glsl, one per combination
+// of features and light count. Each combination becomes a set of #defines
+// ahead of the shared lighting code in lighting.glsl, so that a variant only
+// contains the work it needs: the unlit one does no lighting math at all,
+// the diffuse one no pow(). Variants are compiled on first use and kept
+// (and the program binary cache keeps them across runs).
+//
+// Given tessellation shaders, there are also variants for drawing Bezier
+// patches as GL_PATCHES, one per patch degree as well, since the number of
+// control points a patch has is fixed in the tessellation control shader.
+class ShaderVariants {
+public:
+    ShaderVariants(const char *vertex_file, const char *fragment_file, const char *lighting_file,
+                   const char *tess_control_file = NULL, const char *tess_evaluation_file = NULL);
+
+    ~ShaderVariants();
+
+    ShaderVariants(const ShaderVariants &) = delete;
+
+    ShaderVariants &operator=(const ShaderVariants &) = delete;
+
+    // the program for these features, with its uniform blocks bound to
+    // UNIFORM_BLOCK_CAMERA and UNIFORM_BLOCK_LIGHTING; 0 if it doesn't build.
+    // Needs a current GL context.
+    GLuint get(int features, int light_count);
+
+    // the program for Bezier patches of degree u_deg by v_deg, whose control
+    // points are drawn as GL_PATCHES; 0 without tessellation shaders
+    GLuint get_patches(int features, int light_count, int u_deg, int v_deg);
+
+    inline size_t compiled() const {
+        return _programs.size();
+    }
+
+private:
+    std::string prelude(int features, int light_count);
+
+    // builds and binds the blocks of the program for `key`
+    GLuint build(int key, const std::string &source, bool tessellation);
+
+    std::string _vertex_file;
+    std::string _fragment_file;
+    std::string _tess_control_file;
+    std::string _tess_evaluation_file;
+    std::string _lighting_file;
+    std::string _lighting;      // contents of _lighting_file, once read
+    std::map<int, GLuint> _programs;
+};
+
+#endif //GLRENDER_SHADERVARIANTS_H
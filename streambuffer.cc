@@ -0,0 +1,122 @@
+#include "streambuffer.h"
+
+#include "memstats.h"
+
+static const GLbitfield PERSISTENT_FLAGS = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+StreamBuffer::StreamBuffer()
+        : _persistent(false), _buffer(0), _region_size(0), _current(0), _mapped(NULL) {
+    for (int i = 0; i < REGIONS; ++i) {
+        _fences[i] = 0;
+    }
+}
+
+StreamBuffer::~StreamBuffer() {
+    // the context is usually gone by now, and the driver cleans up with it
+}
+
+void StreamBuffer::init() {
+#ifndef __APPLE__
+    _persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+#endif
+    if (!_persistent) {
+        std::cerr << "ARB_buffer_storage unavailable, streaming through buffer orphaning" << std::endl;
+    }
+}
+
+void StreamBuffer::allocate(size_t region_size) {
+    release();
+
+    _region_size = region_size;
+    glGenBuffers(1, &_buffer);
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+
+    if (_persistent) {
+        glBufferStorage(GL_ARRAY_BUFFER, REGIONS * _region_size, NULL, PERSISTENT_FLAGS);
+        _mapped = static_cast<char *>(glMapBufferRange(GL_ARRAY_BUFFER, 0, REGIONS * _region_size, PERSISTENT_FLAGS));
+        mem_track_alloc(MEM_GPU_BUFFERS, REGIONS * _region_size);
+    } else {
+        glBufferData(GL_ARRAY_BUFFER, _region_size, NULL, GL_STREAM_DRAW);
+        mem_track_alloc(MEM_GPU_BUFFERS, _region_size);
+    }
+    _current = REGIONS - 1;
+}
+
+void StreamBuffer::release() {
+    if (!_buffer) {
+        return;
+    }
+
+    for (int i = 0; i < REGIONS; ++i) {
+        if (_fences[i]) {
+            glDeleteSync(_fences[i]);
+            _fences[i] = 0;
+        }
+    }
+    if (_mapped) {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+        _mapped = NULL;
+    }
+    // deleting a buffer that pending draws still read from is fine, GL keeps
+    // the storage alive until they are done
+    glDeleteBuffers(1, &_buffer);
+    mem_track_free(MEM_GPU_BUFFERS, _persistent ? REGIONS * _region_size : _region_size);
+    _buffer = 0;
+}
+
+void StreamBuffer::wait(int region) {
+    if (!_fences[region]) {
+        return;
+    }
+
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(_fences[region], flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+        flags = 0;
+    }
+    glDeleteSync(_fences[region]);
+    _fences[region] = 0;
+}
+
+void *StreamBuffer::map(size_t bytes) {
+    if (bytes > _region_size || !_buffer) {
+        // leave room to grow into before the next reallocation
+        size_t region_size = 2 * _region_size;
+        allocate(region_size < bytes ? bytes : region_size);
+    }
+
+    if (_persistent) {
+        if (!_mapped) {
+            return NULL;
+        }
+        int next = (_current + 1) % REGIONS;
+        wait(next);
+        _current = next;
+        return _mapped + offset();
+    }
+
+    // orphan the old storage, draws in flight keep using it
+    glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+    glBufferData(GL_ARRAY_BUFFER, _region_size, NULL, GL_STREAM_DRAW);
+    _current = 0;
+    return glMapBufferRange(GL_ARRAY_BUFFER, 0, bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void StreamBuffer::commit() {
+    if (!_persistent) {
+        glBindBuffer(GL_ARRAY_BUFFER, _buffer);
+        glUnmapBuffer(GL_ARRAY_BUFFER);
+    }
+    // with a coherent mapping the writes are visible to commands issued from
+    // here on, nothing to flush
+}
+
+void StreamBuffer::fence() {
+    if (!_persistent) {
+        return;
+    }
+    if (_fences[_current]) {
+        glDeleteSync(_fences[_current]);
+    }
+    _fences[_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,70 @@
+#ifndef GLRENDER_STREAMBUFFER_H
+#define GLRENDER_STREAMBUFFER_H
+
+#include "amath.h"
+
+// A vertex buffer for geometry that the CPU regenerates wholesale, like the
+// tessellated Bezier surfaces on a resolution change.
+//
+// With ARB_buffer_storage the buffer is mapped once, persistently and
+// coherently, and split into a ring of regions. Each update is written
+// straight into the next region while the GPU may still be drawing from the
+// previous one; a fence per region makes sure a region is only rewritten once
+// the GPU is done with it. Without buffer storage every update orphans the
+// buffer and maps it afresh, which gives the driver the same freedom.
+class StreamBuffer {
+public:
+    StreamBuffer();
+
+    ~StreamBuffer();
+
+    StreamBuffer(const StreamBuffer &) = delete;
+
+    StreamBuffer &operator=(const StreamBuffer &) = delete;
+
+    // needs a current GL context
+    void init();
+
+    // CPU pointer to `bytes` of writable buffer memory, which become visible to
+    // the GPU after commit(). Grows the buffer if needed. NULL if the buffer
+    // can't be mapped.
+    void *map(size_t bytes);
+
+    // finishes the write started by map(); from now on draws use this data
+    void commit();
+
+    // call after the draws that read the current region, so that it is not
+    // overwritten before they complete
+    void fence();
+
+    inline GLuint buffer() const {
+        return _buffer;
+    }
+
+    // byte offset of the current data in buffer()
+    inline size_t offset() const {
+        return _current * _region_size;
+    }
+
+    inline bool persistent() const {
+        return _persistent;
+    }
+
+private:
+    static const int REGIONS = 3;
+
+    void allocate(size_t region_size);
+
+    void release();
+
+    void wait(int region);
+
+    bool _persistent;
+    GLuint _buffer;
+    size_t _region_size;
+    int _current;
+    char *_mapped;          // persistent mapping of the whole buffer
+    GLsync _fences[REGIONS];
+};
+
+#endif //GLRENDER_STREAMBUFFER_H
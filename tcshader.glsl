@@ -0,0 +1,78 @@
+#version 400
+// Passes the control points of a Bezier patch through, and decides how
+// finely the patch is cut up: `samples` segments per degree in each
+// direction, like the sampling resolution of the CPU path, or with samples
+// 0, enough for the edges of the triangles to be about `edge_pixels` long
+// on screen.
+
+layout(vertices = CONTROL_POINTS) out;
+
+uniform float samples;
+uniform float edge_pixels;
+uniform vec2 viewport;
+
+vec2 to_screen(vec4 p)
+{
+  vec4 clip = ptm * ctm * p;
+  return clip.xy / max(clip.w, 0.001) * viewport * 0.5;
+}
+
+// the on screen length of the control polygon along one edge of the patch,
+// in segments of edge_pixels. Neighbouring patches share the control points
+// of their common edge, so they agree on its level and meet without cracks.
+float edge_level(int first, int step, int count)
+{
+  float len = 0.0;
+  vec2 prev = to_screen(gl_in[first].gl_Position);
+  for (int k = 1; k <= count; ++k) {
+    vec2 next = to_screen(gl_in[first + k * step].gl_Position);
+    len += distance(prev, next);
+    prev = next;
+  }
+  return clamp(len / edge_pixels, 1.0, float(gl_MaxTessGenLevel));
+}
+
+// true if every control point is beyond the same clip plane
+bool outside()
+{
+  // how far the point furthest inside is from each plane
+  vec3 low = vec3(-1e30);
+  vec3 high = vec3(1e30);
+  for (int k = 0; k < gl_PatchVerticesIn; ++k) {
+    vec4 clip = ptm * ctm * gl_in[k].gl_Position;
+    low = max(low, clip.xyz + clip.w);
+    high = min(high, clip.xyz - clip.w);
+  }
+  return any(lessThan(low, vec3(0.0))) || any(greaterThan(high, vec3(0.0)));
+}
+
+void main()
+{
+  gl_out[gl_InvocationID].gl_Position = gl_in[gl_InvocationID].gl_Position;
+
+  if (gl_InvocationID == 0) {
+    // rows of control points run along u, from v = 1 down to v = 0; a
+    // captured patch is kept wherever it is
+#ifndef CAPTURE
+    if (outside()) {
+      // the patch lies in the hull of its control points; a level of 0
+      // drops it
+      gl_TessLevelOuter[0] = gl_TessLevelOuter[1] = gl_TessLevelOuter[2] = gl_TessLevelOuter[3] = 0.0;
+    } else
+#endif
+    if (samples > 0.0) {
+      gl_TessLevelOuter[0] = gl_TessLevelOuter[2] = samples * float(V_DEGREE);
+      gl_TessLevelOuter[1] = gl_TessLevelOuter[3] = samples * float(U_DEGREE);
+    } else {
+      gl_TessLevelOuter[0] = edge_level(0, U_DEGREE + 1, V_DEGREE);
+      gl_TessLevelOuter[1] = edge_level(V_DEGREE * (U_DEGREE + 1), 1, U_DEGREE);
+      gl_TessLevelOuter[2] = edge_level(U_DEGREE, U_DEGREE + 1, V_DEGREE);
+      gl_TessLevelOuter[3] = edge_level(0, 1, U_DEGREE);
+    }
+    // an inner level of 1 next to a larger one is rounded up to 2, so a
+    // patch of degree 1 at resolution 1 gets a few more triangles than on
+    // the CPU; its edges stay as they are
+    gl_TessLevelInner[0] = max(gl_TessLevelOuter[1], gl_TessLevelOuter[3]);
+    gl_TessLevelInner[1] = max(gl_TessLevelOuter[0], gl_TessLevelOuter[2]);
+  }
+}
@@ -0,0 +1,80 @@
+#version 400
+// Evaluates a Bezier patch at the points tcshader.glsl cut it into: the
+// position and the normal from the analytic partial derivatives, the same
+// as BezierSurface::eval_sample computes on the CPU.
+
+layout(quads, equal_spacing, ccw) in;
+
+#ifdef PER_VERTEX_LIGHTING
+out vec4 color;
+#else
+out vec4 norm;
+out vec4 position;
+#endif
+
+#ifdef CAPTURE
+// where on the patch the point is, for comparing it with eval_sample
+out vec2 uv;
+#endif
+
+#define ORDER (U_DEGREE > V_DEGREE ? U_DEGREE + 1 : V_DEGREE + 1)
+
+// the Bernstein polynomials of degree n at t, and their derivatives, from
+// the polynomials of degree n - 1
+void bernstein(int n, float t, out float b[ORDER], out float d[ORDER])
+{
+  float s = 1.0 - t;
+  float c[ORDER];
+  c[0] = 1.0;
+  for (int j = 1; j < ORDER; ++j) {
+    c[j] = 0.0;
+  }
+  for (int k = 1; k < n; ++k) {
+    float previous = 0.0;
+    for (int j = 0; j <= k; ++j) {
+      float current = c[j];
+      c[j] = s * current + t * previous;
+      previous = current;
+    }
+  }
+
+  for (int j = 0; j < ORDER; ++j) {
+    float lower = j > 0 && j <= n ? c[j - 1] : 0.0;
+    float upper = j < n ? c[j] : 0.0;
+    b[j] = s * upper + t * lower;
+    d[j] = float(n) * (lower - upper);
+  }
+}
+
+void main()
+{
+  // the rows run from v = 1 down to v = 0, so they are evaluated at 1 - v
+  float bu[ORDER], du[ORDER], bt[ORDER], dt[ORDER];
+  bernstein(U_DEGREE, gl_TessCoord.x, bu, du);
+  bernstein(V_DEGREE, 1.0 - gl_TessCoord.y, bt, dt);
+
+  vec4 p = vec4(0.0);
+  vec3 u_tan = vec3(0.0);
+  vec3 v_tan = vec3(0.0);
+  for (int i = 0; i <= V_DEGREE; ++i) {
+    for (int j = 0; j <= U_DEGREE; ++j) {
+      vec4 c = gl_in[i * (U_DEGREE + 1) + j].gl_Position;
+      p += bt[i] * bu[j] * c;
+      u_tan += bt[i] * du[j] * c.xyz;
+      v_tan += dt[i] * bu[j] * c.xyz;
+    }
+  }
+  vec4 n = vec4(normalize(cross(u_tan, v_tan)), 0.0);
+
+#ifdef PER_VERTEX_LIGHTING
+  color = shade(n, p);
+#else
+  norm = n;
+  position = p;
+#endif
+#ifdef CAPTURE
+  uv = gl_TessCoord.xy;
+#endif
+
+  gl_Position = ptm * ctm * p;
+}
@@ -0,0 +1,140 @@
+#version 430
+// Tessellates a batch of Bezier patches into triangle lists, the same as
+// BezierSurface::eval_triangles does on the CPU. Each invocation evaluates
+// one point of a patch's (u, v) grid, its position and analytic normal, and
+// writes it to every triangle corner of the list that uses it, straight into
+// the vertex buffers.
+//
+// MAX_DEGREE comes from the program, ahead of this file.
+
+layout(local_size_x = 64) in;
+
+struct Patch {
+  int first_point;      // in control_points, rows of u_deg + 1 from v = 1 down
+  int u_deg;
+  int v_deg;
+  int samples;          // segments per degree in each direction
+  int first_sample;     // of the batch's grid points, for finding the patch
+  int first_vertex;     // of the triangle list in the vertex buffers
+  int unused[2];
+};
+
+layout(std430, binding = 0) readonly buffer ControlPoints {
+  vec4 control_points[];
+};
+
+layout(std430, binding = 1) readonly buffer Patches {
+  Patch patches[];
+};
+
+layout(std430, binding = 2) writeonly buffer Positions {
+  vec4 positions[];
+};
+
+layout(std430, binding = 3) writeonly buffer Normals {
+  vec4 normals[];
+};
+
+uniform int patch_count;
+uniform int sample_count;
+
+// the Bernstein polynomials of degree n at t, and their derivatives, from
+// the polynomials of degree n - 1
+void bernstein(int n, float t, out float b[MAX_DEGREE + 1], out float d[MAX_DEGREE + 1])
+{
+  float s = 1.0 - t;
+  float c[MAX_DEGREE + 1];
+  c[0] = 1.0;
+  for (int j = 1; j <= n; ++j) {
+    c[j] = 0.0;
+  }
+  for (int k = 1; k < n; ++k) {
+    float previous = 0.0;
+    for (int j = 0; j <= k; ++j) {
+      float current = c[j];
+      c[j] = s * current + t * previous;
+      previous = current;
+    }
+  }
+
+  for (int j = 0; j <= n; ++j) {
+    float lower = j > 0 ? c[j - 1] : 0.0;
+    float upper = j < n ? c[j] : 0.0;
+    b[j] = s * upper + t * lower;
+    d[j] = float(n) * (lower - upper);
+  }
+}
+
+void main()
+{
+  int sample_index = int(gl_GlobalInvocationID.y * gl_NumWorkGroups.x * gl_WorkGroupSize.x + gl_GlobalInvocationID.x);
+  if (sample_index >= sample_count) {
+    return;
+  }
+
+  // the last patch starting at or before the sample
+  int low = 0;
+  int high = patch_count - 1;
+  while (low < high) {
+    int middle = (low + high + 1) / 2;
+    if (patches[middle].first_sample <= sample_index) {
+      low = middle;
+    } else {
+      high = middle - 1;
+    }
+  }
+  Patch entry = patches[low];
+
+  int u_count = entry.samples * entry.u_deg + 1;
+  int v_count = entry.samples * entry.v_deg + 1;
+  int local = sample_index - entry.first_sample;
+  int i = local / u_count;
+  int j = local - i * u_count;
+
+  // the rows run from v = 1 down to v = 0, so they are evaluated at 1 - v
+  float bu[MAX_DEGREE + 1], du[MAX_DEGREE + 1], bt[MAX_DEGREE + 1], dt[MAX_DEGREE + 1];
+  bernstein(entry.u_deg, float(j) * (1.0 / float(u_count - 1)), bu, du);
+  bernstein(entry.v_deg, 1.0 - float(i) * (1.0 / float(v_count - 1)), bt, dt);
+
+  vec3 p = vec3(0.0);
+  vec3 u_tan = vec3(0.0);
+  vec3 v_tan = vec3(0.0);
+  for (int r = 0; r <= entry.v_deg; ++r) {
+    for (int c = 0; c <= entry.u_deg; ++c) {
+      vec3 point = control_points[entry.first_point + r * (entry.u_deg + 1) + c].xyz;
+      p += bt[r] * bu[c] * point;
+      u_tan += bt[r] * du[c] * point;
+      v_tan += dt[r] * bu[c] * point;
+    }
+  }
+  vec4 position = vec4(p, 1.0);
+  vec4 normal = vec4(normalize(cross(u_tan, v_tan)), 0.0);
+
+  // each grid cell is two triangles, (i, j) (i + 1, j + 1) (i + 1, j) and
+  // (i + 1, j + 1) (i, j) (i, j + 1); the point is a corner of up to four
+  // cells
+  int cells = u_count - 1;
+  int corners[6];
+  int count = 0;
+  if (i < v_count - 1 && j < cells) {
+    int cell = entry.first_vertex + 6 * (i * cells + j);
+    corners[count++] = cell;
+    corners[count++] = cell + 4;
+  }
+  if (i > 0 && j > 0) {
+    int cell = entry.first_vertex + 6 * ((i - 1) * cells + j - 1);
+    corners[count++] = cell + 1;
+    corners[count++] = cell + 3;
+  }
+  if (i > 0 && j < cells) {
+    corners[count++] = entry.first_vertex + 6 * ((i - 1) * cells + j) + 2;
+  }
+  if (i < v_count - 1 && j > 0) {
+    corners[count++] = entry.first_vertex + 6 * (i * cells + j - 1) + 5;
+  }
+
+  for (int k = 0; k < count; ++k) {
+    positions[corners[k]] = position;
+    normals[corners[k]] = normal;
+  }
+}
@@ -0,0 +1,141 @@
+#include "tessverify.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "arena.h"
+#include "frustum.h"
+#include "memstats.h"
+
+// vertices the compute shader writes before they are read back and compared
+static const size_t CHECK_BATCH_VERTICES = 1 << 20;
+
+// the diagonal of the bounds of all the patches
+static float patches_size(const std::vector<BezierSurface> &surfaces) {
+    Bounds bounds;
+    for (auto &surf : surfaces) {
+        bounds.extend(surf.bounds());
+    }
+    return bounds.empty() ? 1.0f : std::max(length(bounds.max - bounds.min), 1e-30f);
+}
+
+// adds a point the GPU made to `check`, against the CPU's at the same place.
+// Where the patch has no normal, at a corner collapsed to a point, the CPU
+// normal is not a number, and only the positions are compared.
+static void compare(const vec4 &position, const vec4 &normal, const float *gpu_position, const float *gpu_normal,
+                    float size, TessellationCheck &check) {
+    vec3 d(position.x - gpu_position[0], position.y - gpu_position[1], position.z - gpu_position[2]);
+    check.position_error = std::max(check.position_error, length(d) / size);
+    if (!std::isnan(normal.x)) {
+        vec3 n(normal.x - gpu_normal[0], normal.y - gpu_normal[1], normal.z - gpu_normal[2]);
+        check.normal_error = std::max(check.normal_error, length(n));
+    }
+    ++check.points;
+}
+
+bool check_gpu_patches(GpuPatches &patches, ShaderVariants &variants, std::vector<BezierSurface> &surfaces,
+                       int samples, TessellationCheck &check) {
+    memset(&check, 0, sizeof(check));
+    if (patches.empty()) {
+        return false;
+    }
+
+    // room for the most triangles a patch makes: an inner level rounded up
+    // from 1 to 2 adds a few to those of the CPU
+    size_t capacity = 0;
+    for (auto &surf : surfaces) {
+        capacity = std::max(capacity, (size_t) 6 * (samples * surf.u_deg() + 2) * (samples * surf.v_deg() + 2));
+    }
+    GLuint buffer = 0;
+    glGenBuffers(1, &buffer);
+    glBindBuffer(GL_TRANSFORM_FEEDBACK_BUFFER, buffer);
+    glBufferData(GL_TRANSFORM_FEEDBACK_BUFFER, sizeof(CapturedPoint) * capacity, NULL, GL_STREAM_READ);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, buffer);
+
+    float size = patches_size(surfaces);
+    LinearArena scratch(MEM_TESSELLATOR);
+    std::vector<CapturedPoint> captured;
+    bool ok = true;
+    for (size_t p = 0; p < surfaces.size() && ok; ++p) {
+        BezierSurface &surf = surfaces[p];
+        size_t triangles = patches.capture(p, variants, (float) samples);
+        ok = triangles >= (size_t) surf.triangle_vertex_count(samples) / 3;
+        if (!ok) {
+            std::cerr << "Bezier patch " << p << " makes " << triangles << " triangles in the tessellation shaders, "
+                      << surf.triangle_vertex_count(samples) / 3 << " on the CPU" << std::endl;
+        }
+        captured.resize(3 * std::min(triangles, capacity / 3));
+        glGetBufferSubData(GL_TRANSFORM_FEEDBACK_BUFFER, 0, sizeof(CapturedPoint) * captured.size(),
+                           captured.data());
+        for (const CapturedPoint &point : captured) {
+            vec4 position, normal;
+            surf.eval_sample(point.uv[0], point.uv[1], position, normal, scratch);
+            compare(position, normal, point.position, point.normal, size, check);
+        }
+        ++check.patches;
+    }
+
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glDeleteBuffers(1, &buffer);
+    return ok;
+}
+
+bool check_compute_tessellator(ComputeTessellator &tessellator, std::vector<BezierSurface> &surfaces, int samples,
+                               TessellationCheck &check) {
+    memset(&check, 0, sizeof(check));
+    if (tessellator.empty()) {
+        return false;
+    }
+
+    // a patch bigger than a batch is a batch of its own
+    size_t capacity = CHECK_BATCH_VERTICES;
+    for (auto &surf : surfaces) {
+        capacity = std::max(capacity, (size_t) surf.triangle_vertex_count(samples));
+    }
+    GLuint buffers[2];
+    glGenBuffers(2, buffers);
+    for (int k = 0; k < 2; ++k) {
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[k]);
+        glBufferData(GL_SHADER_STORAGE_BUFFER, sizeof(vec4) * capacity, NULL, GL_STREAM_READ);
+    }
+
+    float size = patches_size(surfaces);
+    LinearArena scratch(MEM_TESSELLATOR);
+    std::vector<vec4> gpu_positions, gpu_normals, positions, normals;
+    for (size_t first = 0; first < surfaces.size();) {
+        size_t last = first;
+        size_t count = 0;
+        while (last < surfaces.size() &&
+               (last == first || count + surfaces[last].triangle_vertex_count(samples) <= capacity)) {
+            tessellator.add(last, samples, (GLint) count);
+            count += surfaces[last].triangle_vertex_count(samples);
+            ++last;
+        }
+        tessellator.dispatch(buffers[0], buffers[1]);
+
+        gpu_positions.resize(count);
+        gpu_normals.resize(count);
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[0]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(vec4) * count, gpu_positions.data());
+        glBindBuffer(GL_SHADER_STORAGE_BUFFER, buffers[1]);
+        glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(vec4) * count, gpu_normals.data());
+
+        size_t vertex = 0;
+        for (size_t p = first; p < last; ++p) {
+            BezierSurface &surf = surfaces[p];
+            size_t vertices = surf.triangle_vertex_count(samples);
+            positions.resize(vertices);
+            normals.resize(vertices);
+            surf.eval_triangles(samples, positions.data(), normals.data(), scratch);
+            for (size_t v = 0; v < vertices; ++v, ++vertex) {
+                compare(positions[v], normals[v], &gpu_positions[vertex].x, &gpu_normals[vertex].x, size, check);
+            }
+            ++check.patches;
+        }
+        first = last;
+    }
+
+    glDeleteBuffers(2, buffers);
+    return true;
+}
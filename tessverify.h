@@ -0,0 +1,45 @@
+#ifndef GLRENDER_TESSVERIFY_H
+#define GLRENDER_TESSVERIFY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "beziersurface.h"
+#include "computetessellator.h"
+#include "gpupatches.h"
+#include "shadervariants.h"
+
+// Checks of the GPU tessellation paths against the CPU evaluator, for
+// --verify-tessellation. What the GPU made is read back and every point
+// compared with BezierSurface::eval_sample at the same place on its patch,
+// so that a change to the shaders, or a new driver, can be checked again on
+// any patch file.
+
+// a point as teshader.glsl captures it with SHADER_CAPTURE, interleaved
+struct CapturedPoint {
+    float uv[2];
+    float position[4];
+    float normal[4];
+};
+
+// how far the GPU is from the CPU
+struct TessellationCheck {
+    size_t patches;
+    size_t points;              // compared
+    float position_error;       // largest distance of two positions, as a share of the patches' size
+    float normal_error;         // largest length of the difference of two normals
+};
+
+// captures every patch at `samples` segments per degree from the
+// tessellation shaders, by transform feedback; false if a patch makes fewer
+// triangles than on the CPU
+bool check_gpu_patches(GpuPatches &patches, ShaderVariants &variants, std::vector<BezierSurface> &surfaces,
+                       int samples, TessellationCheck &check);
+
+// tessellates every patch at `samples` segments per degree with the compute
+// shader, in batches, and reads the buffers it wrote back; they are in the
+// triangle order of eval_triangles. False if the tessellator has no patches.
+bool check_compute_tessellator(ComputeTessellator &tessellator, std::vector<BezierSurface> &surfaces, int samples,
+                               TessellationCheck &check);
+
+#endif //GLRENDER_TESSVERIFY_H
@@ -0,0 +1,82 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned threads)
+        : _task(NULL), _tasks(0), _next(0), _done(0), _generation(0), _stopping(false) {
+    if (threads == 0) {
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    }
+    for (unsigned i = 1; i < threads; ++i) {
+        _workers.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _stopping = true;
+        _started.notify_all();
+    }
+    for (auto &worker : _workers) {
+        worker.join();
+    }
+}
+
+void ThreadPool::run(size_t tasks, const std::function<void(size_t)> &task) {
+    if (tasks == 0) {
+        return;
+    }
+    if (tasks == 1 || _workers.empty()) {
+        for (size_t i = 0; i < tasks; ++i) {
+            task(i);
+        }
+        return;
+    }
+
+    std::unique_lock<std::mutex> run_lock(_run_mutex);
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _task = &task;
+        _tasks = tasks;
+        _next = 0;
+        _done = 0;
+        ++_generation;
+        _started.notify_all();
+    }
+
+    drain();
+
+    std::unique_lock<std::mutex> lock(_mutex);
+    _finished.wait(lock, [this] { return _done == _tasks; });
+    _task = NULL;
+}
+
+void ThreadPool::drain() {
+    std::unique_lock<std::mutex> lock(_mutex);
+    while (_task && _next < _tasks) {
+        size_t i = _next++;
+        const std::function<void(size_t)> &task = *_task;
+        lock.unlock();
+        task(i);
+        lock.lock();
+        if (++_done == _tasks) {
+            _finished.notify_all();
+        }
+    }
+}
+
+void ThreadPool::work() {
+    unsigned long seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _started.wait(lock, [this, seen] { return _stopping || _generation != seen; });
+            if (_stopping) {
+                return;
+            }
+            seen = _generation;
+        }
+        drain();
+    }
+}
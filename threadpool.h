@@ -0,0 +1,53 @@
+#ifndef GLRENDER_THREADPOOL_H
+#define GLRENDER_THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads for data parallel loops that are too short to
+// start threads for, like per-frame culling. The calling thread works along,
+// and run() returns once every task is done. Calls to run() from different
+// threads are served one after the other.
+class ThreadPool {
+public:
+    // 0 threads: one per hardware thread, counting the caller
+    explicit ThreadPool(unsigned threads = 0);
+
+    ~ThreadPool();
+
+    ThreadPool(const ThreadPool &) = delete;
+
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    // calls task(i) for every i in [0, tasks), in no particular order
+    void run(size_t tasks, const std::function<void(size_t)> &task);
+
+    // threads that take part in run(), the caller included
+    inline unsigned size() const {
+        return (unsigned) _workers.size() + 1;
+    }
+
+private:
+    void work();
+
+    // takes tasks of the current run() until there are none left
+    void drain();
+
+    std::vector<std::thread> _workers;
+
+    std::mutex _run_mutex;      // one run() at a time
+    std::mutex _mutex;
+    std::condition_variable _started;
+    std::condition_variable _finished;
+    const std::function<void(size_t)> *_task;
+    size_t _tasks;
+    size_t _next;               // next task to hand out
+    size_t _done;
+    unsigned long _generation;  // counts run() calls, to wake the workers
+    bool _stopping;
+};
+
+#endif //GLRENDER_THREADPOOL_H
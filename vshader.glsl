@@ -1,33 +1,85 @@
-#version 130
+#version 140
 // we are going to be getting an attribute from the main program, named
 // "vPosition", one for each vertex.
 in vec4 vPosition;
 
 // we are going to be getting an attribute from the main program, named
 // "vNorm", one for each vertex.
+#ifdef PACKED_NORMALS
+in vec2 vNorm;
+#else
 in vec4 vNorm;
+#endif
 
-// camera transform matrix
-uniform mat4 ctm;
+// with QUANTIZED_POSITIONS vPosition.xyz is in [0, 1] over the model's
+// bounding box, read from normalized shorts
+#ifdef QUANTIZED_POSITIONS
+uniform vec3 position_offset;
+uniform vec3 position_extent;
+#endif
 
-// projective transform matrix
-uniform mat4 ptm;
+// with INSTANCED every instance comes with its own model transform, a turn,
+// a uniform scale and a move, so that it turns the normals right as well
+#ifdef INSTANCED
+in mat4 vInstance;
+#endif
 
-// camera position
-uniform vec4 pos;
+// the camera transform matrix ctm and projective transform matrix ptm come
+// from the Camera block in lighting.glsl
 
-// light position
-uniform vec4 lpos;
+// with TESSELLATION the vertices are Bezier control points, and the
+// outputs come from teshader.glsl instead
+#ifndef TESSELLATION
+#ifdef PER_VERTEX_LIGHTING
+out vec4 color;
+#else
+out vec4 norm;
+out vec4 position;
+#endif
+#endif
 
-varying vec4 norm;
-varying vec4 light_dir;
-varying vec4 viewer_dir;
+vec4 normal()
+{
+#ifdef PACKED_NORMALS
+  // octahedron decode
+  vec3 n = vec3(vNorm, 1.0 - abs(vNorm.x) - abs(vNorm.y));
+  if (n.z < 0.0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+  vec4 normal = vec4(n, 0.0);
+#else
+  vec4 normal = vNorm;
+#endif
+#ifdef INSTANCED
+  normal = vInstance * normal;
+#endif
+  return normal;
+}
+
+vec4 model_position()
+{
+#ifdef QUANTIZED_POSITIONS
+  vec4 p = vec4(vPosition.xyz * position_extent + position_offset, 1.0);
+#else
+  vec4 p = vPosition;
+#endif
+#ifdef INSTANCED
+  p = vInstance * p;
+#endif
+  return p;
+}
 
 void main()
 {
-  norm = vNorm;
-  light_dir = lpos - vPosition;
-  viewer_dir = pos - vPosition;
+#ifdef TESSELLATION
+  gl_Position = vPosition;
+#else
+  vec4 p = model_position();
+#ifdef PER_VERTEX_LIGHTING
+  color = shade(normal(), p);
+#else
+  norm = normal();
+  position = p;
+#endif
 
-  gl_Position = ptm * ctm * vPosition;
-} 
+  gl_Position = ptm * ctm * p;
+#endif
+}